@@ -9,11 +9,8 @@ in vec3 v_normal;
 in vec3 v_cam_dir;
 in vec3 v_vertex_world_pos;
 //we need to upload these uniforms from material
-uniform int u_use_diffuse_map;
 uniform sampler2D u_diffuse_map;
-uniform int u_use_normal_map;
 uniform sampler2D u_normal_map;
-uniform int u_use_specular_map;
 uniform sampler2D u_specular_map;
 
 uniform vec3 u_diffuse;
@@ -53,6 +50,8 @@ vec3 perturbNormal( vec3 N, vec3 P, vec2 texcoord, vec3 normal_sample )
 {
     
     normal_sample = normal_sample * 2.0 - 1.0;
+    //rebuild z, as two channel (BC5) normal maps store only x and y
+    normal_sample.z = sqrt(max(1.0 - dot(normal_sample.xy, normal_sample.xy), 0.0));
     mat3 TBN = cotangent_frame(N, -P, texcoord);
     return normalize(TBN * normal_sample);
 }
@@ -67,23 +66,25 @@ void main() {
     
     //normal
     vec3 N = normalize(v_normal);
-    if (u_use_normal_map != 0) {
-        vec3 Nmap = perturbNormal(N, normalize(v_cam_dir), s_uv, texture(u_normal_map, s_uv).xyz);
-        N = mix(N, Nmap, u_normal_factor);
-    }
+#ifdef USE_NORMAL_MAP
+    vec3 Nmap = perturbNormal(N, normalize(v_cam_dir), s_uv, texture(u_normal_map, s_uv).xyz);
+    N = mix(N, Nmap, u_normal_factor);
+#endif
     //store the vertex normal
     g_normal = N;
     
     
     //compress specular to one number
     vec3 spec_3 = u_specular;
-    if (u_use_specular_map != 0)
-        spec_3 = u_specular * texture(u_specular_map, s_uv).xyz;
+#ifdef USE_SPECULAR_MAP
+    spec_3 = u_specular * texture(u_specular_map, s_uv).xyz;
+#endif
     float specular = (spec_3.x + spec_3.y + spec_3.z) / 3;
     
     //store the albedo color and specular
     vec3 diffuse_color = u_diffuse;
-   	if (u_use_diffuse_map > 0) 
-   		diffuse_color *= texture(u_diffuse_map, s_uv).xyz;
+#ifdef USE_DIFFUSE_MAP
+    diffuse_color *= texture(u_diffuse_map, s_uv).xyz;
+#endif
     g_albedo = vec4(diffuse_color, specular);
 }
@@ -0,0 +1,23 @@
+#version 330
+
+in vec2 v_uv;
+
+out vec4 fragColor;
+
+//accumulated by weighted blended transparency: sum of colour * weight in rgb,
+//product of (1 - alpha) in a, and sum of weights
+uniform sampler2D u_oit_accum;
+uniform sampler2D u_oit_weight;
+
+
+void main(){
+
+    vec4 accum = texture(u_oit_accum, v_uv);
+    float revealage = accum.a;
+    //nothing transparent here
+    if (revealage >= 1.0) discard;
+
+    float weight = max(texture(u_oit_weight, v_uv).r, 1e-5);
+    //blended as colour * (1 - revealage) + background * revealage
+    fragColor = vec4(accum.rgb / weight, revealage);
+}
@@ -1,10 +1,26 @@
 #version 330
 
 uniform sampler2D u_diffuse_map;
+
+in vec4 v_color;
+
 //out color
+#ifdef USE_WEIGHTED_OIT
+//weighted blended transparency, see phong.frag
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec4 fragWeight;
+#else
 out vec4 fragColor;
+#endif
 
 
 void main(){
-    fragColor = texture(u_diffuse_map, gl_PointCoord);
-}
+    vec4 color = texture(u_diffuse_map, gl_PointCoord) * v_color;
+#ifdef USE_WEIGHTED_OIT
+    float weight = color.a * clamp(3e3 * pow(1.0 - gl_FragCoord.z, 3.0), 1e-2, 3e3);
+    fragColor = vec4(color.rgb * weight, color.a);
+    fragWeight = vec4(weight);
+#else
+    fragColor = color;
+#endif
+}
\ No newline at end of file
@@ -1,21 +1,33 @@
 #version 330
 
-layout(location = 0) in vec3 a_vertex;
-layout(location = 1) in vec3 a_velocity;
-layout(location = 2) in float a_age;
-layout(location = 3) in float a_life;
-
-out vec3 v_vertex;
-out vec3 v_velocity;
-out float v_age;
-out float v_life;
-
-uniform mat4 u_mvp;
-uniform mat4 u_model;
+//#defined by ParticleSystem from GL_MAX_UNIFORM_BLOCK_SIZE, otherwise the 16 KB minimum
+#ifndef MAX_EMITTERS
+#define MAX_EMITTERS 204
+#endif
+
+layout(location = 0) in vec4 a_position_age; //w is time of birth
+layout(location = 1) in vec4 a_velocity_life; //w is lifetime, dead if <= 0
+layout(location = 2) in int a_emitter; //index in u_emitters_ubo
+
+out vec4 v_position_age;
+out vec4 v_velocity_life;
+out vec4 v_color;
+
+struct Emitter {
+    vec4 position_spread;
+    vec4 velocity_size;
+    vec4 gravity_spin;
+    vec4 color;
+    vec4 life_flags; //min life, max life, emitting, visible
+};
+
+layout(std140) uniform u_emitters_ubo {
+    Emitter emitters[MAX_EMITTERS];
+};
+
 uniform mat4 u_vp;
 uniform float u_time;
-
-uniform sampler2D u_diffuse_map;
+uniform float u_delta_time;
 
 uniform float u_height_near_plane;
 
@@ -30,30 +42,45 @@ float random(vec2 co){
 
 void main()
 {
-    
-    float age = u_time - a_age;
-    if (age > a_life) {
+    Emitter e = emitters[a_emitter];
+    float age = u_time - a_position_age.w;
+    float life = a_velocity_life.w;
+    //a dead particle waits -life seconds, a live one lives life seconds
+    bool expired = life > 0.0 ? age > life : age > -life;
+
+    if (expired && e.life_flags.z > 0.5) {
     	float r = random(vec2(gl_VertexID, u_time * 1000.0));
-    	float angle = mod( u_time * 3, 6.283);
-    	vec3 ideal_dir =vec3(2.0 * cos(angle), 3.1415, 2.0 * sin(angle));
-    	vec3 randomize_dir = ideal_dir * vec3( r* 0.5 + 1.5);
-
-    	// reset particle
-    	v_vertex = vec3(0);
-    	v_velocity = randomize_dir;
-    	v_age = u_time;
-    	v_life = a_life;
-    } else {
+    	float r2 = random(vec2(u_time * 1000.0, gl_VertexID));
+    	float angle = mod(u_time * e.gravity_spin.w + (e.gravity_spin.w == 0.0 ? r2 * 6.283 : 0.0), 6.283);
+    	vec3 ideal_dir = e.velocity_size.xyz + vec3(cos(angle), 0.0, sin(angle)) * e.position_spread.w;
+    	vec3 randomize_dir = ideal_dir * (r * 0.25 + 0.75);
+
+    	// spawn particle
+    	v_position_age = vec4(e.position_spread.xyz, u_time);
+    	v_velocity_life = vec4(randomize_dir, mix(e.life_flags.x, e.life_flags.y, r2));
+    } else if (expired && life > 0.0) {
+    	// die, and spawn as soon as emitter emits again
+    	v_position_age = vec4(a_position_age.xyz, u_time);
+    	v_velocity_life = vec4(0.0);
+    } else if (life > 0.0) {
     	//move particle
-	    v_velocity = a_velocity - vec3(0, 0.005, 0);
-	    v_vertex = a_vertex + v_velocity * 0.005;
-	    v_age = a_age;
-	    v_life = a_life;
+    	vec3 velocity = a_velocity_life.xyz + e.gravity_spin.xyz * u_delta_time;
+    	v_position_age = vec4(a_position_age.xyz + velocity * u_delta_time, a_position_age.w);
+    	v_velocity_life = vec4(velocity, life);
+    } else {
+    	v_position_age = a_position_age;
+    	v_velocity_life = a_velocity_life;
+    }
+
+    //fade out over life
+    v_color = e.color;
+    v_color.a *= life > 0.0 ? clamp(1.0 - age / life, 0.0, 1.0) : 0.0;
+
+    gl_Position = u_vp * vec4(a_position_age.xyz, 1.0);
+    gl_PointSize = (e.velocity_size.w * u_height_near_plane) / gl_Position.w;
+
+    //culled or dead particles are still simulated, but moved out of clip space
+    if (e.life_flags.w < 0.5 || life <= 0.0) {
+    	gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
     }
-    
-    
-    gl_Position = u_vp * u_model * vec4(a_vertex, 1.0);
-    
-    gl_PointSize = (0.2 * u_height_near_plane) / gl_Position.w;
-    
 }
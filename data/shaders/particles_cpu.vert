@@ -0,0 +1,17 @@
+#version 330
+
+//particles simulated by ParticleSimulator, drawn with particles.frag
+layout(location = 0) in vec4 a_position_size;
+layout(location = 1) in vec4 a_color;
+
+out vec4 v_color;
+
+uniform mat4 u_vp;
+uniform float u_height_near_plane;
+
+void main()
+{
+    v_color = a_color;
+    gl_Position = u_vp * vec4(a_position_size.xyz, 1.0);
+    gl_PointSize = (a_position_size.w * u_height_near_plane) / gl_Position.w;
+}
@@ -17,10 +17,8 @@ uniform vec3 u_specular;
 uniform float u_specular_gloss;
 
 //texture uniforms
-uniform int u_use_diffuse_map;
 uniform sampler2D u_diffuse_map;
 
-uniform int u_use_reflection_map;
 uniform samplerCube u_skybox;
 
 //light structs and uniforms
@@ -41,16 +39,17 @@ void main(){
     vec3 ambient_color = u_ambient;
     
     //apply reflection map to ambient color
-    if (u_use_reflection_map !=0){
-        ambient_color *= textureLod(u_skybox, N, 10.0).rgb;
-    }
+#ifdef USE_REFLECTION_MAP
+    ambient_color *= textureLod(u_skybox, N, 10.0).rgb;
+#endif
     
     //diffuse colour starts from vec3
     vec3 mat_diffuse = u_diffuse;
     
     //multiply diffuse colour by texture if present
-    if (u_use_diffuse_map != 0)
-        mat_diffuse = mat_diffuse * texture(u_diffuse_map, v_uv).xyz;
+#ifdef USE_DIFFUSE_MAP
+    mat_diffuse = mat_diffuse * texture(u_diffuse_map, v_uv).xyz;
+#endif
     
     //start final color by multiplying the ambient colour by the diffuse colour
     vec3 final_color = ambient_color * mat_diffuse;
@@ -6,7 +6,13 @@ in vec3 v_normal;
 in vec3 v_light_dir;
 in vec3 v_cam_dir;
 in vec3 v_vertex_world_pos;
+#ifdef USE_WEIGHTED_OIT
+//weighted blended transparency: premultiplied colour * weight and alpha, then alpha * weight
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec4 fragWeight;
+#else
 out vec4 fragColor;
+#endif
 
 //basic material uniforms
 uniform vec3 u_ambient;
@@ -17,13 +23,9 @@ uniform vec2 u_uv_scale;
 uniform float u_normal_factor;
 
 //texture uniforms
-uniform int u_use_diffuse_map;
 uniform sampler2D u_diffuse_map;
-uniform int u_use_normal_map;
 uniform sampler2D u_normal_map;
-uniform int u_use_specular_map;
 uniform sampler2D u_specular_map;
-uniform int u_use_transparency_map;
 uniform sampler2D u_transparency_map;
 
 const int MAX_LIGHTS = 8;
@@ -145,6 +147,8 @@ vec3 perturbNormal( vec3 N, vec3 P, vec2 texcoord, vec3 normal_sample )
 {
     
     normal_sample = normal_sample * 2.0 - 1.0;
+    //rebuild z, as two channel (BC5) normal maps store only x and y
+    normal_sample.z = sqrt(max(1.0 - dot(normal_sample.xy, normal_sample.xy), 0.0));
     mat3 TBN = cotangent_frame(N, -P, texcoord);
     return normalize(TBN * normal_sample);
 }
@@ -157,21 +161,23 @@ void main(){
     //normal
     vec3 N = normalize(v_normal); //normal
     
-    if (u_use_normal_map != 0) {
-        vec3 Nmap = perturbNormal(N, normalize(v_cam_dir), s_uv, texture(u_normal_map, s_uv).xyz);
-        N = mix(N, Nmap, u_normal_factor);
-    }
+#ifdef USE_NORMAL_MAP
+    vec3 Nmap = perturbNormal(N, normalize(v_cam_dir), s_uv, texture(u_normal_map, s_uv).xyz);
+    N = mix(N, Nmap, u_normal_factor);
+#endif
 
     //specular
     vec3 mat_specular = u_specular;
-    if (u_use_specular_map != 0)
-        mat_specular = mat_specular * texture(u_specular_map, s_uv).xyz;
+#ifdef USE_SPECULAR_MAP
+    mat_specular = mat_specular * texture(u_specular_map, s_uv).xyz;
+#endif
     
     
 	vec3 mat_diffuse = u_diffuse; //colour from uniform
 	//multiply by texture if present
-	if (u_use_diffuse_map != 0)
-		mat_diffuse = mat_diffuse * texture(u_diffuse_map, s_uv).xyz;
+#ifdef USE_DIFFUSE_MAP
+	mat_diffuse = mat_diffuse * texture(u_diffuse_map, s_uv).xyz;
+#endif
 
 	//ambient light
 	vec3 final_color = u_ambient * mat_diffuse;
@@ -230,9 +236,17 @@ void main(){
 	}
     
     float transparency = 1.0;
-    if (u_use_transparency_map != -1)
-        transparency = texture(u_transparency_map, s_uv).x;
+#ifdef USE_TRANSPARENCY_MAP
+    transparency = texture(u_transparency_map, s_uv).x;
+#endif
     
     //fragColor = vec4(texture(u_normal_map, s_uv).xyz, 1.0);
+#ifdef USE_WEIGHTED_OIT
+    //nearer fragments weigh more (McGuire and Bavoil 2013, from window depth)
+    float weight = transparency * clamp(3e3 * pow(1.0 - gl_FragCoord.z, 3.0), 1e-2, 3e3);
+    fragColor = vec4(final_color * weight, transparency);
+    fragWeight = vec4(weight);
+#else
     fragColor = vec4(final_color, transparency);
+#endif
 }
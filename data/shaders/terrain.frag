@@ -23,19 +23,13 @@ uniform float u_max_height;
 
 //texture uniforms
 uniform vec2 u_uv_scale;
-uniform int u_use_diffuse_map;
 uniform sampler2D u_diffuse_map;
-uniform int u_use_diffuse_map_2;
 uniform sampler2D u_diffuse_map_2;
-uniform int u_use_diffuse_map_3;
 uniform sampler2D u_diffuse_map_3;
 
-uniform int u_use_normal_map;
 uniform sampler2D u_normal_map;
-uniform int u_use_specular_map;
 uniform sampler2D u_specular_map;
 
-uniform int u_use_noise_map;
 uniform sampler2D u_noise_map;
 
 
@@ -121,6 +115,8 @@ mat3 cotangent_frame(vec3 N, vec3 p, vec2 uv)
 vec3 perturbNormal( vec3 N, vec3 P, vec2 texcoord, vec3 normal_sample )
 {
 	normal_sample = normal_sample * 2.0 - 1.0;
+	//rebuild z, as two channel (BC5) normal maps store only x and y
+	normal_sample.z = sqrt(max(1.0 - dot(normal_sample.xy, normal_sample.xy), 0.0));
 	mat3 TBN = cotangent_frame(N, -P, texcoord);
 	vec3 pN = normalize(TBN * normal_sample);
 	return pN * u_normal_factor;
@@ -171,16 +167,17 @@ void main(){
     
     // ******* NORMAL MAP  *******
 	vec3 N_orig = N;
-    if (u_use_normal_map != 0) {
-    	N = perturbNormal(N, v_vertex_world_pos, s_uv, texture(u_normal_map, s_uv).xyz);
-		N = normalize(N);
-    }
+#ifdef USE_NORMAL_MAP
+	N = perturbNormal(N, v_vertex_world_pos, s_uv, texture(u_normal_map, s_uv).xyz);
+	N = normalize(N);
+#endif
 
 
 	// ******* SPECULAR MAP  *******
     vec3 mat_specular = u_specular;
-    if (u_use_specular_map != 0)
-        mat_specular = mat_specular * texture(u_specular_map, s_uv).xyz;
+#ifdef USE_SPECULAR_MAP
+    mat_specular = mat_specular * texture(u_specular_map, s_uv).xyz;
+#endif
 
 
     //start final color by multiplying the ambient colour by the diffuse colour
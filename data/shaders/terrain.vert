@@ -0,0 +1,54 @@
+#version 330
+
+//shared grid patch, drawn once per visible chunk
+//x, z: grid coords within chunk, y: 1 for skirt vertices
+layout(location = 0) in vec3 a_vertex;
+//per instance: grid coords of chunk origin
+layout(location = 3) in vec2 a_chunk_origin;
+
+uniform mat4 u_mvp;
+uniform mat4 u_model;
+uniform mat4 u_normal_matrix;
+uniform vec3 u_cam_pos;
+
+//terrain uniforms
+uniform sampler2D u_height_map;
+uniform int u_terrain_resolution;
+uniform float u_terrain_step;
+uniform float u_terrain_skirt;
+
+out vec2 v_uv;
+out vec3 v_normal;
+out vec3 v_vertex_world_pos;
+out vec3 v_cam_dir;
+
+float gridHeight(ivec2 g) {
+	g = clamp(g, ivec2(0), ivec2(u_terrain_resolution - 1));
+	return texelFetch(u_height_map, g, 0).r;
+}
+
+void main(){
+
+	ivec2 g = min(ivec2(a_chunk_origin + a_vertex.xz), ivec2(u_terrain_resolution - 1));
+	float half_width = float(u_terrain_resolution) * u_terrain_step * 0.5;
+
+	vec3 position = vec3(float(g.x) * u_terrain_step - half_width,
+	                     gridHeight(g) - a_vertex.y * u_terrain_skirt,
+	                     -float(g.y) * u_terrain_step + half_width);
+
+	//central difference normal. z runs opposite to grid y
+	vec3 normal = normalize(vec3(gridHeight(g - ivec2(1, 0)) - gridHeight(g + ivec2(1, 0)),
+	                             2.0 * u_terrain_step,
+	                             gridHeight(g + ivec2(0, 1)) - gridHeight(g - ivec2(0, 1))));
+
+	v_uv = vec2(g) / float(u_terrain_resolution - 1);
+	v_normal = (u_normal_matrix * vec4(normal, 1.0)).xyz;
+
+	//calculate world position of current vertex
+	v_vertex_world_pos = (u_model * vec4(position, 1.0)).xyz;
+
+	//calculate direction to camera in world space
+	v_cam_dir = u_cam_pos - v_vertex_world_pos;
+
+	gl_Position = u_mvp * vec4(position, 1.0);
+}
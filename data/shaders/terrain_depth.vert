@@ -0,0 +1,21 @@
+#version 330
+
+//shadow pass for vertex texture terrain, see terrain.vert
+layout(location = 0) in vec3 a_vertex;
+layout(location = 3) in vec2 a_chunk_origin;
+
+uniform mat4 u_mvp;
+
+uniform sampler2D u_height_map;
+uniform int u_terrain_resolution;
+uniform float u_terrain_step;
+uniform float u_terrain_skirt;
+
+void main() {
+	ivec2 g = min(ivec2(a_chunk_origin + a_vertex.xz), ivec2(u_terrain_resolution - 1));
+	float half_width = float(u_terrain_resolution) * u_terrain_step * 0.5;
+	float height = texelFetch(u_height_map, g, 0).r;
+	gl_Position = u_mvp * vec4(float(g.x) * u_terrain_step - half_width,
+	                           height - a_vertex.y * u_terrain_skirt,
+	                           -float(g.y) * u_terrain_step + half_width, 1.0);
+}
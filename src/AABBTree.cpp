@@ -0,0 +1,271 @@
+//
+//  AABBTree.cpp
+//
+
+#include "AABBTree.h"
+#include <cmath>
+
+int AABBTree::allocate_() {
+    int node;
+    if (free_list_ != -1) {
+        node = free_list_;
+        free_list_ = nodes_[node].parent;
+        nodes_[node] = Node();
+    }
+    else {
+        node = (int)nodes_.size();
+        nodes_.push_back(Node());
+    }
+    num_nodes_++;
+    return node;
+}
+
+void AABBTree::free_(int node) {
+    nodes_[node].parent = free_list_;
+    nodes_[node].height = -1;
+    free_list_ = node;
+    num_nodes_--;
+}
+
+void AABBTree::clear() {
+    nodes_.clear();
+    root_ = free_list_ = -1;
+    num_nodes_ = num_leaves_ = 0;
+}
+
+int AABBTree::insert(const AABB& aabb, int user_data) {
+    int leaf = allocate_();
+    Node& node = nodes_[leaf];
+    node.min[0] = aabb.center.x - aabb.half_width.x - margin;
+    node.min[1] = aabb.center.y - aabb.half_width.y - margin;
+    node.min[2] = aabb.center.z - aabb.half_width.z - margin;
+    node.max[0] = aabb.center.x + aabb.half_width.x + margin;
+    node.max[1] = aabb.center.y + aabb.half_width.y + margin;
+    node.max[2] = aabb.center.z + aabb.half_width.z + margin;
+    node.user_data = user_data;
+    insertLeaf_(leaf);
+    num_leaves_++;
+    return leaf;
+}
+
+void AABBTree::remove(int proxy) {
+    removeLeaf_(proxy);
+    free_(proxy);
+    num_leaves_--;
+}
+
+bool AABBTree::move(int proxy, const AABB& aabb) {
+    const Node& node = nodes_[proxy];
+    if (node.min[0] <= aabb.center.x - aabb.half_width.x && node.max[0] >= aabb.center.x + aabb.half_width.x &&
+        node.min[1] <= aabb.center.y - aabb.half_width.y && node.max[1] >= aabb.center.y + aabb.half_width.y &&
+        node.min[2] <= aabb.center.z - aabb.half_width.z && node.max[2] >= aabb.center.z + aabb.half_width.z)
+        return false;
+
+    int user_data = node.user_data;
+    removeLeaf_(proxy);
+    Node& moved = nodes_[proxy];
+    moved.min[0] = aabb.center.x - aabb.half_width.x - margin;
+    moved.min[1] = aabb.center.y - aabb.half_width.y - margin;
+    moved.min[2] = aabb.center.z - aabb.half_width.z - margin;
+    moved.max[0] = aabb.center.x + aabb.half_width.x + margin;
+    moved.max[1] = aabb.center.y + aabb.half_width.y + margin;
+    moved.max[2] = aabb.center.z + aabb.half_width.z + margin;
+    moved.user_data = user_data;
+    insertLeaf_(proxy);
+    return true;
+}
+
+AABB AABBTree::fatAABB(int proxy) const {
+    const Node& node = nodes_[proxy];
+    AABB aabb;
+    aabb.center = lm::vec3(node.min[0] + node.max[0], node.min[1] + node.max[1], node.min[2] + node.max[2]) * 0.5f;
+    aabb.half_width = lm::vec3(node.max[0] - node.min[0], node.max[1] - node.min[1], node.max[2] - node.min[2]) * 0.5f;
+    return aabb;
+}
+
+//half surface area, the cost of a box being tested
+float AABBTree::area_(const float* min, const float* max) {
+    float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+    return x * y + y * z + z * x;
+}
+
+float AABBTree::unionArea_(const Node& a, const Node& b) {
+    float min[3], max[3];
+    for (int i = 0; i < 3; i++) {
+        min[i] = std::min(a.min[i], b.min[i]);
+        max[i] = std::max(a.max[i], b.max[i]);
+    }
+    return area_(min, max);
+}
+
+void AABBTree::setUnion_(Node& node, const Node& a, const Node& b) {
+    for (int i = 0; i < 3; i++) {
+        node.min[i] = std::min(a.min[i], b.min[i]);
+        node.max[i] = std::max(a.max[i], b.max[i]);
+    }
+}
+
+//slab test of segment p + d * t against node's box
+bool AABBTree::segmentEnters_(const Node& node, const float* p, const float* d, float max_t, float& t) {
+    float t_min = 0.0f, t_max = max_t;
+    for (int i = 0; i < 3; i++) {
+        if (std::abs(d[i]) < 1e-12f) {
+            //parallel to slab, must start inside it
+            if (p[i] < node.min[i] || p[i] > node.max[i]) return false;
+            continue;
+        }
+        float inv = 1.0f / d[i];
+        float t1 = (node.min[i] - p[i]) * inv;
+        float t2 = (node.max[i] - p[i]) * inv;
+        if (t1 > t2) std::swap(t1, t2);
+        t_min = std::max(t_min, t1);
+        t_max = std::min(t_max, t2);
+        if (t_min > t_max) return false;
+    }
+    t = t_min;
+    return true;
+}
+
+//walks down to the sibling whose union with leaf costs least, counting the
+//growth of every ancestor, and puts both under a new parent
+void AABBTree::insertLeaf_(int leaf) {
+    if (root_ == -1) {
+        root_ = leaf;
+        nodes_[root_].parent = -1;
+        return;
+    }
+
+    int index = root_;
+    while (!nodes_[index].isLeaf()) {
+        const Node& node = nodes_[index];
+        const Node& leaf_node = nodes_[leaf];
+        float area = area_(node.min, node.max);
+        float combined_area = unionArea_(node, leaf_node);
+        //cost of making a new parent for this node and the leaf
+        float cost = 2.0f * combined_area;
+        //minimum cost of pushing leaf further down the tree
+        float inheritance_cost = 2.0f * (combined_area - area);
+
+        float child_cost[2];
+        int children[2] = { node.child1, node.child2 };
+        for (int c = 0; c < 2; c++) {
+            const Node& child = nodes_[children[c]];
+            float grown = unionArea_(child, leaf_node);
+            child_cost[c] = (child.isLeaf() ? grown : grown - area_(child.min, child.max)) + inheritance_cost;
+        }
+
+        if (cost < child_cost[0] && cost < child_cost[1]) break;
+        index = child_cost[0] < child_cost[1] ? children[0] : children[1];
+    }
+    int sibling = index;
+
+    int old_parent = nodes_[sibling].parent;
+    int new_parent = allocate_();
+    Node& parent = nodes_[new_parent];
+    parent.parent = old_parent;
+    parent.user_data = -1;
+    setUnion_(parent, nodes_[leaf], nodes_[sibling]);
+    parent.height = nodes_[sibling].height + 1;
+    parent.child1 = sibling;
+    parent.child2 = leaf;
+
+    if (old_parent != -1) {
+        if (nodes_[old_parent].child1 == sibling) nodes_[old_parent].child1 = new_parent;
+        else nodes_[old_parent].child2 = new_parent;
+    }
+    else {
+        root_ = new_parent;
+    }
+    nodes_[sibling].parent = new_parent;
+    nodes_[leaf].parent = new_parent;
+
+    fixUpwards_(new_parent);
+}
+
+//replaces leaf's parent with its sibling
+void AABBTree::removeLeaf_(int leaf) {
+    if (leaf == root_) {
+        root_ = -1;
+        return;
+    }
+    int parent = nodes_[leaf].parent;
+    int grand_parent = nodes_[parent].parent;
+    int sibling = nodes_[parent].child1 == leaf ? nodes_[parent].child2 : nodes_[parent].child1;
+
+    if (grand_parent != -1) {
+        if (nodes_[grand_parent].child1 == parent) nodes_[grand_parent].child1 = sibling;
+        else nodes_[grand_parent].child2 = sibling;
+        nodes_[sibling].parent = grand_parent;
+        free_(parent);
+        fixUpwards_(grand_parent);
+    }
+    else {
+        root_ = sibling;
+        nodes_[sibling].parent = -1;
+        free_(parent);
+    }
+    nodes_[leaf].parent = -1;
+}
+
+//rebalances and refits boxes and heights from node to root
+void AABBTree::fixUpwards_(int index) {
+    while (index != -1) {
+        index = balance_(index);
+        Node& node = nodes_[index];
+        const Node& child1 = nodes_[node.child1];
+        const Node& child2 = nodes_[node.child2];
+        node.height = 1 + std::max(child1.height, child2.height);
+        setUnion_(node, child1, child2);
+        index = node.parent;
+    }
+}
+
+//if one child of a is more than one level taller than the other, rotates it up
+//to take a's place, and returns it
+int AABBTree::balance_(int ia) {
+    Node& a = nodes_[ia];
+    if (a.isLeaf() || a.height < 2) return ia;
+
+    int ib = a.child1, ic = a.child2;
+    Node& b = nodes_[ib];
+    Node& c = nodes_[ic];
+    int balance = c.height - b.height;
+    if (balance >= -1 && balance <= 1) return ia;
+
+    //the taller child is lifted, a takes the place of its shorter child
+    bool lift_c = balance > 1;
+    int iup = lift_c ? ic : ib;
+    Node& up = nodes_[iup];
+    Node& other = lift_c ? b : c;
+    int ig1 = up.child1, ig2 = up.child2;
+    Node& g1 = nodes_[ig1];
+    Node& g2 = nodes_[ig2];
+
+    //up replaces a under a's parent
+    up.child1 = ia;
+    up.parent = a.parent;
+    a.parent = iup;
+    if (up.parent != -1) {
+        if (nodes_[up.parent].child1 == ia) nodes_[up.parent].child1 = iup;
+        else nodes_[up.parent].child2 = iup;
+    }
+    else {
+        root_ = iup;
+    }
+
+    //up keeps its taller child, a adopts the shorter
+    int ikeep = g1.height > g2.height ? ig1 : ig2;
+    int igive = g1.height > g2.height ? ig2 : ig1;
+    Node& keep = nodes_[ikeep];
+    Node& give = nodes_[igive];
+    up.child2 = ikeep;
+    if (lift_c) a.child2 = igive;
+    else a.child1 = igive;
+    give.parent = ia;
+
+    setUnion_(a, other, give);
+    a.height = 1 + std::max(other.height, give.height);
+    setUnion_(up, a, keep);
+    up.height = 1 + std::max(a.height, keep.height);
+    return iup;
+}
@@ -0,0 +1,127 @@
+//
+//  AABBTree.h
+//
+//  Dynamic bounding volume tree of axis aligned boxes, after Box2D's
+//  b2DynamicTree. Leaves keep their box fattened by margin, so objects which
+//  move a little don't touch the tree; one which leaves its fat box is taken
+//  out and reinserted beside the sibling that grows the tree's surface area
+//  least, and rotations on the way up keep the tree balanced. Queries walk
+//  down from the root, skipping every subtree whose box they miss.
+//
+#pragma once
+#include "includes.h"
+#include "GraphicsUtilities.h"
+#include <vector>
+#include <algorithm>
+
+class AABBTree {
+public:
+    //returns proxy of new leaf, which keeps user_data
+    int insert(const AABB& aabb, int user_data);
+    void remove(int proxy);
+    //reinserts leaf only if aabb left its fat box, returning true if it did
+    bool move(int proxy, const AABB& aabb);
+    void clear();
+
+    int userData(int proxy) const { return nodes_[proxy].user_data; }
+    AABB fatAABB(int proxy) const;
+    int numProxies() const { return num_leaves_; }
+    int numNodes() const { return num_nodes_; }
+    int height() const { return root_ == -1 ? 0 : nodes_[root_].height; }
+
+    //calls found(user_data) for each leaf whose fat box overlaps aabb
+    template <typename F> void query(const AABB& aabb, F found) const;
+    //calls hit(user_data, t) for each leaf whose fat box the segment p + (q - p) * t
+    //enters at t <= max_t, nearest subtree first. hit returns the new max_t, so a
+    //closest hit query skips everything behind what it has found
+    template <typename F> void raycast(const lm::vec3& p, const lm::vec3& q, F hit, float max_t = 1.0f) const;
+
+    float margin = 0.1f; //fattening of leaves, in world units
+
+private:
+    struct Node {
+        float min[3], max[3];
+        int parent = -1; //next free node while in free list
+        int child1 = -1, child2 = -1;
+        int height = 0; //leaves 0, free nodes -1
+        int user_data = -1;
+        bool isLeaf() const { return child1 == -1; }
+    };
+    //queries keep their stack on the stack; balance keeps height near log2 of leaves
+    static const int STACK_SIZE = 256;
+
+    std::vector<Node> nodes_;
+    int root_ = -1;
+    int free_list_ = -1;
+    int num_nodes_ = 0;
+    int num_leaves_ = 0;
+
+    int allocate_();
+    void free_(int node);
+    void insertLeaf_(int leaf);
+    void removeLeaf_(int leaf);
+    int balance_(int a);
+    void fixUpwards_(int node);
+    void setUnion_(Node& node, const Node& a, const Node& b);
+    static float area_(const float* min, const float* max);
+    static float unionArea_(const Node& a, const Node& b);
+    static bool segmentEnters_(const Node& node, const float* p, const float* d, float max_t, float& t);
+};
+
+template <typename F>
+void AABBTree::query(const AABB& aabb, F found) const {
+    if (root_ == -1) return;
+    float min[3] = { aabb.center.x - aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z - aabb.half_width.z };
+    float max[3] = { aabb.center.x + aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z + aabb.half_width.z };
+    int stack[STACK_SIZE];
+    int count = 0;
+    stack[count++] = root_;
+    while (count) {
+        const Node& node = nodes_[stack[--count]];
+        if (node.min[0] > max[0] || node.max[0] < min[0] ||
+            node.min[1] > max[1] || node.max[1] < min[1] ||
+            node.min[2] > max[2] || node.max[2] < min[2]) continue;
+        if (node.isLeaf()) {
+            found(node.user_data);
+        }
+        else if (count + 2 <= STACK_SIZE) {
+            stack[count++] = node.child1;
+            stack[count++] = node.child2;
+        }
+    }
+}
+
+template <typename F>
+void AABBTree::raycast(const lm::vec3& from, const lm::vec3& to, F hit, float max_t) const {
+    if (root_ == -1) return;
+    float p[3] = { from.x, from.y, from.z };
+    float d[3] = { to.x - from.x, to.y - from.y, to.z - from.z };
+    int stack[STACK_SIZE];
+    float stack_t[STACK_SIZE];
+    int count = 0;
+    float t;
+    if (!segmentEnters_(nodes_[root_], p, d, max_t, t)) return;
+    stack[count] = root_; stack_t[count++] = t;
+    while (count) {
+        count--;
+        //clipped by a hit since it was pushed
+        if (stack_t[count] > max_t) continue;
+        const Node& node = nodes_[stack[count]];
+        if (node.isLeaf()) {
+            max_t = std::min(max_t, (float)hit(node.user_data, stack_t[count]));
+            continue;
+        }
+        float t1, t2;
+        bool hit1 = segmentEnters_(nodes_[node.child1], p, d, max_t, t1);
+        bool hit2 = segmentEnters_(nodes_[node.child2], p, d, max_t, t2);
+        if (count + 2 > STACK_SIZE) continue;
+        //push farther child first, so nearer one is popped first
+        if (hit1 && hit2 && t1 < t2) {
+            stack[count] = node.child2; stack_t[count++] = t2;
+            stack[count] = node.child1; stack_t[count++] = t1;
+            continue;
+        }
+        if (hit1) { stack[count] = node.child1; stack_t[count++] = t1; }
+        if (hit2) { stack[count] = node.child2; stack_t[count++] = t2; }
+    }
+}
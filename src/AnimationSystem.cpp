@@ -30,7 +30,8 @@ void AnimationSystem::update(float dt) {
     //if counter above threshold
     if (ms_counter_ >= ms_per_frame_) {
         trigger_frame = true;
-        ms_counter_ = 0;
+        //keep remainder, so frames stay in step with time
+        ms_counter_ -= ms_per_frame_;
     }
     
     //animation component
@@ -1,11 +1,84 @@
 #include "CollisionSystem.h"
 #include "extern.h"
+#include "GraphicsSystem.h"
+#include "Terrain.h"
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+
+//rays are tested against eight boxes at a time with AVX, or four with SSE
+#if defined(__AVX__)
+#define COLLISION_AVX
+#include <immintrin.h>
+const int NARROWPHASE_WIDTH = 8;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLLISION_SSE
+#include <xmmintrin.h>
+const int NARROWPHASE_WIDTH = 4;
+#else
+const int NARROWPHASE_WIDTH = 4;
+#endif
 
 using namespace lm;
 
-//nothing to initialise so far
-void CollisionSystem::init() {
-    
+CollisionStats CollisionSystem::stats;
+
+void WorldBoxes::resize(size_t n) {
+    for (auto array : { &cx, &cy, &cz, &ux, &uy, &uz, &vx, &vy, &vz, &wx, &wy, &wz, &ex, &ey, &ez })
+        array->resize(n);
+}
+
+bool WorldBoxes::same(const WorldBoxes& o, size_t i) const {
+    return cx[i] == o.cx[i] && cy[i] == o.cy[i] && cz[i] == o.cz[i] &&
+        ux[i] == o.ux[i] && uy[i] == o.uy[i] && uz[i] == o.uz[i] &&
+        vx[i] == o.vx[i] && vy[i] == o.vy[i] && vz[i] == o.vz[i] &&
+        wx[i] == o.wx[i] && wy[i] == o.wy[i] && wz[i] == o.wz[i] &&
+        ex[i] == o.ex[i] && ey[i] == o.ey[i] && ez[i] == o.ez[i];
+}
+
+//world box in vector form, for the box box tests
+struct OrientedBox {
+    vec3 c;
+    vec3 u[3];
+    float e[3];
+};
+
+static OrientedBox orientedBox_(const WorldBoxes& w, int i) {
+    OrientedBox box;
+    box.c = vec3(w.cx[i], w.cy[i], w.cz[i]);
+    box.u[0] = vec3(w.ux[i], w.uy[i], w.uz[i]);
+    box.u[1] = vec3(w.vx[i], w.vy[i], w.vz[i]);
+    box.u[2] = vec3(w.wx[i], w.wy[i], w.wz[i]);
+    box.e[0] = w.ex[i]; box.e[1] = w.ey[i]; box.e[2] = w.ez[i];
+    return box;
+}
+
+static inline float signOf_(float f) { return f < 0.0f ? -1.0f : 1.0f; }
+
+//outward normal of the face of box which point lies on, or nearest to
+static vec3 boxNormal_(const WorldBoxes& w, int i, const vec3& point) {
+    OrientedBox box = orientedBox_(w, i);
+    vec3 r = point - box.c;
+    int face = 0;
+    float best = -FLT_MAX;
+    for (int a = 0; a < 3; a++) {
+        float f = std::abs(r.dot(box.u[a])) / std::max(box.e[a], 1e-6f);
+        if (f > best) { best = f; face = a; }
+    }
+    return box.u[face] * signOf_(r.dot(box.u[face]));
+}
+
+void CollisionSystem::init(GraphicsSystem* graphics_system) {
+    graphics_system_ = graphics_system;
+    tree_.clear();
+    proxies_.clear();
+    box_pairs_.clear();
+    last_box_collider_.clear();
+    pairs_.clear();
+    pair_index_.clear();
+    events_.clear();
+    boxes_changed_ = true;
 }
 
 void CollisionSystem::update(float dt) {
@@ -17,39 +90,789 @@ void CollisionSystem::update(float dt) {
     for (auto& col : colliders){
         col.colliding = false;
         col.collision_distance = 10000000.0f;
-        col.other = -1;
+        col.contacts.clear();
     }
     
-    //test ray-box collision. This works by looping over ray colliders. For each one, we loop over box colliders
-    //test collision between ray and box, updating collision distance for each collision found
-    //then for future collision tests only look as far as existing stored collision distance
+    stats = CollisionStats();
+    stats.query_rays = query_rays_;
+    query_rays_ = 0;
+    frame_++;
+    auto start = std::chrono::high_resolution_clock::now();
+    updateBroadphase_(colliders);
+    auto broadphase_end = std::chrono::high_resolution_clock::now();
+    collideBoxPairs_();
+    auto pairs_end = std::chrono::high_resolution_clock::now();
+
+    //test ray-box collision of each ray collider
+    std::vector<Transform>& all_transforms = ECS.getAllComponents<Transform>();
     for (size_t i = 0; i < colliders.size(); i++) {
-        
-        //if collider is ray
-        if (colliders[i].collider_type == ColliderTypeRay) {
-            
-            //test all other colliders
-            for (size_t j = 0; j < colliders.size(); j++) {
-                if (j == i) continue; // no self-test
-                
-                //if box
-                if (colliders[j].collider_type == ColliderTypeBox) {
-                    //test collision
-                    float col_distance = 0; //temp var to store distance
-                    if (intersectSegmentBox(colliders[i], //the ray
-                                            colliders[j], //the box
-                                            col_point, //reference to collision point
-                                            col_distance, //reference to collision distance
-                                            colliders[i].collision_distance)){ //only look as far as current nearest collider
-                        colliders[i].colliding = colliders[j].colliding = true;
-						colliders[i].other = (int)j; colliders[j].other = (int)i;
-                        colliders[i].collision_point = colliders[j].collision_point = col_point;
-                        colliders[i].collision_distance = colliders[j].collision_distance = col_distance;
-                    }
+        Collider& ray = colliders[i];
+        if (ray.collider_type != ColliderTypeRay) continue;
+        stats.rays++;
+
+        vec3 p, direction;
+        worldRay_(ray, all_transforms, p, direction);
+        direction = direction.normalize();
+        float length = std::min(ray.max_distance, ray.collision_distance);
+        float nearest_t;
+        int nearest = nearestHit_(p, direction, length, nearest_t, stats.ray_box_tests);
+
+        if (nearest != -1) {
+            Collider& box = colliders[nearest];
+            ContactManifold hit;
+            hit.points[0] = p + direction * nearest_t;
+            hit.normal = boxNormal_(world_boxes_, box_index_[nearest], hit.points[0]);
+            hit.depths[0] = nearest_t;
+            hit.num_points = 1;
+            ray.collision_distance = box.collision_distance = nearest_t;
+            touch_((int)i, nearest, true, hit);
+            stats.hits++;
+        }
+    }
+    updatePairs_(colliders);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    stats.broadphase_ms = std::chrono::duration<float, std::milli>(broadphase_end - start).count();
+    stats.pairs_ms = std::chrono::duration<float, std::milli>(pairs_end - broadphase_end).count();
+    stats.query_ms = std::chrono::duration<float, std::milli>(end - pairs_end).count();
+}
+
+//computes world box of each box collider, noting if it changed, and moves it in tree
+void CollisionSystem::updateBroadphase_(std::vector<Collider>& colliders) {
+    std::vector<Transform>& all_transforms = ECS.getAllComponents<Transform>();
+    proxies_.resize(colliders.size(), -1);
+    box_index_.assign(colliders.size(), -1);
+    std::swap(box_collider_, last_box_collider_);
+    std::swap(world_boxes_, last_world_boxes_);
+    box_collider_.clear();
+    for (size_t i = 0; i < colliders.size(); i++)
+        if (colliders[i].collider_type == ColliderTypeBox) box_collider_.push_back((int)i);
+    boxes_changed_ = box_collider_ != last_box_collider_;
+    world_boxes_.resize(box_collider_.size());
+    box_bounds_.resize(box_collider_.size());
+    box_moved_.resize(box_collider_.size());
+
+    for (size_t i = 0; i < colliders.size(); i++) {
+        Collider& col = colliders[i];
+        if (col.collider_type != ColliderTypeBox) {
+            if (proxies_[i] != -1) tree_.remove(proxies_[i]);
+            proxies_[i] = -1;
+            continue;
+        }
+        box_index_[i] = stats.boxes++;
+        int b = box_index_[i];
+        AABB aabb = setWorldBox_(b, col, all_transforms);
+        box_bounds_[b] = aabb;
+        box_moved_[b] = boxes_changed_ || !world_boxes_.same(last_world_boxes_, b);
+        if (!box_moved_[b]) continue;
+        stats.moved_boxes++;
+        if (proxies_[i] == -1) proxies_[i] = tree_.insert(aabb, (int)i);
+        else if (tree_.move(proxies_[i], aabb)) stats.reinserted++;
+    }
+    stats.tree_height = tree_.height();
+}
+
+//stores box collider rotated and scaled into world space, returning its bounds
+AABB CollisionSystem::setWorldBox_(int index, Collider& box, std::vector<Transform>& all_transforms) {
+    mat4 global = ECS.getComponentFromEntity<Transform>(box.owner).getGlobalMatrix(all_transforms);
+    const vec3& h = box.local_halfwidth;
+    vec3 center = global * box.local_center;
+    //columns of model matrix are axes scaled
+    vec3 axes[3];
+    float extents[3];
+    for (int a = 0; a < 3; a++) {
+        vec3 column(global.m[a * 4], global.m[a * 4 + 1], global.m[a * 4 + 2]);
+        float scale = column.length();
+        axes[a] = scale > 0.0f ? column * (1.0f / scale) : vec3(a == 0, a == 1, a == 2);
+        extents[a] = (a == 0 ? h.x : a == 1 ? h.y : h.z) * scale;
+    }
+
+    WorldBoxes& w = world_boxes_;
+    w.cx[index] = center.x; w.cy[index] = center.y; w.cz[index] = center.z;
+    w.ux[index] = axes[0].x; w.uy[index] = axes[0].y; w.uz[index] = axes[0].z;
+    w.vx[index] = axes[1].x; w.vy[index] = axes[1].y; w.vz[index] = axes[1].z;
+    w.wx[index] = axes[2].x; w.wy[index] = axes[2].y; w.wz[index] = axes[2].z;
+    w.ex[index] = extents[0]; w.ey[index] = extents[1]; w.ez[index] = extents[2];
+
+    //each world axis gets the absolute contribution of each box axis
+    AABB aabb;
+    aabb.center = center;
+    aabb.half_width.x = fabsf(axes[0].x) * extents[0] + fabsf(axes[1].x) * extents[1] + fabsf(axes[2].x) * extents[2];
+    aabb.half_width.y = fabsf(axes[0].y) * extents[0] + fabsf(axes[1].y) * extents[1] + fabsf(axes[2].y) * extents[2];
+    aabb.half_width.z = fabsf(axes[0].z) * extents[0] + fabsf(axes[1].z) * extents[1] + fabsf(axes[2].z) * extents[2];
+    return aabb;
+}
+
+//pairs of a moved box are found by querying the tree with its bounds, and tested
+//in parallel; pairs of two boxes which didn't move are left as they were
+void CollisionSystem::collideBoxPairs_() {
+    box_pairs_.clear();
+    for (int a = 0; a < (int)box_collider_.size(); a++) {
+        if (!box_moved_[a]) continue;
+        tree_.query(box_bounds_[a], [&](int collider) {
+            int b = box_index_[collider];
+            //pair of two moved boxes is found from both, keep it once
+            if (b == a || (box_moved_[b] && b < a)) return;
+            box_pairs_.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+        });
+    }
+    stats.box_pairs = (int)box_pairs_.size();
+    manifolds_.resize(box_pairs_.size());
+
+    JOBS.parallelFor((int)box_pairs_.size(), 64, [this](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            ContactManifold& manifold = manifolds_[k];
+            manifold.num_points = 0;
+            collideBoxes(world_boxes_, box_pairs_[k].first, box_pairs_[k].second, manifold);
+        }
+    });
+
+    //in pair order, so the table is the same each run
+    for (size_t k = 0; k < box_pairs_.size(); k++) {
+        if (manifolds_[k].num_points)
+            touch_(box_collider_[box_pairs_[k].first], box_collider_[box_pairs_[k].second], false, manifolds_[k]);
+    }
+}
+
+//adds pair to table, or refreshes it, as touching this frame
+void CollisionSystem::touch_(int a, int b, bool ray, const ContactManifold& manifold) {
+    uint64_t key = (uint64_t)a << 32 | (uint32_t)b;
+    auto found = pair_index_.find(key);
+    if (found == pair_index_.end()) {
+        CollisionPair pair;
+        pair.a = a; pair.b = b;
+        pair.ray = ray;
+        pair.first_frame = frame_;
+        pair_index_[key] = (int)pairs_.size();
+        pairs_.push_back(pair);
+        found = pair_index_.find(key);
+    }
+    CollisionPair& pair = pairs_[found->second];
+    pair.frame = frame_;
+    pair.manifold = manifold;
+    pair.manifold.a = a;
+    pair.manifold.b = b;
+}
+
+//pairs not found this frame are kept if both boxes stayed still, otherwise they
+//exit. Then every pair left is an enter or stay, and its contacts go to colliders
+void CollisionSystem::updatePairs_(std::vector<Collider>& colliders) {
+    events_.clear();
+    for (size_t i = 0; i < pairs_.size();) {
+        CollisionPair& pair = pairs_[i];
+        if (pair.frame != frame_) {
+            bool still = !pair.ray && !boxes_changed_ &&
+                !box_moved_[box_index_[pair.a]] && !box_moved_[box_index_[pair.b]];
+            if (still) {
+                pair.frame = frame_;
+            }
+            else {
+                events_.push_back({ CollisionExit, pair.a, pair.b });
+                stats.exit_events++;
+                pair_index_.erase((uint64_t)pair.a << 32 | (uint32_t)pair.b);
+                if (i + 1 != pairs_.size()) {
+                    pair = pairs_.back();
+                    pair_index_[(uint64_t)pair.a << 32 | (uint32_t)pair.b] = (int)i;
                 }
+                pairs_.pop_back();
+                continue;
+            }
+        }
+        i++;
+    }
+
+    for (CollisionPair& pair : pairs_) {
+        bool entered = pair.first_frame == frame_;
+        events_.push_back({ entered ? CollisionEnter : CollisionStay, pair.a, pair.b });
+        if (entered) stats.enter_events++;
+        else stats.stay_events++;
+
+        const ContactManifold& manifold = pair.manifold;
+        Collider& a = colliders[pair.a];
+        Collider& b = colliders[pair.b];
+        a.colliding = b.colliding = true;
+        //ray hits carry the surface normal both ways
+        vec3 b_normal = pair.ray ? manifold.normal : manifold.normal * -1.0f;
+        for (int c = 0; c < manifold.num_points; c++) {
+            a.contacts.push_back({ pair.b, manifold.points[c], manifold.normal, manifold.depths[c] });
+            b.contacts.push_back({ pair.a, manifold.points[c], b_normal, manifold.depths[c] });
+        }
+        if (!pair.ray) {
+            stats.box_contacts++;
+            stats.contact_points += manifold.num_points;
+        }
+    }
+}
+
+//half width of box projected on unit axis n
+static inline float projectedRadius_(const OrientedBox& box, const vec3& n) {
+    return box.e[0] * std::abs(box.u[0].dot(n)) + box.e[1] * std::abs(box.u[1].dot(n)) + box.e[2] * std::abs(box.u[2].dot(n));
+}
+
+//clips incident's face most opposed to normal against the sides of reference's
+//face along normal, keeping points below that face. normal is outward from reference
+static int clipFaces_(const OrientedBox& reference, int axis, const vec3& normal, const OrientedBox& incident,
+                      vec3* points, float* depths) {
+    //incident face
+    int face = 0;
+    float most = -1.0f;
+    for (int a = 0; a < 3; a++) {
+        float d = std::abs(incident.u[a].dot(normal));
+        if (d > most) { most = d; face = a; }
+    }
+    vec3 face_normal = incident.u[face] * -signOf_(incident.u[face].dot(normal));
+    vec3 face_center = incident.c + face_normal * incident.e[face];
+    vec3 s = incident.u[(face + 1) % 3] * incident.e[(face + 1) % 3];
+    vec3 t = incident.u[(face + 2) % 3] * incident.e[(face + 2) % 3];
+
+    //each of the four side planes cuts at most one corner off, adding at most one point
+    vec3 polygon[8] = { face_center + s + t, face_center - s + t, face_center - s - t, face_center + s - t };
+    vec3 clipped[8];
+    int count = 4;
+    for (int side = 0; side < 4 && count; side++) {
+        vec3 plane = reference.u[(axis + 1 + side / 2) % 3] * (side % 2 ? -1.0f : 1.0f);
+        float offset = plane.dot(reference.c) + reference.e[(axis + 1 + side / 2) % 3];
+        int n = 0;
+        for (int k = 0; k < count; k++) {
+            const vec3& p = polygon[k];
+            const vec3& q = polygon[(k + 1) % count];
+            float dp = plane.dot(p) - offset, dq = plane.dot(q) - offset;
+            if (dp <= 0.0f) clipped[n++] = p;
+            if ((dp < 0.0f && dq > 0.0f) || (dp > 0.0f && dq < 0.0f))
+                clipped[n++] = p + (q - p) * (dp / (dp - dq));
+        }
+        count = std::min(n, 8);
+        for (int k = 0; k < count; k++) polygon[k] = clipped[k];
+    }
+
+    //points below reference face, moved halfway up to it
+    float face_offset = normal.dot(reference.c) + reference.e[axis];
+    vec3 below[8];
+    float below_depths[8];
+    int num_below = 0;
+    for (int k = 0; k < count; k++) {
+        float depth = face_offset - normal.dot(polygon[k]);
+        if (depth < 0.0f) continue;
+        below[num_below] = polygon[k] + normal * (depth * 0.5f);
+        below_depths[num_below++] = depth;
+    }
+    if (num_below <= 4) {
+        for (int k = 0; k < num_below; k++) { points[k] = below[k]; depths[k] = below_depths[k]; }
+        return num_below;
+    }
+
+    //more than four: keep deepest, farthest from it, then farthest each side of the line between them
+    int keep[4] = { 0, -1, -1, -1 };
+    for (int k = 1; k < num_below; k++) if (below_depths[k] > below_depths[keep[0]]) keep[0] = k;
+    float far = -1.0f;
+    for (int k = 0; k < num_below; k++) {
+        float d = (below[k] - below[keep[0]]).dot(below[k] - below[keep[0]]);
+        if (d > far) { far = d; keep[1] = k; }
+    }
+    float most_left = 0.0f, most_right = 0.0f;
+    vec3 line = below[keep[1]] - below[keep[0]];
+    for (int k = 0; k < num_below; k++) {
+        float area = line.cross(below[k] - below[keep[0]]).dot(normal);
+        if (area > most_left) { most_left = area; keep[2] = k; }
+        if (area < most_right) { most_right = area; keep[3] = k; }
+    }
+    int n = 0;
+    for (int k = 0; k < 4; k++) {
+        if (keep[k] == -1) continue;
+        points[n] = below[keep[k]];
+        depths[n++] = below_depths[keep[k]];
+    }
+    return n;
+}
+
+//Separating axis test of two oriented boxes, after Real Time Collision Detection 4.4.1,
+//keeping the axis of least overlap: the three face normals of each box, and the
+//nine cross products of their edges. Face contacts clip one box's face against
+//the other's; edge contacts are the closest points of the two edges
+static bool collideOriented_(const OrientedBox& a, const OrientedBox& b, ContactManifold& manifold) {
+    vec3 t = b.c - a.c;
+
+    enum { FaceA, FaceB, Edges } kind = FaceA;
+    int axis_a = 0, axis_b = 0;
+    float best = FLT_MAX;
+    vec3 normal;
+
+    for (int i = 0; i < 3; i++) {
+        float d = t.dot(a.u[i]);
+        float overlap = a.e[i] + projectedRadius_(b, a.u[i]) - std::abs(d);
+        if (overlap < 0.0f) return false;
+        if (overlap < best) { best = overlap; kind = FaceA; axis_a = i; normal = a.u[i] * signOf_(d); }
+    }
+    for (int j = 0; j < 3; j++) {
+        float d = t.dot(b.u[j]);
+        float overlap = projectedRadius_(a, b.u[j]) + b.e[j] - std::abs(d);
+        if (overlap < 0.0f) return false;
+        if (overlap < best) { best = overlap; kind = FaceB; axis_b = j; normal = b.u[j] * signOf_(d); }
+    }
+    //edge axes must beat faces clearly, so resting boxes keep a stable face manifold
+    float face_best = best;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            vec3 n = a.u[i].cross(b.u[j]);
+            float length = n.length();
+            if (length < 1e-5f) continue; //parallel edges, covered by face axes
+            n = n * (1.0f / length);
+            float d = t.dot(n);
+            float overlap = projectedRadius_(a, n) + projectedRadius_(b, n) - std::abs(d);
+            if (overlap < 0.0f) return false;
+            if (overlap < best && overlap < face_best * 0.95f - 0.001f) {
+                best = overlap; kind = Edges; axis_a = i; axis_b = j; normal = n * signOf_(d);
+            }
+        }
+    }
+
+    manifold.normal = normal;
+    if (kind == FaceA) {
+        manifold.num_points = clipFaces_(a, axis_a, normal, b, manifold.points, manifold.depths);
+    }
+    else if (kind == FaceB) {
+        manifold.num_points = clipFaces_(b, axis_b, normal * -1.0f, a, manifold.points, manifold.depths);
+    }
+    else {
+        //edge of a furthest along normal, edge of b furthest against it
+        vec3 pa = a.c, pb = b.c;
+        for (int k = 0; k < 3; k++) {
+            if (k != axis_a) pa = pa + a.u[k] * (a.e[k] * signOf_(a.u[k].dot(normal)));
+            if (k != axis_b) pb = pb - b.u[k] * (b.e[k] * signOf_(b.u[k].dot(normal)));
+        }
+        //closest points of the two edge lines, clamped to the edges
+        const vec3& da = a.u[axis_a];
+        const vec3& db = b.u[axis_b];
+        vec3 r = pa - pb;
+        float c = da.dot(db);
+        float denominator = 1.0f - c * c;
+        float sa = denominator > 1e-6f ? (c * db.dot(r) - da.dot(r)) / denominator : 0.0f;
+        sa = std::max(-a.e[axis_a], std::min(a.e[axis_a], sa));
+        float sb = std::max(-b.e[axis_b], std::min(b.e[axis_b], db.dot(r) + sa * c));
+        manifold.points[0] = (pa + da * sa + pb + db * sb) * 0.5f;
+        manifold.depths[0] = best;
+        manifold.num_points = 1;
+    }
+    //clipping can leave nothing when the boxes only just touch
+    if (!manifold.num_points) {
+        manifold.points[0] = a.c + t * 0.5f;
+        manifold.depths[0] = best;
+        manifold.num_points = 1;
+    }
+    return true;
+}
+
+bool CollisionSystem::collideBoxes(const WorldBoxes& w, int a, int b, ContactManifold& manifold) {
+    return collideOriented_(orientedBox_(w, a), orientedBox_(w, b), manifold);
+}
+
+//nearest box collider along unit direction within length, or -1. This works by
+//walking the tree, collecting boxes whose bounds the ray enters, nearest first,
+//and testing them a register at a time. Each hit shortens the ray, so boxes
+//behind it are skipped
+int CollisionSystem::nearestHit_(const vec3& p, const vec3& direction, float length, float& t, int& tests) const {
+    vec3 q = p + direction * length;
+    int nearest = -1;
+    float nearest_t = length;
+    int pending[NARROWPHASE_WIDTH];
+    int num_pending = 0;
+    auto flush = [&]() {
+        float hit_t;
+        int hit = nearestBox(world_boxes_, pending, num_pending, p, direction, nearest_t, hit_t);
+        if (hit != -1) {
+            nearest = box_collider_[pending[hit]];
+            nearest_t = hit_t;
+        }
+        tests += num_pending;
+        num_pending = 0;
+    };
+    tree_.raycast(p, q, [&](int j, float) -> float {
+        pending[num_pending++] = box_index_[j];
+        if (num_pending == NARROWPHASE_WIDTH) flush();
+        return nearest_t / length;
+    });
+    if (num_pending) flush();
+    t = nearest_t;
+    return nearest;
+}
+
+void CollisionSystem::raycastHit_(const vec3& origin, const vec3& direction, float max_distance, RaycastHit& hit) const {
+    hit.collider = -1;
+    if (direction.length() == 0.0f) return;
+    vec3 d = direction;
+    d.normalize();
+    int tests = 0;
+    hit.collider = nearestHit_(origin, d, max_distance, hit.distance, tests);
+    if (hit.collider == -1) return;
+    hit.point = origin + d * hit.distance;
+    hit.normal = boxNormal_(world_boxes_, box_index_[hit.collider], hit.point);
+}
+
+bool CollisionSystem::raycast(const vec3& origin, const vec3& direction, float max_distance, RaycastHit& hit) const {
+    query_rays_++;
+    raycastHit_(origin, direction, max_distance, hit);
+    return hit.collider != -1;
+}
+
+int CollisionSystem::raycastAll(const vec3& origin, const vec3& direction, float max_distance, std::vector<RaycastHit>& hits) const {
+    query_rays_++;
+    if (direction.length() == 0.0f) return 0;
+    vec3 d = direction;
+    d.normalize();
+    size_t first = hits.size();
+    tree_.raycast(origin, origin + d * max_distance, [&](int j, float) -> float {
+        int box = box_index_[j];
+        float t;
+        if (nearestBox(world_boxes_, &box, 1, origin, d, max_distance, t) != -1) {
+            RaycastHit hit;
+            hit.collider = j;
+            hit.distance = t;
+            hit.point = origin + d * t;
+            hit.normal = boxNormal_(world_boxes_, box, hit.point);
+            hits.push_back(hit);
+        }
+        return 1.0f; //keep going to end of ray
+    });
+    std::sort(hits.begin() + first, hits.end(), [](const RaycastHit& a, const RaycastHit& b) { return a.distance < b.distance; });
+    return (int)(hits.size() - first);
+}
+
+bool CollisionSystem::raycastMeshes(const vec3& origin, const vec3& direction, float max_distance, MeshHit& hit) const {
+    query_rays_++;
+    hit.mesh = -1;
+    if (!graphics_system_ || direction.length() == 0.0f) return false;
+    vec3 d = direction;
+    d.normalize();
+    auto& meshes = ECS.getAllComponents<Mesh>();
+    auto& transforms = ECS.getAllComponents<Transform>();
+    float nearest = max_distance;
+    vec3 local_normal;
+    mat4 hit_model;
+    for (size_t i = 0; i < meshes.size(); i++) {
+        Geometry& geom = graphics_system_->getGeometry(meshes[i].geometry);
+        if (geom.terrain == -1 && geom.bvh.empty()) continue;
+        mat4 model = ECS.getComponentFromEntity<Transform>(meshes[i].owner).getGlobalMatrix(transforms);
+        mat4 inv = model;
+        inv.inverse();
+        //local direction is not normalized, so t along it stays in world units
+        vec3 local_origin = inv * origin;
+        vec3 local_direction = inv * (origin + d) - local_origin;
+
+        float t;
+        int triangle = -1;
+        if (geom.terrain != -1) {
+            Terrain* terrain = graphics_system_->getTerrains()[geom.terrain];
+            vec3 local_point;
+            if (!terrain->raycast(local_origin, local_direction, nearest * local_direction.length(), local_point)) continue;
+            t = (model * local_point - origin).length();
+            if (t > nearest) continue;
+            //normal from slope of heightfield
+            const float e = 0.05f;
+            float dx = terrain->heightAt(local_point.x + e, local_point.z) - terrain->heightAt(local_point.x - e, local_point.z);
+            float dz = terrain->heightAt(local_point.x, local_point.z + e) - terrain->heightAt(local_point.x, local_point.z - e);
+            local_normal = vec3(-dx, 2.0f * e, -dz);
+        }
+        else {
+            if (!geom.bvh.raycast(local_origin, local_direction, nearest, t, triangle)) continue;
+            local_normal = geom.bvh.triangleNormal(triangle);
+        }
+        nearest = t;
+        hit.mesh = (int)i;
+        hit.triangle = triangle;
+        hit_model = model;
+    }
+    if (hit.mesh == -1) return false;
+    hit.distance = nearest;
+    hit.point = origin + d * nearest;
+    //normals go through inverse transpose, without translation
+    hit_model.m[12] = 0.0f; hit_model.m[13] = 0.0f; hit_model.m[14] = 0.0f;
+    hit_model.inverse();
+    hit_model.transpose();
+    hit.normal = (hit_model * local_normal).normalize();
+    return true;
+}
+
+//rays per job, each cast on its own; the SIMD is across boxes
+const int RAY_PACKET = 64;
+
+void CollisionSystem::raycastBatch(const QueryRay* rays, int count, RaycastHit* hits) const {
+    query_rays_ += count;
+    JOBS.parallelFor(count, RAY_PACKET, [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            raycastHit_(rays[i].origin, rays[i].direction, rays[i].max_distance, hits[i]);
+    });
+}
+
+int CollisionSystem::sphereOverlap(const vec3& center, float radius, std::vector<int>& colliders) const {
+    AABB bounds;
+    bounds.center = center;
+    bounds.half_width = vec3(radius, radius, radius);
+    int found = 0;
+    tree_.query(bounds, [&](int j) {
+        //closest point of box to center, in box space
+        OrientedBox box = orientedBox_(world_boxes_, box_index_[j]);
+        vec3 r = center - box.c;
+        float distance2 = 0.0f;
+        for (int a = 0; a < 3; a++) {
+            float d = r.dot(box.u[a]);
+            float outside = std::abs(d) - box.e[a];
+            if (outside > 0.0f) distance2 += outside * outside;
+        }
+        if (distance2 > radius * radius) return;
+        colliders.push_back(j);
+        found++;
+    });
+    return found;
+}
+
+int CollisionSystem::boxOverlap(const vec3& center, const vec3& half_width, const mat4& rotation, std::vector<int>& colliders) const {
+    OrientedBox query;
+    query.c = center;
+    query.e[0] = half_width.x; query.e[1] = half_width.y; query.e[2] = half_width.z;
+    for (int a = 0; a < 3; a++)
+        query.u[a] = vec3(rotation.m[a * 4], rotation.m[a * 4 + 1], rotation.m[a * 4 + 2]).normalize();
+    AABB bounds;
+    bounds.center = center;
+    bounds.half_width.x = projectedRadius_(query, vec3(1, 0, 0));
+    bounds.half_width.y = projectedRadius_(query, vec3(0, 1, 0));
+    bounds.half_width.z = projectedRadius_(query, vec3(0, 0, 1));
+    int found = 0;
+    tree_.query(bounds, [&](int j) {
+        ContactManifold manifold;
+        if (!collideOriented_(query, orientedBox_(world_boxes_, box_index_[j]), manifold)) return;
+        colliders.push_back(j);
+        found++;
+    });
+    return found;
+}
+
+//min and max as SSE computes them, so scalar and SIMD tests agree exactly,
+//including when a NaN comes from a ray parallel to a face it lies in
+static inline float minps_(float a, float b) { return a < b ? a : b; }
+static inline float maxps_(float a, float b) { return a > b ? a : b; }
+
+//slab test in box space: the segment is inside the box between the latest entry
+//and earliest exit over the three pairs of faces
+int CollisionSystem::nearestBoxScalar_(const WorldBoxes& w, const int* boxes, int count,
+                                       const float* p, const float* d, float max_t, float& t) {
+    int nearest = -1;
+    for (int k = 0; k < count; k++) {
+        int i = boxes[k];
+        float rx = p[0] - w.cx[i], ry = p[1] - w.cy[i], rz = p[2] - w.cz[i];
+        float axes[3][3] = { { w.ux[i], w.uy[i], w.uz[i] }, { w.vx[i], w.vy[i], w.vz[i] }, { w.wx[i], w.wy[i], w.wz[i] } };
+        float extents[3] = { w.ex[i], w.ey[i], w.ez[i] };
+        float t_enter = -FLT_MAX, t_exit = max_t;
+        for (int a = 0; a < 3; a++) {
+            float o = rx * axes[a][0] + ry * axes[a][1] + rz * axes[a][2];
+            float dd = d[0] * axes[a][0] + d[1] * axes[a][1] + d[2] * axes[a][2];
+            float inv = 1.0f / dd;
+            float t1 = (-extents[a] - o) * inv;
+            float t2 = (extents[a] - o) * inv;
+            t_enter = maxps_(t_enter, minps_(t1, t2));
+            t_exit = minps_(t_exit, maxps_(t1, t2));
+        }
+        if (t_enter <= t_exit && t_enter >= 0.0f && t_enter < max_t) {
+            max_t = t_enter;
+            nearest = k;
+        }
+    }
+    t = max_t;
+    return nearest;
+}
+
+int CollisionSystem::nearestBox(const WorldBoxes& w, const int* boxes, int count,
+                                const lm::vec3& from, const lm::vec3& direction, float max_t, float& t) {
+    float p[3] = { from.x, from.y, from.z };
+    float d[3] = { direction.x, direction.y, direction.z };
+    int nearest = -1;
+    int k = 0;
+#if defined(COLLISION_AVX)
+    for (; k + 8 <= count; k += 8) {
+        const int* b = boxes + k;
+        #define GATHER(array) _mm256_set_ps(w.array[b[7]], w.array[b[6]], w.array[b[5]], w.array[b[4]], \
+                                            w.array[b[3]], w.array[b[2]], w.array[b[1]], w.array[b[0]])
+        __m256 rx = _mm256_sub_ps(_mm256_set1_ps(p[0]), GATHER(cx));
+        __m256 ry = _mm256_sub_ps(_mm256_set1_ps(p[1]), GATHER(cy));
+        __m256 rz = _mm256_sub_ps(_mm256_set1_ps(p[2]), GATHER(cz));
+        __m256 axes[3][3] = { { GATHER(ux), GATHER(uy), GATHER(uz) }, { GATHER(vx), GATHER(vy), GATHER(vz) }, { GATHER(wx), GATHER(wy), GATHER(wz) } };
+        __m256 extents[3] = { GATHER(ex), GATHER(ey), GATHER(ez) };
+        #undef GATHER
+        __m256 t_enter = _mm256_set1_ps(-FLT_MAX), t_exit = _mm256_set1_ps(max_t);
+        for (int a = 0; a < 3; a++) {
+            __m256 o = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rx, axes[a][0]), _mm256_mul_ps(ry, axes[a][1])), _mm256_mul_ps(rz, axes[a][2]));
+            __m256 dd = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(d[0]), axes[a][0]), _mm256_mul_ps(_mm256_set1_ps(d[1]), axes[a][1])), _mm256_mul_ps(_mm256_set1_ps(d[2]), axes[a][2]));
+            __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f), dd);
+            __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), extents[a]), o), inv);
+            __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(extents[a], o), inv);
+            t_enter = _mm256_max_ps(t_enter, _mm256_min_ps(t1, t2));
+            t_exit = _mm256_min_ps(t_exit, _mm256_max_ps(t1, t2));
+        }
+        float enter[8], exit[8];
+        _mm256_storeu_ps(enter, t_enter);
+        _mm256_storeu_ps(exit, t_exit);
+        for (int l = 0; l < 8; l++) {
+            if (enter[l] <= exit[l] && enter[l] >= 0.0f && enter[l] < max_t) {
+                max_t = enter[l];
+                nearest = k + l;
+            }
+        }
+    }
+#elif defined(COLLISION_SSE)
+    for (; k + 4 <= count; k += 4) {
+        const int* b = boxes + k;
+        #define GATHER(array) _mm_set_ps(w.array[b[3]], w.array[b[2]], w.array[b[1]], w.array[b[0]])
+        __m128 rx = _mm_sub_ps(_mm_set1_ps(p[0]), GATHER(cx));
+        __m128 ry = _mm_sub_ps(_mm_set1_ps(p[1]), GATHER(cy));
+        __m128 rz = _mm_sub_ps(_mm_set1_ps(p[2]), GATHER(cz));
+        __m128 axes[3][3] = { { GATHER(ux), GATHER(uy), GATHER(uz) }, { GATHER(vx), GATHER(vy), GATHER(vz) }, { GATHER(wx), GATHER(wy), GATHER(wz) } };
+        __m128 extents[3] = { GATHER(ex), GATHER(ey), GATHER(ez) };
+        #undef GATHER
+        __m128 t_enter = _mm_set1_ps(-FLT_MAX), t_exit = _mm_set1_ps(max_t);
+        for (int a = 0; a < 3; a++) {
+            __m128 o = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, axes[a][0]), _mm_mul_ps(ry, axes[a][1])), _mm_mul_ps(rz, axes[a][2]));
+            __m128 dd = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(d[0]), axes[a][0]), _mm_mul_ps(_mm_set1_ps(d[1]), axes[a][1])), _mm_mul_ps(_mm_set1_ps(d[2]), axes[a][2]));
+            __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), dd);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), extents[a]), o), inv);
+            __m128 t2 = _mm_mul_ps(_mm_sub_ps(extents[a], o), inv);
+            t_enter = _mm_max_ps(t_enter, _mm_min_ps(t1, t2));
+            t_exit = _mm_min_ps(t_exit, _mm_max_ps(t1, t2));
+        }
+        float enter[4], exit[4];
+        _mm_storeu_ps(enter, t_enter);
+        _mm_storeu_ps(exit, t_exit);
+        for (int l = 0; l < 4; l++) {
+            if (enter[l] <= exit[l] && enter[l] >= 0.0f && enter[l] < max_t) {
+                max_t = enter[l];
+                nearest = k + l;
             }
         }
     }
+#endif
+    //remainder
+    float rest_t;
+    int rest = nearestBoxScalar_(w, boxes + k, count - k, p, d, max_t, rest_t);
+    if (rest != -1) {
+        nearest = k + rest;
+        max_t = rest_t;
+    }
+    t = max_t;
+    return nearest;
+}
+
+//old narrowphase on a cached box: six quads, in the order of intersectSegmentBox
+bool CollisionSystem::segmentBoxQuads_(const WorldBoxes& w, int i, const lm::vec3& p, const lm::vec3& q, float& t) {
+    vec3 c(w.cx[i], w.cy[i], w.cz[i]);
+    vec3 x = vec3(w.ux[i], w.uy[i], w.uz[i]) * w.ex[i];
+    vec3 y = vec3(w.vx[i], w.vy[i], w.vz[i]) * w.ey[i];
+    vec3 z = vec3(w.wx[i], w.wy[i], w.wz[i]) * w.ez[i];
+    vec3 a = c - x + y + z, b = c - x - y + z, cc = c + x - y + z, d = c + x + y + z;
+    vec3 e = c - x + y - z, f = c - x - y - z, g = c + x - y - z, h = c + x + y - z;
+    vec3 r;
+    if (intersectSegmentQuad(p, q, a, b, cc, d, r) || intersectSegmentQuad(p, q, d, cc, g, h, r) ||
+        intersectSegmentQuad(p, q, h, g, f, e, r) || intersectSegmentQuad(p, q, e, f, b, a, r) ||
+        intersectSegmentQuad(p, q, a, d, h, e, r) || intersectSegmentQuad(p, q, b, f, g, cc, r)) {
+        t = (p - r).length();
+        return true;
+    }
+    return false;
+}
+
+bool CollisionSystem::testNarrowphase() {
+    const int num_boxes = 1000;
+    const int num_rays = 1000;
+    srand(1);
+    auto random = [](float a, float b) { return a + (b - a) * (rand() / (float)RAND_MAX); };
+
+    //randomly rotated boxes
+    WorldBoxes w;
+    w.resize(num_boxes);
+    std::vector<int> all(num_boxes);
+    for (int i = 0; i < num_boxes; i++) {
+        mat4 rotation;
+        rotation.makeRotationMatrix(random(0.0f, 6.283f), vec3(random(-1, 1), random(-1, 1), random(-1, 1) + 0.01f).normalize());
+        w.cx[i] = random(-20, 20); w.cy[i] = random(-20, 20); w.cz[i] = random(-20, 20);
+        w.ux[i] = rotation.m[0]; w.uy[i] = rotation.m[1]; w.uz[i] = rotation.m[2];
+        w.vx[i] = rotation.m[4]; w.vy[i] = rotation.m[5]; w.vz[i] = rotation.m[6];
+        w.wx[i] = rotation.m[8]; w.wy[i] = rotation.m[9]; w.wz[i] = rotation.m[10];
+        w.ex[i] = random(0.2f, 3.0f); w.ey[i] = random(0.2f, 3.0f); w.ez[i] = random(0.2f, 3.0f);
+        all[i] = i;
+    }
+    std::vector<vec3> starts(num_rays), directions(num_rays);
+    std::vector<float> lengths(num_rays);
+    for (int r = 0; r < num_rays; r++) {
+        starts[r] = vec3(random(-30, 30), random(-30, 30), random(-30, 30));
+        directions[r] = vec3(random(-1, 1), random(-1, 1), random(-1, 1) + 0.01f).normalize();
+        lengths[r] = random(5.0f, 60.0f);
+    }
+
+    //nearest hit of each ray, three ways
+    CollisionSystem reference;
+    std::vector<int> quad_hit(num_rays), scalar_hit(num_rays), simd_hit(num_rays);
+    std::vector<float> quad_t(num_rays), scalar_t(num_rays), simd_t(num_rays);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < num_rays; r++) {
+        quad_hit[r] = -1;
+        quad_t[r] = lengths[r];
+        vec3 q = starts[r] + directions[r] * lengths[r];
+        for (int i = 0; i < num_boxes; i++) {
+            float t;
+            if (reference.segmentBoxQuads_(w, i, starts[r], q, t) && t < quad_t[r]) {
+                quad_t[r] = t;
+                quad_hit[r] = i;
+            }
+        }
+    }
+    auto quads_end = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < num_rays; r++) {
+        float p[3] = { starts[r].x, starts[r].y, starts[r].z };
+        float d[3] = { directions[r].x, directions[r].y, directions[r].z };
+        scalar_hit[r] = nearestBoxScalar_(w, all.data(), num_boxes, p, d, lengths[r], scalar_t[r]);
+    }
+    auto scalar_end = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < num_rays; r++)
+        simd_hit[r] = nearestBox(w, all.data(), num_boxes, starts[r], directions[r], lengths[r], simd_t[r]);
+    auto simd_end = std::chrono::high_resolution_clock::now();
+
+    //a different box at the same distance is a tie, e.g. at a shared edge
+    int nearest_mismatches = 0, simd_mismatches = 0, hits = 0;
+    for (int r = 0; r < num_rays; r++) {
+        if (quad_hit[r] != -1) hits++;
+        bool same = quad_hit[r] == scalar_hit[r] ||
+            (quad_hit[r] != -1 && scalar_hit[r] != -1 && std::abs(quad_t[r] - scalar_t[r]) < 1e-3f);
+        if (!same || (quad_hit[r] != -1 && std::abs(quad_t[r] - scalar_t[r]) > 1e-3f * (1.0f + quad_t[r])))
+            nearest_mismatches++;
+        if (simd_hit[r] != scalar_hit[r] || simd_t[r] != scalar_t[r])
+            simd_mismatches++;
+    }
+
+    float tests = (float)num_rays * num_boxes;
+    auto ns = [tests](std::chrono::high_resolution_clock::time_point a, std::chrono::high_resolution_clock::time_point b) {
+        return std::chrono::duration<float, std::nano>(b - a).count() / tests;
+    };
+    printf("narrowphase: %d rays x %d boxes, %d rays hit\n", num_rays, num_boxes, hits);
+    printf("%12s %14s %12s\n", "", "ns per test", "mismatches");
+    printf("%12s %14.2f %12s\n", "quads", ns(start, quads_end), "-");
+    printf("%12s %14.2f %12d\n", "slab", ns(quads_end, scalar_end), nearest_mismatches);
+    printf("%12s %14.2f %12d\n", NARROWPHASE_WIDTH == 8 ? "slab AVX" : "slab SSE", ns(scalar_end, simd_end), simd_mismatches);
+    return nearest_mismatches == 0 && simd_mismatches == 0;
+}
+
+//world start and unit direction of ray collider
+void CollisionSystem::worldRay_(Collider& ray, std::vector<Transform>& all_transforms, lm::vec3& p, lm::vec3& direction) {
+    mat4 ray_global = ECS.getComponentFromEntity<Transform>(ray.owner).getGlobalMatrix(all_transforms);
+    
+    //translate the center of ray locally before applying global positionthen get position
+    ray_global.translateLocal(ray.local_center.x, ray.local_center.y, ray.local_center.z);
+    p = ray_global.position();
+    
+    //direction is more complex as we must rotate the it without translation or scale
+    //To do this we muts multiply the direction by the InverseTranspose of the global model
+    //setting translation component to zero first. This is similar to the normal matrix in a shader
+    mat4 inv = ray_global;
+    inv.m[12] = 0.0; inv.m[13] = 0.0; inv.m[14] = 0.0;
+    inv.inverse();
+    mat4 inv_trans = inv.transpose();
+    direction = inv_trans * ray.direction.normalize(); //normalize direction as there's no guarantee it's length = 1!
 }
 
 // Calculates whether a Ray collider (treated as a segment with a finite distance)
@@ -69,7 +892,6 @@ bool CollisionSystem::intersectSegmentBox(Collider& ray, Collider& box, lm::vec3
     // normal, so in fact we only test collisions for maximum 3 faces
     
     //get model matrices
-    Transform& ray_model = ECS.getComponentFromEntity<Transform>(ray.owner);
     Transform& box_model = ECS.getComponentFromEntity<Transform>(box.owner);
     //get reference to all transforms in ECS, for world pos calculations
     std::vector<Transform>& all_transforms = ECS.getAllComponents<Transform>();
@@ -102,20 +924,8 @@ bool CollisionSystem::intersectSegmentBox(Collider& ray, Collider& box, lm::vec3
     
     
     //*** TRANSFORM RAY TO WORLD ***//
-    mat4 ray_global = ray_model.getGlobalMatrix(all_transforms);
-    
-    //translate the center of ray locally before applying global positionthen get position
-    ray_global.translateLocal(ray.local_center.x, ray.local_center.y, ray.local_center.z);
-    vec3 p = ray_global.position();
-    
-    //direction is more complex as we must rotate the it without translation or scale
-    //To do this we muts multiply the direction by the InverseTranspose of the global model
-    //setting translation component to zero first. This is similar to the normal matrix in a shader
-    mat4 inv = ray_global;
-    inv.m[12] = 0.0; inv.m[13] = 0.0; inv.m[14] = 0.0;
-    inv.inverse();
-    mat4 inv_trans = inv.transpose();
-    vec3 q = inv_trans * ray.direction.normalize(); //normalize direction as there's no guarantee it's length = 1!
+    vec3 p, q;
+    worldRay_(ray, all_transforms, p, q);
     
     //now scale q by max distance to get segment size - safe to do this as direction was normalized
     float test_distance = (ray.max_distance < max_distance ? ray.max_distance : max_distance);
@@ -129,32 +939,32 @@ bool CollisionSystem::intersectSegmentBox(Collider& ray, Collider& box, lm::vec3
     //abcd; dcgh, hgfe, efba, adhe, bfgc
     bool abcd = intersectSegmentQuad(p, q, a, b, c, d, col_point);
     if (abcd) {
-        col_distance = (ray_global.position()-col_point).length();
+        col_distance = (p-col_point).length();
         return true;
     }
     bool dcgh = intersectSegmentQuad(p, q, d, c, g, h, col_point);
     if (dcgh) {
-        col_distance = (ray_global.position()-col_point).length();
+        col_distance = (p-col_point).length();
         return true;
     }
     bool hgfe = intersectSegmentQuad(p, q, h, g, f, e, col_point);
     if (hgfe) {
-        col_distance = (ray_global.position()-col_point).length();
+        col_distance = (p-col_point).length();
         return true;
     }
     bool efba = intersectSegmentQuad(p, q, e, f, b, a, col_point);
     if (efba) {
-        col_distance = (ray_global.position()-col_point).length();
+        col_distance = (p-col_point).length();
         return true;
     }
     bool adhe = intersectSegmentQuad(p, q, a, d, h, e, col_point);
     if (adhe) {
-        col_distance = (ray_global.position()-col_point).length();
+        col_distance = (p-col_point).length();
         return true;
     }
     bool bfgc = intersectSegmentQuad(p, q, b, f, g, c, col_point);
     if (bfgc) {
-        col_distance = (ray_global.position()-col_point).length();
+        col_distance = (p-col_point).length();
         return true;
     }
     
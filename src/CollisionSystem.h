@@ -1,11 +1,138 @@
 #pragma once
 #include "includes.h"
 #include "Components.h"
+#include "AABBTree.h"
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <cstdint>
 
+//work of last update
+struct CollisionStats {
+    int boxes = 0;
+    int rays = 0;
+    int reinserted = 0; //boxes which left their fat box in the tree
+    int tree_height = 0;
+    int ray_box_tests = 0; //narrowphase tests, rays * boxes without broadphase
+    int hits = 0;
+    int query_rays = 0; //cast by raycast functions between the two last updates
+    int moved_boxes = 0; //world box changed since last frame
+    int box_pairs = 0; //pairs with a moved box whose bounds overlap, tested again
+    int box_contacts = 0; //pairs which touch, tested or kept
+    int contact_points = 0;
+    int enter_events = 0, stay_events = 0, exit_events = 0;
+    float broadphase_ms = 0.0f; //updating tree
+    float pairs_ms = 0.0f; //box pairs from tree, with separating axis tests
+    float query_ms = 0.0f; //rays down tree, with narrowphase tests
+};
+
+//box colliders in world space, structure of arrays so that several boxes can
+//be loaded in one SIMD register
+struct WorldBoxes {
+    std::vector<float> cx, cy, cz; //center
+    std::vector<float> ux, uy, uz, vx, vy, vz, wx, wy, wz; //unit axes
+    std::vector<float> ex, ey, ez; //half extents along axes
+    void resize(size_t n);
+    bool same(const WorldBoxes& other, size_t i) const; //box i is identical in both
+};
+
+//where two boxes touch: up to four points sharing one normal
+struct ContactManifold {
+    int a, b; //colliders
+    lm::vec3 normal; //from a towards b
+    int num_points = 0;
+    lm::vec3 points[4]; //halfway between surfaces
+    float depths[4];
+};
+
+//ray for queries; direction need not be unit length
+struct QueryRay {
+    lm::vec3 origin;
+    lm::vec3 direction;
+    float max_distance = 100000.0f;
+};
+
+//box collider which a query ray hits
+struct RaycastHit {
+    int collider = -1; //-1 if ray hits nothing
+    lm::vec3 point;
+    lm::vec3 normal; //box surface normal at point
+    float distance = 0.0f;
+};
+
+//mesh triangle which a query ray hits
+struct MeshHit {
+    int mesh = -1; //Mesh component, -1 if ray hits nothing
+    int triangle = -1; //in geometry's bvh, -1 for terrains
+    lm::vec3 point;
+    lm::vec3 normal;
+    float distance = 0.0f;
+};
+
+class GraphicsSystem;
+
+enum CollisionEventType {
+    CollisionEnter,
+    CollisionStay,
+    CollisionExit
+};
+
+//pair of colliders which started touching this frame, still touch, or stopped
+struct CollisionEvent {
+    CollisionEventType type;
+    int collider;
+    int other;
+};
+
+//Box colliders are kept in a dynamic AABB tree by their world bounds. Each ray
+//walks the tree nearest box first, testing only boxes whose bounds its segment
+//enters, and stops once no box left can be nearer than its closest hit.
+//World boxes are computed once per frame; candidates from the tree are tested
+//eight (AVX) or four (SSE) at a time with a slab test in each box's space.
+//Boxes whose bounds overlap in the tree are tested against each other with
+//separating axes across the job pool, and contacts of those which touch are
+//added to both colliders.
+//Touching pairs are kept in a table from frame to frame. Only boxes whose world
+//box changed look for pairs in the tree; a pair of boxes which both stayed still
+//keeps its contacts without being tested. Comparing the table with the pairs
+//found gives the enter, stay and exit events of each frame
 class CollisionSystem {
 public:
-    void init();
+    //graphics system is only needed for raycasts against meshes
+    void init(GraphicsSystem* graphics_system = nullptr);
     void update(float dt);
+    static CollisionStats stats;
+
+    //events of last update, exits first
+    const std::vector<CollisionEvent>& getEvents() const { return events_; }
+
+    //Queries against box colliders where the last update left them, answered
+    //at once without a collider entity. Results are collider indices
+    //nearest box along ray, false if none
+    bool raycast(const lm::vec3& origin, const lm::vec3& direction, float max_distance, RaycastHit& hit) const;
+    //every box along ray, nearest first, returning how many
+    int raycastAll(const lm::vec3& origin, const lm::vec3& direction, float max_distance, std::vector<RaycastHit>& hits) const;
+    //nearest hit of each ray, in packets of rays across the job pool
+    void raycastBatch(const QueryRay* rays, int count, RaycastHit* hits) const;
+    //boxes overlapping sphere, or box with rotation, appended to colliders, returning how many
+    int sphereOverlap(const lm::vec3& center, float radius, std::vector<int>& colliders) const;
+    int boxOverlap(const lm::vec3& center, const lm::vec3& half_width, const lm::mat4& rotation, std::vector<int>& colliders) const;
+    //nearest triangle of any mesh along ray, through the bvh of its geometry in
+    //the mesh's local space, or the heightfield of a terrain. Meshes are not
+    //colliders, so this ignores boxes, and skinned meshes are in bind pose
+    bool raycastMeshes(const lm::vec3& origin, const lm::vec3& direction, float max_distance, MeshHit& hit) const;
+
+    //nearest of boxes[0..count) which segment p + direction * t, 0 <= t <= max_t,
+    //enters, or -1, writing its t. A segment starting inside a box doesn't hit it,
+    //as with intersectSegmentBox
+    static int nearestBox(const WorldBoxes& world, const int* boxes, int count,
+                          const lm::vec3& p, const lm::vec3& direction, float max_t, float& t);
+    //compares slab tests, scalar and SIMD, with quad tests on random boxes and
+    //prints timings to console. Returns true if all agree
+    static bool testNarrowphase();
+    //separating axis test of world boxes a and b. If they overlap, fills manifold
+    //(except its colliders) from the face or edges they overlap least along
+    static bool collideBoxes(const WorldBoxes& world, int a, int b, ContactManifold& manifold);
     bool intersectSegmentBox(Collider& ray, Collider& box, lm::vec3& col_point, float& col_distance, float max_distance = 100000.0f);
     
     bool intersectSegmentTriangle(lm::vec3 p, lm::vec3 q, lm::vec3 a, lm::vec3 b, lm::vec3 c);
@@ -13,5 +140,45 @@ public:
     
     //LINE not segment
     bool intersectLineQuad(lm::vec3 p, lm::vec3 q, lm::vec3 a, lm::vec3 b, lm::vec3 c, lm::vec3 d, lm::vec3& r);
+
+private:
+    //pair of colliders which touch, kept while they do
+    struct CollisionPair {
+        int a, b; //colliders, a < b for boxes, a is the ray for ray hits
+        bool ray;
+        unsigned first_frame; //frame it started touching, for enter events
+        unsigned frame; //last frame it was found or kept
+        ContactManifold manifold;
+    };
+
+    GraphicsSystem* graphics_system_ = nullptr;
+    AABBTree tree_;
+    std::vector<int> proxies_; //tree proxy of each collider, -1 if not a box
+    WorldBoxes world_boxes_;
+    std::vector<int> box_index_; //index in world_boxes_ of each collider, -1 if not a box
+    std::vector<int> box_collider_; //collider of each world box
+    WorldBoxes last_world_boxes_;
+    std::vector<int> last_box_collider_;
+    std::vector<char> box_moved_; //world box changed since last frame
+    bool boxes_changed_ = true; //boxes added or removed, so every box counts as moved
+    std::vector<AABB> box_bounds_; //tight world bounds of each world box
+    std::vector<std::pair<int, int>> box_pairs_; //world boxes whose bounds overlap
+    std::vector<ContactManifold> manifolds_; //one per pair, written in parallel
+    std::vector<CollisionPair> pairs_;
+    std::unordered_map<uint64_t, int> pair_index_; //a << 32 | b to index in pairs_
+    std::vector<CollisionEvent> events_;
+    unsigned frame_ = 0;
+    mutable int query_rays_ = 0; //since last update
+    void updateBroadphase_(std::vector<Collider>& colliders);
+    void collideBoxPairs_();
+    void touch_(int a, int b, bool ray, const ContactManifold& manifold);
+    void updatePairs_(std::vector<Collider>& colliders);
+    int nearestHit_(const lm::vec3& p, const lm::vec3& direction, float length, float& t, int& tests) const;
+    void raycastHit_(const lm::vec3& origin, const lm::vec3& direction, float max_distance, RaycastHit& hit) const;
+    AABB setWorldBox_(int index, Collider& box, std::vector<Transform>& all_transforms);
+    static int nearestBoxScalar_(const WorldBoxes& world, const int* boxes, int count,
+                                 const float* p, const float* d, float max_t, float& t);
+    bool segmentBoxQuads_(const WorldBoxes& world, int box, const lm::vec3& p, const lm::vec3& q, float& t);
+    void worldRay_(Collider& ray, std::vector<Transform>& all_transforms, lm::vec3& p, lm::vec3& direction);
 };
 
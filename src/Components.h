@@ -149,6 +149,17 @@ enum ColliderType {
     ColliderTypeRay
 };
 
+//Point where a collider touches another collider
+// - other is index of other collider in collider array
+// - box against box: normal points from this box towards other, depth is overlap
+// - ray against box: normal is box surface normal at point, depth is distance along ray
+struct Contact {
+    int other;
+    lm::vec3 point;
+    lm::vec3 normal;
+    float depth;
+};
+
 //ColliderComponent. Only specifies size - collider location is given by any
 //associated TransformComponent
 // - collider_type is the type according to enum above
@@ -156,6 +167,7 @@ enum ColliderType {
 // - local_halfwidth is used for box,
 // - direction is used for ray
 // - max_distance is used to convert ray to segment
+// - contacts are rebuilt every frame by the CollisionSystem
 struct Collider: public Component {
     ColliderType collider_type;
     lm::vec3 local_center; //offset from transform component
@@ -165,15 +177,13 @@ struct Collider: public Component {
     
     //collision state
     bool colliding;
-    int other;
-    lm::vec3 collision_point;
-    float collision_distance;
+    float collision_distance; //along ray, to nearest hit
+    std::vector<Contact> contacts; //a ray has at most one, its nearest hit
     
     Collider() {
         local_halfwidth = lm::vec3(0.5, 0.5, 0.5); //default dimensions = 1 in each axis
         max_distance = 10000000.0f; //infinite ray by default
         colliding = false; // not colliding
-        other = -1; //no other collider
     }
 };
 
@@ -277,18 +287,28 @@ struct BlendShapes : public Component {
         blend_weights.push_back(0.0);
     }
 };
-//
-//struct ParticleEmitter : public Component {
-//    Shader* shader;
-//    GLuint texture;
-//    GLuint num_particles;
-//    float particle_size;
-//    GLuint vaoA_, vaoB_;
-//    GLuint tfA_, tfB_;
-//    GLuint active_VAO;
-//    float min_life;
-//    float max_life;
-//};
+// ParticleEmitter Component
+// - spawns particles at position of its entity, simulated on GPU by ParticleSystem
+// - fields after emitting are written by ParticleSystem each frame
+struct ParticleEmitter : public Component {
+    GLuint texture = 0;
+    int num_particles = 1000;
+    float particle_size = 0.2f;
+    float min_life = 0.5f;
+    float max_life = 1.5f;
+    lm::vec3 velocity = lm::vec3(0.0f, 3.1415f, 0.0f); //initial velocity of every particle
+    float spread = 2.0f; //horizontal speed added in a ring around velocity
+    float spin = 3.0f; //radians per second the spawn direction rotates, 0 for random
+    lm::vec3 gravity = lm::vec3(0.0f, -1.0f, 0.0f);
+    lm::vec3 color = lm::vec3(1.0f, 1.0f, 1.0f);
+    float alpha = 1.0f;
+    float bounds_radius = 10.0f; //for frustum culling, around entity position
+    bool emitting = true; //if false, live particles finish and no more spawn
+    int first_particle = -1; //offset in shared particle buffers
+    lm::vec3 position; //world position of entity
+    bool spawning = true; //emitting, and entity is active
+    bool visible = true; //in camera frustum, and entity is active
+};
 
 /**** COMPONENT STORAGE ****/
 
@@ -303,8 +323,8 @@ std::vector<GUIElement>,
 std::vector<GUIText>,
 std::vector<Animation>,
 std::vector<SkinnedMesh>,
-std::vector<BlendShapes>
-//std::vector<ParticleEmitter>
+std::vector<BlendShapes>,
+std::vector<ParticleEmitter>
 > ComponentArrays;
 
 //way of mapping different types to an integer value i.e.
@@ -321,7 +341,7 @@ template<> struct type2int<GUIText> { enum { result = 6 }; };
 template<> struct type2int<Animation> { enum { result = 7 }; };
 template<> struct type2int<SkinnedMesh> { enum { result = 8 }; };
 template<> struct type2int<BlendShapes> { enum { result = 9 }; };
-//template<> struct type2int<ParticleEmitter> { enum { result = 10 }; };
+template<> struct type2int<ParticleEmitter> { enum { result = 10 }; };
 //UPDATE THIS!
 const int NUM_TYPE_COMPONENTS = 11;
 
@@ -1,8 +1,12 @@
 #include "ControlSystem.h"
 #include "extern.h"
+#include "Terrain.h"
+#include "CollisionSystem.h"
 
 //set initial state of input system
-void ControlSystem::init() {
+void ControlSystem::init(CollisionSystem* collision_system) {
+	collision_system_ = collision_system;
+	mouse.x = mouse.y = mouse.delta_x = mouse.delta_y = 0;
 	//set all keys and buttons to 0
 	for (int i = 0; i < GLFW_KEY_LAST; i++) input[i] = 0;
 }
@@ -16,9 +20,10 @@ void ControlSystem::key_mouse_callback(int key_button, int action, int mods) {
 }
 
 //called from hardware input (via game)
+//deltas add up until an update uses them, as with fixed steps a frame may have none
 void ControlSystem::updateMousePosition(int new_x, int new_y) {
-	mouse.delta_x = new_x - mouse.x;
-	mouse.delta_y = new_y - mouse.y;
+	mouse.delta_x += new_x - mouse.x;
+	mouse.delta_y += new_y - mouse.y;
 	mouse.x = new_x;
 	mouse.y = new_y;
 }
@@ -41,6 +46,8 @@ void ControlSystem::update(float dt) {
 		ECS.main_camera = 1;
 		control_type = ControlTypeFPS;
 	}
+
+	mouse.delta_x = mouse.delta_y = 0;
 }
 
 //update an entity with a free movement control component 
@@ -103,24 +110,47 @@ void ControlSystem::updateFPS(float dt) {
 		camera.forward = R_pitch * camera.forward;
 	}
 
-	//fps control should have five ray colliders assigned
-	auto& colliders = ECS.getAllComponents<Collider>();
-	Collider& collider_down = colliders[FPS_collider_down];
-	Collider& collider_forward = colliders[FPS_collider_forward];
-	Collider& collider_left = colliders[FPS_collider_left];
-	Collider& collider_right = colliders[FPS_collider_right];
-	Collider& collider_back = colliders[FPS_collider_back];
+	//five rays from player, cast now against colliders: one down for ground, and
+	//one along each direction of movement, flat, for walls
+	lm::vec3 walk_forward(camera.forward.x, 0.0f, camera.forward.z);
+	lm::vec3 walk_right = camera.forward.cross(lm::vec3(0, 1, 0));
+	walk_right.y = 0.0f;
+	enum { RayDown, RayForward, RayBack, RayLeft, RayRight, NUM_RAYS };
+	lm::vec3 ray_directions[NUM_RAYS] = { lm::vec3(0, -1, 0), walk_forward, walk_forward * -1.0f, walk_right * -1.0f, walk_right };
+	QueryRay rays[NUM_RAYS];
+	RaycastHit hits[NUM_RAYS];
+	for (int i = 0; i < NUM_RAYS; i++) {
+		rays[i].origin = transform.position();
+		rays[i].direction = ray_directions[i];
+		rays[i].max_distance = i == RayDown ? FPS_ground_ray : FPS_wall_ray;
+	}
+	collision_system_->raycastBatch(rays, NUM_RAYS, hits);
+
+	//ground is highest of down ray hit, mesh triangles and terrain below player
+	bool on_ground = hits[RayDown].collider != -1;
+	lm::vec3 ground_point = hits[RayDown].point;
+	MeshHit mesh_hit;
+	float mesh_ray = on_ground ? hits[RayDown].distance : FPS_ground_ray;
+	if (collision_system_->raycastMeshes(transform.position(), lm::vec3(0, -1, 0), mesh_ray, mesh_hit)) {
+		on_ground = true;
+		ground_point = mesh_hit.point;
+	}
+	lm::vec3 terrain_point;
+	if (terrainGround_(transform.position(), terrain_point) && (!on_ground || terrain_point.y > ground_point.y)) {
+		on_ground = true;
+		ground_point = terrain_point;
+	}
 
 	//collisions and gravity
 	//player down ray is always colliding, we need to keep player at 'FPS_height' units above nearest collider
-	float dist_above_ground = (transform.position() - collider_down.collision_point).length();
+	float dist_above_ground = (transform.position() - ground_point).length();
 	//collision test # 1
-	if (collider_down.colliding && dist_above_ground < FPS_height + 0.01f) // if below or on ground
+	if (on_ground && dist_above_ground < FPS_height + 0.01f) // if below or on ground
 	{
 		//say we can jump
 		FPS_can_jump = true;
 		//force player to correct height above ground
-		transform.position(transform.position().x, collider_down.collision_point.y + FPS_height, transform.position().z);
+		transform.position(transform.position().x, ground_point.y + FPS_height, transform.position().z);
 	}
 	else { // we are in the air
 		if (FPS_jump_force > 0.0) {// slow down jump with time
@@ -134,11 +164,11 @@ void ControlSystem::updateFPS(float dt) {
 		transform.translate(0.0f, (FPS_jump_force - FPS_gravity)*dt, 0.0f);
 
 		//Collision test #2, as we might have moved down since test #1
-		dist_above_ground = (transform.position() - collider_down.collision_point).length();
-		if (collider_down.colliding && dist_above_ground < FPS_height + 0.01f) // if below or on ground
+		dist_above_ground = (transform.position() - ground_point).length();
+		if (on_ground && dist_above_ground < FPS_height + 0.01f) // if below or on ground
 		{
 			//force player to correct height
-			transform.position(transform.position().x, collider_down.collision_point.y + FPS_height, transform.position().z);
+			transform.position(transform.position().x, ground_point.y + FPS_height, transform.position().z);
 		}
 	}
 
@@ -162,13 +192,13 @@ void ControlSystem::updateFPS(float dt) {
 	forward_dir.y = 0.0;
 	strafe_dir.y = 0.0;
 	//now move
-	if (input[GLFW_KEY_W] == true && !collider_forward.colliding)
+	if (input[GLFW_KEY_W] == true && hits[RayForward].collider == -1)
 		transform.translate(forward_dir);
-	if (input[GLFW_KEY_S] == true && !collider_back.colliding)
+	if (input[GLFW_KEY_S] == true && hits[RayBack].collider == -1)
 		transform.translate(forward_dir * -1.0f);
-	if (input[GLFW_KEY_A] == true && !collider_left.colliding)
+	if (input[GLFW_KEY_A] == true && hits[RayLeft].collider == -1)
 		transform.translate(strafe_dir * -1.0f);
-	if (input[GLFW_KEY_D] == true && !collider_right.colliding)
+	if (input[GLFW_KEY_D] == true && hits[RayRight].collider == -1)
 		transform.translate(strafe_dir);
 
 	//update camera position
@@ -177,4 +207,20 @@ void ControlSystem::updateFPS(float dt) {
 	//check if switch to Debug cam
 	if (input[GLFW_KEY_O] == true) ECS.main_camera = 0; //debug cam is 0
 	if (input[GLFW_KEY_P] == true) ECS.main_camera = 1;
-}
\ No newline at end of file
+}
+
+//point on terrain directly below (or above) position, in world space
+//returns false if there is no terrain, or position is not over it
+bool ControlSystem::terrainGround_(const lm::vec3& position, lm::vec3& ground_point) {
+	if (!FPS_terrain || FPS_terrain_entity == -1) return false;
+
+	Transform& terrain_transform = ECS.getComponentFromEntity<Transform>(FPS_terrain_entity);
+	lm::mat4 model = terrain_transform.getGlobalMatrix(ECS.getAllComponents<Transform>());
+	lm::mat4 inv_model = model;
+	inv_model.inverse();
+
+	lm::vec3 local = inv_model * position;
+	if (!FPS_terrain->containsXZ(local.x, local.z)) return false;
+	ground_point = model * lm::vec3(local.x, FPS_terrain->heightAt(local.x, local.z), local.z);
+	return true;
+}
@@ -3,6 +3,9 @@
 #include "Components.h"
 #include <map>
 
+class Terrain;
+class CollisionSystem;
+
 //struct to store mouse state
 struct Mouse {
 	int x;
@@ -19,7 +22,8 @@ enum ControlType {
 //System which manages all our controls
 class ControlSystem {
 public:
-	void init();
+	//FPS control casts its rays against the collision system
+	void init(CollisionSystem* collision_system);
 	void update(float dt);
 
 	//functions called directly from main.cpp, via game
@@ -36,25 +40,27 @@ public:
 	Mouse mouse;
 
 	//FPS stuff
-	int FPS_collider_down;
-	int FPS_collider_left;
-	int FPS_collider_right;
-	int FPS_collider_forward;
-	int FPS_collider_back;
+	float FPS_ground_ray = 100.0f; //length of ray down for ground
+	float FPS_wall_ray = 1.0f; //length of rays along each direction of movement, which stop it
 	bool FPS_can_jump = true;
 	float FPS_jump_force = 0.0f;
 	float FPS_jump_initial_force = 12.0f;
 	float FPS_jump_force_slowdown = 7.0f;
 	float FPS_gravity = 9.8f;
 	float FPS_height = 2.0f;
+	//optional heightfield to walk on, queried directly rather than with down ray
+	Terrain* FPS_terrain = nullptr;
+	int FPS_terrain_entity = -1;
 
 private:
 	float move_speed_ = 20.0f;
 	float turn_speed_ = 2.3f;
+	CollisionSystem* collision_system_ = nullptr;
 
 	bool input[GLFW_KEY_LAST];
 
 	//function to update entity movement
 	void updateFree(float dt);
 	void updateFPS(float dt);
+	bool terrainGround_(const lm::vec3& position, lm::vec3& ground_point);
 };
@@ -0,0 +1,42 @@
+//
+//  FixedTimestep.h
+//
+//  Accumulates frame time and hands it out in steps of equal length, so the
+//  simulation advances the same way whatever the frame rate. What is left over
+//  after the last whole step is the fraction of a step the renderer blends
+//  towards, between the states before and after that step.
+//
+#pragma once
+#include <cmath>
+
+struct FixedTimestep {
+    //settings
+    float tick_rate = 60.0f; //steps per second
+    int max_steps = 5; //per frame; time beyond is dropped, so a slow frame cannot spiral
+    bool interpolate = true; //render between last two steps, else at last step
+
+    //last frame
+    int steps = 0;
+    float simulation_ms = 0.0f; //all steps of the frame
+    int dropped_steps = 0; //since start
+
+    float step() const { return 1.0f / tick_rate; }
+    //fraction of a step since the last one, 0 to 1
+    float alpha() const { return interpolate ? accumulator_ / step() : 1.0f; }
+
+    //adds frame time, returning how many steps to run now
+    int advance(float dt) {
+        float s = step();
+        accumulator_ += dt;
+        steps = (int)(accumulator_ / s);
+        if (steps > max_steps) {
+            dropped_steps += steps - max_steps;
+            steps = max_steps;
+        }
+        accumulator_ = std::fmod(accumulator_, s);
+        return steps;
+    }
+
+private:
+    float accumulator_ = 0.0f;
+};
@@ -8,6 +8,9 @@
 #include "Shader.h"
 #include "extern.h"
 #include "Parsers.h"
+#include <chrono>
+#include <cstring>
+#include <cmath>
 
 Game::Game() {
 
@@ -20,13 +23,15 @@ void Game::init(int w, int h) {
 	//******* INIT SYSTEMS *******
 
 	//init systems except debug, which needs info about scene
-	control_system_.init();
+	control_system_.init(&collision_system_);
 	graphics_system_.init(window_width_, window_height_, "data/assets/");
 	debug_system_.init(&graphics_system_);
-	tools_system_.init(&graphics_system_);
-	script_system_.init(&control_system_);
+	collision_system_.init(&graphics_system_);
+	tools_system_.init(&graphics_system_, &particle_system_, &collision_system_, &timestep);
+	script_system_.init(&control_system_, &collision_system_);
 	gui_system_.init(window_width_, window_height_);
     animation_system_.init();
+    particle_system_.init();
 
     graphics_system_.screen_background_color = lm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
     createFreeCamera_(41,16,25,-0.819, -0.179,-0.545);
@@ -88,7 +93,7 @@ void Game::init(int w, int h) {
 
 	/******** TERRAIN **********/
 	ImageData noise_image_data;
-	Shader* terrain_shader = graphics_system_.loadShader("data/shaders/phong.vert", "data/shaders/terrain.frag");
+	Shader* terrain_shader = graphics_system_.loadShader("data/shaders/terrain.vert", "data/shaders/terrain.frag");
 	float terrain_height = 30.0f;
 
 	int mat_terrain_index = graphics_system_.createMaterial();
@@ -106,7 +111,8 @@ void Game::init(int w, int h) {
 	int terrain_geometry = graphics_system_.createTerrainGeometry(500,
 		0.4f,
 		terrain_height,
-		noise_image_data);
+		noise_image_data,
+		true);
 	//delete noise_image data otherwise we might have a memory leak
 	delete noise_image_data.data;
 	int terrain_entity = ECS.createEntity("Terrain");
@@ -114,10 +120,14 @@ void Game::init(int w, int h) {
 	terrain_mesh.geometry = terrain_geometry;
 	terrain_mesh.material = mat_terrain_index;
 	terrain_mesh.render_mode = RenderModeForward;
+	//player walks on terrain heightfield
+	control_system_.FPS_terrain = graphics_system_.getTerrains()[graphics_system_.getGeometry(terrain_geometry).terrain];
+	control_system_.FPS_terrain_entity = terrain_entity;
 
 	/******** PARTICLES **********/
-    //particle_emitter_ = new ParticleEmitter();
-    //particle_emitter_->init();
+	int particles_entity = ECS.createEntity("Particles");
+	ParticleEmitter& emitter = ECS.createComponentForEntity<ParticleEmitter>(particles_entity);
+	emitter.num_particles = 1000;
 
 	/******** LIGHTS **********/
 	int ent_light_dir = ECS.createEntity("light_dir");
@@ -147,24 +157,27 @@ void Game::update(float dt) {
 
 	if (ECS.getAllComponents<Camera>().size() == 0) {print("There is no camera set!"); return;}
 
-	//update input
-	control_system_.update(dt);
-
-	//collision
-	collision_system_.update(dt);
-
-    //animation
-    animation_system_.update(dt);
-    
-	//scripts
-	script_system_.update(dt);
+	//simulation, in as many fixed steps as dt covers
+	int steps = timestep.advance(dt);
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < steps; i++) {
+		savePreviousState_();
+		fixedUpdate_(timestep.step());
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	timestep.simulation_ms = std::chrono::duration<float, std::milli>(end - start).count();
 
-	//render
+	//render, with transforms and cameras part way from last step to the next
+	blendState_(timestep.alpha());
 	graphics_system_.setEnvironmentVisibility(tools_system_.getEnvironmentState());
 	graphics_system_.update(dt);
     
-    //particles
-    //particle_emitter_->update();
+    //particles, blended with transparent surfaces in weighted oit mode
+    particle_system_.weighted_oit = graphics_system_.transparency_mode == TransparencyWeightedOIT;
+    particle_system_.update(dt);
+    graphics_system_.compositeTransparency();
+	//tools may edit transforms, so they see the simulated ones
+	restoreState_();
     
 	//gui
 	gui_system_.update(dt);
@@ -177,6 +190,85 @@ void Game::update(float dt) {
    
 }
 
+void Game::fixedUpdate_(float step) {
+	//update input
+	control_system_.update(step);
+
+	//collision
+	collision_system_.update(step);
+
+    //animation
+    animation_system_.update(step);
+    
+	//scripts
+	script_system_.update(step);
+}
+
+void Game::savePreviousState_() {
+	auto& transforms = ECS.getAllComponents<Transform>();
+	previous_transforms_.resize(transforms.size());
+	for (size_t i = 0; i < transforms.size(); i++)
+		previous_transforms_[i] = transforms[i];
+	auto& cameras = ECS.getAllComponents<Camera>();
+	previous_cameras_.resize(cameras.size() * 2);
+	for (size_t i = 0; i < cameras.size(); i++) {
+		previous_cameras_[i * 2] = cameras[i].position;
+		previous_cameras_[i * 2 + 1] = cameras[i].forward;
+	}
+}
+
+//translation and axes are each lerped, and axes scaled back to their lerped
+//length, which is close to a slerp for the rotation of one step
+static lm::mat4 blendMatrix_(const lm::mat4& a, const lm::mat4& b, float t) {
+	lm::mat4 r = b;
+	for (int c = 0; c < 4; c++) {
+		float la = 0.0f, lb = 0.0f, lr = 0.0f;
+		for (int k = 0; k < 3; k++) {
+			r.M[c][k] = a.M[c][k] + (b.M[c][k] - a.M[c][k]) * t;
+			la += a.M[c][k] * a.M[c][k];
+			lb += b.M[c][k] * b.M[c][k];
+			lr += r.M[c][k] * r.M[c][k];
+		}
+		if (c == 3 || lr < 1e-12f) continue;
+		float scale = (std::sqrt(la) + (std::sqrt(lb) - std::sqrt(la)) * t) / std::sqrt(lr);
+		for (int k = 0; k < 3; k++) r.M[c][k] *= scale;
+	}
+	return r;
+}
+
+//keeps current state, and replaces it by blend with previous. Anything created
+//since last step has no previous state, and stays as it is
+void Game::blendState_(float alpha) {
+	auto& transforms = ECS.getAllComponents<Transform>();
+	auto& cameras = ECS.getAllComponents<Camera>();
+	current_transforms_.resize(transforms.size());
+	current_cameras_.resize(cameras.size() * 2);
+	for (size_t i = 0; i < transforms.size(); i++) {
+		current_transforms_[i] = transforms[i];
+		if (i >= previous_transforms_.size() || alpha >= 1.0f) continue;
+		if (memcmp(&previous_transforms_[i], &current_transforms_[i], sizeof(lm::mat4)) == 0) continue;
+		transforms[i].set(blendMatrix_(previous_transforms_[i], current_transforms_[i], alpha));
+	}
+	for (size_t i = 0; i < cameras.size(); i++) {
+		current_cameras_[i * 2] = cameras[i].position;
+		current_cameras_[i * 2 + 1] = cameras[i].forward;
+		if (i * 2 >= previous_cameras_.size() || alpha >= 1.0f) continue;
+		cameras[i].position = previous_cameras_[i * 2] + (current_cameras_[i * 2] - previous_cameras_[i * 2]) * alpha;
+		cameras[i].forward = previous_cameras_[i * 2 + 1] + (current_cameras_[i * 2 + 1] - previous_cameras_[i * 2 + 1]) * alpha;
+	}
+}
+
+void Game::restoreState_() {
+	auto& transforms = ECS.getAllComponents<Transform>();
+	auto& cameras = ECS.getAllComponents<Camera>();
+	for (size_t i = 0; i < transforms.size() && i < current_transforms_.size(); i++)
+		transforms[i].set(current_transforms_[i]);
+	for (size_t i = 0; i < cameras.size() && i * 2 < current_cameras_.size(); i++) {
+		cameras[i].position = current_cameras_[i * 2];
+		cameras[i].forward = current_cameras_[i * 2 + 1];
+	}
+}
+
 //update game viewports
 void Game::update_viewports(int window_width, int window_height) {
 	
@@ -223,54 +315,7 @@ int Game::createPlayer_(float aspect, ControlSystem& sys) {
 	player_cam.forward = lm::vec3(0.0f, 0.0f, -1.0f);
 	player_cam.setPerspective(60.0f*DEG2RAD, aspect, 0.01f, 10000.0f);
 
-	//FPS colliders 
-	//each collider ray entity is parented to the playerFPS entity
-	int ent_down_ray = ECS.createEntity("Down Ray");
-	Transform& down_ray_trans = ECS.getComponentFromEntity<Transform>(ent_down_ray);
-	down_ray_trans.parent = ECS.getComponentID<Transform>(ent_player); //set parent as player entity *transform*!
-	Collider& down_ray_collider = ECS.createComponentForEntity<Collider>(ent_down_ray);
-	down_ray_collider.collider_type = ColliderTypeRay;
-	down_ray_collider.direction = lm::vec3(0.0, -1.0, 0.0);
-	down_ray_collider.max_distance = 100.0f;
-
-	int ent_left_ray = ECS.createEntity("Left Ray");
-	Transform& left_ray_trans = ECS.getComponentFromEntity<Transform>(ent_left_ray);
-	left_ray_trans.parent = ECS.getComponentID<Transform>(ent_player); //set parent as player entity *transform*!
-	Collider& left_ray_collider = ECS.createComponentForEntity<Collider>(ent_left_ray);
-	left_ray_collider.collider_type = ColliderTypeRay;
-	left_ray_collider.direction = lm::vec3(-1.0, 0.0, 0.0);
-	left_ray_collider.max_distance = 1.0f;
-
-	int ent_right_ray = ECS.createEntity("Right Ray");
-	Transform& right_ray_trans = ECS.getComponentFromEntity<Transform>(ent_right_ray);
-	right_ray_trans.parent = ECS.getComponentID<Transform>(ent_player); //set parent as player entity *transform*!
-	Collider& right_ray_collider = ECS.createComponentForEntity<Collider>(ent_right_ray);
-	right_ray_collider.collider_type = ColliderTypeRay;
-	right_ray_collider.direction = lm::vec3(1.0, 0.0, 0.0);
-	right_ray_collider.max_distance = 1.0f;
-
-	int ent_forward_ray = ECS.createEntity("Forward Ray");
-	Transform& forward_ray_trans = ECS.getComponentFromEntity<Transform>(ent_forward_ray);
-	forward_ray_trans.parent = ECS.getComponentID<Transform>(ent_player); //set parent as player entity *transform*!
-	Collider& forward_ray_collider = ECS.createComponentForEntity<Collider>(ent_forward_ray);
-	forward_ray_collider.collider_type = ColliderTypeRay;
-	forward_ray_collider.direction = lm::vec3(0.0, 0.0, -1.0);
-	forward_ray_collider.max_distance = 1.0f;
-
-	int ent_back_ray = ECS.createEntity("Back Ray");
-	Transform& back_ray_trans = ECS.getComponentFromEntity<Transform>(ent_back_ray);
-	back_ray_trans.parent = ECS.getComponentID<Transform>(ent_player); //set parent as player entity *transform*!
-	Collider& back_ray_collider = ECS.createComponentForEntity<Collider>(ent_back_ray);
-	back_ray_collider.collider_type = ColliderTypeRay;
-	back_ray_collider.direction = lm::vec3(0.0, 0.0, 1.0);
-	back_ray_collider.max_distance = 1.0f;
-
-	//the control system stores the FPS colliders 
-	sys.FPS_collider_down = ECS.getComponentID<Collider>(ent_down_ray);
-	sys.FPS_collider_left = ECS.getComponentID<Collider>(ent_left_ray);
-	sys.FPS_collider_right = ECS.getComponentID<Collider>(ent_right_ray);
-	sys.FPS_collider_forward = ECS.getComponentID<Collider>(ent_forward_ray);
-	sys.FPS_collider_back = ECS.getComponentID<Collider>(ent_back_ray);
+	//ground and wall rays are cast by the control system, see ControlSystem::updateFPS
 
 	ECS.main_camera = ECS.getComponentID<Camera>(ent_player);
 
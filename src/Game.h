@@ -13,9 +13,9 @@
 #include "ScriptSystem.h"
 #include "GUISystem.h"
 #include "AnimationSystem.h"
-//#include "ParticleSystem.h"
-#include "ParticleEmitter.h"
+#include "ParticleSystem.h"
 #include "ToolsSystem.h"
+#include "FixedTimestep.h"
 
 
 class Game
@@ -23,6 +23,7 @@ class Game
 public:
 	Game();
 	void init(int, int);
+	//runs simulation in fixed steps for time dt, then renders between last two
 	void update(float dt);
 
 	//pass input straight to input system, if we are not showing Debug GUI
@@ -54,6 +55,9 @@ public:
 
 	float current_fps;
 
+	//tick rate and step limit of simulation systems
+	FixedTimestep timestep;
+
 private:
 
 	GraphicsSystem graphics_system_;
@@ -63,11 +67,18 @@ private:
     ScriptSystem script_system_;
 	GUISystem gui_system_;
     AnimationSystem animation_system_;
-    //ParticleSystem particle_system_;
+    ParticleSystem particle_system_;
 	ToolsSystem tools_system_;
-    
-    //particles
-    ParticleEmitter* particle_emitter_;
+
+	//control, collision, animation and scripts, by one fixed step
+	void fixedUpdate_(float step);
+
+	//transforms and cameras before and after last step, blended for rendering
+	std::vector<lm::mat4> previous_transforms_, current_transforms_;
+	std::vector<lm::vec3> previous_cameras_, current_cameras_; //position then forward, per camera
+	void savePreviousState_();
+	void blendState_(float alpha);
+	void restoreState_();
 
 	int createFreeCamera_(float, float, float, float, float, float);
 	int createPlayer_(float aspect, ControlSystem& sys);
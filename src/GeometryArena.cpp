@@ -0,0 +1,231 @@
+//
+//  GeometryArena.cpp
+//
+
+#include "GeometryArena.h"
+#include <algorithm>
+
+GLuint GeometryArena::bound_vao_ = 0;
+
+static GeometryArena arenas_[GeometryArena::LAYOUT_COUNT];
+
+//returns arena for layout, creating its buffers on first use
+GeometryArena& GeometryArena::get(Layout layout) {
+    GeometryArena& arena = arenas_[layout];
+    if (!arena.vao_) arena.init_(layout);
+    return arena;
+}
+
+bool GeometryArena::exists(Layout layout) {
+    return arenas_[layout].vao_ != 0;
+}
+
+void GeometryArena::releaseAll() {
+    for (auto& arena : arenas_) {
+        if (!arena.vao_) continue;
+        glDeleteBuffers(1, &arena.vbo_);
+        glDeleteBuffers(1, &arena.ibo_);
+        glDeleteVertexArrays(1, &arena.vao_);
+        arena = GeometryArena();
+    }
+    bound_vao_ = 0;
+}
+
+void GeometryArena::init_(Layout layout) {
+    layout_ = layout;
+    stride_ = 3 * sizeof(float) + (layout == LayoutPackedHalfUV ? 2 * sizeof(GLushort) : 2 * sizeof(float)) + sizeof(GLuint);
+    glGenVertexArrays(1, &vao_);
+    rebuild_(65536, 512 * 1024);
+}
+
+//points attributes 0, 1, 2 at the packed layout of currently bound array buffer
+void GeometryArena::setVertexAttributes(Layout layout, size_t base_offset) {
+    GLsizei uv_bytes = layout == LayoutPackedHalfUV ? 2 * sizeof(GLushort) : 2 * sizeof(float);
+    GLsizei stride = 3 * sizeof(float) + uv_bytes + sizeof(GLuint);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)base_offset);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, layout == LayoutPackedHalfUV ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, stride,
+                          (void*)(base_offset + 12));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(base_offset + 12 + uv_bytes));
+}
+
+// Creates new buffers with the given capacity and copies every live allocation
+// to the front of them, in allocation order. This both grows the arena and
+// removes fragmentation, as all free space ends up in one range at the end.
+void GeometryArena::rebuild_(GLuint vertex_capacity, size_t index_capacity) {
+    GLuint new_vbo, new_ibo;
+    glGenBuffers(1, &new_vbo);
+    glGenBuffers(1, &new_ibo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, new_vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, (size_t)vertex_capacity * stride_, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, new_ibo);
+    glBufferData(GL_COPY_WRITE_BUFFER, index_capacity, NULL, GL_STATIC_DRAW);
+
+    GLuint next_vertex = 0;
+    size_t next_index = 0;
+    for (auto& a : allocations_) {
+        if (!a.live) continue;
+        if (vbo_) {
+            glBindBuffer(GL_COPY_READ_BUFFER, vbo_);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, new_vbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                (size_t)a.first_vertex * stride_, (size_t)next_vertex * stride_, (size_t)a.num_vertices * stride_);
+            glBindBuffer(GL_COPY_READ_BUFFER, ibo_);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, new_ibo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, a.index_offset, next_index, a.index_bytes);
+        }
+        a.first_vertex = next_vertex;
+        a.index_offset = next_index;
+        next_vertex += a.num_vertices;
+        next_index += (a.index_bytes + 3) & ~(size_t)3;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    if (vbo_) {
+        glDeleteBuffers(1, &vbo_);
+        glDeleteBuffers(1, &ibo_);
+        num_compactions++;
+    }
+    vbo_ = new_vbo;
+    ibo_ = new_ibo;
+    vertex_capacity_ = vertex_capacity;
+    index_capacity_ = index_capacity;
+
+    free_vertices_.clear();
+    free_indices_.clear();
+    if (next_vertex < vertex_capacity_)
+        free_vertices_.push_back({ next_vertex, vertex_capacity_ - next_vertex });
+    if (next_index < index_capacity_)
+        free_indices_.push_back({ next_index, index_capacity_ - next_index });
+
+    glBindVertexArray(vao_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    setVertexAttributes(layout_, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bound_vao_ = 0;
+}
+
+//first fit from sorted free list
+bool GeometryArena::allocateRange_(std::vector<FreeRange>& ranges, size_t size, size_t& offset) {
+    for (size_t i = 0; i < ranges.size(); i++) {
+        if (ranges[i].size < size) continue;
+        offset = ranges[i].offset;
+        ranges[i].offset += size;
+        ranges[i].size -= size;
+        if (ranges[i].size == 0)
+            ranges.erase(ranges.begin() + i);
+        return true;
+    }
+    return false;
+}
+
+//returns range to sorted free list, merging with neighbours
+void GeometryArena::freeRange_(std::vector<FreeRange>& ranges, size_t offset, size_t size) {
+    if (size == 0) return;
+    auto it = std::lower_bound(ranges.begin(), ranges.end(), offset,
+                               [](const FreeRange& r, size_t o) { return r.offset < o; });
+    it = ranges.insert(it, { offset, size });
+    size_t i = it - ranges.begin();
+    if (i + 1 < ranges.size() && ranges[i].offset + ranges[i].size == ranges[i + 1].offset) {
+        ranges[i].size += ranges[i + 1].size;
+        ranges.erase(ranges.begin() + i + 1);
+    }
+    if (i > 0 && ranges[i - 1].offset + ranges[i - 1].size == ranges[i].offset) {
+        ranges[i - 1].size += ranges[i].size;
+        ranges.erase(ranges.begin() + i);
+    }
+}
+
+int GeometryArena::allocate(const void* vertex_data, GLuint num_vertices, const void* index_data, size_t index_bytes) {
+    size_t aligned_index_bytes = (index_bytes + 3) & ~(size_t)3; //keep every range 4 byte aligned
+    size_t first_vertex = 0, index_offset = 0;
+
+    bool fits = allocateRange_(free_vertices_, num_vertices, first_vertex);
+    if (fits && !allocateRange_(free_indices_, aligned_index_bytes, index_offset)) {
+        freeRange_(free_vertices_, first_vertex, num_vertices);
+        fits = false;
+    }
+
+    if (!fits) {
+        //compact, and grow whichever buffer can't hold the live data plus this request
+        GLuint vertex_capacity = vertex_capacity_;
+        size_t index_capacity = index_capacity_;
+        size_t used_vertices = used_vertex_bytes / stride_;
+        while (used_vertices + num_vertices > vertex_capacity) vertex_capacity *= 2;
+        while (used_index_bytes + aligned_index_bytes > index_capacity) index_capacity *= 2;
+        rebuild_(vertex_capacity, index_capacity);
+        allocateRange_(free_vertices_, num_vertices, first_vertex);
+        allocateRange_(free_indices_, aligned_index_bytes, index_offset);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbo_);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, first_vertex * stride_, (size_t)num_vertices * stride_, vertex_data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ibo_);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, index_offset, index_bytes, index_data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    int id;
+    if (!free_allocation_ids_.empty()) {
+        id = free_allocation_ids_.back();
+        free_allocation_ids_.pop_back();
+    }
+    else {
+        allocations_.emplace_back();
+        id = (int)allocations_.size() - 1;
+    }
+    ArenaAllocation& a = allocations_[id];
+    a.first_vertex = (GLuint)first_vertex;
+    a.num_vertices = num_vertices;
+    a.index_offset = index_offset;
+    a.index_bytes = index_bytes;
+    a.live = true;
+
+    used_vertex_bytes += (size_t)num_vertices * stride_;
+    used_index_bytes += aligned_index_bytes;
+    return id;
+}
+
+void GeometryArena::free(int id) {
+    ArenaAllocation& a = allocations_[id];
+    if (!a.live) return;
+    size_t aligned_index_bytes = (a.index_bytes + 3) & ~(size_t)3;
+    freeRange_(free_vertices_, a.first_vertex, a.num_vertices);
+    freeRange_(free_indices_, a.index_offset, aligned_index_bytes);
+    used_vertex_bytes -= (size_t)a.num_vertices * stride_;
+    used_index_bytes -= aligned_index_bytes;
+    a.live = false;
+    free_allocation_ids_.push_back(id);
+}
+
+void GeometryArena::bind() {
+    if (bound_vao_ != vao_) {
+        glBindVertexArray(vao_);
+        bound_vao_ = vao_;
+    }
+}
+
+//draws count indices starting at first_index, relative to allocation
+void GeometryArena::draw(int id, GLsizei count, GLenum index_type, size_t first_index) {
+    const ArenaAllocation& a = allocations_[id];
+    size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    bind();
+    glDrawElementsBaseVertex(GL_TRIANGLES, count, index_type,
+                             (void*)(a.index_offset + first_index * index_size), (GLint)a.first_vertex);
+}
+
+//several ranges of one allocation in a single call
+void GeometryArena::multiDraw(int id, GLsizei* counts, GLenum index_type, const size_t* first_indices, GLsizei draw_count) {
+    const ArenaAllocation& a = allocations_[id];
+    size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    std::vector<void*> offsets(draw_count);
+    std::vector<GLint> base_vertices(draw_count, (GLint)a.first_vertex);
+    for (GLsizei i = 0; i < draw_count; i++)
+        offsets[i] = (void*)(a.index_offset + first_indices[i] * index_size);
+    bind();
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts, index_type, &(offsets[0]), draw_count, &(base_vertices[0]));
+}
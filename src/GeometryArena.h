@@ -0,0 +1,85 @@
+//
+//  GeometryArena.h
+//
+//  Shared vertex and index buffers for static geometry of one vertex layout.
+//  Geometries sub-allocate a range of vertices and a range of index bytes,
+//  and are drawn with glDrawElementsBaseVertex under a single VAO, so that
+//  switching between meshes does not need a VAO change. Freed ranges return
+//  to a free list; when a request does not fit, the arena compacts all live
+//  ranges to the front of fresh buffers, growing them if needed.
+//
+#pragma once
+#include "includes.h"
+#include <vector>
+
+//range of an arena allocation
+struct ArenaAllocation {
+    GLuint first_vertex = 0; //base vertex
+    GLuint num_vertices = 0;
+    size_t index_offset = 0; //bytes into index buffer
+    size_t index_bytes = 0;
+    bool live = false;
+};
+
+class GeometryArena {
+public:
+    //packed layouts of Geometry, which differ only in the uv format
+    enum Layout {
+        LayoutPackedHalfUV, //position 3 floats, uv 2 halfs, normal 2_10_10_10
+        LayoutPackedFloatUV, //position 3 floats, uv 2 floats, normal 2_10_10_10
+        LAYOUT_COUNT
+    };
+    static GeometryArena& get(Layout layout);
+    static bool exists(Layout layout); //whether get has created arena
+    static void releaseAll(); //deletes GL objects of all arenas, call while context is alive
+
+    //points attributes 0, 1, 2 at layout in currently bound array buffer, from byte offset
+    static void setVertexAttributes(Layout layout, size_t base_offset);
+
+    //forget which vao is bound, call after code outside the arena binds vertex arrays
+    static void invalidateBinding() { bound_vao_ = 0; }
+
+    //copies vertex data (num_vertices * stride bytes) and index data into arena
+    //returns allocation id
+    int allocate(const void* vertex_data, GLuint num_vertices, const void* index_data, size_t index_bytes);
+    void free(int allocation);
+    const ArenaAllocation& allocation(int id) const { return allocations_[id]; }
+
+    //draw helpers - bind the arena vao only if it is not bound already
+    void bind();
+    void draw(int allocation, GLsizei count, GLenum index_type, size_t first_index);
+    void multiDraw(int allocation, GLsizei* counts, GLenum index_type, const size_t* first_indices, GLsizei draw_count);
+
+    GLuint vertexBuffer() const { return vbo_; }
+    GLuint indexBuffer() const { return ibo_; }
+    GLsizei stride() const { return stride_; }
+    Layout layout() const { return layout_; }
+
+    //stats
+    size_t vertex_capacity_bytes() const { return (size_t)vertex_capacity_ * stride_; }
+    size_t index_capacity_bytes() const { return index_capacity_; }
+    size_t used_vertex_bytes = 0;
+    size_t used_index_bytes = 0;
+    int num_compactions = 0;
+
+private:
+    Layout layout_ = LayoutPackedHalfUV;
+    GLsizei stride_ = 20;
+    GLuint vao_ = 0;
+    GLuint vbo_ = 0;
+    GLuint ibo_ = 0;
+    GLuint vertex_capacity_ = 0; //in vertices
+    size_t index_capacity_ = 0; //in bytes
+    static GLuint bound_vao_;
+
+    struct FreeRange { size_t offset, size; };
+    std::vector<FreeRange> free_vertices_; //sorted by offset, in vertices
+    std::vector<FreeRange> free_indices_; //sorted by offset, in bytes
+    std::vector<ArenaAllocation> allocations_;
+    std::vector<int> free_allocation_ids_;
+
+    void init_(Layout layout);
+    void rebuild_(GLuint vertex_capacity, size_t index_capacity);
+    static bool allocateRange_(std::vector<FreeRange>& ranges, size_t size, size_t& offset);
+    static void freeRange_(std::vector<FreeRange>& ranges, size_t offset, size_t size);
+};
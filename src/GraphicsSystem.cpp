@@ -4,7 +4,13 @@
 #include "GraphicsSystem.h"
 #include "Parsers.h"
 #include "extern.h"
+#include "GeometryArena.h"
+#include "Texture.h"
+#include "ResourceCache.h"
+#include "MeshCache.h"
+#include "ObjParser.h"
 #include <algorithm>
+#include <chrono>
 
 //destructor
 GraphicsSystem::~GraphicsSystem() {
@@ -13,6 +19,13 @@ GraphicsSystem::~GraphicsSystem() {
 		if (shader_pair.second)
 			delete shader_pair.second;
 	}
+	for (auto terrain : terrains_)
+		delete terrain;
+	//shared geometry buffers
+	GeometryArena::releaseAll();
+	//shared textures, and texture upload staging buffers
+	ResourceCache::releaseAll();
+	Texture::releaseStreaming();
 }
 
 //set initial state of graphics system
@@ -52,12 +65,16 @@ void GraphicsSystem::init(int window_width, int window_height, std::string asset
 
     //screen space texture shader
     screen_space_shader_ = new Shader("data/shaders/screen.vert", "data/shaders/screen.frag");
+
+    //blends weighted oit accumulation over screen
+    oit_composite_shader_ = new Shader("data/shaders/screen.vert", "data/shaders/oit_composite.frag");
     
 	//screen space depth shader
 	screen_depth_shader_ = new Shader("data/shaders/screen.vert", "data/shaders/screen_depth.frag");
 
 	//shadow map shader
 	depth_shader_ = new Shader("data/shaders/depth.vert", "data/shaders/depth.frag");
+	terrain_depth_shader_ = new Shader("data/shaders/terrain_depth.vert", "data/shaders/depth.frag");
 
     //gbuffer stuff
     gbuffer_shader_ = new Shader("data/shaders/gbuffer.vert", "data/shaders/gbuffer.frag");
@@ -73,6 +90,21 @@ void GraphicsSystem::lateInit() {
 	// sort meshes initially
     sortMeshes_();
 
+    //compile every shader variant used by the scene now rather than on first draw
+    auto warmVariants = [this](Mesh& mesh) {
+        Shader* base = mesh.render_mode == RenderModeDeferred ? gbuffer_shader_ : shaders_[materials_[mesh.material].shader_id];
+        getShaderVariant_(base, materials_[mesh.material]);
+        for (int id : geometries_[mesh.geometry].material_set_ids)
+            getShaderVariant_(base, materials_[id]);
+    };
+    for (auto& mesh : ECS.getAllComponents<Mesh>()) warmVariants(mesh);
+    for (auto& mesh : ECS.getAllComponents<SkinnedMesh>()) warmVariants(mesh);
+
+    //wait for all programs, which the driver may have been compiling in parallel
+    Shader::finishAll();
+    std::cout << "Shaders: " << Shader::stats.programs << " programs (" << Shader::stats.cache_hits
+              << " from cache) in " << Shader::stats.build_ms + Shader::stats.finish_ms << " ms" << std::endl;
+
 	//create shadow buffers depending on number of lights
 	for (size_t i = 0; i < ECS.getAllComponents<Light>().size(); i++) {
 		shadow_frame_[i].initDepth(2048, 2048);
@@ -84,8 +116,19 @@ void GraphicsSystem::update(float dt) {
     
 	updateAllCameras_();
 
+	//upload textures loaded in background since last frame, within budget
+	Texture::updateStreaming();
+	updateMemory_();
+
+	//other systems (debug, gui) bind their own vertex arrays between frames
+	GeometryArena::invalidateBinding();
+
 	if (needUpdateLights)
 		updateLights_();
+
+	//terrain draw stats add up over shadow and camera passes
+	for (auto terrain : terrains_)
+		terrain->resetStats();
     
 	/* SHADOW PASS FOR ALL LIGHTS */
 	glCullFace(GL_FRONT);
@@ -121,12 +164,14 @@ void GraphicsSystem::update(float dt) {
     /* FORWARD RENDERING */
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_BLEND);
+    defer_transparent_ = true;
     for (auto &mesh : ECS.getAllComponents<Mesh>()) {
         if (mesh.render_mode != RenderModeForward)
             continue;
         checkShaderAndMaterial_(mesh);
         renderMeshComponent_(mesh);
     }
+    defer_transparent_ = false;
     
     auto& skinnedmesh_components = ECS.getAllComponents<SkinnedMesh>();
     for (auto &skinnedmesh : skinnedmesh_components) {
@@ -137,6 +182,9 @@ void GraphicsSystem::update(float dt) {
     /* ENVIRONMENT */
 	if(environmentVisible)
 		renderEnvironment_();
+
+    /* TRANSPARENT, BACK TO FRONT */
+    renderTransparent_();
     
 	/* VIEW FRAMES */
     //previewTextureViewport(gbuffer_.color_textures[2]);
@@ -292,10 +340,26 @@ void GraphicsSystem::renderDepth_(Mesh& comp, const Light& light) {
 	Transform& transform = ECS.getComponentFromEntity<Transform>(comp.owner);
 	lm::mat4 model_matrix = transform.getGlobalMatrix(ECS.getAllComponents<Transform>());
 	lm::mat4 mvp_matrix = light.view_projection * model_matrix;
+	Geometry& geom = geometries_[comp.geometry];
+	//vertex texture terrain needs its own depth shader
+	if (geom.terrain != -1 && terrains_[geom.terrain]->vertex_texture) {
+		useShader(terrain_depth_shader_);
+		terrain_depth_shader_->setUniform(U_MVP, mvp_matrix);
+		terrains_[geom.terrain]->setUniforms(terrain_depth_shader_);
+		terrains_[geom.terrain]->render(mvp_matrix);
+		GeometryArena::invalidateBinding();
+		useShader(depth_shader_);
+		return;
+	}
 	//set sole uniform
 	depth_shader_->setUniform(U_MVP, mvp_matrix);
 	//render
-	geometries_[comp.geometry].render();
+	if (geom.terrain != -1) {
+		terrains_[geom.terrain]->render(mvp_matrix);
+		GeometryArena::invalidateBinding();
+	}
+	else
+		geom.render();
 
 }
 
@@ -316,48 +380,181 @@ void GraphicsSystem::renderMeshComponent_(Mesh& comp) {
 		return;
 	}
 
+	//queue transparent sets with the view depth of their center
+	if (defer_transparent_ && geom.terrain == -1) {
+		auto queue = [&](int set, const lm::vec3& center) {
+			lm::vec3 view_center = cam.view_matrix * (model_matrix * center);
+			transparent_items_.push_back({ &comp, set });
+			//view space z is more negative further away, so ascending z is back to front
+			transparent_keys_.push_back(RadixSort::floatKey(view_center.z));
+		};
+		if (geom.material_sets.size() == 0) {
+			if (materials_[comp.material].transparency_map != -1) {
+				queue(-1, geom.aabb.center);
+				return;
+			}
+		}
+		else {
+			for (int i = 0; i < (int)geom.material_sets.size(); i++)
+				if (materials_[geom.material_set_ids[i]].transparency_map != -1)
+					queue(i, i < (int)geom.material_set_centers.size() ? geom.material_set_centers[i] : geom.aabb.center);
+		}
+	}
+
 	//normal matrix
 	lm::mat4 normal_matrix = model_matrix;
 	normal_matrix.inverse();
 	normal_matrix.transpose();
 
-	//transform uniforms
-	shader_->setUniform(U_MVP, mvp_matrix);
-	shader_->setUniform(U_MODEL, model_matrix);
-	shader_->setUniform(U_NORMAL_MATRIX, normal_matrix);
-	shader_->setUniform(U_CAM_POS, cam.position);
-    
-    //blend shapes
-    if (ECS.hasComponent<BlendShapes>(comp.owner)) {
-        BlendShapes& bs = ECS.getComponentFromEntity<BlendShapes>(comp.owner);
-        shader_->setUniformFloatArray(U_BLEND_WEIGHTS, &(bs.blend_weights[0]), (int)bs.blend_weights.size());
-    }
+	//per object uniforms, set again if a material set binds another shader variant
+	auto setObjectUniforms = [&]() {
+		//transform uniforms
+		shader_->setUniform(U_MVP, mvp_matrix);
+		shader_->setUniform(U_MODEL, model_matrix);
+		shader_->setUniform(U_NORMAL_MATRIX, normal_matrix);
+		shader_->setUniform(U_CAM_POS, cam.position);
+
+		//blend shapes
+		if (ECS.hasComponent<BlendShapes>(comp.owner)) {
+			BlendShapes& bs = ECS.getComponentFromEntity<BlendShapes>(comp.owner);
+			shader_->setUniformFloatArray(U_BLEND_WEIGHTS, &(bs.blend_weights[0]), (int)bs.blend_weights.size());
+		}
 
+		//skinning
+		if (current_skin_)
+			setSkinUniforms_(*current_skin_);
+	};
+	setObjectUniforms();
+
+    //chunked terrain streams and selects lods from camera position in its local space
+    if (geom.terrain != -1) {
+        Terrain* terrain = terrains_[geom.terrain];
+        lm::mat4 inv_model = model_matrix;
+        inv_model.inverse();
+        terrain->update(inv_model * cam.position);
+        terrain->setUniforms(shader_);
+        terrain->render(mvp_matrix);
+        GeometryArena::invalidateBinding();
+    }
     //draw raw geom if no material sets
-    if (geom.material_sets.size() == 0)
+    else if (geom.material_sets.size() == 0 || item_set_ == -1)
         geom.render();
     else {
-        //loop material sets - first non-transparent
-        for (int i = 0; i < geom.material_sets.size(); i++) {
-            if (materials_[geom.material_set_ids[i]].transparency_map != -1) // skip transparent
-                continue;
-            //set current material id of set
-            current_material_ = geom.material_set_ids[i];
-            setMaterialUniforms();
-            //render current set
-            geom.render(i);
+        //group sets by material - first non-transparent, then transparent - so each
+        //material is set once and its sets go out in a single multi-draw.
+        //A queued transparent set is drawn on its own
+        std::vector<int>& groups = material_groups_;
+        groups.clear();
+        if (item_set_ >= 0) groups.push_back(item_set_);
+        for (int pass = 0; pass < 2 && item_set_ < 0; pass++) {
+            size_t pass_start = groups.size();
+            for (int i = 0; i < geom.material_sets.size(); i++) {
+                bool transparent = materials_[geom.material_set_ids[i]].transparency_map != -1;
+                if (transparent != (pass == 1)) continue;
+                if (transparent && defer_transparent_) continue;
+                groups.push_back(i);
+            }
+            //stable, so sets keep their original order within a material
+            std::stable_sort(groups.begin() + pass_start, groups.end(), [&geom](int a, int b) {
+                return geom.material_set_ids[a] < geom.material_set_ids[b];
+            });
         }
-        //loop material sets - now transparent
-        for (int i = 0; i < geom.material_sets.size(); i++) {
-            if (materials_[geom.material_set_ids[i]].transparency_map == -1) // skip non-transparent
-                continue;
-            current_material_ = geom.material_set_ids[i];
-            setMaterialUniforms();
-            geom.render(i);
+        std::vector<int>& batch = material_batch_;
+        for (size_t i = 0; i < groups.size(); ) {
+            //bind variant and uniforms of group's material
+            if (useMaterial_(pass_shader_, geom.material_set_ids[groups[i]]))
+                setObjectUniforms();
+            batch.clear();
+            while (i < groups.size() && geom.material_set_ids[groups[i]] == current_material_)
+                batch.push_back(groups[i++]);
+            //render all sets of material
+            geom.renderSets(batch);
         }
     }
 }
 
+//draws queued transparent sets, farthest first, or into weighted oit targets
+//in any order
+void GraphicsSystem::renderTransparent_() {
+    int count = (int)transparent_items_.size();
+    bool weighted = transparency_mode == TransparencyWeightedOIT;
+    transparent_order_.resize(count);
+    for (int i = 0; i < count; i++) transparent_order_[i] = i;
+    if (count && !weighted) transparent_sort_.sort(&transparent_keys_[0], &transparent_order_[0], count);
+    num_transparent_items = count;
+    transparent_sort_ms = count && !weighted ? transparent_sort_.last_ms : 0.0f;
+
+    if (weighted) {
+        beginWeightedOIT_();
+    }
+    else {
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glEnable(GL_BLEND);
+    }
+    for (int i = 0; i < count; i++) {
+        TransparentItem& item = transparent_items_[transparent_order_[i]];
+        checkShaderAndMaterial_(*item.mesh);
+        item_set_ = item.set;
+        renderMeshComponent_(*item.mesh);
+    }
+    item_set_ = -2;
+    pass_keywords_ = 0;
+    transparent_items_.clear();
+    transparent_keys_.clear();
+}
+
+//binds accumulation targets, with depth of opaque pass to test against, and
+//blending which adds colour and weight and multiplies revealage. GL 3.3 has one
+//blend function for all targets, so weights go in red of the second target
+void GraphicsSystem::beginWeightedOIT_() {
+    //made at viewport size, and again when updateMainViewport resizes it
+    if (oit_frame_.framebuffer != (GLuint)-1 &&
+        (oit_frame_.width != (GLuint)viewport_width_ || oit_frame_.height != (GLuint)viewport_height_))
+        oit_frame_.release();
+    if (oit_frame_.framebuffer == (GLuint)-1)
+        oit_frame_.initWeightedOIT(viewport_width_, viewport_height_);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oit_frame_.framebuffer);
+    glBlitFramebuffer(0, 0, viewport_width_, viewport_height_, 0, 0, oit_frame_.width, oit_frame_.height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, oit_frame_.framebuffer);
+    glViewport(0, 0, oit_frame_.width, oit_frame_.height);
+
+    //revealage starts at 1, nothing covering the background
+    const GLfloat clear_accum[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    const GLfloat clear_weight[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glClearBufferfv(GL_COLOR, 0, clear_accum);
+    glClearBufferfv(GL_COLOR, 1, clear_weight);
+
+    glEnable(GL_BLEND);
+    glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+    pass_keywords_ = 1 << KEYWORD_WEIGHTED_OIT;
+    oit_open_ = true;
+}
+
+void GraphicsSystem::compositeTransparency() {
+    if (!oit_open_) return;
+    oit_open_ = false;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, viewport_width_, viewport_height_);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+
+    resetShaderAndMaterial_();
+    useShader(oit_composite_shader_);
+    shader_->setTexture(U_OIT_ACCUM, oit_frame_.color_textures[0], 0);
+    shader_->setTexture(U_OIT_WEIGHT, oit_frame_.color_textures[1], 1);
+    geometries_[screen_space_geom_].render();
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_DEPTH_TEST);
+    resetShaderAndMaterial_();
+}
+
 void GraphicsSystem::getJointMatrices(Joint* current,
                       lm::mat4 current_model,
                       std::vector<float>& pos_matrices,
@@ -380,27 +577,32 @@ void GraphicsSystem::getJointMatrices(Joint* current,
 
 void GraphicsSystem::renderSkinnedMeshComponent_(SkinnedMesh& comp) {
     
-    //set joint bind poses
+    //create float vector and fill it with matrices for each joint
+    joint_pos_matrices_.assign(comp.num_joints * 16, 0.0f);
+    joint_bind_matrices_.assign(comp.num_joints * 16, 0.0f);
+    
+    int joint_counter = 0;
+    getJointMatrices(comp.root, lm::mat4(), joint_pos_matrices_, joint_bind_matrices_, joint_counter);
+    
+    //joints are sent with the other per object uniforms
+    current_skin_ = &comp;
+    renderMeshComponent_(comp);
+    current_skin_ = nullptr;
+}
+
+//sends joint matrices of skin to current shader
+void GraphicsSystem::setSkinUniforms_(SkinnedMesh& comp) {
     Camera& cam = ECS.getComponentInArray<Camera>(ECS.main_camera);
     
     GLint u_joint_pos_matrices = glGetUniformLocation(shader_->program, "u_joint_pos_matrices");
     GLint u_joint_bind_matrices = glGetUniformLocation(shader_->program, "u_joint_bind_matrices");
     
-    //create float vector and fill it with matrices for each joint
-    std::vector<float> p_m(comp.num_joints * 16, 0);
-    std::vector<float> b_m(comp.num_joints * 16, 0);
-    
-    int joint_counter = 0;
-    getJointMatrices(comp.root, lm::mat4(), p_m, b_m, joint_counter);
-    
     //send to shader
-    glUniformMatrix4fv(u_joint_pos_matrices, comp.num_joints, GL_FALSE, &p_m[0]);
-    glUniformMatrix4fv(u_joint_bind_matrices, comp.num_joints, GL_FALSE, &b_m[0]);
+    glUniformMatrix4fv(u_joint_pos_matrices, comp.num_joints, GL_FALSE, &joint_pos_matrices_[0]);
+    glUniformMatrix4fv(u_joint_bind_matrices, comp.num_joints, GL_FALSE, &joint_bind_matrices_[0]);
     
     shader_->setUniform(U_SKIN_BIND_MATRIX, comp.skin_bind_matrix);
     shader_->setUniform(U_VP, cam.view_projection);
-    
-    renderMeshComponent_(comp);
 }
 
 //render the skybox as a cubemap
@@ -445,23 +647,65 @@ void GraphicsSystem::renderEnvironment_() {
 //the ones need for mesh passed as parameter
 //if not, change them
 void GraphicsSystem::checkShaderAndMaterial_(Mesh& mesh) {
-    //get shader id from material. if same, don't change
-    if (!shader_ || shader_->program != materials_[mesh.material].shader_id) {
-		useShader(materials_[mesh.material].shader_id);
-    }
-    //set material uniforms if required
-    if (current_material_ != mesh.material) {
-        current_material_ = mesh.material;
-        setMaterialUniforms();
-    }
+    //base shader from material, the variant bound depends on the material's maps
+    pass_shader_ = shaders_[materials_[mesh.material].shader_id];
+    useMaterial_(pass_shader_, mesh.material);
 }
 
+//as above, but with the shader of the current pass, e.g. gbuffer
 void GraphicsSystem::checkMaterial_(Mesh& mesh) {
-    //set material uniforms if required
-    if (current_material_ != mesh.material) {
-        current_material_ = mesh.material;
+    pass_shader_ = gbuffer_shader_;
+    useMaterial_(pass_shader_, mesh.material);
+}
+
+//binds variant of base shader for material, and sets material uniforms if either
+//material or program changed. Returns true if program changed, in which case
+//per object uniforms must be set again
+bool GraphicsSystem::useMaterial_(Shader* base, int material) {
+    Shader* variant = getShaderVariant_(base, materials_[material]);
+    bool program_changed = shader_ != variant;
+    useShader(variant);
+    if (program_changed || current_material_ != material) {
+        current_material_ = material;
         setMaterialUniforms();
     }
+    return program_changed;
+}
+
+//keywords of the maps a material uses
+GLuint GraphicsSystem::materialKeywords_(const Material& mat) {
+    GLuint keys = 0;
+    if (mat.diffuse_map != -1) keys |= 1 << KEYWORD_DIFFUSE_MAP;
+    if (mat.diffuse_map_2 != -1) keys |= 1 << KEYWORD_DIFFUSE_MAP_2;
+    if (mat.diffuse_map_3 != -1) keys |= 1 << KEYWORD_DIFFUSE_MAP_3;
+    if (mat.normal_map != -1) keys |= 1 << KEYWORD_NORMAL_MAP;
+    if (mat.specular_map != -1) keys |= 1 << KEYWORD_SPECULAR_MAP;
+    if (mat.cube_map != -1) keys |= 1 << KEYWORD_REFLECTION_MAP;
+    if (mat.noise_map != -1) keys |= 1 << KEYWORD_NOISE_MAP;
+    if (mat.transparency_map != -1) keys |= 1 << KEYWORD_TRANSPARENCY_MAP;
+    return keys;
+}
+
+//returns program of base shader specialised for material, compiling it on first use.
+//Keywords the shader source doesn't mention are ignored, so materials which only
+//differ in unused maps share a program
+Shader* GraphicsSystem::getShaderVariant_(Shader* base, const Material& mat) {
+    if (!base || base->vertex_path.empty()) return base; //compiled from strings
+    GLuint keys = (materialKeywords_(mat) | pass_keywords_) & base->keyword_mask;
+    if (keys == base->keys) return base;
+
+    uint64_t variant_id = ((uint64_t)base->program << 32) | keys;
+    auto it = shader_variants_.find(variant_id);
+    if (it != shader_variants_.end())
+        return it->second;
+
+    Shader* variant = new Shader(base->vertex_path, base->fragment_path, keys, base->defines);
+    variant->name = base->name;
+    for (int k = 0; k < KEYWORDS_COUNT; k++)
+        if (keys & (1 << k)) variant->name += std::string(" ") + shader_keyword_names_[k];
+    shaders_[variant->program] = variant; //owned by shaders_
+    shader_variants_[variant_id] = variant;
+    return variant;
 }
 
 //sets uniforms for current material and current shader
@@ -469,74 +713,57 @@ void GraphicsSystem::setMaterialUniforms() {
     Material& mat = materials_[current_material_];
 
     //material uniforms
-	shader_->setUniform(U_AMBIENT, mat.ambient);
-	shader_->setUniform(U_DIFFUSE, mat.diffuse);
-	shader_->setUniform(U_SPECULAR, mat.specular);
-	shader_->setUniform(U_SPECULAR_GLOSS, mat.specular_gloss);
+    shader_->setUniform(U_AMBIENT, mat.ambient);
+    shader_->setUniform(U_DIFFUSE, mat.diffuse);
+    shader_->setUniform(U_SPECULAR, mat.specular);
+    shader_->setUniform(U_SPECULAR_GLOSS, mat.specular_gloss);
     shader_->setUniform(U_UV_SCALE, mat.uv_scale);
     shader_->setUniform(U_NORMAL_FACTOR, mat.normal_factor);
     shader_->setUniform(U_MAX_HEIGHT, mat.height);
-    
-    //texture uniforms - diffuse
-    if (mat.diffuse_map != -1){
-        shader_->setUniform(U_USE_DIFFUSE_MAP, 1);
+
+    //mark maps as used this frame, for texture residency
+    for (int map : { mat.diffuse_map, mat.diffuse_map_2, mat.diffuse_map_3, mat.normal_map, mat.specular_map, mat.transparency_map })
+        if (map != -1) Texture::touch(map);
+
+    //texture uniforms - whether a map is used is compiled into the shader variant
+    if (mat.diffuse_map != -1)
         shader_->setTexture(U_DIFFUSE_MAP, mat.diffuse_map, 8);
-    } else shader_->setUniform(U_USE_DIFFUSE_MAP, 0);
-    
     //add extra diffuse maps
-    if (mat.diffuse_map_2 != -1) {
-        shader_->setUniform(U_USE_DIFFUSE_MAP_2, 1);
+    if (mat.diffuse_map_2 != -1)
         shader_->setTexture(U_DIFFUSE_MAP_2, mat.diffuse_map_2, 9);
-    }
-    else shader_->setUniform(U_USE_DIFFUSE_MAP_2, 0);
-    if (mat.diffuse_map_3 != -1) {
-        shader_->setUniform(U_USE_DIFFUSE_MAP_3, 1);
+    if (mat.diffuse_map_3 != -1)
         shader_->setTexture(U_DIFFUSE_MAP_3, mat.diffuse_map_3, 10);
-    }
-    else shader_->setUniform(U_USE_DIFFUSE_MAP_3, 0);
     //normal
-    if (mat.normal_map != -1) {
-        shader_->setUniform(U_USE_NORMAL_MAP, 1);
+    if (mat.normal_map != -1)
         shader_->setTexture(U_NORMAL_MAP, mat.normal_map, 11);
-    } else shader_->setUniform(U_USE_NORMAL_MAP, 0);
     //specular
-    if (mat.specular_map != -1) {
-        shader_->setUniform(U_USE_SPECULAR_MAP, 1);
+    if (mat.specular_map != -1)
         shader_->setTexture(U_SPECULAR_MAP, mat.specular_map, 12);
-    } else shader_->setUniform(U_USE_SPECULAR_MAP, 0);
     //reflection
-    if (mat.cube_map) {
-        shader_->setUniform(U_USE_REFLECTION_MAP, 1);
+    if (mat.cube_map != -1)
         shader_->setTextureCube(U_SKYBOX, mat.cube_map, 13);
-    } else shader_->setUniform(U_USE_REFLECTION_MAP, 0);
     //noise map
-    if (mat.noise_map != -1) {
-        shader_->setUniform(U_USE_NOISE_MAP, 1);
+    if (mat.noise_map != -1)
         shader_->setTexture(U_NOISE_MAP, mat.noise_map, 14);
-    }
-    else shader_->setUniform(U_USE_NOISE_MAP, 0);
-    //noise map
-    if (mat.transparency_map != -1) {
-        shader_->setUniform(U_USE_TRANSPARENCY_MAP, 1);
+    //transparency map
+    if (mat.transparency_map != -1)
         shader_->setTexture(U_TRANSPARENCY_MAP, mat.transparency_map, 15);
-    }
-    else shader_->setUniform(U_USE_TRANSPARENCY_MAP, 0);
 
-	auto lights = ECS.getAllComponents<Light>();
-	for (size_t i = 0; i < lights.size(); i++) {
+    auto lights = ECS.getAllComponents<Light>();
+    for (size_t i = 0; i < lights.size(); i++) {
 
-		glActiveTexture(GL_TEXTURE0 + (GLenum)i);
-		glBindTexture(GL_TEXTURE_2D, shadow_frame_[i].color_textures[0]);
+        glActiveTexture(GL_TEXTURE0 + (GLenum)i);
+        glBindTexture(GL_TEXTURE_2D, shadow_frame_[i].color_textures[0]);
 
-		std::string shadow_map_name = "u_shadow_map[" + std::to_string(i) + "]";
-		GLint u_shadow_map_pos = glGetUniformLocation(shader_->program, shadow_map_name.c_str());
-		if (u_shadow_map_pos != -1)
-			glUniform1i(u_shadow_map_pos, (GLint)i);
-	}
-    
-	//light uniforms
+        std::string shadow_map_name = "u_shadow_map[" + std::to_string(i) + "]";
+        GLint u_shadow_map_pos = glGetUniformLocation(shader_->program, shadow_map_name.c_str());
+        if (u_shadow_map_pos != -1)
+            glUniform1i(u_shadow_map_pos, (GLint)i);
+    }
+
+    //light uniforms
     shader_->setUniformBlock(U_LIGHTS_UBO, LIGHTS_BINDING_POINT);
-	shader_->setUniform(U_NUM_LIGHTS, (int)lights.size());
+    shader_->setUniform(U_NUM_LIGHTS, (int)lights.size());
 }
 
 //updates light ubo
@@ -583,10 +810,10 @@ void GraphicsSystem::updateLights_() {
 }
 
 //This function executes two sorts:
-// i) sorts materials array by shader_id
+// i) sorts materials array by shader_id, then by shader variant
 // ii) sorts Mesh components by material id
 //the result is that the mesh component array is
-//ordered by both shader and material
+//ordered by shader, variant and material
 void GraphicsSystem::sortMeshes_() {
 
 	//sort materials by shader id
@@ -594,9 +821,11 @@ void GraphicsSystem::sortMeshes_() {
 	for (size_t i = 0; i < materials_.size(); i++)
 		materials_[i].index = (int)i; // 'index' is a new property of Material
 
-	//second, we sort materials by shader_id
+	//second, we sort materials by shader_id, and within a shader by variant keywords
 	std::sort(materials_.begin(), materials_.end(), [](const Material& a, const Material& b) {
-		return a.shader_id < b.shader_id;
+		if (a.shader_id != b.shader_id)
+			return a.shader_id < b.shader_id;
+		return materialKeywords_(a) < materialKeywords_(b);
 	});
     
 	//now we map old indices to new indices
@@ -740,21 +969,113 @@ int GraphicsSystem::createGeometry(std::vector<float>& vertices,
     return (int)geometries_.size() - 1;
 }
 
-//create geometry from
+int GraphicsSystem::addGeometry(const Geometry& geom) {
+    geometries_.push_back(geom);
+    return (int)geometries_.size() - 1;
+}
+
+//adds up gpu memory of all resources, and evicts texture levels to keep it under budget
+void GraphicsSystem::updateMemory_() {
+	memory_stats_ = GpuMemoryStats();
+	for (int l = 0; l < GeometryArena::LAYOUT_COUNT; l++) {
+		if (!GeometryArena::exists((GeometryArena::Layout)l)) continue;
+		GeometryArena& arena = GeometryArena::get((GeometryArena::Layout)l);
+		memory_stats_.geometry += arena.vertex_capacity_bytes() + arena.index_capacity_bytes();
+	}
+	for (auto& geom : geometries_)
+		if (geom.arena_allocation == -1)
+			memory_stats_.geometry += geom.vertex_bytes + geom.index_bytes;
+	for (auto terrain : terrains_)
+		memory_stats_.terrain += terrain->memory_bytes;
+	memory_stats_.framebuffers = frame_.bytes + gbuffer_.bytes + oit_frame_.bytes;
+	for (int i = 0; i < MAX_LIGHTS; i++)
+		memory_stats_.framebuffers += shadow_frame_[i].bytes;
+
+	//textures get what the rest leaves
+	size_t budget = (size_t)(memory_budget_mb * 1024 * 1024);
+	size_t others = memory_stats_.total();
+	Texture::updateResidency(budget > others ? budget - others : 0);
+	memory_stats_.textures = Texture::totalBytes();
+}
+
+//create geometry from file, or share the one already loaded from it
 //returns index in geometry array with stored geometry data
 int GraphicsSystem::createGeometryFromFile(std::string filename) {
+    //timed here so the cold and warm figures include everything a load reads
+    auto start = std::chrono::high_resolution_clock::now();
+    bool loaded = false, warm = false;
+    int geom_id = ResourceCache::acquire(ResourceGeometry, filename, [this, &loaded, &warm](std::string path, unsigned long long& hash) {
+        loaded = true;
+        return loadGeometryFromFile_(path, hash, warm);
+    });
+    if (loaded && geom_id != -1)
+        MeshCache::recordLoad(filename, warm, std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    return geom_id;
+}
+
+int GraphicsSystem::createMultiGeometryFromFile(std::string filename) {
+    auto start = std::chrono::high_resolution_clock::now();
+    bool loaded = false, warm = false;
+    int geom_id = ResourceCache::acquire(ResourceMultiGeometry, filename, [this, &loaded, &warm](std::string path, unsigned long long&) {
+        loaded = true;
+        int first = (int)geometries_.size();
+        int last = loadMultiGeometryFromFile_(path, warm);
+        if (last != -1) multi_geometry_first_[last] = first;
+        return last;
+    });
+    if (loaded && geom_id != -1)
+        MeshCache::recordLoad(filename, warm, std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    return geom_id;
+}
+
+//drops a reference to a geometry from file, freeing its buffers if it was the last
+//the geometry keeps its index, so indices of other geometries do not change
+void GraphicsSystem::releaseGeometry(int geom_id) {
+    auto it = multi_geometry_first_.find(geom_id);
+    if (it != multi_geometry_first_.end()) {
+        if (!ResourceCache::release(ResourceMultiGeometry, geom_id)) return;
+        for (int i = it->second; i <= geom_id; i++)
+            geometries_[i].release();
+        multi_geometry_first_.erase(it);
+    }
+    else if (ResourceCache::release(ResourceGeometry, geom_id)) {
+        geometries_[geom_id].release();
+    }
+}
+
+//hash is set to the file's content hash, warm to whether it came from the mesh cache.
+//Returns the geometry already loaded from the same contents, if any
+int GraphicsSystem::loadGeometryFromFile_(std::string filename, unsigned long long& hash, bool& warm) {
     
-    std::vector<GLfloat> vertices, uvs, normals;
-    std::vector<GLuint> indices;
     //check for supported format
     std::string ext = filename.substr(filename.size() - 4, 4);
     if (ext == ".obj" || ext == ".OBJ")
     {
+        //cooked on an earlier import, and source unchanged since
+        Geometry cooked_geom;
+        if (MeshCache::load(filename, cooked_geom, hash)) {
+            warm = true;
+            int shared = ResourceCache::findByHash(ResourceGeometry, hash);
+            if (shared != -1) {
+                cooked_geom.release();
+                return shared;
+            }
+            geometries_.emplace_back(cooked_geom);
+            return (int)geometries_.size() - 1;
+        }
+
         //fill it with data from object
-        if (Parsers::parseOBJ(filename, vertices, uvs, normals, indices)) {
+        ObjMesh mesh;
+        if (ObjParser::parse(filename, mesh)) {
+            hash = mesh.source_hash;
+            int shared = ResourceCache::findByHash(ResourceGeometry, hash);
+            if (shared != -1) return shared;
         
             //generate the OpenGL buffers and create geometry
-			Geometry new_geom(vertices, uvs, normals, indices);
+            Geometry new_geom;
+            new_geom.keep_packed = MeshCache::enabled();
+            new_geom.createVertexArrays(mesh.vertices, mesh.uvs, mesh.normals, mesh.indices);
+            MeshCache::save(filename, new_geom, hash);
             geometries_.emplace_back(new_geom);
 
             return (int)geometries_.size() - 1;
@@ -774,16 +1095,16 @@ int GraphicsSystem::createGeometryFromFile(std::string filename) {
 
 
 
-int GraphicsSystem::createMultiGeometryFromFile(std::string filename) {
+//warm is set to whether it came from the mesh cache
+int GraphicsSystem::loadMultiGeometryFromFile_(std::string filename, bool& warm) {
     
-    std::vector<GLfloat> vertices, uvs, normals;
-    std::vector<GLuint> indices;
     //check for supported format
     std::string ext = filename.substr(filename.size() - 4, 4);
     if (ext == ".obj" || ext == ".OBJ")
     {
         //fill it with data from object
-        if (int p = Parsers::parseOBJ_multi(filename, geometries_, materials_) ) {
+        int p = Parsers::parseOBJ_multi(filename, geometries_, materials_, warm);
+        if (p != -1) {
             return p;
         }
         else {
@@ -798,10 +1119,18 @@ int GraphicsSystem::createMultiGeometryFromFile(std::string filename) {
     
 }
 
-//create terrain geometry and adds to geometry array
-int GraphicsSystem::createTerrainGeometry(int resolution, float step, float max_height, ImageData& height_map) {
+//create chunked terrain and a geometry which refers to it, and adds to geometry array
+//- vertex_texture: displace a shared patch from a height texture, material shader must use terrain.vert
+int GraphicsSystem::createTerrainGeometry(int resolution, float step, float max_height, ImageData& height_map, bool vertex_texture) {
+    Terrain* terrain = new Terrain();
+    terrain->vertex_texture = vertex_texture;
+    terrain->init(resolution, step, max_height, height_map);
+    terrains_.push_back(terrain);
+    
     Geometry new_geom;
-    new_geom.createTerrain(resolution, step, max_height, height_map);
+    new_geom.terrain = (int)terrains_.size() - 1;
+    new_geom.max_terrain_height = max_height;
+    new_geom.aabb = terrain->aabb;
     geometries_.emplace_back(new_geom);
     return (int)geometries_.size() - 1;
 }
@@ -961,85 +1290,7 @@ bool GraphicsSystem::AABBInFrustum_(const AABB& aabb, const lm::mat4& to_clip) {
 
 //tests whether Bounding box is inside frustum or not, based on model_view_projection matrix
 bool GraphicsSystem::BBInFrustum_(const AABB& aabb, const lm::mat4& mvp) {
-    //each corner point of box gets transformed into clip space, to give point PC, in HOMOGENOUS coords
-    //point is inside clip space iff
-    //-PC.w < PC.xyz < PC.w
-    //so we first take each corner of AABB (note, using vec4 because of homogenous coords) and multiply
-    //by matrix to clip space. Then we test each point against the 6 planes e.g. PC is on the 'right' side
-    //of the left plane iff -PC.w < PC.x; and is on 'left' side of right plane is PC.x < PC.w etc.
-    //For more info see:
-    //http://www.lighthouse3d.com/tutorials/view-frustum-culling/clip-space-approach-extracting-the-planes/
-    
-    
-    //the eight points of the box corners are calculated using center and +/- halfwith:
-    //- - -
-    //- - +
-    //- + -
-    //- + +
-    //+ - -
-    //+ - +
-    //+ + -
-    //+ + +
-	lm::vec4 points[8];
-	points[0] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[1] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-	points[2] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[3] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-	points[4] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[5] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-	points[6] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[7] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-
-	//transform to clip space
-	lm::vec4 clip_points[8];
-	for (int i = 0; i < 8; i++) {
-		clip_points[i] = mvp * points[i];
-	}
-
-	//now test clip points against each plane. If all clip points are outside plane we return false
-	//left plane
-	int in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (-clip_points[i].w < clip_points[i].x) in++;
-	}
-	if (!in) return false;
-
-	//right plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (clip_points[i].x < clip_points[i].w) in++;
-	}
-	if (!in) return false;
-
-	//bottom plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (-clip_points[i].w < clip_points[i].y) in++;
-	}
-	if (!in) return false;
-
-	//top plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (clip_points[i].y < clip_points[i].w) in++;
-	}
-	if (!in) return false;
-
-	//near plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (-clip_points[i].z < clip_points[i].z) in++;
-	}
-	if (!in) return false;
-
-	//far plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (clip_points[i].z < clip_points[i].w) in++;
-	}
-	if (!in) return false;
-
-	return true;
+    return BBInFrustum(aabb, mvp);
 }
 
 //sets viewport of graphics system
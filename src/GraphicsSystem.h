@@ -6,10 +6,27 @@
 #include "Shader.h"
 #include "Components.h"
 #include "GraphicsUtilities.h"
+#include "Terrain.h"
+#include "RadixSort.h"
 #include <unordered_map>
 
 #define MAX_LIGHTS 8
 
+//gpu memory by kind of resource, in bytes
+struct GpuMemoryStats {
+    size_t textures = 0;
+    size_t geometry = 0;
+    size_t terrain = 0;
+    size_t framebuffers = 0;
+    size_t total() const { return textures + geometry + terrain + framebuffers; }
+};
+
+//how transparent material sets and particles are blended
+enum TransparencyMode {
+    TransparencySorted, //back to front, exact for surfaces which don't intersect
+    TransparencyWeightedOIT //order independent weighted blending, no sort
+};
+
 class GraphicsSystem {
 public:
 	~GraphicsSystem();
@@ -43,19 +60,40 @@ public:
                        std::vector<float>& uvs,
                        std::vector<float>& normals,
                        std::vector<unsigned int>& indices);
+    int addGeometry(const Geometry& geom); //created elsewhere, e.g. loaded from MeshCache
+    //geometry from file is shared, call releaseGeometry once for every create
     int createGeometryFromFile(std::string filename);
     int createMultiGeometryFromFile(std::string filename);
-    int createTerrainGeometry(int resolution, float step, float max_height, ImageData& height_map);
+    void releaseGeometry(int geom_id);
+    int createTerrainGeometry(int resolution, float step, float max_height, ImageData& height_map, bool vertex_texture = false);
+    std::vector<Terrain*>& getTerrains() { return terrains_; }
 
 	//lights update
 	bool needUpdateLights = true;
 
+	//gpu memory; textures are shrunk to keep the total under budget
+	float memory_budget_mb = 1024.0f;
+	const GpuMemoryStats& getMemoryStats() const { return memory_stats_; }
+	//transparent draws of last frame, sorted back to front
+	int num_transparent_items = 0;
+	float transparent_sort_ms = 0.0f;
+	TransparencyMode transparency_mode = TransparencySorted;
+	//in weighted oit mode, update leaves accumulation targets bound so particles
+	//can be drawn into them; this blends them over the screen
+	void compositeTransparency();
+
 private:
     //resources
     std::string assets_folder_;
 	std::unordered_map<GLint, Shader*> shaders_; //compiled id, pointer
     std::vector<Geometry> geometries_;
     std::vector<Material> materials_;
+    std::vector<Terrain*> terrains_;
+    int loadGeometryFromFile_(std::string filename, unsigned long long& hash, bool& warm);
+    int loadMultiGeometryFromFile_(std::string filename, bool& warm);
+    std::unordered_map<int, int> multi_geometry_first_; //last geometry of a multi geometry file -> first
+    GpuMemoryStats memory_stats_;
+    void updateMemory_();
 
     //viewport
     int viewport_width_, viewport_height_;
@@ -70,8 +108,17 @@ private:
 
 	//materials stuff
     GLint current_material_ = -1;
+    std::vector<int> material_groups_; //scratch for batching material sets
+    std::vector<int> material_batch_;
     void setMaterialUniforms();
 
+	//shader variants, see ShaderKeyword
+	Shader* pass_shader_ = nullptr; //base shader of current pass, variants are chosen per material
+	std::unordered_map<uint64_t, Shader*> shader_variants_; //base program << 32 | keys
+	static GLuint materialKeywords_(const Material& mat);
+	Shader* getShaderVariant_(Shader* base, const Material& mat);
+	bool useMaterial_(Shader* base, int material);
+
 	//sorting and checking and abstracting
 	void sortMeshes_();
 	void resetShaderAndMaterial_();
@@ -96,6 +143,7 @@ private:
 	//shadowing
 	Shader* depth_shader_ = nullptr;
 	Shader* screen_depth_shader_ = nullptr;
+	Shader* terrain_depth_shader_ = nullptr;
 	Framebuffer shadow_frame_[MAX_LIGHTS];
 	void renderDepth_(Mesh& comp, const Light& light);
     
@@ -124,6 +172,28 @@ private:
     //rendering
     void renderMeshComponent_(Mesh& comp);
     void renderSkinnedMeshComponent_(SkinnedMesh& comp);
+    SkinnedMesh* current_skin_ = nullptr; //skin being drawn by renderMeshComponent_
+    //transparent sets of forward meshes are queued with their view depth while
+    //opaque ones are drawn, then drawn back to front
+    struct TransparentItem {
+        Mesh* mesh;
+        int set; //-1 for whole mesh
+    };
+    std::vector<TransparentItem> transparent_items_;
+    std::vector<uint32_t> transparent_keys_;
+    std::vector<uint32_t> transparent_order_;
+    RadixSort transparent_sort_;
+    bool defer_transparent_ = false;
+    int item_set_ = -2; //set of transparent item being drawn, -2 if none
+    void renderTransparent_();
+    //weighted blended transparency
+    Framebuffer oit_frame_;
+    Shader* oit_composite_shader_ = nullptr;
+    GLuint pass_keywords_ = 0; //keywords added to every material variant, e.g. weighted oit
+    bool oit_open_ = false; //accumulation targets bound, waiting for composite
+    void beginWeightedOIT_();
+    std::vector<float> joint_pos_matrices_, joint_bind_matrices_;
+    void setSkinUniforms_(SkinnedMesh& comp);
     void renderEnvironment_();
     void previewTextureViewport(GLuint texture_id);
     
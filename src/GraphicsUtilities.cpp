@@ -1,40 +1,167 @@
 #include "GraphicsUtilities.h"
+#include "MeshOptimizer.h"
+#include "GeometryArena.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 // ****** GEOMETRY ***** //
 
+//IEEE half float from float, rounding to nearest. Denormals flush to zero
+static GLushort floatToHalf(float f) {
+    GLuint bits;
+    memcpy(&bits, &f, sizeof(float));
+    GLuint sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    GLuint mantissa = bits & 0x7fffff;
+    if (exponent <= 0) return (GLushort)sign;
+    if (exponent >= 31) return (GLushort)(sign | 0x7c00);
+    GLuint half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000) half++; //round, may carry into exponent which is still correct
+    return (GLushort)half;
+}
+
+//packs normalized vector into signed GL_INT_2_10_10_10_REV
+static GLuint packNormal(float x, float y, float z) {
+    auto pack = [](float v) {
+        v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+        return (GLuint)((int)roundf(v * 511.0f) & 0x3ff);
+    };
+    return pack(x) | (pack(y) << 10) | (pack(z) << 20);
+}
+
+//size in bytes of one index of geometry
+static size_t indexSize(GLenum index_type) {
+    return index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+}
+
+//index buffer contents, 16 bit if every vertex can be addressed. Returns index type
+static GLenum packIndices(const std::vector<GLuint>& indices, GLuint num_vertices, std::vector<GLubyte>& data) {
+    GLenum index_type = num_vertices <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    data.resize(indices.size() * indexSize(index_type));
+    if (index_type == GL_UNSIGNED_SHORT) {
+        GLushort* out = (GLushort*)&data[0];
+        for (size_t i = 0; i < indices.size(); i++) out[i] = (GLushort)indices[i];
+    }
+    else
+        memcpy(&data[0], &indices[0], data.size());
+    return index_type;
+}
+
+//bytes per vertex of a packed layout: position, uv, normal
+static GLsizei packedStride(GeometryArena::Layout layout) {
+    GLsizei uv_bytes = layout == GeometryArena::LayoutPackedHalfUV ? 2 * sizeof(GLushort) : 2 * sizeof(float);
+    return 3 * sizeof(float) + uv_bytes + sizeof(GLuint);
+}
+
 //generates buffers in VRAM
 Geometry::Geometry(std::vector<float>& vertices, std::vector<float>& uvs, std::vector<float>& normals, std::vector<unsigned int>& indices) {
 	createVertexArrays(vertices, uvs, normals, indices);
 }
 
 void Geometry::render() {
+	if (arena_allocation != -1) {
+		GeometryArena::get((GeometryArena::Layout)arena_layout).draw(arena_allocation, num_tris * 3, index_type, 0);
+		return;
+	}
 	glBindVertexArray(vao);
-	glDrawElements(GL_TRIANGLES, num_tris * 3, GL_UNSIGNED_INT, 0);
+	glDrawElements(GL_TRIANGLES, num_tris * 3, index_type, 0);
 	glBindVertexArray(0);
+	GeometryArena::invalidateBinding();
 }
 
 
 void Geometry::render(int set) {
+    //if first set, draw from start to "end of set 0" (* 3 to convert from triangles
+    //to indices), otherwise start triangle is end triangle of previous set
+    GLuint start_index = set == 0 ? 0 : material_sets[set - 1] * 3;
+    //end triangle is end of current set
+    GLuint end_index = material_sets[set] * 3;
+    //count is the number of indices to draw
+    GLuint count = end_index - start_index;
+
+    //arena keeps its vao bound between draws
+    if (arena_allocation != -1) {
+        GeometryArena::get((GeometryArena::Layout)arena_layout).draw(arena_allocation, count, index_type, start_index);
+        return;
+    }
+
     //bind the vao
     glBindVertexArray(vao);
-    //if first set, draw from start to "end of set 0" (* 3 to convert from triangles
-    //to indices)
-    if (set == 0)
-        glDrawElements(GL_TRIANGLES, material_sets[set] * 3, GL_UNSIGNED_INT, 0);
-    else {
-        //start triangle is end triangle of previous set
-        GLuint start_index = material_sets[set - 1] * 3;
-        //end triangle is end of current set
-        GLuint end_index = material_sets[set] * 3;
-        //count is the number of indices to draw
-        GLuint count = end_index - start_index;
-        
-        glDrawElements(GL_TRIANGLES, //things to draw
-                       count, //number of indices
-                       GL_UNSIGNED_INT, //format of indices
-                       (void*)(start_index * sizeof(GLuint))); //pointer to start!
+    glDrawElements(GL_TRIANGLES, //things to draw
+                   count, //number of indices
+                   index_type, //format of indices
+                   (void*)(start_index * indexSize(index_type))); //pointer to start!
+    glBindVertexArray(0);
+    GeometryArena::invalidateBinding();
+}
+
+//renders several material sets which share uniforms, e.g. the same material
+void Geometry::renderSets(const std::vector<int>& sets) {
+    if (sets.empty()) return;
+    if (arena_allocation == -1 || sets.size() == 1) {
+        for (int set : sets) render(set);
+        return;
     }
+    std::vector<GLsizei> counts(sets.size());
+    std::vector<size_t> first_indices(sets.size());
+    for (size_t i = 0; i < sets.size(); i++) {
+        int set = sets[i];
+        first_indices[i] = set == 0 ? 0 : material_sets[set - 1] * 3;
+        counts[i] = (GLsizei)(material_sets[set] * 3 - first_indices[i]);
+    }
+    GeometryArena::get((GeometryArena::Layout)arena_layout).multiDraw(arena_allocation, &counts[0], index_type,
+                                                                       &first_indices[0], (GLsizei)sets.size());
+}
+
+//moves geometry out of the arena into its own vao and buffers, copying on the GPU.
+//Needed before adding per-geometry attributes such as skin weights or blend shapes
+void Geometry::detachFromArena() {
+    if (arena_allocation == -1) return;
+    GeometryArena& arena = GeometryArena::get((GeometryArena::Layout)arena_layout);
+    const ArenaAllocation& a = arena.allocation(arena_allocation);
+    size_t vertex_size = (size_t)a.num_vertices * arena.stride();
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    GLuint vbo, ibo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertex_size, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, arena.vertexBuffer());
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, (size_t)a.first_vertex * arena.stride(), 0, vertex_size);
+    GeometryArena::setVertexAttributes((GeometryArena::Layout)arena_layout, 0);
+
+    glGenBuffers(1, &ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, a.index_bytes, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, arena.indexBuffer());
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ELEMENT_ARRAY_BUFFER, a.index_offset, 0, a.index_bytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+    buffers.push_back(vbo);
+    buffers.push_back(ibo);
+
+    arena.free(arena_allocation);
+    arena_allocation = -1;
+    arena_layout = -1;
+    GeometryArena::invalidateBinding();
+}
+
+void Geometry::release() {
+    if (arena_allocation != -1) {
+        GeometryArena::get((GeometryArena::Layout)arena_layout).free(arena_allocation);
+        arena_allocation = -1;
+        arena_layout = -1;
+    }
+    if (!buffers.empty())
+        glDeleteBuffers((GLsizei)buffers.size(), &buffers[0]);
+    buffers.clear();
+    if (vao) glDeleteVertexArrays(1, &vao);
+    vao = 0;
+    vertex_bytes = index_bytes = 0;
+    bvh.clear();
 }
 
 void Geometry::createMaterialSet(int tri_count, int material_id) {
@@ -45,36 +172,98 @@ void Geometry::createMaterialSet(int tri_count, int material_id) {
 void Geometry::createVertexArrays(std::vector<float>& vertices, std::vector<float>& uvs, std::vector<float>& normals, std::vector<unsigned int>& indices) {
     
     
-	//generate and bind vao
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
 	GLuint vbo;
-	//positions
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &(vertices[0]), GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	//texture coords
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(float), &(uvs[0]), GL_STATIC_DRAW);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-	//normals
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(float), &(normals[0]), GL_STATIC_DRAW);
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	//indices
+	num_vertices = (GLuint)vertices.size() / 3;
+
+	//reorder triangles and vertices within material sets
+	VertexCacheStats stats = MeshOptimizer::analyzeVertexCache(indices, num_vertices);
+	acmr_source = stats.acmr;
+	if (optimize_order) {
+		vertex_remap = MeshOptimizer::optimizeMesh(vertices, uvs, normals, indices, material_sets);
+		stats = MeshOptimizer::analyzeVertexCache(indices, num_vertices);
+	}
+	acmr = stats.acmr;
+	atvr = stats.atvr;
+	if (build_bvh) bvh.build(vertices, indices);
+
+	//half floats step by 1/1024 in [1,2), about a texel of a 1024 texture, and twice
+	//as coarse above; tiled uvs beyond that stay as float so textures don't swim
+	bool half_uvs = true;
+	for (float uv : uvs)
+		if (std::abs(uv) > 2.0f) { half_uvs = false; break; }
+
+	if (packed_vertices) {
+		//single interleaved stream: position (3 floats), uv (2 halfs or floats), normal (2_10_10_10)
+		GLsizei uv_bytes = half_uvs ? 2 * sizeof(GLushort) : 2 * sizeof(float);
+		GLsizei stride = packedStride(half_uvs ? GeometryArena::LayoutPackedHalfUV : GeometryArena::LayoutPackedFloatUV);
+		std::vector<GLubyte> packed((size_t)num_vertices * stride);
+		for (GLuint i = 0; i < num_vertices; i++) {
+			GLubyte* v = &packed[(size_t)i * stride];
+			memcpy(v, &vertices[i * 3], 3 * sizeof(float));
+			float u = i * 2 < uvs.size() ? uvs[i * 2] : 0.0f;
+			float w = i * 2 + 1 < uvs.size() ? uvs[i * 2 + 1] : 0.0f;
+			if (half_uvs) {
+				GLushort h[2] = { floatToHalf(u), floatToHalf(w) };
+				memcpy(v + 12, h, sizeof(h));
+			}
+			else {
+				float f[2] = { u, w };
+				memcpy(v + 12, f, sizeof(f));
+			}
+			GLuint n = i * 3 + 2 < normals.size() ? packNormal(normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2]) : 0;
+			memcpy(v + 12 + uv_bytes, &n, sizeof(GLuint));
+		}
+		std::vector<GLubyte> index_data;
+		GLenum packed_index_type = packIndices(indices, num_vertices, index_data);
+		uploadPacked(half_uvs ? GeometryArena::LayoutPackedHalfUV : GeometryArena::LayoutPackedFloatUV,
+		             &(packed[0]), num_vertices, &(index_data[0]), index_data.size(), packed_index_type);
+		setAABB(vertices);
+		//for the mesh cache
+		if (keep_packed) {
+			packed_vertex_data.swap(packed);
+			packed_index_data.swap(index_data);
+		}
+		return;
+	}
+	else {
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		//positions
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &(vertices[0]), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		buffers.push_back(vbo);
+		//texture coords
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(float), &(uvs[0]), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+		buffers.push_back(vbo);
+		//normals
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(float), &(normals[0]), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		buffers.push_back(vbo);
+		vertex_bytes = (vertices.size() + uvs.size() + normals.size()) * sizeof(float);
+	}
+	//indices, 16 bit if every vertex can be addressed
+	std::vector<GLubyte> index_data;
+	index_type = packIndices(indices, num_vertices, index_data);
+	index_bytes = index_data.size();
 	GLuint ibo;
 	glGenBuffers(1, &ibo);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &(indices[0]), GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_data.size(), &(index_data[0]), GL_STATIC_DRAW);
+	buffers.push_back(ibo);
 	//unbind
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
+	GeometryArena::invalidateBinding();
 
 	//set number of triangles
 	num_tris = (GLuint)indices.size() / 3;
@@ -83,87 +272,58 @@ void Geometry::createVertexArrays(std::vector<float>& vertices, std::vector<floa
 	setAABB(vertices);
 }
 
-int Geometry::createTerrain(int resolution, float step, float the_max_height, ImageData& height_map){
-    //set max_height of geometry
-    max_terrain_height = the_max_height;
-    
-    std::vector<GLfloat> vertices, uvs, normals;
-    std::vector<GLuint> indices;
-    
-    int height_value[3];
-    height_map.getPixel(0, 0, height_value);
-    
-    int N = resolution; // grid dimensions in x and z
-    float hw = ((float)N * step) / 2; //halfwidth, used to center terrain
-    
-    for (int vx = 0; vx < N; vx++) {
-        for (int vz = 0; vz < N; vz++) {
-            
-            //get height
-            int x_pixel = (int)( ( (float)vx / (float)N ) * height_map.width);
-            int y_pixel = (int)( ( (float)vz / (float)N ) * height_map.height);
-            height_map.getPixel(x_pixel, y_pixel, height_value);
-            
-            float x_pos = ((float)vx * step) - hw;
-            float y_pos = ((float)height_value[0] / 255.0f) * max_terrain_height;
-            float z_pos = ((float)-vz * step) + hw;
-            
-            GLfloat v[] = { x_pos, y_pos, z_pos };
-            //GLfloat n[] = { 0, 0, 1 };//calculate_normal(vx, vz);
-            lm::vec3 nvec = calculateTerrainNormal(height_map, x_pixel, y_pixel);
-            GLfloat* n = nvec.value_;
-            GLfloat uv[] = { (float)vx / (float)(N-1), (float)vz / (float)(N-1) };
-            
-            vertices.insert(vertices.end(), v, v + 3);
-            normals.insert(normals.end(), n, n + 3);
-            uvs.insert(uvs.end(), uv, uv + 2);
-        }
-    }
-    
-    for (int jx = 0; jx < N - 1; jx++)
-    {
-        for (int iz = 0; iz < N - 1; iz++)
-        {
-            //one quad
-            int row = iz; //current row
-            int col1 = jx *  N ; //current columns
-            int col2 = (jx + 1) * N; // next column along
-            
-            // B---D
-            // | \ |
-            // A---C
-            // two tris: ACB, CDB
-            GLuint A = row + col1;
-            GLuint B = A + 1;
-            GLuint C = row + col2;
-            GLuint D = C + 1;
-            
-            GLuint square[] = { A, C, B, C, D, B };
-            indices.insert(indices.end(), square, square + 6);
-        }
-    }
-    
-    //generate the OpenGL buffers and create geometry
-    createVertexArrays(vertices, uvs, normals, indices);
-    
-    return 1;
+//uploads vertices already interleaved in layout (GeometryArena::Layout) and
+//indices of index_type, into the arena or buffers of the geometry's own.
+//Used by createVertexArrays and by MeshCache, which maps cooked data from disk
+void Geometry::uploadPacked(int layout, const void* vertex_data, GLuint vertex_count,
+                            const void* index_data, size_t index_size, GLenum packed_index_type) {
+	GeometryArena::Layout layout_type = (GeometryArena::Layout)layout;
+	packed_layout = layout;
+	num_vertices = vertex_count;
+	index_type = packed_index_type;
+	index_bytes = index_size;
+	num_tris = (GLuint)(index_size / indexSize(index_type) / 3);
+	vertex_bytes = (size_t)vertex_count * packedStride(layout_type);
+
+	if (use_arena) {
+		//sub-allocate vertices and indices from the shared buffers, no vao of our own
+		arena_layout = layout;
+		arena_allocation = GeometryArena::get(layout_type).allocate(vertex_data, vertex_count, index_data, index_size);
+		return;
+	}
+
+	GLuint vbo, ibo;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertex_bytes, vertex_data, GL_STATIC_DRAW);
+	GeometryArena::setVertexAttributes(layout_type, 0);
+	buffers.push_back(vbo);
+	glGenBuffers(1, &ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_size, index_data, GL_STATIC_DRAW);
+	buffers.push_back(ibo);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	GeometryArena::invalidateBinding();
 }
 
-lm::vec3 Geometry::calculateTerrainNormal(ImageData& height_map, int x, int y){
-    //boundary check
-    if (x == 0) x = 1; if (y == 0) y = 1;
-    if (x == height_map.width) x--; if (y == height_map.height) y--;
-    
-    //obtain partial derivatives in both dimensions, using data points either side
-    int hl[3]; int hr[3]; int hd[3]; int hu[3];
-    height_map.getPixel(x - 1, y, hl);
-    height_map.getPixel(x + 1, y, hr);
-    height_map.getPixel(x, y - 1, hu);
-    height_map.getPixel(x, y + 1, hd);
-    
-    lm::vec3 n((float)(hl[0] - hr[0]), 2.0, (float)(hd[0] - hu[0]));
-    
-    return n;
+//center of bounding box of each material set
+void Geometry::setMaterialSetCenters(std::vector<GLfloat>& vertices, std::vector<unsigned int>& indices) {
+	material_set_centers.resize(material_sets.size());
+	for (size_t set = 0; set < material_sets.size(); set++) {
+		lm::vec3 min(1000000.0f, 1000000.0f, 1000000.0f);
+		lm::vec3 max(-1000000.0f, -1000000.0f, -1000000.0f);
+		size_t first = set == 0 ? 0 : material_sets[set - 1] * 3;
+		size_t last = std::min((size_t)material_sets[set] * 3, indices.size());
+		for (size_t i = first; i < last; i++) {
+			const float* v = &vertices[indices[i] * 3];
+			min.x = std::min(min.x, v[0]); min.y = std::min(min.y, v[1]); min.z = std::min(min.z, v[2]);
+			max.x = std::max(max.x, v[0]); max.y = std::max(max.y, v[1]); max.z = std::max(max.z, v[2]);
+		}
+		material_set_centers[set] = first < last ? (min + max) * 0.5f : lm::vec3();
+	}
 }
 
 // Given an array of floats (in sets of three, representing vertices) calculates and
@@ -217,38 +377,91 @@ int Geometry::createPlaneGeometry() {
 int Geometry::addVertexWeights(std::vector<lm::vec4>& vertex_weights,
                                std::vector<lm::ivec4>& vertex_jointids) {
     
+    //skin weights are a per geometry stream, so leave the shared arena vao
+    detachFromArena();
+    glBindVertexArray(vao);
+    GLuint vbo;
+
+    //weights are in original vertex order, so follow the optimized order. Copies, as
+    //the same weights may be added to more than one instance of a geometry
+    std::vector<lm::vec4> remapped_weights;
+    std::vector<lm::ivec4> remapped_jointids;
+    if (!vertex_remap.empty()) {
+        remapped_weights = vertex_weights;
+        remapped_jointids = vertex_jointids;
+        MeshOptimizer::remapVertexData(remapped_weights, vertex_remap, 1);
+        MeshOptimizer::remapVertexData(remapped_jointids, vertex_remap, 1);
+    }
+    std::vector<lm::vec4>& weights_in = vertex_remap.empty() ? vertex_weights : remapped_weights;
+    std::vector<lm::ivec4>& jointids_in = vertex_remap.empty() ? vertex_jointids : remapped_jointids;
+
+    //ids are stored as bytes if skeleton is small enough
+    int max_joint_id = 0;
+    for (auto& ids : jointids_in)
+        for (int i = 0; i < 4; i++)
+            max_joint_id = std::max(max_joint_id, ids.value_[i]);
+
+    if (packed_vertices && max_joint_id < 256) {
+        //interleaved: 4 normalized byte weights, then 4 byte joint ids
+        std::vector<GLubyte> packed(weights_in.size() * 8, 0);
+        for (size_t i = 0; i < weights_in.size(); i++) {
+            GLubyte* w = &packed[i * 8];
+            GLubyte* j = w + 4;
+            int total = 0, largest = 0;
+            for (int k = 0; k < 4; k++) {
+                float weight = std::max(0.0f, std::min(weights_in[i].value_[k], 1.0f));
+                w[k] = (GLubyte)roundf(weight * 255.0f);
+                total += w[k];
+                if (w[k] > w[largest]) largest = k;
+                //unused joints are -1, but their weight is zero so any joint will do
+                j[k] = (GLubyte)std::max(jointids_in[i].value_[k], 0);
+            }
+            //keep weights summing to one after rounding
+            if (total > 0)
+                w[largest] = (GLubyte)std::max(0, std::min(255, (int)w[largest] + 255 - total));
+        }
+        glGenBuffers(1, &vbo);
+        buffers.push_back(vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, packed.size(), &(packed[0]), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, 8, 0);
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_FALSE, 8, (void*)4);
+        vertex_bytes += packed.size();
+        return 1;
+    }
+
     //temporary hack
-    std::vector<float> weights(vertex_weights.size() * 4, 0.0f);
-    std::vector<float> ids(vertex_jointids.size() * 4, -1.0f);
-    
-    for (size_t i = 0; i < vertex_weights.size(); i++) {
-        weights[i*4] = vertex_weights[i].x;
-        weights[i*4+1] = vertex_weights[i].y;
-        weights[i*4+2] = vertex_weights[i].z;
-        weights[i*4+3] = vertex_weights[i].w;
+    std::vector<float> weights(weights_in.size() * 4, 0.0f);
+    std::vector<float> ids(jointids_in.size() * 4, -1.0f);
+    
+    for (size_t i = 0; i < weights_in.size(); i++) {
+        weights[i*4] = weights_in[i].x;
+        weights[i*4+1] = weights_in[i].y;
+        weights[i*4+2] = weights_in[i].z;
+        weights[i*4+3] = weights_in[i].w;
         
-        ids[i*4] = (float)vertex_jointids[i].x;
-        ids[i*4+1] = (float)vertex_jointids[i].y;
-        ids[i*4+2] = (float)vertex_jointids[i].z;
-        ids[i*4+3] = (float)vertex_jointids[i].w;
+        ids[i*4] = (float)jointids_in[i].x;
+        ids[i*4+1] = (float)jointids_in[i].y;
+        ids[i*4+2] = (float)jointids_in[i].z;
+        ids[i*4+3] = (float)jointids_in[i].w;
     }
     
-    
-    glBindVertexArray(vao);
-    GLuint vbo;
-    
     glGenBuffers(1, &vbo);
+    buffers.push_back(vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, weights.size() * sizeof(float), &(weights[0]), GL_STATIC_DRAW);
     glEnableVertexAttribArray(3);
     glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 0, 0);
     
     glGenBuffers(1, &vbo);
+    buffers.push_back(vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(float), &(ids[0]), GL_STATIC_DRAW);
     glEnableVertexAttribArray(4);
     glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 0, 0);
-    
+    vertex_bytes += (weights.size() + ids.size()) * sizeof(float);
     
     return 1;
 }
@@ -260,19 +473,113 @@ int Geometry::addBlendShape(std::vector<float>& blend_offsets) {
     
     //attribute location is 2 (positions(0) + normals(1) + uvs(2)) + num_blend_shapes
     GLuint new_attrib_location = 2 + num_blend_shapes;
+
+    //offsets are in original vertex order
+    std::vector<float> remapped_offsets;
+    if (!vertex_remap.empty()) {
+        remapped_offsets = blend_offsets;
+        MeshOptimizer::remapVertexData(remapped_offsets, vertex_remap, 3);
+    }
+    std::vector<float>& offsets_in = vertex_remap.empty() ? blend_offsets : remapped_offsets;
     
+    detachFromArena();
     glBindVertexArray(vao);
     GLuint vbo;
     
     glGenBuffers(1, &vbo);
+    buffers.push_back(vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, blend_offsets.size() * sizeof(float), &(blend_offsets[0]), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, offsets_in.size() * sizeof(float), &(offsets_in[0]), GL_STATIC_DRAW);
     glEnableVertexAttribArray(new_attrib_location);
     glVertexAttribPointer(new_attrib_location, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    vertex_bytes += offsets_in.size() * sizeof(float);
     
     return 1;
 }
 
+//tests whether Bounding box is inside frustum or not, based on model_view_projection matrix
+bool BBInFrustum(const AABB& aabb, const lm::mat4& mvp) {
+    //each corner point of box gets transformed into clip space, to give point PC, in HOMOGENOUS coords
+    //point is inside clip space iff
+    //-PC.w < PC.xyz < PC.w
+    //so we first take each corner of AABB (note, using vec4 because of homogenous coords) and multiply
+    //by matrix to clip space. Then we test each point against the 6 planes e.g. PC is on the 'right' side
+    //of the left plane iff -PC.w < PC.x; and is on 'left' side of right plane is PC.x < PC.w etc.
+    //For more info see:
+    //http://www.lighthouse3d.com/tutorials/view-frustum-culling/clip-space-approach-extracting-the-planes/
+    
+    
+    //the eight points of the box corners are calculated using center and +/- halfwith:
+    //- - -
+    //- - +
+    //- + -
+    //- + +
+    //+ - -
+    //+ - +
+    //+ + -
+    //+ + +
+	lm::vec4 points[8];
+	points[0] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
+	points[1] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
+	points[2] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
+	points[3] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
+	points[4] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
+	points[5] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
+	points[6] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
+	points[7] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
+
+	//transform to clip space
+	lm::vec4 clip_points[8];
+	for (int i = 0; i < 8; i++) {
+		clip_points[i] = mvp * points[i];
+	}
+
+	//now test clip points against each plane. If all clip points are outside plane we return false
+	//left plane
+	int in = 0;
+	for (int i = 0; i < 8; i++) {
+		if (-clip_points[i].w < clip_points[i].x) in++;
+	}
+	if (!in) return false;
+
+	//right plane
+	in = 0;
+	for (int i = 0; i < 8; i++) {
+		if (clip_points[i].x < clip_points[i].w) in++;
+	}
+	if (!in) return false;
+
+	//bottom plane
+	in = 0;
+	for (int i = 0; i < 8; i++) {
+		if (-clip_points[i].w < clip_points[i].y) in++;
+	}
+	if (!in) return false;
+
+	//top plane
+	in = 0;
+	for (int i = 0; i < 8; i++) {
+		if (clip_points[i].y < clip_points[i].w) in++;
+	}
+	if (!in) return false;
+
+	//near plane
+	in = 0;
+	for (int i = 0; i < 8; i++) {
+		if (-clip_points[i].z < clip_points[i].z) in++;
+	}
+	if (!in) return false;
+
+	//far plane
+	in = 0;
+	for (int i = 0; i < 8; i++) {
+		if (clip_points[i].z < clip_points[i].w) in++;
+	}
+	if (!in) return false;
+
+	return true;
+}
+
 /*******************
  * FRAMEBUFFER *
  ******************/
@@ -318,6 +625,7 @@ void Framebuffer::initColor(GLsizei w, GLsizei h) {
 	glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
 	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
+	bytes = (size_t)width * height * (4 + 4); //rgb (padded) + depth stencil
 
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
@@ -351,6 +659,7 @@ void Framebuffer::initDepth(GLsizei w, GLsizei h) {
 	//attach this texture to the framebuffers depth attachment
 	//so anything drawn to this framebuffer is essentially just stored as depth, no colour
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, color_textures[0], 0);
+	bytes = (size_t)width * height * 4; //24 bit depth is stored in 4 bytes
 	//tell openGL we are not going to draw to a color buffer - if we don't say this then the 
 	//framebuffer is incomplete and we get an error
 	glDrawBuffer(GL_NONE);
@@ -408,8 +717,61 @@ void Framebuffer::initGbuffer(GLsizei w, GLsizei h) {
     
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
                               GL_RENDERBUFFER, rbo);
+    bytes = (size_t)width * height * (8 + 8 + 4 + 4); //2 x rgb16f (padded), rgba8, depth stencil
     
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cout << "ERROR::Framebuffer is not complete!" << std::endl;
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
+
+//accumulation targets of weighted blended transparency. Depth is blitted in from
+//the opaque pass, so it must match the default framebuffer's depth stencil
+void Framebuffer::initWeightedOIT(GLsizei w, GLsizei h) {
+    width = w; height = h;
+
+    glGenFramebuffers(1, &(framebuffer));
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    //colour * weight in rgb, revealage in a
+    glGenTextures(1, &(color_textures[0]));
+    glBindTexture(GL_TEXTURE_2D, color_textures[0]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_textures[0], 0);
+
+    //sum of weights
+    glGenTextures(1, &(color_textures[1]));
+    glBindTexture(GL_TEXTURE_2D, color_textures[1]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width, height, 0, GL_RED, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, color_textures[1], 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    num_color_attachments = 2;
+
+    unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, attachments);
+
+    glGenRenderbuffers(1, &depth_renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+    bytes = (size_t)width * height * (8 + 2 + 4); //rgba16f, r16f, depth stencil
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::Framebuffer is not complete!" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Framebuffer::release() {
+    if (framebuffer == (GLuint)-1) return;
+    glDeleteTextures(num_color_attachments, color_textures);
+    if (depth_renderbuffer) glDeleteRenderbuffers(1, &depth_renderbuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+    for (GLuint i = 0; i < num_color_attachments; i++) color_textures[i] = 0;
+    framebuffer = -1;
+    num_color_attachments = 0;
+    depth_renderbuffer = 0;
+    bytes = 0;
+}
@@ -2,11 +2,15 @@
 #include "includes.h"
 #include "Shader.h"
 #include "Components.h"
+#include "MeshBVH.h"
 struct AABB {
 	lm::vec3 center;
 	lm::vec3 half_width;
 };
 
+//tests whether bounding box is inside frustum, given model_view_projection matrix
+bool BBInFrustum(const AABB& aabb, const lm::mat4& mvp);
+
 struct ImageData {
     GLubyte* data;
     int width;
@@ -37,25 +41,60 @@ struct Geometry {
 	GLuint vao;
 	GLuint num_tris;
 	AABB aabb;
+
+    //vertex format. If packed (set before createVertexArrays), vertices are
+    //interleaved with half float uvs and 10-bit normals, and skin weights
+    //and joint ids are stored as bytes
+    bool packed_vertices = true;
+    GLenum index_type = GL_UNSIGNED_INT; //GL_UNSIGNED_SHORT if few enough vertices
+    GLuint num_vertices = 0;
+    size_t vertex_bytes = 0; //VRAM used by all vertex buffers
+    size_t index_bytes = 0;
+    //keep the packed vertex and index data uploaded, for MeshCache to write. Set before createVertexArrays
+    bool keep_packed = false;
+    std::vector<GLubyte> packed_vertex_data, packed_index_data;
+    int packed_layout = -1; //GeometryArena::Layout of packed vertices, in arena or not
+
+    //vertex cache, overdraw and fetch order optimization, see MeshOptimizer
+    bool optimize_order = true; //set before createVertexArrays
+    std::vector<GLuint> vertex_remap; //remap[original vertex] = optimized vertex, for data added later
+    float acmr_source = 0.0f, acmr = 0.0f, atvr = 0.0f; //before and after optimization
+
+    //packed geometries are sub-allocated from the shared buffers of their layout
+    //(see GeometryArena) unless use_arena is false. Set before createVertexArrays
+    bool use_arena = true;
+    int arena_layout = -1; //GeometryArena::Layout, -1 if geometry has its own vao
+    int arena_allocation = -1;
+    std::vector<GLuint> buffers; //own vertex and index buffers
+    void detachFromArena(); //copies data to own vao, so attributes can be added
+    void release(); //frees arena range or deletes own buffers
+
+    //triangles kept on cpu in a bvh, for raycasts against the mesh
+    bool build_bvh = true; //set before createVertexArrays
+    MeshBVH bvh;
     
     //material sets
     void createMaterialSet(int tri_count, int material_id);
     std::vector<int> material_sets;
     std::vector<int> material_set_ids;
+    std::vector<lm::vec3> material_set_centers; //object space, to sort transparent sets by depth
     
     //rendering
     void render();
     void render(int set);
+    void renderSets(const std::vector<int>& sets); //one multi-draw if in arena
 
 	//geometry, arrays and AABB
 	void createVertexArrays(std::vector<float>& vertices, std::vector<float>& uvs, std::vector<float>& normals, std::vector<unsigned int>& indices);
+    void uploadPacked(int layout, const void* vertex_data, GLuint vertex_count,
+                      const void* index_data, size_t index_size, GLenum packed_index_type);
     int createPlaneGeometry();
 	void setAABB(std::vector<GLfloat>& vertices);
+	void setMaterialSetCenters(std::vector<GLfloat>& vertices, std::vector<unsigned int>& indices);
     
     //terrain
     float max_terrain_height;
-    int createTerrain(int resolution, float step, float max_height, ImageData& height_map);
-    lm::vec3 calculateTerrainNormal(ImageData& height_map, int x, int y);
+    int terrain = -1; //index of chunked terrain in graphics system, if any
     
     //animation
     int addVertexWeights(std::vector<lm::vec4>& vertex_weights,
@@ -113,10 +152,14 @@ struct Framebuffer {
 	GLuint framebuffer = -1;
 	GLuint num_color_attachments = 0;
 	GLuint color_textures[10] = { 0,0,0,0,0,0,0,0,0,0 };
+	GLuint depth_renderbuffer = 0; //of initWeightedOIT
+	size_t bytes = 0; //gpu memory of all attachments
 	void bindAndClear();
     void bindAndClear(lm::vec4 clear_color);
 	void initColor(GLsizei width, GLsizei height);
 	void initDepth(GLsizei width, GLsizei height);
     void initGbuffer(GLsizei width, GLsizei height);
+    void initWeightedOIT(GLsizei width, GLsizei height);
+    void release(); //deletes framebuffer and attachments, e.g. to init at a new size
 };
 
@@ -0,0 +1,102 @@
+//
+//  JobPool.cpp
+//
+
+#include "JobPool.h"
+#include <algorithm>
+
+JobPool::~JobPool() {
+    shutdown();
+}
+
+void JobPool::init(int num_threads) {
+    shutdown();
+    if (num_threads <= 0)
+        num_threads = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+    quit_ = false;
+    for (int i = 0; i < num_threads; i++)
+        workers_.emplace_back(&JobPool::workerLoop_, this);
+}
+
+void JobPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    job_available_.notify_all();
+    for (auto& worker : workers_)
+        worker.join();
+    workers_.clear();
+    background_jobs_.clear();
+}
+
+void JobPool::workerLoop_() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            job_available_.wait(lock, [this] { return quit_ || !jobs_.empty() || !background_jobs_.empty(); });
+            if (quit_ && jobs_.empty()) return; //queued background jobs are dropped
+            std::deque<std::function<void()>>& queue = jobs_.empty() ? background_jobs_ : jobs_;
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        job();
+    }
+}
+
+void JobPool::submit(std::function<void()> job) {
+    if (workers_.empty()) {
+        job();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        background_jobs_.push_back(std::move(job));
+    }
+    job_available_.notify_one();
+}
+
+bool JobPool::runOneJob_() {
+    std::function<void()> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (jobs_.empty()) return false;
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+    }
+    job();
+    return true;
+}
+
+void JobPool::parallelFor(int count, int min_batch, const std::function<void(int, int)>& func) {
+    if (count <= 0) return;
+
+    //a few batches per thread, so uneven batches balance out
+    int num_batches = std::min(numThreads() * 4, (count + min_batch - 1) / std::max(min_batch, 1));
+    if (workers_.empty() || num_batches <= 1) {
+        func(0, count);
+        return;
+    }
+
+    int batch_size = (count + num_batches - 1) / num_batches;
+    std::atomic<int> remaining(0);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int begin = 0; begin < count; begin += batch_size) {
+            int end = std::min(begin + batch_size, count);
+            remaining++;
+            jobs_.push_back([&func, &remaining, begin, end] {
+                func(begin, end);
+                remaining--;
+            });
+        }
+    }
+    job_available_.notify_all();
+
+    //help out, then wait for any batches still running on workers
+    while (remaining > 0) {
+        if (!runOneJob_())
+            std::this_thread::yield();
+    }
+}
@@ -0,0 +1,48 @@
+//
+//  JobPool.h
+//
+//  Small pool of worker threads. Work is submitted as ranges with
+//  parallelFor, which splits the range into batches, lets the workers and
+//  the calling thread process them, and returns once all are done.
+//  Longer running work (file loading) can be submitted as background jobs,
+//  which workers pick up only when no parallelFor batch is waiting.
+//  Jobs must not touch OpenGL, as the context belongs to the main thread.
+//
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+class JobPool {
+public:
+    ~JobPool();
+
+    //starts worker threads. 0 = one less than number of hardware threads
+    void init(int num_threads = 0);
+    void shutdown();
+
+    //calls func(begin, end) for batches covering [0, count), in parallel
+    //- min_batch: smallest number of items worth sending to another thread
+    void parallelFor(int count, int min_batch, const std::function<void(int, int)>& func);
+
+    //queues job and returns immediately. Runs job on caller if there are no workers
+    void submit(std::function<void()> job);
+
+    //number of threads which do work, including the caller
+    int numThreads() const { return (int)workers_.size() + 1; }
+
+private:
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> jobs_;
+    std::deque<std::function<void()>> background_jobs_; //not run by parallelFor callers, so they never wait on them
+    std::mutex mutex_;
+    std::condition_variable job_available_;
+    bool quit_ = false;
+
+    void workerLoop_();
+    bool runOneJob_(); //returns false if queue was empty
+};
@@ -0,0 +1,49 @@
+//
+//  MappedFile.cpp
+//
+
+#include "MappedFile.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::string& filename, bool sequential) {
+#ifdef _WIN32
+    file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                        sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_ == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_, &file_size)) return false;
+    size = (size_t)file_size.QuadPart;
+    if (!size) return true;
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping_) return false;
+    data = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+#else
+    fd_ = ::open(filename.c_str(), O_RDONLY);
+    if (fd_ == -1) return false;
+    struct stat info;
+    if (fstat(fd_, &info) != 0) return false;
+    size = (size_t)info.st_size;
+    if (!size) return true;
+    void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (view == MAP_FAILED) return false;
+    if (sequential) madvise(view, size, MADV_SEQUENTIAL);
+    data = (const char*)view;
+#endif
+    return data != nullptr;
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+    if (data) munmap((void*)data, size);
+    if (fd_ != -1) close(fd_);
+#endif
+}
@@ -0,0 +1,33 @@
+//
+//  MappedFile.h
+//
+//  Read only view of a whole file through the OS page cache, so large files
+//  can be parsed or uploaded without first copying them into memory.
+//
+#pragma once
+#include <string>
+#include <cstddef>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+//unmapped when destroyed
+class MappedFile {
+public:
+    const char* data = nullptr;
+    size_t size = 0;
+
+    //false if the file can't be opened or mapped. An empty file opens with no data
+    bool open(const std::string& filename, bool sequential = true);
+    ~MappedFile();
+
+private:
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = NULL;
+#else
+    int fd_ = -1;
+#endif
+};
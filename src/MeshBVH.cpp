@@ -0,0 +1,347 @@
+//
+//  MeshBVH.cpp
+//
+
+#include "MeshBVH.h"
+#include "Parsers.h"
+#include "Terrain.h"
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+
+using namespace lm;
+
+//half surface area of box, the cost of a ray entering it
+static inline float halfArea_(const float* min, const float* max) {
+    float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+    return x * y + y * z + z * x;
+}
+
+static inline void grow_(float* min, float* max, const float* bmin, const float* bmax) {
+    for (int a = 0; a < 3; a++) {
+        min[a] = std::min(min[a], bmin[a]);
+        max[a] = std::max(max[a], bmax[a]);
+    }
+}
+
+void MeshBVH::clear() {
+    nodes_.clear(); nodes_.shrink_to_fit();
+    positions_.clear(); positions_.shrink_to_fit();
+    indices_.clear(); indices_.shrink_to_fit();
+}
+
+size_t MeshBVH::memoryBytes() const {
+    return nodes_.size() * sizeof(Node) + positions_.size() * sizeof(float) + indices_.size() * sizeof(unsigned int);
+}
+
+void MeshBVH::build(const std::vector<float>& positions, const std::vector<unsigned int>& indices) {
+    static_assert(sizeof(Node) == 32, "MeshBVH nodes should be 32 bytes");
+    auto start = std::chrono::high_resolution_clock::now();
+    clear();
+    int num_tris = (int)indices.size() / 3;
+    if (!num_tris) return;
+    positions_ = positions;
+
+    //bounds and centroid of each triangle
+    std::vector<float> tri_min(num_tris * 3), tri_max(num_tris * 3), centroids(num_tris * 3);
+    std::vector<int> order(num_tris);
+    for (int i = 0; i < num_tris; i++) {
+        const float* v[3] = { &positions[indices[i * 3] * 3], &positions[indices[i * 3 + 1] * 3], &positions[indices[i * 3 + 2] * 3] };
+        for (int a = 0; a < 3; a++) {
+            tri_min[i * 3 + a] = std::min(v[0][a], std::min(v[1][a], v[2][a]));
+            tri_max[i * 3 + a] = std::max(v[0][a], std::max(v[1][a], v[2][a]));
+            centroids[i * 3 + a] = (tri_min[i * 3 + a] + tri_max[i * 3 + a]) * 0.5f;
+        }
+        order[i] = i;
+    }
+
+    auto setBounds = [&](Node& node) {
+        for (int a = 0; a < 3; a++) { node.min[a] = FLT_MAX; node.max[a] = -FLT_MAX; }
+        for (int i = node.first; i < node.first + node.count; i++)
+            grow_(node.min, node.max, &tri_min[order[i] * 3], &tri_max[order[i] * 3]);
+    };
+
+    nodes_.reserve(num_tris * 2);
+    Node root;
+    root.first = 0;
+    root.count = num_tris;
+    setBounds(root);
+    nodes_.push_back(root);
+
+    //node, depth. Depth is capped so queries never overflow their stack
+    std::vector<std::pair<int, int>> pending;
+    pending.push_back(std::make_pair(0, 0));
+    while (!pending.empty()) {
+        int index = pending.back().first;
+        int depth = pending.back().second;
+        pending.pop_back();
+        Node node = nodes_[index];
+        if (node.count <= 2 || depth >= STACK_SIZE - 2) continue;
+
+        float cmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, cmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (int i = node.first; i < node.first + node.count; i++)
+            grow_(cmin, cmax, &centroids[order[i] * 3], &centroids[order[i] * 3]);
+
+        //cheapest split over bins of every axis, in units of area times triangles
+        int best_axis = -1, best_split = 0;
+        float best_cost = FLT_MAX;
+        for (int a = 0; a < 3; a++) {
+            float extent = cmax[a] - cmin[a];
+            if (extent <= 0.0f) continue;
+            int bin_count[BINS] = {};
+            float bin_min[BINS][3], bin_max[BINS][3];
+            for (int b = 0; b < BINS; b++)
+                for (int k = 0; k < 3; k++) { bin_min[b][k] = FLT_MAX; bin_max[b][k] = -FLT_MAX; }
+            float scale = BINS / extent;
+            for (int i = node.first; i < node.first + node.count; i++) {
+                int t = order[i];
+                int b = std::min(BINS - 1, (int)((centroids[t * 3 + a] - cmin[a]) * scale));
+                bin_count[b]++;
+                grow_(bin_min[b], bin_max[b], &tri_min[t * 3], &tri_max[t * 3]);
+            }
+            //area and count left of each split, then sweep back from the right
+            float left_area[BINS];
+            int left_count[BINS];
+            float lmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, lmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            int count = 0;
+            for (int s = 1; s < BINS; s++) {
+                count += bin_count[s - 1];
+                if (bin_count[s - 1]) grow_(lmin, lmax, bin_min[s - 1], bin_max[s - 1]);
+                left_count[s] = count;
+                left_area[s] = count ? halfArea_(lmin, lmax) : 0.0f;
+            }
+            float rmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, rmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            count = 0;
+            for (int s = BINS - 1; s >= 1; s--) {
+                count += bin_count[s];
+                if (bin_count[s]) grow_(rmin, rmax, bin_min[s], bin_max[s]);
+                if (!count || !left_count[s]) continue;
+                float cost = left_area[s] * left_count[s] + halfArea_(rmin, rmax) * count;
+                if (cost < best_cost) { best_cost = cost; best_axis = a; best_split = s; }
+            }
+        }
+
+        //a leaf costs its triangles, a split one traversal plus its children
+        float area = halfArea_(node.min, node.max);
+        bool split_pays = best_axis != -1 && area + best_cost < area * node.count;
+        if (!split_pays && node.count <= MAX_LEAF) continue;
+
+        int* begin = &order[node.first];
+        int* end = begin + node.count;
+        int* middle;
+        if (best_axis != -1) {
+            int a = best_axis;
+            float scale = BINS / (cmax[a] - cmin[a]);
+            middle = std::partition(begin, end, [&](int t) {
+                return std::min(BINS - 1, (int)((centroids[t * 3 + a] - cmin[a]) * scale)) < best_split;
+            });
+        }
+        else {
+            //all centroids in one point, halve by order
+            middle = begin + node.count / 2;
+        }
+
+        int left = (int)nodes_.size();
+        Node children[2];
+        children[0].first = node.first;
+        children[0].count = (int)(middle - begin);
+        children[1].first = node.first + children[0].count;
+        children[1].count = node.count - children[0].count;
+        setBounds(children[0]);
+        setBounds(children[1]);
+        nodes_.push_back(children[0]);
+        nodes_.push_back(children[1]);
+        nodes_[index].first = left;
+        nodes_[index].count = 0;
+        pending.push_back(std::make_pair(left, depth + 1));
+        pending.push_back(std::make_pair(left + 1, depth + 1));
+    }
+    nodes_.shrink_to_fit();
+
+    //triangles in leaf order
+    indices_.resize(num_tris * 3);
+    for (int i = 0; i < num_tris; i++)
+        for (int k = 0; k < 3; k++)
+            indices_[i * 3 + k] = indices[order[i] * 3 + k];
+
+    auto end = std::chrono::high_resolution_clock::now();
+    build_ms = std::chrono::duration<float, std::milli>(end - start).count();
+}
+
+//Moller Trumbore, either side facing. On floats, as it is the inner loop
+bool MeshBVH::intersectTriangle_(int triangle, const vec3& origin, const vec3& direction, float max_t, float& t) const {
+    const float* p0 = &positions_[indices_[triangle * 3] * 3];
+    const float* p1 = &positions_[indices_[triangle * 3 + 1] * 3];
+    const float* p2 = &positions_[indices_[triangle * 3 + 2] * 3];
+    float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    float d[3] = { direction.x, direction.y, direction.z };
+    float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+    float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    if (std::abs(det) < 1e-12f) return false;
+    float inv_det = 1.0f / det;
+    float s[3] = { origin.x - p0[0], origin.y - p0[1], origin.z - p0[2] };
+    float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_det;
+    if (u < 0.0f || u > 1.0f) return false;
+    float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+    float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv_det;
+    if (v < 0.0f || u + v > 1.0f) return false;
+    float hit_t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+    if (hit_t < 0.0f || hit_t > max_t) return false;
+    t = hit_t;
+    return true;
+}
+
+bool MeshBVH::raycast(const vec3& origin, const vec3& direction, float max_t, float& t, int& triangle) const {
+    if (nodes_.empty()) return false;
+    float o[3] = { origin.x, origin.y, origin.z };
+    //a zero component becomes a huge inverse rather than infinity, so that a ray
+    //lying on a slab plane never gives NaN
+    float inv[3];
+    for (int a = 0; a < 3; a++) {
+        float d = direction.value_[a];
+        inv[a] = 1.0f / (std::abs(d) > 1e-20f ? d : (d < 0.0f ? -1e-20f : 1e-20f));
+    }
+
+    //entry t of ray into node's box, or FLT_MAX
+    auto enter = [&](const Node& node, float limit) {
+        float t_min = 0.0f, t_max = limit;
+        for (int a = 0; a < 3; a++) {
+            float t1 = (node.min[a] - o[a]) * inv[a];
+            float t2 = (node.max[a] - o[a]) * inv[a];
+            t_min = std::max(t_min, std::min(t1, t2));
+            t_max = std::min(t_max, std::max(t1, t2));
+        }
+        return t_min <= t_max ? t_min : FLT_MAX;
+    };
+
+    float best = max_t;
+    int hit = -1;
+    int stack[STACK_SIZE];
+    float stack_t[STACK_SIZE];
+    int count = 0;
+    float root_t = enter(nodes_[0], best);
+    if (root_t == FLT_MAX) return false;
+    stack[count] = 0; stack_t[count++] = root_t;
+    while (count) {
+        count--;
+        if (stack_t[count] > best) continue;
+        const Node& node = nodes_[stack[count]];
+        if (node.count) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                float tri_t;
+                if (intersectTriangle_(i, origin, direction, best, tri_t)) { best = tri_t; hit = i; }
+            }
+            continue;
+        }
+        float t1 = enter(nodes_[node.first], best);
+        float t2 = enter(nodes_[node.first + 1], best);
+        //farther child first, so nearer one is popped first
+        int near_child = t1 <= t2 ? node.first : node.first + 1;
+        float near_t = std::min(t1, t2), far_t = std::max(t1, t2);
+        if (far_t != FLT_MAX) { stack[count] = near_child == node.first ? node.first + 1 : node.first; stack_t[count++] = far_t; }
+        if (near_t != FLT_MAX) { stack[count] = near_child; stack_t[count++] = near_t; }
+    }
+    if (hit == -1) return false;
+    t = best;
+    triangle = hit;
+    return true;
+}
+
+vec3 MeshBVH::triangleNormal(int triangle) const {
+    const float* p0 = &positions_[indices_[triangle * 3] * 3];
+    const float* p1 = &positions_[indices_[triangle * 3 + 1] * 3];
+    const float* p2 = &positions_[indices_[triangle * 3 + 2] * 3];
+    vec3 e1(p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]);
+    vec3 e2(p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]);
+    return e1.cross(e2).normalize();
+}
+
+void MeshBVH::benchmark(const std::vector<std::string>& obj_files, const std::vector<Terrain*>& terrains) {
+    const int num_rays = 100000;
+    const int num_checked = 1000; //rays also tested against every triangle
+    srand(1);
+    auto random = [](float a, float b) { return a + (b - a) * (rand() / (float)RAND_MAX); };
+
+    printf("%-36s %9s %8s %10s %10s %10s %8s %10s\n", "mesh", "tris", "nodes", "build (ms)", "memory KB", "Mrays/s", "hits", "mismatches");
+    auto run = [&](const std::string& name, const std::vector<float>& positions, const std::vector<unsigned int>& indices,
+                   const Terrain* terrain) {
+        MeshBVH bvh;
+        bvh.build(positions, indices);
+        if (bvh.empty()) return;
+        float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (size_t i = 0; i < positions.size(); i += 3)
+            grow_(min, max, &positions[i], &positions[i]);
+        vec3 lo(min[0], min[1], min[2]), hi(max[0], max[1], max[2]);
+        vec3 center = (lo + hi) * 0.5f;
+        float radius = (hi - lo).length() * 0.5f;
+
+        //rays from a sphere around the mesh to points inside its bounds; for
+        //terrains, down from above it, as ground queries are
+        std::vector<vec3> origins(num_rays), directions(num_rays);
+        for (int r = 0; r < num_rays; r++) {
+            vec3 target(random(lo.x, hi.x), random(lo.y, hi.y), random(lo.z, hi.z));
+            if (terrain) origins[r] = vec3(random(lo.x, hi.x), hi.y + 10.0f, random(lo.z, hi.z));
+            else origins[r] = center + vec3(random(-1, 1), random(-1, 1), random(-1, 1)).normalize() * (radius * 2.0f);
+            directions[r] = (target - origins[r]).normalize();
+        }
+        float max_t = radius * 4.0f;
+
+        std::vector<float> hit_t(num_rays);
+        std::vector<int> hit_triangle(num_rays);
+        int hits = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < num_rays; r++) {
+            hit_triangle[r] = -1;
+            if (bvh.raycast(origins[r], directions[r], max_t, hit_t[r], hit_triangle[r])) hits++;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        float seconds = std::chrono::duration<float>(end - start).count();
+
+        //nearest distance must match brute force
+        int mismatches = 0;
+        for (int r = 0; r < num_checked; r++) {
+            float nearest = max_t;
+            bool any = false;
+            for (int i = 0; i < bvh.numTriangles(); i++) {
+                float t;
+                if (bvh.intersectTriangle_(i, origins[r], directions[r], nearest, t)) { nearest = t; any = true; }
+            }
+            if (any != (hit_triangle[r] != -1) || (any && std::abs(nearest - hit_t[r]) > 1e-4f * (1.0f + nearest)))
+                mismatches++;
+        }
+        printf("%-36s %9d %8d %10.2f %10.1f %10.2f %7.1f%% %10d\n", name.c_str(), bvh.numTriangles(), bvh.numNodes(),
+               bvh.build_ms, (float)bvh.memoryBytes() / 1024.0f, num_rays / seconds / 1e6f, 100.0f * hits / num_rays, mismatches);
+
+        //heightfield march on the same rays, for comparison
+        if (terrain) {
+            int terrain_hits = 0;
+            start = std::chrono::high_resolution_clock::now();
+            for (int r = 0; r < num_rays; r++) {
+                vec3 point;
+                if (terrain->raycast(origins[r], directions[r], max_t, point)) terrain_hits++;
+            }
+            end = std::chrono::high_resolution_clock::now();
+            seconds = std::chrono::duration<float>(end - start).count();
+            printf("%-36s %9s %8s %10s %10s %10.2f %7.1f%% %10s\n", "  heightfield march", "-", "-", "-", "-",
+                   num_rays / seconds / 1e6f, 100.0f * terrain_hits / num_rays, "-");
+        }
+    };
+
+    for (auto& file : obj_files) {
+        std::vector<float> positions, uvs, normals;
+        std::vector<unsigned int> indices;
+        if (!Parsers::parseOBJ(file, positions, uvs, normals, indices) || indices.empty()) {
+            printf("%-36s could not be loaded\n", file.c_str());
+            continue;
+        }
+        run(file, positions, indices, nullptr);
+    }
+    for (size_t i = 0; i < terrains.size(); i++) {
+        std::vector<float> positions;
+        std::vector<unsigned int> indices;
+        terrains[i]->getTriangles(positions, indices);
+        run("terrain " + std::to_string(i), positions, indices, terrains[i]);
+    }
+}
@@ -0,0 +1,57 @@
+//
+//  MeshBVH.h
+//
+//  Bounding volume hierarchy over the triangles of one geometry, kept on the
+//  CPU for exact ray queries. It is built top down: each node is split along
+//  the axis and bin boundary (of 16 bins of triangle centroids) with the least
+//  surface area heuristic cost, and becomes a leaf when no split is cheaper
+//  than testing its triangles. Nodes are 32 bytes, children are stored next to
+//  each other, and triangles are reordered so each leaf's are contiguous.
+//
+#pragma once
+#include "includes.h"
+#include <vector>
+#include <string>
+
+class Terrain;
+
+class MeshBVH {
+public:
+    //copies positions (xyz per vertex) and triangles, and builds tree
+    void build(const std::vector<float>& positions, const std::vector<unsigned int>& indices);
+    void clear();
+    bool empty() const { return nodes_.empty(); }
+
+    //nearest triangle hit by origin + direction * t, 0 <= t <= max_t, from either
+    //side. direction need not be unit length, t is in its units
+    bool raycast(const lm::vec3& origin, const lm::vec3& direction, float max_t, float& t, int& triangle) const;
+    //unit normal of triangle, from its winding
+    lm::vec3 triangleNormal(int triangle) const;
+
+    int numTriangles() const { return (int)indices_.size() / 3; }
+    int numNodes() const { return (int)nodes_.size(); }
+    size_t memoryBytes() const;
+    float build_ms = 0.0f;
+
+    //prints table of build time, memory and rays per second for the obj files
+    //and terrains given, checking a sample of rays against every triangle
+    static void benchmark(const std::vector<std::string>& obj_files, const std::vector<Terrain*>& terrains);
+
+private:
+    friend class MeshCache; //writes and reads the arrays below as they are
+    struct Node {
+        float min[3];
+        int first; //leaf: first triangle, inner: left child, right child follows
+        float max[3];
+        int count; //triangles in leaf, 0 for inner nodes
+    };
+    static const int STACK_SIZE = 64;
+    static const int BINS = 16;
+    static const int MAX_LEAF = 8; //split larger leaves even if it costs more
+
+    std::vector<Node> nodes_;
+    std::vector<float> positions_;
+    std::vector<unsigned int> indices_; //three per triangle, in leaf order
+
+    bool intersectTriangle_(int triangle, const lm::vec3& origin, const lm::vec3& direction, float max_t, float& t) const;
+};
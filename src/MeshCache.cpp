@@ -0,0 +1,245 @@
+//
+//  MeshCache.cpp
+//
+
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include "ResourceCache.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define MAKE_DIR(path) _mkdir(path)
+#else
+#define MAKE_DIR(path) mkdir(path, 0755)
+#endif
+
+std::string MeshCache::cache_folder = "data/mesh_cache";
+MeshCacheStats MeshCache::stats;
+
+//start of a cooked file, followed by the blobs and arrays it counts, in order
+struct CookedHeader_ {
+    char magic[4]; //"MESH"
+    uint32_t version;
+    //source when cooked
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash;
+    //geometry settings it was cooked with
+    uint32_t optimized;
+    uint32_t has_bvh;
+    //vertices interleaved in GeometryArena layout, then indices of index_type
+    int32_t layout;
+    uint32_t num_vertices;
+    uint32_t index_type;
+    uint32_t num_material_sets; //end triangles and ids (ints), then centers (vec3)
+    uint64_t vertex_bytes;
+    uint64_t index_bytes;
+    uint32_t num_remap;
+    uint32_t bvh_nodes, bvh_positions, bvh_indices;
+    float aabb_center[3];
+    float aabb_half_width[3];
+    float acmr_source, acmr, atvr;
+    //extras: material names, each ending in 0, then source vertices
+    uint64_t names_bytes;
+    uint32_t num_source_vertices;
+};
+
+static bool statSource_(const std::string& path, uint64_t& size, int64_t& mtime) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return false;
+    size = (uint64_t)info.st_size;
+    mtime = (int64_t)info.st_mtime;
+    return true;
+}
+
+template <typename T>
+static void readArray_(const char*& p, std::vector<T>& v, size_t count) {
+    v.resize(count);
+    if (count) memcpy(&v[0], p, count * sizeof(T));
+    p += count * sizeof(T);
+}
+
+template <typename T>
+static void writeArray_(FILE* f, const std::vector<T>& v) {
+    if (!v.empty()) fwrite(&v[0], sizeof(T), v.size(), f);
+}
+
+//one file per source path and part, named by their hash
+std::string MeshCache::cookedPath_(const std::string& source, const std::string& part) {
+    std::string key = ResourceCache::canonicalPath(source);
+    if (!part.empty()) key += "#" + part;
+    unsigned long long hash = ResourceCache::HASH_SEED;
+    ResourceCache::hashBytes(key.data(), key.size(), hash);
+    char file[32];
+    snprintf(file, sizeof(file), "/%016llx.mesh", hash);
+    return cache_folder + file;
+}
+
+bool MeshCache::load(const std::string& source, Geometry& geometry, unsigned long long& source_hash,
+                     const std::string& part, CookedExtras* extras) {
+    if (!enabled() || !geometry.packed_vertices) return false;
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (!statSource_(source, source_size, source_mtime)) return false;
+
+    std::string path = cookedPath_(source, part);
+    CookedHeader_ header;
+    bool touched;
+    {
+        MappedFile file;
+        if (!file.open(path, false) || file.size < sizeof(header)) return false;
+        memcpy(&header, file.data, sizeof(header));
+        if (memcmp(header.magic, "MESH", 4) != 0 || header.version != VERSION) return false;
+        if (header.optimized != (uint32_t)geometry.optimize_order || header.has_bvh != (uint32_t)geometry.build_bvh)
+            return false;
+
+        //a new size means new contents, a new time only may (e.g. after a checkout)
+        if (header.source_size != source_size) {
+            stats.stale++;
+            return false;
+        }
+        touched = header.source_mtime != source_mtime;
+        if (touched) {
+            unsigned long long hash = ResourceCache::HASH_SEED;
+            if (!ResourceCache::hashFile(source, hash)) return false;
+            if (hash != header.source_hash) {
+                stats.stale++;
+                return false;
+            }
+        }
+
+        //truncated writes are cooked again
+        size_t expected = sizeof(header) + header.vertex_bytes + header.index_bytes +
+            header.num_material_sets * (2 * sizeof(int) + sizeof(lm::vec3)) + header.num_remap * sizeof(GLuint) +
+            header.bvh_nodes * sizeof(MeshBVH::Node) + header.bvh_positions * sizeof(float) +
+            header.bvh_indices * sizeof(unsigned int) + header.names_bytes + header.num_source_vertices * sizeof(GLuint);
+        if (file.size != expected) return false;
+
+        const char* p = file.data + sizeof(header);
+        const char* vertex_data = p;
+        p += header.vertex_bytes;
+        const char* index_data = p;
+        p += header.index_bytes;
+        readArray_(p, geometry.material_sets, header.num_material_sets);
+        readArray_(p, geometry.material_set_ids, header.num_material_sets);
+        readArray_(p, geometry.material_set_centers, header.num_material_sets);
+        readArray_(p, geometry.vertex_remap, header.num_remap);
+        geometry.bvh.clear();
+        readArray_(p, geometry.bvh.nodes_, header.bvh_nodes);
+        readArray_(p, geometry.bvh.positions_, header.bvh_positions);
+        readArray_(p, geometry.bvh.indices_, header.bvh_indices);
+        geometry.bvh.build_ms = 0.0f;
+        if (extras) {
+            extras->material_names.clear();
+            for (const char* name = p; name < p + header.names_bytes; name += strlen(name) + 1)
+                extras->material_names.push_back(name);
+        }
+        p += header.names_bytes;
+        if (extras) readArray_(p, extras->source_vertices, header.num_source_vertices);
+
+        geometry.acmr_source = header.acmr_source;
+        geometry.acmr = header.acmr;
+        geometry.atvr = header.atvr;
+        geometry.aabb.center = lm::vec3(header.aabb_center[0], header.aabb_center[1], header.aabb_center[2]);
+        geometry.aabb.half_width = lm::vec3(header.aabb_half_width[0], header.aabb_half_width[1], header.aabb_half_width[2]);
+        //straight from the mapped file to the GPU
+        geometry.uploadPacked(header.layout, vertex_data, header.num_vertices, index_data,
+                              (size_t)header.index_bytes, header.index_type);
+        source_hash = header.source_hash;
+    }
+
+    //same contents, store the new time so the next load need not hash the source
+    if (touched) {
+        header.source_mtime = source_mtime;
+        FILE* f = fopen(path.c_str(), "r+b");
+        if (f) {
+            fwrite(&header, sizeof(header), 1, f);
+            fclose(f);
+        }
+    }
+    return true;
+}
+
+void MeshCache::save(const std::string& source, Geometry& geometry, unsigned long long source_hash,
+                     const std::string& part, const CookedExtras* extras) {
+    if (!enabled() || geometry.packed_vertex_data.empty()) return;
+
+    CookedHeader_ header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MESH", 4);
+    header.version = VERSION;
+    bool source_ok = statSource_(source, header.source_size, header.source_mtime);
+    header.source_hash = source_hash;
+    header.optimized = geometry.optimize_order;
+    header.has_bvh = geometry.build_bvh;
+    header.layout = geometry.packed_layout;
+    header.num_vertices = geometry.num_vertices;
+    header.index_type = geometry.index_type;
+    header.num_material_sets = (uint32_t)geometry.material_sets.size();
+    header.vertex_bytes = geometry.packed_vertex_data.size();
+    header.index_bytes = geometry.packed_index_data.size();
+    header.num_remap = (uint32_t)geometry.vertex_remap.size();
+    header.bvh_nodes = (uint32_t)geometry.bvh.nodes_.size();
+    header.bvh_positions = (uint32_t)geometry.bvh.positions_.size();
+    header.bvh_indices = (uint32_t)geometry.bvh.indices_.size();
+    for (int i = 0; i < 3; i++) {
+        header.aabb_center[i] = geometry.aabb.center.value_[i];
+        header.aabb_half_width[i] = geometry.aabb.half_width.value_[i];
+    }
+    header.acmr_source = geometry.acmr_source;
+    header.acmr = geometry.acmr;
+    header.atvr = geometry.atvr;
+    std::string names;
+    if (extras) {
+        for (auto& name : extras->material_names)
+            names.append(name.c_str(), name.size() + 1);
+        header.num_source_vertices = (uint32_t)extras->source_vertices.size();
+    }
+    header.names_bytes = names.size();
+
+    std::string path = cookedPath_(source, part);
+    FILE* f = source_ok ? fopen(path.c_str(), "wb") : nullptr;
+    if (source_ok && !f) {
+        MAKE_DIR(cache_folder.c_str());
+        f = fopen(path.c_str(), "wb");
+    }
+    if (f) {
+        fwrite(&header, sizeof(header), 1, f);
+        writeArray_(f, geometry.packed_vertex_data);
+        writeArray_(f, geometry.packed_index_data);
+        writeArray_(f, geometry.material_sets);
+        writeArray_(f, geometry.material_set_ids);
+        writeArray_(f, geometry.material_set_centers);
+        writeArray_(f, geometry.vertex_remap);
+        writeArray_(f, geometry.bvh.nodes_);
+        writeArray_(f, geometry.bvh.positions_);
+        writeArray_(f, geometry.bvh.indices_);
+        if (!names.empty()) fwrite(names.data(), 1, names.size(), f);
+        if (extras) writeArray_(f, extras->source_vertices);
+        fclose(f);
+    }
+    else
+        std::cerr << "Could not write mesh cache " << path << std::endl;
+
+    //only kept for writing
+    std::vector<GLubyte>().swap(geometry.packed_vertex_data);
+    std::vector<GLubyte>().swap(geometry.packed_index_data);
+}
+
+void MeshCache::recordLoad(const std::string& source, bool warm, float ms) {
+    if (warm) {
+        stats.warm_loads++;
+        stats.warm_ms += ms;
+        stats.last_warm_ms = ms;
+    }
+    else {
+        stats.cold_loads++;
+        stats.cold_ms += ms;
+        stats.last_cold_ms = ms;
+    }
+    print("Loaded " + source + (warm ? " from mesh cache in " : " from source in ") + std::to_string(ms) + " ms");
+}
@@ -0,0 +1,58 @@
+//
+//  MeshCache.h
+//
+//  Cooked copies of geometries loaded from files, so later runs skip parsing,
+//  optimization and the BVH build. The first import writes the packed vertex
+//  and index data exactly as uploaded, with the AABB, material sets, vertex
+//  remap and BVH, to one file per source in cache_folder. Later loads map
+//  that file and upload straight from it, without reading the source. A
+//  cooked file records the size, modification time and content hash of its
+//  source (the hash is taken by the parser, as it reads the file): a new size
+//  means the source is cooked again, a new time alone that it is hashed and
+//  cooked again only if the hash differs. A source holding several
+//  geometries (e.g. a Collada file) cooks one file for each named part, and
+//  loaders may cook extras beside a geometry, see CookedExtras.
+//
+#pragma once
+#include "GraphicsUtilities.h"
+#include <string>
+#include <vector>
+
+//what a loader needs beside the geometry to use it without its source
+struct CookedExtras {
+    //material of each material set by name, "" for none, as material ids depend on load order
+    std::vector<std::string> material_names;
+    //source vertex of each vertex, in input order, e.g. to map Collada skin weights
+    std::vector<GLuint> source_vertices;
+};
+
+struct MeshCacheStats {
+    int cold_loads = 0; //parsed and cooked
+    int warm_loads = 0; //read from cooked file
+    int stale = 0; //cooked files replaced because their source changed
+    //loads of a file from GraphicsSystem::create(Multi)GeometryFromFile and Collada, source reads included
+    float cold_ms = 0.0f, warm_ms = 0.0f; //all loads of each kind
+    float last_cold_ms = 0.0f, last_warm_ms = 0.0f;
+};
+
+class MeshCache {
+public:
+    static std::string cache_folder; //empty disables the cache
+    static MeshCacheStats stats;
+    static bool enabled() { return !cache_folder.empty(); }
+
+    //fills and uploads geometry from the cooked file of source (and part), if there
+    //is one which matches the source and the geometry's settings. Gives the source's hash
+    static bool load(const std::string& source, Geometry& geometry, unsigned long long& source_hash,
+                     const std::string& part = "", CookedExtras* extras = nullptr);
+    //writes geometry, created with keep_packed, as the cooked file of source (and part)
+    //whose contents hash to source_hash, and frees its packed data
+    static void save(const std::string& source, Geometry& geometry, unsigned long long source_hash,
+                     const std::string& part = "", const CookedExtras* extras = nullptr);
+    //adds a timed load to stats, and prints it
+    static void recordLoad(const std::string& source, bool warm, float ms);
+
+private:
+    static const unsigned int VERSION = 3; //bump when packing changes
+    static std::string cookedPath_(const std::string& source, const std::string& part);
+};
@@ -0,0 +1,239 @@
+//
+//  MeshOptimizer.cpp
+//
+
+#include "MeshOptimizer.h"
+#include "Parsers.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#ifdef _WIN32
+#include "dirent.h"
+#else
+#include <dirent.h>
+#endif
+
+VertexCacheStats MeshOptimizer::analyzeVertexCache(const std::vector<GLuint>& indices, GLuint num_vertices, int cache_size) {
+    VertexCacheStats stats;
+    if (indices.empty()) return stats;
+
+    //a vertex is in cache if it was added less than cache_size misses ago
+    std::vector<int> added_at(num_vertices, -cache_size - 1);
+    std::vector<bool> used(num_vertices, false);
+    int misses = 0;
+    GLuint num_used = 0;
+    for (GLuint index : indices) {
+        if (misses - added_at[index] > cache_size) {
+            added_at[index] = misses;
+            misses++;
+        }
+        if (!used[index]) {
+            used[index] = true;
+            num_used++;
+        }
+    }
+
+    stats.acmr = (float)misses / (float)(indices.size() / 3);
+    stats.atvr = (float)misses / (float)num_used;
+    return stats;
+}
+
+// Tipsify: fans around a vertex, emitting all its remaining triangles, then
+// picks the next fanning vertex among those just used, preferring the one
+// which will still be in cache after its own triangles are emitted. When no
+// candidate is left it takes one from the dead end stack or scans forward,
+// which is where a new cluster starts.
+void MeshOptimizer::optimizeTriangles(std::vector<GLuint>& indices, size_t first, size_t last,
+                                      const std::vector<float>& positions, GLuint num_vertices, int cache_size) {
+    size_t num_tris = (last - first) / 3;
+    if (num_tris < 2) return;
+    const GLuint* tri_indices = &indices[first];
+
+    //vertex -> triangle adjacency, as offsets into a single array
+    std::vector<GLuint> live(num_vertices, 0);
+    for (size_t i = 0; i < num_tris * 3; i++) live[tri_indices[i]]++;
+    std::vector<GLuint> offsets(num_vertices + 1, 0);
+    for (GLuint v = 0; v < num_vertices; v++) offsets[v + 1] = offsets[v] + live[v];
+    std::vector<GLuint> adjacency(num_tris * 3);
+    std::vector<GLuint> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < num_tris; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[fill[tri_indices[t * 3 + k]]++] = (GLuint)t;
+
+    std::vector<int> cache_time(num_vertices, 0);
+    std::vector<bool> emitted(num_tris, false);
+    std::vector<GLuint> dead_end;
+    std::vector<GLuint> output;
+    output.reserve(num_tris * 3);
+    std::vector<size_t> cluster_starts; //in triangles
+    int time = cache_size + 1;
+    GLuint cursor = 0;
+
+    //start from first vertex used
+    int fan = (int)tri_indices[0];
+    cluster_starts.push_back(0);
+    std::vector<GLuint> candidates;
+
+    while (fan >= 0) {
+        candidates.clear();
+        for (GLuint a = offsets[fan]; a < offsets[fan + 1]; a++) {
+            GLuint t = adjacency[a];
+            if (emitted[t]) continue;
+            for (int k = 0; k < 3; k++) {
+                GLuint v = tri_indices[t * 3 + k];
+                output.push_back(v);
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cache_time[v] > cache_size)
+                    cache_time[v] = time++;
+            }
+            emitted[t] = true;
+        }
+
+        //best candidate stays in cache while its remaining triangles are emitted
+        int best = -1, best_priority = -1;
+        for (GLuint v : candidates) {
+            if (live[v] == 0) continue;
+            int priority = 0;
+            if (time - cache_time[v] + 2 * (int)live[v] <= cache_size)
+                priority = time - cache_time[v];
+            if (priority > best_priority) {
+                best = (int)v;
+                best_priority = priority;
+            }
+        }
+
+        if (best == -1) {
+            //dead end, start a new cluster
+            while (!dead_end.empty() && best == -1) {
+                GLuint d = dead_end.back();
+                dead_end.pop_back();
+                if (live[d] > 0) best = (int)d;
+            }
+            while (best == -1 && cursor < num_vertices) {
+                if (live[cursor] > 0) best = (int)cursor;
+                cursor++;
+            }
+            if (best != -1 && output.size() / 3 < num_tris)
+                cluster_starts.push_back(output.size() / 3);
+        }
+        fan = best;
+    }
+
+    //overdraw: sort clusters so those facing outward from the mesh centre,
+    //and furthest along that direction, are drawn first (Sander et al. 2007)
+    lm::vec3 mesh_center;
+    for (size_t i = 0; i < num_tris * 3; i++) {
+        GLuint v = output[i];
+        mesh_center = mesh_center + lm::vec3(positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2]);
+    }
+    mesh_center = mesh_center * (1.0f / (float)(num_tris * 3));
+
+    cluster_starts.push_back(num_tris);
+    std::vector<std::pair<float, size_t>> clusters; //sort key, cluster index
+    for (size_t c = 0; c + 1 < cluster_starts.size(); c++) {
+        lm::vec3 center, normal;
+        for (size_t t = cluster_starts[c]; t < cluster_starts[c + 1]; t++) {
+            lm::vec3 p[3];
+            for (int k = 0; k < 3; k++) {
+                GLuint v = output[t * 3 + k];
+                p[k] = lm::vec3(positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2]);
+            }
+            lm::vec3 area_normal = (p[1] - p[0]).cross(p[2] - p[0]); //length is twice area
+            float area = area_normal.length();
+            center = center + (p[0] + p[1] + p[2]) * (area / 3.0f);
+            normal = normal + area_normal;
+        }
+        float total_area = normal.length();
+        float key = 0.0f;
+        if (total_area > 0.0f) {
+            center = center * (1.0f / std::max(total_area, 0.000001f));
+            key = (center - mesh_center).dot(normal * (1.0f / total_area));
+        }
+        clusters.push_back(std::make_pair(-key, c));
+    }
+    std::stable_sort(clusters.begin(), clusters.end());
+
+    size_t out = first;
+    for (auto& cluster : clusters) {
+        size_t c = cluster.second;
+        for (size_t t = cluster_starts[c]; t < cluster_starts[c + 1]; t++)
+            for (int k = 0; k < 3; k++)
+                indices[out++] = output[t * 3 + k];
+    }
+}
+
+std::vector<GLuint> MeshOptimizer::optimizeVertexFetch(std::vector<GLuint>& indices, GLuint num_vertices) {
+    const GLuint unset = 0xffffffff;
+    std::vector<GLuint> remap(num_vertices, unset);
+    GLuint next = 0;
+    for (GLuint& index : indices) {
+        if (remap[index] == unset)
+            remap[index] = next++;
+        index = remap[index];
+    }
+    for (GLuint v = 0; v < num_vertices; v++)
+        if (remap[v] == unset) remap[v] = next++;
+    return remap;
+}
+
+std::vector<GLuint> MeshOptimizer::optimizeMesh(std::vector<float>& positions, std::vector<float>& uvs,
+                                                std::vector<float>& normals, std::vector<GLuint>& indices,
+                                                const std::vector<int>& set_ends) {
+    GLuint num_vertices = (GLuint)positions.size() / 3;
+
+    size_t first = 0;
+    for (size_t s = 0; s <= set_ends.size(); s++) {
+        size_t last = s < set_ends.size() ? (size_t)set_ends[s] * 3 : indices.size();
+        if (last > first)
+            optimizeTriangles(indices, first, last, positions, num_vertices);
+        first = std::max(first, last);
+    }
+
+    std::vector<GLuint> remap = optimizeVertexFetch(indices, num_vertices);
+    remapVertexData(positions, remap, 3);
+    remapVertexData(uvs, remap, 2);
+    remapVertexData(normals, remap, 3);
+    return remap;
+}
+
+//collects obj files in folder and its subfolders
+static void findOBJFiles(std::string folder, std::vector<std::string>& files) {
+    DIR* dir = opendir(folder.c_str());
+    if (!dir) return;
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        std::string path = folder + "/" + name;
+        if (entry->d_type == DT_DIR)
+            findOBJFiles(path, files);
+        else if (name.size() > 4 && (name.substr(name.size() - 4) == ".obj" || name.substr(name.size() - 4) == ".OBJ"))
+            files.push_back(path);
+    }
+    closedir(dir);
+}
+
+void MeshOptimizer::benchmark(std::string folder) {
+    std::vector<std::string> files;
+    findOBJFiles(folder, files);
+    std::sort(files.begin(), files.end());
+
+    printf("%-40s %8s %8s %8s %8s %8s %10s\n", "mesh", "tris", "verts", "ACMR", "ACMR opt", "ATVR opt", "time (ms)");
+    for (auto& file : files) {
+        std::vector<float> positions, uvs, normals;
+        std::vector<GLuint> indices;
+        if (!Parsers::parseOBJ(file, positions, uvs, normals, indices) || indices.empty()) continue;
+        GLuint num_vertices = (GLuint)positions.size() / 3;
+
+        VertexCacheStats before = analyzeVertexCache(indices, num_vertices);
+        auto start = std::chrono::high_resolution_clock::now();
+        optimizeMesh(positions, uvs, normals, indices, std::vector<int>());
+        auto end = std::chrono::high_resolution_clock::now();
+        VertexCacheStats after = analyzeVertexCache(indices, num_vertices);
+
+        float ms = std::chrono::duration<float, std::milli>(end - start).count();
+        printf("%-40s %8d %8d %8.3f %8.3f %8.3f %10.3f\n", file.c_str(), (int)indices.size() / 3, (int)num_vertices,
+               before.acmr, after.acmr, after.atvr, ms);
+    }
+}
@@ -0,0 +1,57 @@
+//
+//  MeshOptimizer.h
+//
+//  Load time optimization of indexed triangle meshes:
+//  - triangle order for the post transform vertex cache (Tipsify, Sander et al. 2007)
+//  - cluster order to reduce overdraw, keeping the clusters found by Tipsify
+//  - vertex order matching first use in the index buffer, for fetch locality
+//  All reordering is done within each material set, so sets stay contiguous.
+//
+#pragma once
+#include "includes.h"
+#include <vector>
+
+//average cache miss ratio (misses per triangle) and average transformed
+//vertex ratio (misses per vertex), for a FIFO cache
+struct VertexCacheStats {
+    float acmr = 0.0f;
+    float atvr = 0.0f;
+};
+
+class MeshOptimizer {
+public:
+    static const int CACHE_SIZE = 16;
+
+    //simulate FIFO post transform cache over index buffer
+    static VertexCacheStats analyzeVertexCache(const std::vector<GLuint>& indices, GLuint num_vertices,
+                                               int cache_size = CACHE_SIZE);
+
+    //reorder triangles of indices[first, last) for vertex cache, then sort
+    //resulting clusters front to back to reduce overdraw
+    static void optimizeTriangles(std::vector<GLuint>& indices, size_t first, size_t last,
+                                  const std::vector<float>& positions, GLuint num_vertices,
+                                  int cache_size = CACHE_SIZE);
+
+    //renumber vertices in order of first use. Returns remap, where remap[old] = new.
+    //Unused vertices are moved to the end
+    static std::vector<GLuint> optimizeVertexFetch(std::vector<GLuint>& indices, GLuint num_vertices);
+
+    //reorder per vertex data with 'components' values per vertex according to remap
+    template <typename T>
+    static void remapVertexData(std::vector<T>& data, const std::vector<GLuint>& remap, int components) {
+        if (data.size() < remap.size() * components) return;
+        std::vector<T> old_data(data);
+        for (size_t i = 0; i < remap.size(); i++)
+            for (int c = 0; c < components; c++)
+                data[remap[i] * components + c] = old_data[i * components + c];
+    }
+
+    //runs all stages on a mesh. set_ends are cumulative triangle counts of
+    //material sets, the last set runs to end of indices. Returns vertex remap
+    static std::vector<GLuint> optimizeMesh(std::vector<float>& positions, std::vector<float>& uvs,
+                                            std::vector<float>& normals, std::vector<GLuint>& indices,
+                                            const std::vector<int>& set_ends);
+
+    //parses every obj in folder (recursively), prints stats and timings of optimization
+    static void benchmark(std::string folder);
+};
@@ -0,0 +1,346 @@
+//
+//  ObjParser.cpp
+//
+
+#include "ObjParser.h"
+#include "Parsers.h"
+#include "extern.h"
+#include "MappedFile.h"
+#include "ResourceCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+static inline const char* skipSpace_(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+static inline bool isDigit_(char c) { return c >= '0' && c <= '9'; }
+
+//decimal float with optional sign, fraction and exponent. Up to 19 significant
+//digits go into an integer which is scaled once, so the result is within an
+//ulp or so of atof's
+static const char* parseFloat_(const char* p, const char* end, float& value) {
+    static const double POWERS[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    p = skipSpace_(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    for (; p < end && isDigit_(*p); p++) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) digits++;
+        }
+        else exponent++;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && isDigit_(*p); p++) {
+            if (digits >= 19) continue;
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) digits++;
+            exponent--;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+')) negative_exponent = *p++ == '-';
+        int e = 0;
+        for (; p < end && isDigit_(*p); p++)
+            if (e < 10000) e = e * 10 + (*p - '0');
+        exponent += negative_exponent ? -e : e;
+    }
+    double v = (double)mantissa;
+    if (exponent < 0) v = -exponent <= 22 ? v / POWERS[-exponent] : v * std::pow(10.0, exponent);
+    else if (exponent > 0) v = exponent <= 22 ? v * POWERS[exponent] : v * std::pow(10.0, exponent);
+    value = (float)(negative ? -v : v);
+    return p;
+}
+
+static inline const char* parseInt_(const char* p, const char* end, int& value) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    int v = 0;
+    for (; p < end && isDigit_(*p); p++) v = v * 10 + (*p - '0');
+    value = negative ? -v : v;
+    return p;
+}
+
+//what a chunk of lines holds. Face indices are 0 based, and -1 where a face
+//vertex has no uv or normal. Negative (relative) indices in the file count back
+//from the chunk's own vertices, so need its offset added when merging; their
+//slots in corners are listed in relative
+struct ObjChunk_ {
+    const char* begin;
+    const char* end;
+    std::vector<float> positions, uvs, normals;
+    std::vector<int> corners; //position, uv and normal per triangle corner
+    std::vector<int> relative; //slot in corners, which is 3 * corner + component
+    std::vector<int> material_starts; //in chunk triangles
+    std::vector<std::string> material_names;
+};
+
+static void tokenize_(ObjChunk_& chunk) {
+    const char* p = chunk.begin;
+    const char* end = chunk.end;
+    int face[3 * 64]; //corners of one polygon, more are ignored
+    while (p < end) {
+        p = skipSpace_(p, end);
+        const char* line_end = (const char*)memchr(p, '\n', end - p);
+        if (!line_end) line_end = end;
+
+        if (line_end - p > 2 && p[0] == 'v') {
+            float f[3];
+            if (p[1] == ' ' || p[1] == '\t') {
+                const char* q = p + 2;
+                for (int i = 0; i < 3; i++) q = parseFloat_(q, line_end, f[i]);
+                chunk.positions.insert(chunk.positions.end(), f, f + 3);
+            }
+            else if (p[1] == 't' && (p[2] == ' ' || p[2] == '\t')) {
+                const char* q = p + 3;
+                for (int i = 0; i < 2; i++) q = parseFloat_(q, line_end, f[i]);
+                chunk.uvs.insert(chunk.uvs.end(), f, f + 2);
+            }
+            else if (p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+                const char* q = p + 3;
+                for (int i = 0; i < 3; i++) q = parseFloat_(q, line_end, f[i]);
+                chunk.normals.insert(chunk.normals.end(), f, f + 3);
+            }
+        }
+        else if (line_end - p > 1 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            //v, v/t, v//n or v/t/n per corner
+            int counts[3] = { (int)chunk.positions.size() / 3, (int)chunk.uvs.size() / 2, (int)chunk.normals.size() / 3 };
+            int num_corners = 0;
+            const char* q = skipSpace_(p + 1, line_end);
+            while (q < line_end && num_corners < 64 && (isDigit_(*q) || *q == '-' || *q == '+')) {
+                int* corner = &face[num_corners * 3];
+                for (int c = 0; c < 3; c++) {
+                    corner[c] = 0;
+                    if (c > 0) {
+                        if (q >= line_end || *q != '/') continue;
+                        q++;
+                    }
+                    if (q < line_end && *q != '/' && !isDigit_(*q) && *q != '-' && *q != '+') continue;
+                    q = parseInt_(q, line_end, corner[c]);
+                }
+                num_corners++;
+                q = skipSpace_(q, line_end);
+                while (q < line_end && *q == '\r') q++;
+            }
+            //fan of triangles, each after the first starting at its new corner, so a
+            //quad 1 2 3 4 gives 1 2 3 and 4 1 3 as the line based parser did
+            for (int i = 2; i < num_corners; i++) {
+                int fan[3] = { 0, i - 1, i };
+                if (i > 2) { fan[0] = i; fan[1] = 0; fan[2] = i - 1; }
+                for (int k = 0; k < 3; k++) {
+                    for (int c = 0; c < 3; c++) {
+                        int index = face[fan[k] * 3 + c];
+                        if (index < 0) {
+                            chunk.relative.push_back((int)chunk.corners.size());
+                            index += counts[c];
+                        }
+                        else index -= 1; //0 (absent) becomes -1
+                        chunk.corners.push_back(index);
+                    }
+                }
+            }
+        }
+        else if (line_end - p > 7 && strncmp(p, "usemtl", 6) == 0 && (p[6] == ' ' || p[6] == '\t')) {
+            const char* name = skipSpace_(p + 7, line_end);
+            const char* name_end = line_end;
+            while (name_end > name && (name_end[-1] == '\r' || name_end[-1] == ' ' || name_end[-1] == '\t')) name_end--;
+            chunk.material_starts.push_back((int)chunk.corners.size() / 9);
+            chunk.material_names.push_back(std::string(name, name_end));
+        }
+        p = line_end + 1;
+    }
+}
+
+bool ObjParser::parse(const std::string& filename, ObjMesh& mesh) {
+    mesh = ObjMesh();
+    auto start = std::chrono::high_resolution_clock::now();
+    MappedFile file;
+    if (!file.open(filename)) {
+        print("ERROR: Could not open file " + filename);
+        return false;
+    }
+    auto mapped = std::chrono::high_resolution_clock::now();
+
+    //chunks of at least 256 KB, a few per thread, each ending after a newline
+    const size_t MIN_CHUNK = 256 * 1024;
+    size_t num_chunks = std::max<size_t>(1, std::min<size_t>(JOBS.numThreads() * 4, file.size / MIN_CHUNK));
+    std::vector<ObjChunk_> chunks;
+    const char* file_end = file.data + file.size;
+    const char* p = file.data;
+    for (size_t i = 0; i < num_chunks && p < file_end; i++) {
+        const char* end = i + 1 == num_chunks ? file_end : std::max(p, file.data + file.size * (i + 1) / num_chunks);
+        const char* newline = end < file_end ? (const char*)memchr(end, '\n', file_end - end) : nullptr;
+        end = newline ? newline + 1 : file_end;
+        chunks.emplace_back();
+        chunks.back().begin = p;
+        chunks.back().end = end;
+        p = end;
+    }
+    //one more item hashes the whole file alongside, for caches keyed on contents
+    mesh.source_hash = ResourceCache::HASH_SEED;
+    JOBS.parallelFor((int)chunks.size() + 1, 1, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            if (i < (int)chunks.size()) tokenize_(chunks[i]);
+            else ResourceCache::hashBytes(file.data, file.size, mesh.source_hash);
+        }
+    });
+    auto tokenized = std::chrono::high_resolution_clock::now();
+
+    //offsets of each chunk's vertices, and its relative indices resolved
+    int totals[3] = { 0, 0, 0 };
+    size_t num_corners = 0;
+    for (auto& chunk : chunks) {
+        for (int slot : chunk.relative) chunk.corners[slot] += totals[slot % 3];
+        for (auto start : chunk.material_starts) mesh.material_starts.push_back(start + (int)(num_corners / 3));
+        mesh.material_names.insert(mesh.material_names.end(), chunk.material_names.begin(), chunk.material_names.end());
+        totals[0] += (int)chunk.positions.size() / 3;
+        totals[1] += (int)chunk.uvs.size() / 2;
+        totals[2] += (int)chunk.normals.size() / 3;
+        num_corners += chunk.corners.size() / 3;
+    }
+    std::vector<float> positions, uvs, normals;
+    positions.reserve(totals[0] * 3);
+    uvs.reserve(totals[1] * 2);
+    normals.reserve(totals[2] * 3);
+    for (auto& chunk : chunks) {
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+        uvs.insert(uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+        normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+    }
+
+    //dedup on index triplet: a chain of vertices per position, each keyed by
+    //its uv and normal indices packed in one integer
+    std::vector<int> first(totals[0], -1);
+    std::vector<int> next;
+    std::vector<uint64_t> keys;
+    std::vector<int> sources; //position, uv, normal of each vertex
+    next.reserve(num_corners / 4);
+    keys.reserve(num_corners / 4);
+    sources.reserve(num_corners / 4 * 3);
+    mesh.indices.resize(num_corners);
+    size_t corner = 0;
+    for (auto& chunk : chunks) {
+        for (size_t i = 0; i < chunk.corners.size(); i += 3) {
+            const int* c = &chunk.corners[i];
+            if (c[0] < 0 || c[0] >= totals[0] || c[1] >= totals[1] || c[2] >= totals[2] || c[1] < -1 || c[2] < -1) {
+                print("ERROR: Face index out of range in " + filename);
+                return false;
+            }
+            uint64_t key = (uint64_t)(uint32_t)c[1] << 32 | (uint32_t)c[2];
+            int vertex = first[c[0]];
+            while (vertex != -1 && keys[vertex] != key) vertex = next[vertex];
+            if (vertex == -1) {
+                vertex = (int)keys.size();
+                keys.push_back(key);
+                next.push_back(first[c[0]]);
+                first[c[0]] = vertex;
+                sources.insert(sources.end(), c, c + 3);
+            }
+            mesh.indices[corner++] = vertex;
+        }
+        //free chunk as it is merged
+        std::vector<int>().swap(chunk.corners);
+    }
+
+    //vertex attributes, in parallel
+    int num_vertices = (int)keys.size();
+    mesh.vertices.resize(num_vertices * 3);
+    mesh.uvs.resize(num_vertices * 2);
+    mesh.normals.resize(num_vertices * 3);
+    JOBS.parallelFor(num_vertices, 4096, [&](int begin, int end) {
+        for (int v = begin; v < end; v++) {
+            const int* s = &sources[v * 3];
+            for (int k = 0; k < 3; k++) mesh.vertices[v * 3 + k] = positions[s[0] * 3 + k];
+            for (int k = 0; k < 2; k++) mesh.uvs[v * 2 + k] = s[1] == -1 ? 0.0f : uvs[s[1] * 2 + k];
+            for (int k = 0; k < 3; k++) mesh.normals[v * 3 + k] = s[2] == -1 ? 0.0f : normals[s[2] * 3 + k];
+        }
+    });
+    auto end = std::chrono::high_resolution_clock::now();
+
+    mesh.chunks = (int)chunks.size();
+    mesh.map_ms = std::chrono::duration<float, std::milli>(mapped - start).count();
+    mesh.tokenize_ms = std::chrono::duration<float, std::milli>(tokenized - mapped).count();
+    mesh.merge_ms = std::chrono::duration<float, std::milli>(end - tokenized).count();
+    return true;
+}
+
+//square grid with uvs and normals, of at least num_triangles
+static void writeGridOBJ_(const std::string& filename, int num_triangles) {
+    int quads = (int)std::ceil(std::sqrt(num_triangles / 2.0));
+    int side = quads + 1;
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file) return;
+    for (int z = 0; z < side; z++)
+        for (int x = 0; x < side; x++)
+            fprintf(file, "v %.6f %.6f %.6f\n", x * 0.1f, std::sin(x * 0.05f) * std::cos(z * 0.07f), z * 0.1f);
+    for (int z = 0; z < side; z++)
+        for (int x = 0; x < side; x++)
+            fprintf(file, "vt %.6f %.6f\n", (float)x / quads, (float)z / quads);
+    fprintf(file, "vn 0.000000 1.000000 0.000000\n");
+    for (int z = 0; z < quads; z++) {
+        for (int x = 0; x < quads; x++) {
+            int a = z * side + x + 1, b = a + 1, c = a + side, d = c + 1;
+            fprintf(file, "f %d/%d/1 %d/%d/1 %d/%d/1\nf %d/%d/1 %d/%d/1 %d/%d/1\n", a, a, c, c, b, b, b, b, c, c, d, d);
+        }
+    }
+    fclose(file);
+}
+
+void ObjParser::benchmark(const std::vector<std::string>& files, int generated_triangles) {
+    std::vector<std::string> all_files = files;
+    std::string grid_file = "obj_benchmark_grid.obj";
+    if (generated_triangles > 0) {
+        writeGridOBJ_(grid_file, generated_triangles);
+        all_files.push_back(grid_file);
+    }
+
+    printf("%-40s %9s %9s %7s %12s %12s %30s %8s %10s\n", "file", "tris", "verts", "chunks", "getline (ms)",
+           "mapped (ms)", "map / tokenize / merge (ms)", "speedup", "mismatches");
+    for (auto& file : all_files) {
+        std::vector<float> vertices, uvs, normals;
+        std::vector<unsigned int> indices;
+        auto start = std::chrono::high_resolution_clock::now();
+        bool loaded = Parsers::parseOBJ_getline(file, vertices, uvs, normals, indices);
+        auto end = std::chrono::high_resolution_clock::now();
+        float getline_ms = std::chrono::duration<float, std::milli>(end - start).count();
+
+        ObjMesh mesh;
+        start = std::chrono::high_resolution_clock::now();
+        bool parsed = parse(file, mesh);
+        end = std::chrono::high_resolution_clock::now();
+        float mapped_ms = std::chrono::duration<float, std::milli>(end - start).count();
+        if (!loaded || !parsed) {
+            printf("%-40s could not be loaded\n", file.c_str());
+            continue;
+        }
+
+        //same indices, and floats within rounding of atof
+        size_t mismatches = 0;
+        auto compare = [&](const std::vector<float>& a, const std::vector<float>& b) {
+            if (a.size() != b.size()) { mismatches += std::max(a.size(), b.size()); return; }
+            for (size_t i = 0; i < a.size(); i++)
+                if (std::abs(a[i] - b[i]) > 1e-6f * std::max(1.0f, std::abs(a[i]))) mismatches++;
+        };
+        if (indices != mesh.indices) mismatches++;
+        compare(vertices, mesh.vertices);
+        compare(uvs, mesh.uvs);
+        compare(normals, mesh.normals);
+
+        char split[64];
+        snprintf(split, sizeof(split), "%.1f / %.1f / %.1f", mesh.map_ms, mesh.tokenize_ms, mesh.merge_ms);
+        printf("%-40s %9d %9d %7d %12.1f %12.1f %30s %7.1fx %10d\n", file.c_str(), (int)mesh.indices.size() / 3,
+               (int)mesh.vertices.size() / 3, mesh.chunks, getline_ms, mapped_ms, split, getline_ms / mapped_ms, (int)mismatches);
+    }
+    if (generated_triangles > 0) remove(grid_file.c_str());
+}
@@ -0,0 +1,38 @@
+//
+//  ObjParser.h
+//
+//  Wavefront OBJ reader for large files. The file is memory mapped and cut
+//  into chunks at line ends, and the job pool tokenizes the chunks in
+//  parallel straight from the mapped bytes, with no string per line or word.
+//  The chunks are then merged in file order. Face vertices are deduplicated
+//  on their position, uv and normal indices, numbered in order of first use
+//  as by the line based parser, so both give the same mesh.
+//
+#pragma once
+#include "includes.h"
+#include <vector>
+#include <string>
+
+//contents of an obj file, ready for Geometry::createVertexArrays
+struct ObjMesh {
+    std::vector<float> vertices, uvs, normals; //zero where a face vertex has no uv or normal
+    std::vector<unsigned int> indices; //polygons are split into triangle fans
+    //usemtl lines: triangles before each, and material name
+    std::vector<int> material_starts;
+    std::vector<std::string> material_names;
+    unsigned long long source_hash = 0; //of the file's bytes, as ResourceCache::hashFile
+
+    //timings of parse
+    int chunks = 0;
+    float map_ms = 0.0f, tokenize_ms = 0.0f, merge_ms = 0.0f;
+};
+
+class ObjParser {
+public:
+    //false, with message, if file can't be opened or a face has an index out of range
+    static bool parse(const std::string& filename, ObjMesh& mesh);
+
+    //times parse against Parsers::parseOBJ_getline on each file, and on a generated
+    //grid of generated_triangles if not 0, and checks they agree. Prints to console
+    static void benchmark(const std::vector<std::string>& files, int generated_triangles = 0);
+};
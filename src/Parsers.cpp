@@ -1,4 +1,11 @@
 #include "Parsers.h"
+#include "Texture.h"
+#include "ResourceCache.h"
+#include "ObjParser.h"
+#include "MeshCache.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <regex>
 #include <unordered_map>
@@ -139,8 +146,20 @@ bool Parsers::parseMTL(std::string path, std::string filename, std::vector<Mater
     return false;
 }
 
-//parses a wavefront object into passed arrays
+//parses a wavefront object into passed arrays, see ObjParser
 bool Parsers::parseOBJ(std::string filename, std::vector<float>& vertices, std::vector<float>& uvs, std::vector<float>& normals, std::vector<unsigned int>& indices) {
+	ObjMesh mesh;
+	if (!ObjParser::parse(filename, mesh)) return false;
+	vertices.swap(mesh.vertices);
+	uvs.swap(mesh.uvs);
+	normals.swap(mesh.normals);
+	indices.swap(mesh.indices);
+	return true;
+}
+
+//parses a wavefront object line by line, as parseOBJ did before ObjParser
+//kept as the reference ObjParser::benchmark compares against
+bool Parsers::parseOBJ_getline(std::string filename, std::vector<float>& vertices, std::vector<float>& uvs, std::vector<float>& normals, std::vector<unsigned int>& indices) {
     
     vertices.clear();
     uvs.clear();
@@ -271,173 +290,67 @@ bool Parsers::parseOBJ(std::string filename, std::vector<float>& vertices, std::
 }
 
 
-//parses a wavefront object into passed arrays
-int Parsers::parseOBJ_multi(std::string filename, std::vector<Geometry>& geometries, std::vector<Material>& materials) {
-    
-    std::vector<GLfloat> vertices, uvs, normals;
-    std::vector<GLuint> indices;
-    
-    std::string path;
-    size_t position_last_separator = filename.find_last_of("\\/");
-    if (std::string::npos != position_last_separator) {
-        path += filename.substr(0, position_last_separator + 1);
-        filename = filename.substr(position_last_separator + 1);
-    }
-    
-    
-    std::string line;
-    std::ifstream file(path + filename);
-    if (file.is_open())
-    {
-        //declare containers for temporary and final attributes
-        std::vector<lm::vec3> temp_vertices;
-        std::vector<lm::vec2> temp_uvs;
-        std::vector<lm::vec3> temp_normals;
-        
-        //container to store map for indices
-        std::unordered_map<std::string, int> indices_map;
-        int next_index = 0; //stores next available index
-        
-        //current material id allows us to store material ids for sub-materials
-        //it starts at -1, we set it as soon as we see a usemtl line
-        int current_material_id = -1;
-        bool usemtl = false; // used to say whether obj uses mtl or not
-        
-        //create 'empty' geometry
-        geometries.emplace_back();
-        Geometry* current_geometry = &(geometries.back());
-        
-        
-        //parse file line by line
-        while (std::getline(file, line))
-        {
-            //split line string
-            std::vector<std::string> words;
-            split(line, " ", words);
-            
-            if (words.empty()) continue; //empty line, skip
-            if (words[0][0] == '#')    continue; //first word starts with #, line is a comment
-            
-            if (words[0] == "v") { //line contains vertex data
-                //read words to floats
-                lm::vec3 pos( (float)atof( words[1].c_str() ),
-                             (float)atof( words[2].c_str() ),
-                             (float)atof( words[3].c_str() ) );
-                //add to temporary vector of positions
-                temp_vertices.push_back(pos);
-            }
-            if (words[0] == "vt") { //line contains texture data
-                //read words to floats
-                lm::vec2 tex( (float)atof(words[1].c_str() ),
-                             (float)atof(words[2].c_str() ) );
-                //add to temporary vector of texture coords
-                temp_uvs.push_back(tex);
-            }
-            if (words[0] == "vn") { //line contains vertex data
-                //read words to floats
-                lm::vec3 norm( (float)atof(words[1].c_str() ),
-                              (float)atof(words[2].c_str() ),
-                              (float)atof(words[3].c_str() ) );
-                //add to temporary vector of normals
-                temp_normals.push_back(norm);
-            }
-            if (words[0] == "f") {//line contains face-vertex data
-                if (words.size() < 4) continue; // faces with fewer than 3 vertices??!
-                
-                bool quad_face = false; //boolean to help us deal with quad faces
-                
-                std::vector<std::string> nums; // container used for split indices
-                //for each face vertex
-                for (int i = 1; i < words.size(); i++) {
-                    
-                    //check if face vertex has already been indexed
-                    if (indices_map.count(words[i]) == 0) {
-                        
-                        //if not, start by getting all indices
-                        nums.clear();
-                        split(words[i], "/", nums);
-                        int v_ind = atoi(nums[0].c_str()) - 1; //subtract 1 to convert to 0-based array!
-                        int t_ind = atoi(nums[1].c_str()) - 1;
-                        int n_ind = atoi(nums[2].c_str()) - 1;
-                        
-                        //add vertices to final arrays of floats
-                        for (int j = 0; j < 3; j++)
-                            vertices.push_back(temp_vertices[v_ind].value_[j]);
-                        for (int j = 0; j < 2; j++)
-                            uvs.push_back(temp_uvs[t_ind].value_[j]);
-                        for (int j = 0; j < 3; j++)
-                            normals.push_back(temp_normals[n_ind].value_[j]);
-                        
-                        //add an index to final array
-                        indices.push_back(next_index);
-                        
-                        //record that this index is used for this face vertex
-                        indices_map[words[i]] = next_index;
-                        
-                        //increment index
-                        next_index++;
-                    }
-                    else {
-                        //face vertex was already added to final arrays
-                        //so search for its stored index
-                        int the_index = indices_map.at(words[i]); //safe to use as we know it exists
-                        //add it to final index array
-                        indices.push_back(the_index);
-                    }
-                    
-                    //***CHECK FOR QUAD FACES****
-                    //If the face is a quads (i.e. words.size() == 5), we need to create two triangles
-                    //out of the quad. We have already created one triangle with words[1], [2] and [3]
-                    //now we make another with [4], [1] and [3].
-                    if (i == 4 ) {
-                        //face-vertex 4 is already added, so we search for indices of 1 and 3 and add them
-                        int index_1 = indices_map.at(words[1]);
-                        indices.push_back(index_1);
-                        int index_3 = indices_map.at(words[3]);
-                        indices.push_back(index_3);
-                    }
-                    
-                }
-                
-            }
-            if (words[0] == "usemtl") { //
-                //we create material sets at the *end* of a list of faces
-                //so if this is the first time we see this keyword, we do nothing
-                
-                if (!usemtl) // first time, do nothing
-                    usemtl = true;
-                else //subsequent times, create material set for previous indices
-                    current_geometry->createMaterialSet((int)indices.size()/3, current_material_id);
-                
-                //search materials array for mat with name
-                //if not exists, current_material_id stays as -1
-                for (int i = 0; i < materials.size(); i++){
-                    if (materials[i].name == words[1]){
-                        current_material_id = i;
-                        break;
-                    }
-                    
+//parses a wavefront object into a new geometry, with a material set for each usemtl
+int Parsers::parseOBJ_multi(std::string filename, std::vector<Geometry>& geometries, std::vector<Material>& materials, bool& warm) {
+    
+    //cooked on an earlier import. Material ids depend on what was loaded before,
+    //so sets find their material by name again
+    Geometry cooked_geom;
+    CookedExtras extras;
+    unsigned long long hash = 0;
+    if (MeshCache::load(filename, cooked_geom, hash, "multi", &extras)) {
+        warm = true;
+        for (size_t s = 0; s < cooked_geom.material_set_ids.size(); s++) {
+            cooked_geom.material_set_ids[s] = -1;
+            for (int m = 0; m < (int)materials.size() && s < extras.material_names.size(); m++) {
+                if (!extras.material_names[s].empty() && materials[m].name == extras.material_names[s]) {
+                    cooked_geom.material_set_ids[s] = m;
+                    break;
                 }
             }
-            
-            
         }
-        file.close();
-        
-        //create vertex arrays
-        current_geometry->createVertexArrays(vertices, uvs, normals, indices);
-        //close final (or only) material set and sets transparency flat
-        current_geometry->createMaterialSet((int)indices.size()/3, current_material_id);
-        
-        
-        
-        //return index of new geometry in the geometries array
+        geometries.push_back(cooked_geom);
         return (int)geometries.size() - 1;
     }
-    return -1;
+
+    ObjMesh mesh;
+    if (!ObjParser::parse(filename, mesh)) return -1;
+    
+    //create 'empty' geometry
+    geometries.emplace_back();
+    Geometry* current_geometry = &(geometries.back());
+    current_geometry->keep_packed = MeshCache::enabled();
+    
+    //we create material sets at the *end* of a list of faces, so the first usemtl
+    //closes no set. current material stays as it was if no material has its name
+    int current_material_id = -1;
+    for (size_t i = 0; i < mesh.material_starts.size(); i++) {
+        if (i > 0)
+            current_geometry->createMaterialSet(mesh.material_starts[i], current_material_id);
+        for (int m = 0; m < materials.size(); m++) {
+            if (materials[m].name == mesh.material_names[i]) {
+                current_material_id = m;
+                break;
+            }
+        }
+    }
+    
+    //create vertex arrays
+    current_geometry->createVertexArrays(mesh.vertices, mesh.uvs, mesh.normals, mesh.indices);
+    //close final (or only) material set and sets transparency flat
+    current_geometry->createMaterialSet((int)mesh.indices.size()/3, current_material_id);
+    //sets are final now; vertices and indices are in the order the optimizer left them
+    current_geometry->setMaterialSetCenters(mesh.vertices, mesh.indices);
+    for (int id : current_geometry->material_set_ids)
+        extras.material_names.push_back(id != -1 ? materials[id].name : "");
+    MeshCache::save(filename, *current_geometry, mesh.source_hash, "multi", &extras);
+    
+    //return index of new geometry in the geometries array
+    return (int)geometries.size() - 1;
 }
 
-// load uncompressed RGB targa file into an OpenGL texture
+// load uncompressed RGB targa file, or a DDS/KTX file with its mip chain, into an OpenGL texture
+// unless its data is kept, the texture is returned at once and streamed in later (see Texture.h)
 GLint Parsers::parseTexture(std::string filename,
                             ImageData* image_data,
                             bool keep_data) {
@@ -445,55 +358,46 @@ GLint Parsers::parseTexture(std::string filename,
 	std::string str = filename;
 	std::string ext = str.substr(str.size() - 4, 4);
 
+	bool supported = ext == ".tga" || ext == ".TGA" || ext == ".dds" || ext == ".DDS" || ext == ".ktx" || ext == ".KTX";
 
-	GLuint texture_id;
+	//textures whose pixels the engine does not keep are shared through the cache
+	//and go through Texture, streamed unless disabled
+	if (supported && !keep_data)
+	{
+		return ResourceCache::acquire(ResourceTexture, filename, [](std::string path, unsigned long long& hash) -> int {
+			//streamed textures report their hash once loaded
+			if (Texture::streaming)
+				return Texture::loadAsync(path);
+			TextureImage image;
+			if (!Texture::loadFile(path, image)) return -1;
+			hash = Texture::contentHash(image);
+			int shared = ResourceCache::findByHash(ResourceTexture, hash);
+			if (shared != -1) return shared;
+			return Texture::upload(image, path);
+		});
+	}
 
+	//textures whose pixels the engine also reads, e.g. height maps, are shared as
+	//well; the cache keeps the pixels, and each caller gets a copy it must free
 	if (ext == ".tga" || ext == ".TGA")
 	{
-		TGAInfo* tgainfo = loadTGA(filename);
-		if (tgainfo == NULL) {
-			std::cerr << "ERROR: Could not load TGA file" << std::endl;
-			return false;
-		}
+		ResourcePixels loaded;
+		int texture = ResourceCache::acquire(ResourceTextureData, filename, [&loaded](std::string path, unsigned long long&) -> int {
+			return (int)loadTextureWithPixels_(path, loaded);
+		});
+		if (texture == -1) return -1;
+		if (!loaded.data.empty())
+			ResourceCache::setPixels(ResourceTextureData, texture, std::move(loaded));
 
-		//generate new openGL texture and bind it (tell openGL we want to do stuff with it)
-		glGenTextures(1, &texture_id);
-		glBindTexture(GL_TEXTURE_2D, texture_id); //we are making a regular 2D texture
-
-												  //screen pixels will almost certainly not be same as texture pixels, so we need to
-												  //set some parameters regarding the filter we use to deal with these cases
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);	//set the mag filter
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); //set the min filter
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4); //use anisotropic filtering
-
-																		  //this is function that actually loads texture data into OpenGL
-		glTexImage2D(GL_TEXTURE_2D, //the target type, a 2D texture
-			0, //the base level-of-detail in the mipmap
-			(tgainfo->bpp == 24 ? GL_RGB : GL_RGBA), //specified the color channels for opengl
-			tgainfo->width, //the width of the texture
-			tgainfo->height, //the height of the texture
-			0, //border - must always be 0
-			(tgainfo->bpp == 24 ? GL_BGR : GL_BGRA), //the format of the incoming data
-			GL_UNSIGNED_BYTE, //the type of the incoming data
-			tgainfo->data); // a pointer to the incoming data
-
-        //we want to use mipmaps
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-        //clean up memory if required
-        if (!keep_data) {
-            delete tgainfo->data;
-            delete tgainfo;
-        }
-        else {
-            //keep image data for use in engine
-            image_data->data = tgainfo->data;
-            image_data->width = tgainfo->width;
-            image_data->height = tgainfo->height;
-            image_data->bytes_pp = tgainfo->bpp / 8;
-            //delete tgainfo;
-        }
-		return texture_id;
+		const ResourcePixels* pixels = ResourceCache::pixels(ResourceTextureData, texture);
+		if (pixels && image_data) {
+			image_data->data = (GLubyte*)malloc(pixels->data.size());
+			memcpy(image_data->data, pixels->data.data(), pixels->data.size());
+			image_data->width = pixels->width;
+			image_data->height = pixels->height;
+			image_data->bytes_pp = pixels->bytes_pp;
+		}
+		return texture;
 	}
 	else {
 		std::cerr << "ERROR: No extension or extension not supported" << std::endl;
@@ -501,6 +405,58 @@ GLint Parsers::parseTexture(std::string filename,
 	}
 }
 
+//uncompressed tga with generated mips; its pixels are moved into pixels
+GLuint Parsers::loadTextureWithPixels_(std::string filename, ResourcePixels& pixels) {
+	GLuint texture_id;
+	TGAInfo* tgainfo = loadTGA(filename);
+	if (tgainfo == NULL) {
+		std::cerr << "ERROR: Could not load TGA file" << std::endl;
+		return 0;
+	}
+
+	//generate new openGL texture and bind it (tell openGL we want to do stuff with it)
+	glGenTextures(1, &texture_id);
+	glBindTexture(GL_TEXTURE_2D, texture_id); //we are making a regular 2D texture
+
+											  //screen pixels will almost certainly not be same as texture pixels, so we need to
+											  //set some parameters regarding the filter we use to deal with these cases
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);	//set the mag filter
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); //set the min filter
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4); //use anisotropic filtering
+
+																	  //this is function that actually loads texture data into OpenGL
+	glTexImage2D(GL_TEXTURE_2D, //the target type, a 2D texture
+		0, //the base level-of-detail in the mipmap
+		(tgainfo->bpp == 24 ? GL_RGB : GL_RGBA), //specified the color channels for opengl
+		tgainfo->width, //the width of the texture
+		tgainfo->height, //the height of the texture
+		0, //border - must always be 0
+		(tgainfo->bpp == 24 ? GL_BGR : GL_BGRA), //the format of the incoming data
+		GL_UNSIGNED_BYTE, //the type of the incoming data
+		tgainfo->data); // a pointer to the incoming data
+
+	//we want to use mipmaps
+	glGenerateMipmap(GL_TEXTURE_2D);
+
+	TextureInfo info;
+	info.file = filename;
+	info.internal_format = tgainfo->bpp == 24 ? GL_RGB : GL_RGBA;
+	info.width = tgainfo->width;
+	info.height = tgainfo->height;
+	info.levels = (int)std::log2(std::max(info.width, info.height)) + 1;
+	info.bytes = Texture::levelBytes(info.internal_format, info.width, info.height) * 4 / 3;
+	Texture::track(texture_id, info);
+
+	//keep image data for use in engine
+	pixels.width = tgainfo->width;
+	pixels.height = tgainfo->height;
+	pixels.bytes_pp = tgainfo->bpp / 8;
+	pixels.data.assign(tgainfo->data, tgainfo->data + (size_t)pixels.width * pixels.height * pixels.bytes_pp);
+	free(tgainfo->data);
+	delete tgainfo;
+	return texture_id;
+}
+
 // this reader supports only uncompressed RGB targa files with no colour table
 TGAInfo* Parsers::loadTGA(std::string filename)
 {
@@ -535,8 +491,8 @@ TGAInfo* Parsers::loadTGA(std::string filename)
 
 	TGAInfo* tgainfo = new TGAInfo;
 
-	tgainfo->width = info_header[1] * 256 + info_header[0]; //width is stored in first two bytes of info_header
-	tgainfo->height = info_header[3] * 256 + info_header[2]; //height is stored in next two bytes of info_header
+	tgainfo->width = (unsigned char)info_header[1] * 256 + (unsigned char)info_header[0]; //width is stored in first two bytes of info_header
+	tgainfo->height = (unsigned char)info_header[3] * 256 + (unsigned char)info_header[2]; //height is stored in next two bytes of info_header
 
 	if (tgainfo->width <= 0 || tgainfo->height <= 0 || (info_header[4] != 24 && info_header[4] != 32)) {
 		file.close();
@@ -572,7 +528,14 @@ TGAInfo* Parsers::loadTGA(std::string filename)
 	return tgainfo;
 }
 
+//cubemap shared through the cache, keyed by all six faces
 GLuint Parsers::parseCubemap(std::vector<std::string>& faces) {
+    return (GLuint)ResourceCache::acquire(ResourceCubemap, faces, [](const std::vector<std::string>& paths, unsigned long long&) -> int {
+        return loadCubemap(paths);
+    });
+}
+
+GLuint Parsers::loadCubemap(const std::vector<std::string>& faces) {
     
     TGAInfo* tgainfo0 = loadTGA(faces[0]);
     TGAInfo* tgainfo1 = loadTGA(faces[1]);
@@ -608,6 +571,15 @@ GLuint Parsers::parseCubemap(std::vector<std::string>& faces) {
     
     glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
     
+    TextureInfo info;
+    info.file = faces[0];
+    info.internal_format = GL_RGB;
+    info.width = width;
+    info.height = height;
+    info.levels = (int)std::log2(std::max(width, height)) + 1;
+    info.bytes = Texture::levelBytes(GL_RGB, width, height) * 6 * 4 / 3;
+    Texture::track(texture_id, info);
+    
     
     //clean up memory
     delete tgainfo0->data; delete tgainfo0;
@@ -1070,6 +1042,8 @@ bool Parsers::parseCollada(std::string filename, Shader* shader, GraphicsSystem&
         return false;
     }
     
+    auto start = std::chrono::high_resolution_clock::now();
+    
     //load document and check for errors
     XMLDocument doc;
     doc.LoadFile(filename.c_str());
@@ -1100,6 +1074,11 @@ bool Parsers::parseCollada(std::string filename, Shader* shader, GraphicsSystem&
     //mapping previously created vertices using string, much in the same way as the
     //.obj files.
     
+    //each geometry is cooked as a part of the file, with its original vertex indices.
+    //the document is still read, as skins, materials and nodes come from it
+    unsigned long long source_hash = 0;
+    bool hashed = false, all_warm = true;
+    
     XMLElement* lib_geometries = root->FirstChildElement("library_geometries");
     if (lib_geometries){
         XMLElement* geom = lib_geometries->FirstChildElement("geometry");
@@ -1108,6 +1087,15 @@ bool Parsers::parseCollada(std::string filename, Shader* shader, GraphicsSystem&
             std::string geom_id = geom->Attribute("id");
             std::string geom_name = geom->Attribute("name");
             
+            Geometry cooked_geom;
+            CookedExtras extras;
+            if (MeshCache::load(filename, cooked_geom, source_hash, geom_id, &extras)) {
+                geometries[geom_id] = graphics_system.addGeometry(cooked_geom);
+                geometries_orig_vertex_indices[geom_id] = extras.source_vertices;
+                continue;
+            }
+            all_warm = false;
+            
             //only one mesh element per geometry is supported
             XMLElement* mesh_element = geom->FirstChildElement("mesh");
             
@@ -1320,8 +1308,16 @@ bool Parsers::parseCollada(std::string filename, Shader* shader, GraphicsSystem&
                 
             }
             
-            //create the new geometry in the graphics system
-            int new_geom_id = graphics_system.createGeometry(positions_final, uvs_final, normals_final, indices_final);
+            //create the new geometry in the graphics system, cooking it on the way
+            Geometry new_geom;
+            new_geom.keep_packed = MeshCache::enabled();
+            new_geom.createVertexArrays(positions_final, uvs_final, normals_final, indices_final);
+            if (MeshCache::enabled()) {
+                if (!hashed) hashed = ResourceCache::hashFile(filename, source_hash);
+                extras.source_vertices = orig_indices;
+                MeshCache::save(filename, new_geom, source_hash, geom_id, &extras);
+            }
+            int new_geom_id = graphics_system.addGeometry(new_geom);
             
             //store the geometry id string with the engine id int
             //and save the map back to the original positions indices (for animation weights)
@@ -1332,6 +1328,8 @@ bool Parsers::parseCollada(std::string filename, Shader* shader, GraphicsSystem&
     else {
         print("Collada file has no geometries!");
     }
+    if (!geometries.empty())
+        MeshCache::recordLoad(filename, all_warm, std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
     
     /***** MATERIALS - EFFECTS ******/
     
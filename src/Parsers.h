@@ -4,6 +4,8 @@
 #include "GraphicsSystem.h"
 #include "ControlSystem.h"
 
+struct ResourcePixels;
+
 struct TGAInfo //stores info about TGA file
 {
 	GLuint width;
@@ -13,9 +15,8 @@ struct TGAInfo //stores info about TGA file
 };
 
 class Parsers {
-private:
-	static TGAInfo* loadTGA(std::string filename);
 public:
+	static TGAInfo* loadTGA(std::string filename);
     static bool parseMTL(std::string path,
                          std::string filename,
                          std::vector<Material>& materials,
@@ -25,9 +26,16 @@ public:
 						 std::vector<float>& uvs, 
 						 std::vector<float>& normals,
 						 std::vector<unsigned int>& indices);
+	static bool parseOBJ_getline(std::string filename,
+						 std::vector<float>& vertices,
+						 std::vector<float>& uvs,
+						 std::vector<float>& normals,
+						 std::vector<unsigned int>& indices);
+    //warm is set to whether the geometry came from the mesh cache
     static int parseOBJ_multi(std::string filename,
                          std::vector<Geometry>& geometries,
-                         std::vector<Material>& materials);
+                         std::vector<Material>& materials,
+                         bool& warm);
     static GLint parseTexture(std::string filename,
                                ImageData* image_data = nullptr,
                                bool keep_data = false);
@@ -39,4 +47,7 @@ public:
     static bool parseCollada(std::string filename,
                              Shader* shader,
                              GraphicsSystem& graphics_system);
+private:
+    static GLuint loadCubemap(const std::vector<std::string>& faces);
+    static GLuint loadTextureWithPixels_(std::string filename, ResourcePixels& pixels);
 };
@@ -0,0 +1,184 @@
+//
+//  ParticleSimulator.cpp
+//
+
+#include "ParticleSimulator.h"
+#include "extern.h"
+#include <algorithm>
+#include <cmath>
+
+//particles are integrated eight at a time with AVX, or four with SSE
+#if defined(__AVX__)
+#define PARTICLES_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARTICLES_SSE
+#include <xmmintrin.h>
+#endif
+
+//live particles integrated by one job
+const int PARTICLE_BATCH = 8192;
+
+void ParticleSimulator::reset(const std::vector<ParticleEmitter>& emitters, unsigned int seed) {
+    int total = 0;
+    first_.resize(emitters.size());
+    for (size_t e = 0; e < emitters.size(); e++) {
+        first_[e] = emitters[e].first_particle;
+        total = std::max(total, emitters[e].first_particle + std::max(emitters[e].num_particles, 0));
+    }
+    px.assign(total, 0); py.assign(total, 0); pz.assign(total, 0);
+    vx.assign(total, 0); vy.assign(total, 0); vz.assign(total, 0);
+    age.assign(total, 0); life.assign(total, 0);
+    alive_.assign(emitters.size(), 0);
+    spawn_credit_.assign(emitters.size(), 0.0f);
+    random_.resize(emitters.size());
+    for (size_t e = 0; e < emitters.size(); e++)
+        random_[e] = (seed * 2654435761u) ^ ((unsigned int)e * 2246822519u) ^ 0x9e3779b9u;
+    time_ = 0.0f;
+}
+
+//xorshift, one sequence per emitter
+float ParticleSimulator::random01_(int e) {
+    unsigned int x = random_[e];
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    random_[e] = x;
+    return (float)(x >> 8) / 16777216.0f;
+}
+
+int ParticleSimulator::numAlive() const {
+    int count = 0;
+    for (int a : alive_) count += a;
+    return count;
+}
+
+//v += g * dt, p += v * dt, age += dt
+void ParticleSimulator::integrate_(const Range& range, const ParticleEmitter& emitter, float dt) {
+    int i = range.begin;
+#if defined(PARTICLES_AVX)
+    const __m256 dt8 = _mm256_set1_ps(dt);
+    const __m256 gx = _mm256_set1_ps(emitter.gravity.x * dt);
+    const __m256 gy = _mm256_set1_ps(emitter.gravity.y * dt);
+    const __m256 gz = _mm256_set1_ps(emitter.gravity.z * dt);
+    for (; i + 8 <= range.end; i += 8) {
+        __m256 x = _mm256_add_ps(_mm256_loadu_ps(&vx[i]), gx);
+        __m256 y = _mm256_add_ps(_mm256_loadu_ps(&vy[i]), gy);
+        __m256 z = _mm256_add_ps(_mm256_loadu_ps(&vz[i]), gz);
+        _mm256_storeu_ps(&vx[i], x);
+        _mm256_storeu_ps(&vy[i], y);
+        _mm256_storeu_ps(&vz[i], z);
+        _mm256_storeu_ps(&px[i], _mm256_add_ps(_mm256_loadu_ps(&px[i]), _mm256_mul_ps(x, dt8)));
+        _mm256_storeu_ps(&py[i], _mm256_add_ps(_mm256_loadu_ps(&py[i]), _mm256_mul_ps(y, dt8)));
+        _mm256_storeu_ps(&pz[i], _mm256_add_ps(_mm256_loadu_ps(&pz[i]), _mm256_mul_ps(z, dt8)));
+        _mm256_storeu_ps(&age[i], _mm256_add_ps(_mm256_loadu_ps(&age[i]), dt8));
+    }
+#elif defined(PARTICLES_SSE)
+    const __m128 dt4 = _mm_set1_ps(dt);
+    const __m128 gx = _mm_set1_ps(emitter.gravity.x * dt);
+    const __m128 gy = _mm_set1_ps(emitter.gravity.y * dt);
+    const __m128 gz = _mm_set1_ps(emitter.gravity.z * dt);
+    for (; i + 4 <= range.end; i += 4) {
+        __m128 x = _mm_add_ps(_mm_loadu_ps(&vx[i]), gx);
+        __m128 y = _mm_add_ps(_mm_loadu_ps(&vy[i]), gy);
+        __m128 z = _mm_add_ps(_mm_loadu_ps(&vz[i]), gz);
+        _mm_storeu_ps(&vx[i], x);
+        _mm_storeu_ps(&vy[i], y);
+        _mm_storeu_ps(&vz[i], z);
+        _mm_storeu_ps(&px[i], _mm_add_ps(_mm_loadu_ps(&px[i]), _mm_mul_ps(x, dt4)));
+        _mm_storeu_ps(&py[i], _mm_add_ps(_mm_loadu_ps(&py[i]), _mm_mul_ps(y, dt4)));
+        _mm_storeu_ps(&pz[i], _mm_add_ps(_mm_loadu_ps(&pz[i]), _mm_mul_ps(z, dt4)));
+        _mm_storeu_ps(&age[i], _mm_add_ps(_mm_loadu_ps(&age[i]), dt4));
+    }
+#endif
+    //remainder
+    for (; i < range.end; i++) {
+        vx[i] += emitter.gravity.x * dt;
+        vy[i] += emitter.gravity.y * dt;
+        vz[i] += emitter.gravity.z * dt;
+        px[i] += vx[i] * dt;
+        py[i] += vy[i] * dt;
+        pz[i] += vz[i] * dt;
+        age[i] += dt;
+    }
+}
+
+//replaces each expired particle with the last live one, then appends spawns
+void ParticleSimulator::killAndSpawn_(int e, const ParticleEmitter& emitter, float dt) {
+    int first = first_[e];
+    int& alive = alive_[e];
+    for (int i = first; i < first + alive;) {
+        if (age[i] < life[i]) { i++; continue; }
+        int last = first + alive - 1;
+        px[i] = px[last]; py[i] = py[last]; pz[i] = pz[last];
+        vx[i] = vx[last]; vy[i] = vy[last]; vz[i] = vz[last];
+        age[i] = age[last]; life[i] = life[last];
+        alive--;
+    }
+
+    int capacity = std::max(emitter.num_particles, 0);
+    if (!emitter.spawning) { spawn_credit_[e] = 0.0f; return; }
+    float mean_life = std::max(0.5f * (emitter.min_life + emitter.max_life), 0.001f);
+    spawn_credit_[e] += capacity * dt / mean_life;
+    int spawn = std::min((int)spawn_credit_[e], capacity - alive);
+    spawn_credit_[e] -= (float)(int)spawn_credit_[e];
+
+    //same distribution as particles.vert
+    for (int s = 0; s < spawn; s++) {
+        int i = first + alive++;
+        float r = random01_(e);
+        float r2 = random01_(e);
+        float angle = emitter.spin != 0.0f ? std::fmod(time_ * emitter.spin, 6.283f) : r2 * 6.283f;
+        float scale = r * 0.25f + 0.75f;
+        px[i] = emitter.position.x; py[i] = emitter.position.y; pz[i] = emitter.position.z;
+        vx[i] = (emitter.velocity.x + std::cos(angle) * emitter.spread) * scale;
+        vy[i] = emitter.velocity.y * scale;
+        vz[i] = (emitter.velocity.z + std::sin(angle) * emitter.spread) * scale;
+        age[i] = 0.0f;
+        life[i] = emitter.min_life + (emitter.max_life - emitter.min_life) * r2;
+    }
+}
+
+void ParticleSimulator::update(const std::vector<ParticleEmitter>& emitters, float dt) {
+    time_ += dt;
+
+    ranges_.clear();
+    for (int e = 0; e < (int)emitters.size(); e++) {
+        for (int begin = first_[e]; begin < first_[e] + alive_[e]; begin += PARTICLE_BATCH)
+            ranges_.push_back({ e, begin, std::min(begin + PARTICLE_BATCH, first_[e] + alive_[e]) });
+    }
+    JOBS.parallelFor((int)ranges_.size(), 1, [&](int begin, int end) {
+        for (int r = begin; r < end; r++)
+            integrate_(ranges_[r], emitters[ranges_[r].emitter], dt);
+    });
+
+    JOBS.parallelFor((int)emitters.size(), 16, [&](int begin, int end) {
+        for (int e = begin; e < end; e++)
+            killAndSpawn_(e, emitters[e], dt);
+    });
+}
+
+void ParticleSimulator::pack(const std::vector<ParticleEmitter>& emitters, const std::vector<int>& order,
+                             std::vector<GLfloat>& out, std::vector<int>& offsets) {
+    offsets.resize(order.size() + 1);
+    offsets[0] = 0;
+    for (size_t o = 0; o < order.size(); o++)
+        offsets[o + 1] = offsets[o] + (emitters[order[o]].visible ? alive_[order[o]] : 0);
+    out.resize((size_t)offsets.back() * PARTICLE_VERTEX_FLOATS);
+
+    JOBS.parallelFor((int)order.size(), 16, [&](int begin, int end) {
+        for (int o = begin; o < end; o++) {
+            int e = order[o];
+            const ParticleEmitter& emitter = emitters[e];
+            GLfloat* vertex = out.data() + (size_t)offsets[o] * PARTICLE_VERTEX_FLOATS;
+            for (int i = first_[e]; i < first_[e] + offsets[o + 1] - offsets[o]; i++) {
+                vertex[0] = px[i]; vertex[1] = py[i]; vertex[2] = pz[i];
+                vertex[3] = emitter.particle_size;
+                vertex[4] = emitter.color.x; vertex[5] = emitter.color.y; vertex[6] = emitter.color.z;
+                //fade out over life
+                vertex[7] = emitter.alpha * std::min(std::max(1.0f - age[i] / life[i], 0.0f), 1.0f);
+                vertex += PARTICLE_VERTEX_FLOATS;
+            }
+        }
+    });
+}
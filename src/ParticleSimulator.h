@@ -0,0 +1,56 @@
+//
+//  ParticleSimulator.h
+//
+//  CPU particle simulation, for machines without a GPU and as a reference
+//  to test the transform feedback path against. Particles are stored as
+//  structure of arrays, each emitter owning a range of its capacity whose
+//  first alive_ entries are live. Integration runs over the job pool with
+//  SSE or AVX; killed particles are replaced by the last live one of their
+//  emitter, and spawns append, so live ranges stay compact. Results do not
+//  depend on the number of threads, as each emitter has its own random
+//  sequence and is spawned and compacted by one thread.
+//
+#pragma once
+#include "includes.h"
+#include "Components.h"
+#include <vector>
+
+//floats written by pack for each particle: position, size, colour
+const int PARTICLE_VERTEX_FLOATS = 8;
+
+class ParticleSimulator {
+public:
+    //gives each emitter a range of num_particles, with no live particles.
+    //Uses first_particle of emitters, set by ParticleSystem
+    void reset(const std::vector<ParticleEmitter>& emitters, unsigned int seed = 1);
+    //ages and moves particles, then kills expired and spawns new ones. Emitters
+    //spawn to keep their capacity alive over a mean lifetime
+    void update(const std::vector<ParticleEmitter>& emitters, float dt);
+    //writes live particles of visible emitters, in order, to out. offsets has
+    //order.size() + 1 entries, the first vertex of each emitter and the total
+    void pack(const std::vector<ParticleEmitter>& emitters, const std::vector<int>& order,
+              std::vector<GLfloat>& out, std::vector<int>& offsets);
+
+    int numAlive() const;
+
+    //particle data, live particles of emitter e are [first_[e], first_[e] + alive_[e])
+    std::vector<float> px, py, pz;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> age, life;
+
+private:
+    struct Range {
+        int emitter;
+        int begin, end;
+    };
+    std::vector<int> first_;
+    std::vector<int> alive_;
+    std::vector<float> spawn_credit_; //fraction of particle carried to next frame
+    std::vector<unsigned int> random_;
+    std::vector<Range> ranges_; //live particles split in batches for integration
+    float time_ = 0.0f;
+
+    void integrate_(const Range& range, const ParticleEmitter& emitter, float dt);
+    void killAndSpawn_(int e, const ParticleEmitter& emitter, float dt);
+    float random01_(int e);
+};
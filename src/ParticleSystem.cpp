@@ -0,0 +1,535 @@
+//
+//  ParticleSystem.cpp
+//
+
+#include "ParticleSystem.h"
+#include "extern.h"
+#include "Parsers.h"
+#include "GraphicsUtilities.h"
+#include "Texture.h"
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <chrono>
+
+//HOW DOES TRANSFORM FEEDBACK WORK?
+//A transform feedback is basically a mechanism by which OpenGL can tell the
+//output from a shader to be written back to a vertex buffer, (which is
+//probably part of a VAO.
+//The transformfeedback object itself is just handle which points the shader attribute
+//to the buffer id
+//Procedure
+//---------
+//Create two VAOs 'A' and 'B'
+//Create two empty transform feedbacks 'A' and 'B'
+//For each VAO:
+//create vertex array buffer with initial geometry
+//use glbindbufferbase to bind the transform feedback id to the
+// - buffer of bound VAO
+// - out attribute id in shader
+//e.g Transform Feedback A is bound to vertex buffer in VAO A
+//
+//Now when we draw:
+//Bind VAO 'A' but bind Transform feedback *B*
+//That way when we draw buffer of A, the out variable in vertex shader will save data to B
+//then next frame bind VAO 'B' and transform feedback A
+//etc.
+//
+//Several draws inside one glBeginTransformFeedback append their output, so
+//batches drawn in buffer order write each particle back to its own slot.
+
+ParticleStats ParticleSystem::stats;
+
+ParticleSystem::~ParticleSystem() {
+    deleteBuffers_();
+    if (emitters_ubo_) glDeleteBuffers(1, &emitters_ubo_);
+    if (cpu_vbo_) glDeleteBuffers(1, &cpu_vbo_);
+    if (cpu_ibo_) glDeleteBuffers(1, &cpu_ibo_);
+    if (cpu_vao_) glDeleteVertexArrays(1, &cpu_vao_);
+    if (particle_shader_) delete particle_shader_;
+    if (cpu_shader_) delete cpu_shader_;
+    if (particle_oit_shader_) delete particle_oit_shader_;
+    if (cpu_oit_shader_) delete cpu_oit_shader_;
+}
+
+void ParticleSystem::init() {
+
+    //GL 3.3 only guarantees 16 KB uniform blocks, so the emitter array is sized
+    //from the driver's limit and compiled into the shader as MAX_EMITTERS
+    GLint max_block_size = 16384;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &max_block_size);
+    emitters_per_block_ = std::max(1, max_block_size / (GLint)(EMITTER_FLOATS * sizeof(GLfloat)));
+    std::string defines = "#define MAX_EMITTERS " + std::to_string(emitters_per_block_) + "\n";
+
+    const GLchar* feedback_varyings[]{
+        "v_position_age",
+        "v_velocity_life"
+    };
+    particle_shader_ = new Shader("data/shaders/particles.vert",
+        "data/shaders/particles.frag",
+        2,
+        feedback_varyings,
+        defines);
+    cpu_shader_ = new Shader("data/shaders/particles_cpu.vert", "data/shaders/particles.frag");
+    //drawing only, into weighted oit targets
+    particle_oit_shader_ = new Shader("data/shaders/particles.vert", "data/shaders/particles.frag", 1 << KEYWORD_WEIGHTED_OIT, defines);
+    cpu_oit_shader_ = new Shader("data/shaders/particles_cpu.vert", "data/shaders/particles.frag", 1 << KEYWORD_WEIGHTED_OIT);
+
+    // tell opengl that the shader set the point size
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glEnable(GL_POINT_SPRITE);
+    default_texture_ = Parsers::parseTexture("data/assets/droptexture.tga");
+
+    //blocks are bound at offsets which must be aligned
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    GLint block_bytes = emitters_per_block_ * EMITTER_FLOATS * sizeof(GLfloat);
+    block_stride_ = (block_bytes + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &emitters_ubo_);
+}
+
+//changes when emitters are added, resized or change texture, or backend changes
+size_t ParticleSystem::layoutKey_(const std::vector<ParticleEmitter>& emitters) {
+    size_t key = emitters.size() * 2 + backend;
+    for (auto& emitter : emitters) {
+        key = key * 31 + emitter.texture;
+        key = key * 31 + (size_t)std::max(emitter.num_particles, 0);
+    }
+    return key;
+}
+
+void ParticleSystem::deleteBuffers_() {
+    for (int i = 0; i < 2; i++) {
+        if (position_age_[i]) glDeleteBuffers(1, &position_age_[i]);
+        if (velocity_life_[i]) glDeleteBuffers(1, &velocity_life_[i]);
+        if (vao_[i]) glDeleteVertexArrays(1, &vao_[i]);
+        if (tf_[i]) glDeleteTransformFeedbacks(1, &tf_[i]);
+        position_age_[i] = velocity_life_[i] = vao_[i] = tf_[i] = 0;
+    }
+    if (emitter_index_) glDeleteBuffers(1, &emitter_index_);
+    if (sorted_ibo_) glDeleteBuffers(1, &sorted_ibo_);
+    if (readback_buffer_) glDeleteBuffers(1, &readback_buffer_);
+    if (readback_fence_) glDeleteSync(readback_fence_);
+    emitter_index_ = sorted_ibo_ = readback_buffer_ = 0;
+    readback_fence_ = 0;
+    have_sorted_ = false;
+}
+
+//gives each emitter a range in the shared buffers, grouped by texture so
+//that each batch is a contiguous range. All particles restart
+void ParticleSystem::buildLayout_(std::vector<ParticleEmitter>& emitters) {
+    layout_key_ = layoutKey_(emitters);
+    layout_dirty_ = false;
+    stats.layout_rebuilds++;
+
+    order_.resize(emitters.size());
+    std::iota(order_.begin(), order_.end(), 0);
+    auto texture_of = [&](int i) { return emitters[i].texture ? emitters[i].texture : default_texture_; };
+    std::stable_sort(order_.begin(), order_.end(), [&](int a, int b) { return texture_of(a) < texture_of(b); });
+
+    batches_.clear();
+    num_particles_ = 0;
+    for (int i = 0; i < (int)order_.size(); i++) {
+        ParticleEmitter& emitter = emitters[order_[i]];
+        GLuint texture = texture_of(order_[i]);
+        if (batches_.empty() || batches_.back().texture != texture || batches_.back().num_emitters == emitters_per_block_)
+            batches_.push_back({ texture, i, 0, num_particles_, 0 });
+        Batch& batch = batches_.back();
+        emitter.first_particle = num_particles_;
+        int count = std::max(emitter.num_particles, 0);
+        batch.num_emitters++;
+        batch.num_particles += count;
+        num_particles_ += count;
+    }
+    emitter_data_.assign(batches_.size() * block_stride_ / sizeof(GLfloat), 0.0f);
+
+    deleteBuffers_();
+    stats.buffer_bytes = 0;
+    if (!num_particles_) return;
+
+    if (backend == ParticleBackendCPU) {
+        simulator_.reset(emitters);
+        stats.buffer_bytes = (size_t)num_particles_ * 8 * sizeof(float);
+        return;
+    }
+
+    //dead particles with negative life wait -life seconds before first spawn,
+    //so emitters start spread over their lifetime instead of in one burst
+    std::vector<GLfloat> position_age(num_particles_ * 4, 0);
+    std::vector<GLfloat> velocity_life(num_particles_ * 4, 0);
+    std::vector<GLint> emitter_index(num_particles_, 0);
+    for (auto& batch : batches_) {
+        for (int e = 0; e < batch.num_emitters; e++) {
+            ParticleEmitter& emitter = emitters[order_[batch.first_emitter + e]];
+            for (int p = 0; p < emitter.num_particles; p++) {
+                int i = emitter.first_particle + p;
+                position_age[i * 4 + 3] = time_;
+                velocity_life[i * 4 + 3] = -emitter.max_life * (float)(rand() % 9000) / 9000.0f;
+                emitter_index[i] = e;
+            }
+        }
+    }
+
+    glGenBuffers(1, &emitter_index_);
+    glBindBuffer(GL_ARRAY_BUFFER, emitter_index_);
+    glBufferData(GL_ARRAY_BUFFER, emitter_index.size() * sizeof(GLint), &(emitter_index[0]), GL_STATIC_DRAW);
+
+    //sorted draw order, and copy of positions to sort by
+    glGenBuffers(1, &sorted_ibo_);
+    glGenBuffers(1, &readback_buffer_);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, readback_buffer_);
+    glBufferData(GL_COPY_WRITE_BUFFER, position_age.size() * sizeof(GLfloat), NULL, GL_STREAM_READ);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glGenVertexArrays(2, vao_);
+    glGenTransformFeedbacks(2, tf_);
+    for (int i = 0; i < 2; i++) {
+        glBindVertexArray(vao_[i]);
+
+        //position and time of birth
+        glGenBuffers(1, &position_age_[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, position_age_[i]);
+        glBufferData(GL_ARRAY_BUFFER, position_age.size() * sizeof(GLfloat), &(position_age[0]), GL_STREAM_COPY);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+        //velocity and lifetime
+        glGenBuffers(1, &velocity_life_[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, velocity_life_[i]);
+        glBufferData(GL_ARRAY_BUFFER, velocity_life.size() * sizeof(GLfloat), &(velocity_life[0]), GL_STREAM_COPY);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+        //emitter, shared by both vaos
+        glBindBuffer(GL_ARRAY_BUFFER, emitter_index_);
+        glEnableVertexAttribArray(2);
+        glVertexAttribIPointer(2, 1, GL_INT, 0, 0);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sorted_ibo_);
+        if (i == 0) glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_particles_ * sizeof(GLuint), NULL, GL_STREAM_DRAW);
+
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tf_[i]);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, position_age_[i]);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, velocity_life_[i]);
+    }
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+    glBindVertexArray(0);
+    source_ = 0;
+    stats.buffer_bytes = (size_t)num_particles_ * (5 * 4 * sizeof(GLfloat) + 2 * sizeof(GLint));
+}
+
+//writes parameters of emitters to the uniform buffer
+void ParticleSystem::writeEmitterBlocks_(std::vector<ParticleEmitter>& emitters) {
+    for (size_t b = 0; b < batches_.size(); b++) {
+        Batch& batch = batches_[b];
+        GLfloat* block = &emitter_data_[b * block_stride_ / sizeof(GLfloat)];
+        for (int e = 0; e < batch.num_emitters; e++) {
+            ParticleEmitter& emitter = emitters[order_[batch.first_emitter + e]];
+            GLfloat* data = block + e * EMITTER_FLOATS;
+            data[0] = emitter.position.x; data[1] = emitter.position.y; data[2] = emitter.position.z; data[3] = emitter.spread;
+            data[4] = emitter.velocity.x; data[5] = emitter.velocity.y; data[6] = emitter.velocity.z; data[7] = emitter.particle_size;
+            data[8] = emitter.gravity.x; data[9] = emitter.gravity.y; data[10] = emitter.gravity.z; data[11] = emitter.spin;
+            data[12] = emitter.color.x; data[13] = emitter.color.y; data[14] = emitter.color.z; data[15] = emitter.alpha;
+            data[16] = emitter.min_life; data[17] = emitter.max_life;
+            data[18] = emitter.spawning ? 1.0f : 0.0f;
+            data[19] = emitter.visible ? 1.0f : 0.0f;
+        }
+    }
+
+    //orphan last frame's data, which may still be in use
+    glBindBuffer(GL_UNIFORM_BUFFER, emitters_ubo_);
+    glBufferData(GL_UNIFORM_BUFFER, emitter_data_.size() * sizeof(GLfloat), &(emitter_data_[0]), GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void ParticleSystem::beginDraw_(Shader* shader, Camera& cam) {
+    glUseProgram(shader->program);
+
+    glEnable(GL_BLEND);
+    //same blending as GraphicsSystem's weighted oit pass, whose targets are bound
+    if (weighted_oit) glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    else glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float height_near_plane = std::abs(viewport[3] - viewport[1]) / ( 2 * tan(0.5f * cam.fov));
+
+    shader->setUniform(U_VP, cam.view_projection);
+    shader->setUniform(U_HEIGHT_NEAR_PLANE, height_near_plane);
+}
+
+void ParticleSystem::endDraw_() {
+    glBindVertexArray(0);
+    glDisable(GL_BLEND);
+    glDepthMask(GL_TRUE);
+}
+
+//culls emitters against camera and takes their position and state from their entity
+void ParticleSystem::update(float dt) {
+    auto& emitters = ECS.getAllComponents<ParticleEmitter>();
+    auto& transforms = ECS.getAllComponents<Transform>();
+    Camera& cam = ECS.getComponentInArray<Camera>(ECS.main_camera);
+
+    stats.visible_emitters = 0;
+    for (auto& emitter : emitters) {
+        bool active = ECS.entities[emitter.owner].active;
+        emitter.position = ECS.getComponentFromEntity<Transform>(emitter.owner).getGlobalMatrix(transforms).position();
+
+        AABB bounds;
+        bounds.center = emitter.position;
+        bounds.half_width = lm::vec3(emitter.bounds_radius, emitter.bounds_radius, emitter.bounds_radius);
+        emitter.visible = active && BBInFrustum(bounds, cam.view_projection);
+        emitter.spawning = emitter.emitting && active;
+        if (emitter.visible) stats.visible_emitters++;
+    }
+
+    simulate_(emitters, dt, &cam);
+}
+
+void ParticleSystem::simulate_(std::vector<ParticleEmitter>& emitters, float dt, Camera* cam) {
+    time_ += dt;
+
+    stats.emitters = (int)emitters.size();
+    if (layout_dirty_ || layoutKey_(emitters) != layout_key_) buildLayout_(emitters);
+    stats.particles = num_particles_;
+    stats.draws = 0;
+    stats.sorted = 0;
+    stats.sort_ms = 0.0f;
+    if (!num_particles_) return;
+
+    if (backend == ParticleBackendCPU) simulateCPU_(emitters, dt, cam);
+    else simulateGPU_(emitters, dt, cam);
+}
+
+//sorts particles [first, first + count) by distance along view, farthest
+//first, into sorted_indices_. Positions are stride floats apart
+void ParticleSystem::sortRange_(const GLfloat* positions, int stride, int first, int count, const Camera& cam) {
+    if ((int)sort_keys_.size() < count) sort_keys_.resize(count);
+    JOBS.parallelFor(count, 4096, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            const GLfloat* p = positions + (size_t)(first + i) * stride;
+            float depth = (p[0] - cam.position.x) * cam.forward.x + (p[1] - cam.position.y) * cam.forward.y +
+                          (p[2] - cam.position.z) * cam.forward.z;
+            sort_keys_[i] = RadixSort::floatKey(-depth);
+            sorted_indices_[first + i] = first + i;
+        }
+    });
+    sort_.sort(&sort_keys_[0], &sorted_indices_[first], count);
+    stats.sorted += count;
+    stats.sort_ms += sort_.last_ms;
+}
+
+//sorts by positions copied from gpu once the copy has arrived, then starts
+//the next copy. Particles keep their slot on gpu, so an old order stays valid
+void ParticleSystem::readbackAndSort_(const Camera& cam) {
+    if (readback_fence_) {
+        GLenum status = glClientWaitSync(readback_fence_, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+        glDeleteSync(readback_fence_);
+        readback_fence_ = 0;
+
+        glBindBuffer(GL_COPY_READ_BUFFER, readback_buffer_);
+        const GLfloat* positions = (const GLfloat*)glMapBufferRange(GL_COPY_READ_BUFFER, 0,
+            num_particles_ * 4 * sizeof(GLfloat), GL_MAP_READ_BIT);
+        if (positions) {
+            auto start = std::chrono::high_resolution_clock::now();
+            sorted_indices_.resize(num_particles_);
+            for (auto& batch : batches_)
+                sortRange_(positions, 4, batch.first_particle, batch.num_particles, cam);
+            auto end = std::chrono::high_resolution_clock::now();
+            stats.sort_ms = std::chrono::duration<float, std::milli>(end - start).count();
+            //not through the element binding, which belongs to whichever vao is bound
+            glBindBuffer(GL_COPY_WRITE_BUFFER, sorted_ibo_);
+            glBufferData(GL_COPY_WRITE_BUFFER, num_particles_ * sizeof(GLuint), &(sorted_indices_[0]), GL_STREAM_DRAW);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            have_sorted_ = true;
+        }
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+
+    //positions just simulated
+    glBindBuffer(GL_COPY_READ_BUFFER, position_age_[source_]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, readback_buffer_);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, num_particles_ * 4 * sizeof(GLfloat));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    readback_fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+//one transform feedback pass over all particles, drawing them unless there is
+//no camera. Sorted or weighted oit particles are drawn in a second pass
+void ParticleSystem::simulateGPU_(std::vector<ParticleEmitter>& emitters, float dt, Camera* cam) {
+    writeEmitterBlocks_(emitters);
+    bool draw_pass = cam && (sort_particles || weighted_oit) && stats.visible_emitters;
+
+    if (cam && !draw_pass) beginDraw_(particle_shader_, *cam);
+    else glUseProgram(particle_shader_->program);
+    //nothing to see, only simulate
+    if (!cam || !stats.visible_emitters || draw_pass) glEnable(GL_RASTERIZER_DISCARD);
+
+    particle_shader_->setUniform(U_TIME, time_);
+    particle_shader_->setUniform(U_DELTA_TIME, dt);
+    particle_shader_->setUniformBlock(U_EMITTERS_UBO, EMITTERS_BINDING_POINT);
+
+    glBindVertexArray(vao_[source_]);
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tf_[1 - source_]);
+
+    glBeginTransformFeedback(GL_POINTS);
+    for (size_t b = 0; b < batches_.size(); b++) {
+        Batch& batch = batches_[b];
+        if (!batch.num_particles) continue;
+        glBindBufferRange(GL_UNIFORM_BUFFER, EMITTERS_BINDING_POINT, emitters_ubo_, b * block_stride_,
+                          emitters_per_block_ * EMITTER_FLOATS * sizeof(GLfloat));
+        particle_shader_->setTexture(U_DIFFUSE_MAP, batch.texture, 0);
+        Texture::touch(batch.texture);
+        glDrawArrays(GL_POINTS, batch.first_particle, batch.num_particles);
+        stats.draws++;
+    }
+    glEndTransformFeedback();
+    source_ = 1 - source_;
+
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    if (!draw_pass) {
+        if (cam) endDraw_();
+        else glBindVertexArray(0);
+        return;
+    }
+
+    //draw new state without capturing it; the shader's outputs are discarded.
+    //Weighted blending doesn't depend on order
+    bool sorted = sort_particles && !weighted_oit;
+    if (sorted) readbackAndSort_(*cam);
+    Shader* shader = weighted_oit ? particle_oit_shader_ : particle_shader_;
+    beginDraw_(shader, *cam);
+    shader->setUniform(U_TIME, time_);
+    shader->setUniformBlock(U_EMITTERS_UBO, EMITTERS_BINDING_POINT);
+    glBindVertexArray(vao_[source_]);
+    for (size_t b = 0; b < batches_.size(); b++) {
+        Batch& batch = batches_[b];
+        if (!batch.num_particles) continue;
+        glBindBufferRange(GL_UNIFORM_BUFFER, EMITTERS_BINDING_POINT, emitters_ubo_, b * block_stride_,
+                          emitters_per_block_ * EMITTER_FLOATS * sizeof(GLfloat));
+        shader->setTexture(U_DIFFUSE_MAP, batch.texture, 0);
+        Texture::touch(batch.texture);
+        if (sorted && have_sorted_)
+            glDrawElements(GL_POINTS, batch.num_particles, GL_UNSIGNED_INT, (void*)(batch.first_particle * sizeof(GLuint)));
+        else
+            glDrawArrays(GL_POINTS, batch.first_particle, batch.num_particles);
+        stats.draws++;
+    }
+    endDraw_();
+}
+
+//simulates on the job pool, then streams live particles of visible emitters
+//to a vertex buffer, drawn with one call per texture
+void ParticleSystem::simulateCPU_(std::vector<ParticleEmitter>& emitters, float dt, Camera* cam) {
+    simulator_.update(emitters, dt);
+    stats.particles = simulator_.numAlive();
+    if (!cam || !stats.visible_emitters) return;
+
+    simulator_.pack(emitters, order_, cpu_vertices_, cpu_offsets_);
+    int num_vertices = cpu_offsets_.back();
+    if (!num_vertices) return;
+
+    if (!cpu_vao_) {
+        glGenVertexArrays(1, &cpu_vao_);
+        glBindVertexArray(cpu_vao_);
+        glGenBuffers(1, &cpu_vbo_);
+        glBindBuffer(GL_ARRAY_BUFFER, cpu_vbo_);
+        //position and size, colour
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, PARTICLE_VERTEX_FLOATS * sizeof(GLfloat), 0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, PARTICLE_VERTEX_FLOATS * sizeof(GLfloat), (void*)(4 * sizeof(GLfloat)));
+        glGenBuffers(1, &cpu_ibo_);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cpu_ibo_);
+    }
+
+    //vertex range of each texture, there is no block limit here
+    struct Run { GLuint texture; int first, count; };
+    std::vector<Run> runs;
+    for (size_t b = 0; b < batches_.size();) {
+        size_t last = b;
+        while (last + 1 < batches_.size() && batches_[last + 1].texture == batches_[b].texture) last++;
+        int first = cpu_offsets_[batches_[b].first_emitter];
+        int count = cpu_offsets_[batches_[last].first_emitter + batches_[last].num_emitters] - first;
+        if (count) runs.push_back({ batches_[b].texture, first, count });
+        b = last + 1;
+    }
+
+    glBindVertexArray(cpu_vao_);
+    glBindBuffer(GL_ARRAY_BUFFER, cpu_vbo_);
+    //orphan last frame's vertices, which may still be in use
+    GLsizeiptr bytes = cpu_vertices_.size() * sizeof(GLfloat);
+    glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, &(cpu_vertices_[0]));
+    bool sorted = sort_particles && !weighted_oit;
+    if (sorted) {
+        sorted_indices_.resize(num_vertices);
+        for (auto& run : runs)
+            sortRange_(&cpu_vertices_[0], PARTICLE_VERTEX_FLOATS, run.first, run.count, *cam);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_vertices * sizeof(GLuint), &(sorted_indices_[0]), GL_STREAM_DRAW);
+    }
+
+    Shader* shader = weighted_oit ? cpu_oit_shader_ : cpu_shader_;
+    beginDraw_(shader, *cam);
+    for (auto& run : runs) {
+        shader->setTexture(U_DIFFUSE_MAP, run.texture, 0);
+        Texture::touch(run.texture);
+        if (sorted)
+            glDrawElements(GL_POINTS, run.count, GL_UNSIGNED_INT, (void*)(run.first * sizeof(GLuint)));
+        else
+            glDrawArrays(GL_POINTS, run.first, run.count);
+        stats.draws++;
+    }
+    endDraw_();
+}
+
+void ParticleSystem::benchmark() {
+    ParticleBackend scene_backend = backend;
+    const float dt = 1.0f / 60.0f;
+    const int steps = 60;
+
+    printf("%10s %10s %12s %12s %14s %14s\n", "particles", "emitters", "CPU (ms)", "GPU (ms)", "CPU (M/s)", "GPU (M/s)");
+    for (int count : { 100000, 250000, 500000, 1000000 }) {
+        std::vector<ParticleEmitter> emitters(count / 1000);
+        for (size_t i = 0; i < emitters.size(); i++) {
+            emitters[i].num_particles = 1000;
+            emitters[i].spin = 0.0f;
+            emitters[i].position = lm::vec3((float)(i % 40) * 5.0f, 0.0f, (float)(i / 40) * 5.0f);
+            emitters[i].visible = false;
+        }
+        float ms[2];
+        for (int b = 0; b < 2; b++) {
+            backend = b == 0 ? ParticleBackendCPU : ParticleBackendGPU;
+            //fill emitters before timing
+            for (int i = 0; i < 2 * steps; i++) simulate_(emitters, dt, nullptr);
+            glFinish();
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < steps; i++) simulate_(emitters, dt, nullptr);
+            glFinish();
+            auto end = std::chrono::high_resolution_clock::now();
+            ms[b] = std::chrono::duration<float, std::milli>(end - start).count() / steps;
+        }
+        printf("%10d %10d %12.3f %12.3f %14.1f %14.1f\n", count, (int)emitters.size(), ms[0], ms[1],
+               count / (ms[0] * 1000.0f), count / (ms[1] * 1000.0f));
+    }
+
+    //radix sort alone, of random depths
+    std::vector<uint32_t> keys(1000000), values(1000000);
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = RadixSort::floatKey((float)(rand() % 100000) * 0.01f);
+        values[i] = (uint32_t)i;
+    }
+    RadixSort sort;
+    sort.sort(&keys[0], &values[0], (int)keys.size());
+    printf("radix sort of %d keys: %.3f ms on %d threads\n", (int)keys.size(), sort.last_ms, JOBS.numThreads());
+
+    //scene emitters restart next frame
+    backend = scene_backend;
+    layout_dirty_ = true;
+}
@@ -0,0 +1,128 @@
+//
+//  ParticleSystem.h
+//
+//  Simulates and draws the particles of every ParticleEmitter component on
+//  the GPU. All emitters share one pair of transform feedback buffers, each
+//  owning a contiguous range of particles, and their parameters are packed
+//  in a uniform buffer which each particle indexes by its emitter. The whole
+//  pass is one glDrawArrays while emitters fit in one uniform block and use
+//  one texture; otherwise there is one draw per block or texture change.
+//
+//  The CPU backend simulates the same emitters with ParticleSimulator and
+//  streams live particles of visible emitters to a vertex buffer each frame,
+//  drawn as point sprites with the same fragment shader.
+//
+//  With sort_particles, particles are drawn back to front through an index
+//  buffer sorted by RadixSort. The GPU backend then simulates with the
+//  rasterizer off and draws in a second pass; the depths it sorts by are
+//  read back asynchronously, so its order may be a few frames old.
+//
+//  With weighted_oit, particles are drawn unsorted into the accumulation
+//  targets GraphicsSystem leaves bound in TransparencyWeightedOIT mode.
+//
+#pragma once
+#include "includes.h"
+#include "Shader.h"
+#include "Components.h"
+#include "ParticleSimulator.h"
+#include "RadixSort.h"
+#include <vector>
+
+//five vec4 per emitter in std140 layout
+const int EMITTER_FLOATS = 20;
+
+enum ParticleBackend {
+    ParticleBackendGPU,
+    ParticleBackendCPU
+};
+
+struct ParticleStats {
+    int emitters = 0;
+    int visible_emitters = 0;
+    int particles = 0; //live on CPU, all slots on GPU
+    int draws = 0;
+    size_t buffer_bytes = 0;
+    int layout_rebuilds = 0;
+    int sorted = 0; //particles sorted last frame
+    float sort_ms = 0.0f; //depth keys and radix sort, last frame
+};
+
+class ParticleSystem {
+public:
+    ~ParticleSystem();
+    void init();
+    void update(float dt);
+
+    //prints table of CPU and GPU simulation time for 100k to 1M particles
+    void benchmark();
+
+    ParticleBackend backend = ParticleBackendGPU;
+    bool sort_particles = true; //back to front, for alpha blending
+    bool weighted_oit = false; //set each frame from GraphicsSystem's transparency mode
+    static ParticleStats stats;
+
+private:
+    //emitters drawn in one call: same texture, same uniform block
+    struct Batch {
+        GLuint texture;
+        int first_emitter; //in order_
+        int num_emitters;
+        int first_particle;
+        int num_particles;
+    };
+
+    Shader* particle_shader_ = nullptr;
+    Shader* cpu_shader_ = nullptr;
+    Shader* particle_oit_shader_ = nullptr; //no transform feedback, drawing only
+    Shader* cpu_oit_shader_ = nullptr;
+    GLuint default_texture_ = 0;
+    GLuint vao_[2] = { 0, 0 };
+    GLuint tf_[2] = { 0, 0 };
+    GLuint position_age_[2] = { 0, 0 };
+    GLuint velocity_life_[2] = { 0, 0 };
+    GLuint emitter_index_ = 0; //per particle, index of its emitter in its block
+    GLuint emitters_ubo_ = 0;
+    GLuint EMITTERS_BINDING_POINT = 2;
+    int emitters_per_block_ = 0; //as many as fit GL_MAX_UNIFORM_BLOCK_SIZE, MAX_EMITTERS in particles.vert
+    GLint block_stride_ = 0; //bytes between blocks, respecting offset alignment
+    int source_ = 0;
+    float time_ = 0.0f;
+
+    //cpu backend
+    ParticleSimulator simulator_;
+    GLuint cpu_vao_ = 0;
+    GLuint cpu_vbo_ = 0;
+    std::vector<GLfloat> cpu_vertices_;
+    std::vector<int> cpu_offsets_; //first vertex of each emitter in order_
+    GLuint cpu_ibo_ = 0;
+
+    //back to front sorting
+    RadixSort sort_;
+    std::vector<uint32_t> sort_keys_;
+    std::vector<uint32_t> sorted_indices_;
+    GLuint sorted_ibo_ = 0; //gpu backend, indices into particle buffers
+    GLuint readback_buffer_ = 0; //positions copied from gpu, to compute depths
+    GLsync readback_fence_ = 0;
+    bool have_sorted_ = false;
+    void sortRange_(const GLfloat* positions, int stride, int first, int count, const Camera& cam);
+    void readbackAndSort_(const Camera& cam);
+
+    //layout of emitters in buffers, rebuilt when emitters are added or resized
+    size_t layout_key_ = 0;
+    bool layout_dirty_ = true;
+    int num_particles_ = 0;
+    std::vector<int> order_; //emitter indices sorted by texture
+    std::vector<Batch> batches_;
+    std::vector<GLfloat> emitter_data_;
+
+    //emitters of benchmark are not in ECS, and are simulated without a camera
+    void simulate_(std::vector<ParticleEmitter>& emitters, float dt, Camera* cam);
+    void simulateGPU_(std::vector<ParticleEmitter>& emitters, float dt, Camera* cam);
+    void simulateCPU_(std::vector<ParticleEmitter>& emitters, float dt, Camera* cam);
+    size_t layoutKey_(const std::vector<ParticleEmitter>& emitters);
+    void buildLayout_(std::vector<ParticleEmitter>& emitters);
+    void deleteBuffers_();
+    void writeEmitterBlocks_(std::vector<ParticleEmitter>& emitters);
+    void beginDraw_(Shader* shader, Camera& cam);
+    void endDraw_();
+};
@@ -0,0 +1,88 @@
+//
+//  RadixSort.cpp
+//
+
+#include "RadixSort.h"
+#include "extern.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+//fewer keys than this per block are not worth another thread
+const int RADIX_MIN_BLOCK = 16384;
+
+uint32_t RadixSort::floatKey(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    //negative floats sort reversed, so flip all their bits; positive ones just move above them
+    return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+void RadixSort::sort(uint32_t* keys, uint32_t* values, int count) {
+    auto start = std::chrono::high_resolution_clock::now();
+    if (count < 2) { last_ms = 0.0f; return; }
+
+    if ((int)key_scratch_.size() < count) {
+        key_scratch_.resize(count);
+        value_scratch_.resize(count);
+    }
+    int num_blocks = std::max(std::min(JOBS.numThreads() * 4, count / RADIX_MIN_BLOCK), 1);
+    int block_size = (count + num_blocks - 1) / num_blocks;
+    histograms_.resize(num_blocks * 256);
+
+    uint32_t* src_keys = keys;
+    uint32_t* src_values = values;
+    uint32_t* dst_keys = key_scratch_.data();
+    uint32_t* dst_values = value_scratch_.data();
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        //count digits of each block
+        JOBS.parallelFor(num_blocks, 1, [&](int begin, int end) {
+            for (int b = begin; b < end; b++) {
+                uint32_t* histogram = &histograms_[b * 256];
+                std::fill(histogram, histogram + 256, 0);
+                int last = std::min((b + 1) * block_size, count);
+                for (int i = b * block_size; i < last; i++)
+                    histogram[(src_keys[i] >> shift) & 0xFF]++;
+            }
+        });
+
+        //nothing to do if every key has the same digit
+        uint32_t first_digit = (src_keys[0] >> shift) & 0xFF;
+        uint32_t same = 0;
+        for (int b = 0; b < num_blocks; b++) same += histograms_[b * 256 + first_digit];
+        if (same == (uint32_t)count) continue;
+
+        //offset of each digit in each block: all smaller digits, then this digit in earlier blocks
+        uint32_t sum = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            for (int b = 0; b < num_blocks; b++) {
+                uint32_t n = histograms_[b * 256 + digit];
+                histograms_[b * 256 + digit] = sum;
+                sum += n;
+            }
+        }
+
+        JOBS.parallelFor(num_blocks, 1, [&](int begin, int end) {
+            for (int b = begin; b < end; b++) {
+                uint32_t* offsets = &histograms_[b * 256];
+                int last = std::min((b + 1) * block_size, count);
+                for (int i = b * block_size; i < last; i++) {
+                    uint32_t position = offsets[(src_keys[i] >> shift) & 0xFF]++;
+                    dst_keys[position] = src_keys[i];
+                    dst_values[position] = src_values[i];
+                }
+            }
+        });
+        std::swap(src_keys, dst_keys);
+        std::swap(src_values, dst_values);
+    }
+
+    //odd number of passes leaves result in scratch
+    if (src_keys != keys) {
+        memcpy(keys, src_keys, count * sizeof(uint32_t));
+        memcpy(values, src_values, count * sizeof(uint32_t));
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    last_ms = std::chrono::duration<float, std::milli>(end - start).count();
+}
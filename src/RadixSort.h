@@ -0,0 +1,28 @@
+//
+//  RadixSort.h
+//
+//  Least significant digit radix sort of 32-bit keys with a 32-bit value
+//  each, eight bits per pass. Every pass counts digits per block of keys on
+//  the job pool, turns the counts into offsets, and scatters each block in
+//  parallel; passes where all keys share a digit are skipped. The sort is
+//  stable, so equal keys keep the order they came in.
+//
+#pragma once
+#include <vector>
+#include <cstdint>
+
+class RadixSort {
+public:
+    //sorts count keys ascending, moving values with them
+    void sort(uint32_t* keys, uint32_t* values, int count);
+
+    //key whose unsigned order is the order of the floats, negative included
+    static uint32_t floatKey(float f);
+
+    float last_ms = 0.0f; //time taken by last call to sort
+
+private:
+    std::vector<uint32_t> key_scratch_;
+    std::vector<uint32_t> value_scratch_;
+    std::vector<uint32_t> histograms_; //256 per block
+};
@@ -0,0 +1,193 @@
+//
+//  ResourceCache.cpp
+//
+
+#include "ResourceCache.h"
+#include "Texture.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+std::vector<Resource> ResourceCache::resources_;
+std::unordered_map<std::string, int> ResourceCache::by_path_;
+std::unordered_map<unsigned long long, int> ResourceCache::by_hash_;
+int ResourceCache::num_path_hits = 0;
+int ResourceCache::num_content_hits = 0;
+int ResourceCache::num_content_duplicates = 0;
+
+//resolves "." and ".." and uses forward slashes, so one file has one key
+std::string ResourceCache::canonicalPath(std::string path) {
+    std::replace(path.begin(), path.end(), '\\', '/');
+#ifdef _WIN32
+    std::transform(path.begin(), path.end(), path.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+#endif
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) end = path.size();
+        std::string part = path.substr(start, end - start);
+        if (part == "..") {
+            if (!parts.empty() && parts.back() != "..") parts.pop_back();
+            else parts.push_back(part);
+        }
+        else if (!part.empty() && part != ".")
+            parts.push_back(part);
+        start = end + 1;
+    }
+    std::string result = path.size() && path[0] == '/' ? "/" : "";
+    for (size_t i = 0; i < parts.size(); i++)
+        result += (i ? "/" : "") + parts[i];
+    return result;
+}
+
+void ResourceCache::hashBytes(const void* data, size_t size, unsigned long long& hash) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+bool ResourceCache::hashFile(std::string path, unsigned long long& hash) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    char buffer[65536];
+    while (file) {
+        file.read(buffer, sizeof(buffer));
+        hashBytes(buffer, (size_t)file.gcount(), hash);
+    }
+    return true;
+}
+
+//size and modification time, so an edited file gets a new key without being read
+static std::string fileStamp_(const std::string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return "";
+    return "@" + std::to_string((long long)info.st_size) + "." + std::to_string((long long)info.st_mtime);
+}
+
+int ResourceCache::acquire(ResourceType type, std::string path,
+                           const std::function<int(std::string, unsigned long long&)>& load) {
+    return acquire(type, std::vector<std::string>{ path },
+                   [&load](const std::vector<std::string>& paths, unsigned long long& hash) { return load(paths[0], hash); });
+}
+
+int ResourceCache::acquire(ResourceType type, const std::vector<std::string>& paths,
+                           const std::function<int(const std::vector<std::string>&, unsigned long long&)>& load) {
+    std::string key = std::to_string(type);
+    std::string canonical;
+    for (auto& path : paths) {
+        std::string canonical_path = canonicalPath(path);
+        canonical += (canonical.empty() ? "" : "|") + canonical_path;
+        key += "|" + canonical_path + fileStamp_(path);
+    }
+
+    //same file, unchanged
+    auto it = by_path_.find(key);
+    if (it != by_path_.end()) {
+        resources_[it->second].refs++;
+        num_path_hits++;
+        return resources_[it->second].handle;
+    }
+
+    unsigned long long hash = 0;
+    int handle = load(paths, hash);
+    if (handle == -1 || (handle == 0 && isTexture(type))) return -1;
+
+    //loader found the same contents under another path, and returned its handle
+    int existing = find_(type, handle);
+    if (existing != -1) {
+        Resource& resource = resources_[existing];
+        resource.refs++;
+        resource.path_count++;
+        by_path_[key] = existing;
+        num_content_hits++;
+        return handle;
+    }
+
+    Resource resource;
+    resource.type = type;
+    resource.path = canonical;
+    resource.handle = handle;
+    resource.refs = 1;
+    resource.path_count = 1;
+
+    //reuse slot of an unloaded resource
+    int index = (int)resources_.size();
+    for (size_t i = 0; i < resources_.size(); i++) {
+        if (resources_[i].refs == 0) { index = (int)i; break; }
+    }
+    if (index == (int)resources_.size()) resources_.push_back(resource);
+    else resources_[index] = resource;
+    by_path_[key] = index;
+    if (hash) setContentHash(type, handle, hash);
+    return handle;
+}
+
+int ResourceCache::findByHash(ResourceType type, unsigned long long hash) {
+    if (!hash) return -1;
+    auto ht = by_hash_.find(hashKey_(type, hash));
+    return ht != by_hash_.end() ? resources_[ht->second].handle : -1;
+}
+
+void ResourceCache::setContentHash(ResourceType type, int handle, unsigned long long hash) {
+    int index = find_(type, handle);
+    if (index == -1 || !hash) return;
+    resources_[index].hash = hash;
+    auto ht = by_hash_.find(hashKey_(type, hash));
+    if (ht == by_hash_.end()) by_hash_[hashKey_(type, hash)] = index;
+    else if (ht->second != index) num_content_duplicates++;
+}
+
+int ResourceCache::find_(ResourceType type, int handle) {
+    for (size_t i = 0; i < resources_.size(); i++)
+        if (resources_[i].refs > 0 && resources_[i].type == type && resources_[i].handle == handle)
+            return (int)i;
+    return -1;
+}
+
+bool ResourceCache::release(ResourceType type, int handle) {
+    int index = find_(type, handle);
+    if (index == -1) return false;
+    if (--resources_[index].refs > 0) return false;
+    unload_(index);
+    return true;
+}
+
+void ResourceCache::unload_(int index) {
+    Resource& resource = resources_[index];
+    if (isTexture(resource.type))
+        Texture::release(resource.handle);
+    resource.pixels = ResourcePixels();
+
+    auto ht = by_hash_.find(hashKey_(resource.type, resource.hash));
+    if (ht != by_hash_.end() && ht->second == index) by_hash_.erase(ht);
+    for (auto it = by_path_.begin(); it != by_path_.end();) {
+        if (it->second == index) it = by_path_.erase(it);
+        else ++it;
+    }
+    resource.refs = 0;
+    resource.handle = -1;
+}
+
+void ResourceCache::setPixels(ResourceType type, int handle, ResourcePixels pixels) {
+    int index = find_(type, handle);
+    if (index != -1) resources_[index].pixels = std::move(pixels);
+}
+
+const ResourcePixels* ResourceCache::pixels(ResourceType type, int handle) {
+    int index = find_(type, handle);
+    return index != -1 && !resources_[index].pixels.data.empty() ? &resources_[index].pixels : nullptr;
+}
+
+void ResourceCache::releaseAll() {
+    for (size_t i = 0; i < resources_.size(); i++)
+        if (resources_[i].refs > 0 && isTexture(resources_[i].type))
+            Texture::release(resources_[i].handle);
+    resources_.clear();
+    by_path_.clear();
+    by_hash_.clear();
+}
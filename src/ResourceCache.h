@@ -0,0 +1,89 @@
+//
+//  ResourceCache.h
+//
+//  Shares textures and geometries loaded from files. Resources are found by
+//  canonical path, with the file's size and modification time, so asking for
+//  a file again costs no read and a file changed on disk is loaded afresh.
+//  Loaders may also give a hash of what they loaded, computed where the file
+//  is read (on a worker for streamed textures). A load which turns out to
+//  match a resident resource can return that resource's handle instead, and
+//  is then shared; content reported only after the handle was handed out is
+//  counted as a duplicate. Each acquire adds a reference to the handle (a GL
+//  texture name or an index in the geometry array) and each release removes
+//  one; the resource is unloaded when no reference is left. Textures are
+//  deleted by the cache, geometries by GraphicsSystem::releaseGeometry which
+//  owns them. Textures the engine also reads on the CPU keep their pixels
+//  in the cache, beside the texture.
+//
+#pragma once
+#include "includes.h"
+#include <vector>
+#include <unordered_map>
+#include <functional>
+
+enum ResourceType {
+    ResourceTexture,
+    ResourceCubemap,
+    ResourceGeometry,
+    ResourceMultiGeometry, //obj split by material, handle is its last geometry
+    ResourceTextureData, //texture whose pixels are kept as well, see pixels()
+    RESOURCE_TYPES_COUNT
+};
+
+//pixels of a texture as loaded, rows bottom up, bgr(a)
+struct ResourcePixels {
+    std::vector<unsigned char> data;
+    int width = 0, height = 0, bytes_pp = 0;
+};
+
+struct Resource {
+    ResourceType type = ResourceTexture;
+    std::string path; //canonical path of first file it was loaded from
+    unsigned long long hash = 0; //of contents, 0 if its loader has not given one
+    int handle = -1;
+    int refs = 0;
+    int path_count = 0; //number of paths that lead to it
+    ResourcePixels pixels; //ResourceTextureData only
+};
+
+class ResourceCache {
+public:
+    //returns shared handle for file, calling load(path, hash) if it is not resident yet.
+    //load returns handle, or -1 on failure, which is not cached. It sets hash to the
+    //content hash if it knows it by then (see findByHash), else leaves it 0
+    static int acquire(ResourceType type, std::string path,
+                       const std::function<int(std::string, unsigned long long&)>& load);
+    //as above, for resources made of several files (cubemaps)
+    static int acquire(ResourceType type, const std::vector<std::string>& paths,
+                       const std::function<int(const std::vector<std::string>&, unsigned long long&)>& load);
+    //handle of resident resource with contents hash, or -1. A loader may return it instead of its own
+    static int findByHash(ResourceType type, unsigned long long hash);
+    //content hash of a resource which was still loading when acquire returned
+    static void setContentHash(ResourceType type, int handle, unsigned long long hash);
+    //returns true if this was the last reference, and the resource must be (or was) unloaded
+    static bool release(ResourceType type, int handle);
+    static void releaseAll(); //deletes all textures regardless of references, call while context is alive
+    //pixels kept beside resource, set once after its first acquire
+    static void setPixels(ResourceType type, int handle, ResourcePixels pixels);
+    static const ResourcePixels* pixels(ResourceType type, int handle);
+    static bool isTexture(ResourceType type) { return type == ResourceTexture || type == ResourceCubemap || type == ResourceTextureData; }
+
+    static std::string canonicalPath(std::string path);
+    static const unsigned long long HASH_SEED = 14695981039346656037ULL;
+    //FNV-1a of file contents, continuing from hash. Returns false if file can't be read
+    static bool hashFile(std::string path, unsigned long long& hash);
+    static void hashBytes(const void* data, size_t size, unsigned long long& hash);
+
+    static const std::vector<Resource>& resources() { return resources_; } //includes unloaded, with refs 0
+    static int num_path_hits;
+    static int num_content_hits;
+    static int num_content_duplicates; //same contents found once both were loaded
+
+private:
+    static std::vector<Resource> resources_;
+    static std::unordered_map<std::string, int> by_path_; //type + canonical path, size and time to resource index
+    static std::unordered_map<unsigned long long, int> by_hash_; //type + content hash to resource index
+    static int find_(ResourceType type, int handle);
+    static unsigned long long hashKey_(ResourceType type, unsigned long long hash) { return hash * 31 + type; }
+    static void unload_(int index);
+};
@@ -1,4 +1,5 @@
 #include "ScriptSystem.h"
+#include "extern.h"
 
 //call init function of all registered scripts
 void ScriptSystem::lateInit() {
@@ -9,6 +10,7 @@ void ScriptSystem::lateInit() {
 
 //update all scripts
 void ScriptSystem::update(float dt) {
+	sendCollisionEvents_();
 	for (auto scr : scripts_)
 		scr->update(dt);
 }
@@ -20,3 +22,29 @@ void ScriptSystem::registerScript(Script* new_script) {
 
 }
 
+//subscribe script to collision events of entity
+void ScriptSystem::subscribeCollisions(Script* script, int entity) {
+	collision_subscribers_[entity].push_back(script);
+}
+
+//send each event of the last collision update to scripts of both entities,
+//turned so that event.collider is always the script's own
+void ScriptSystem::sendCollisionEvents_() {
+	if (!collisions_ || collision_subscribers_.empty()) return;
+	auto& colliders = ECS.getAllComponents<Collider>();
+	for (const CollisionEvent& event : collisions_->getEvents()) {
+		for (int side = 0; side < 2; side++) {
+			CollisionEvent own = event;
+			if (side == 1) std::swap(own.collider, own.other);
+			//exit of a collider removed since
+			if (own.collider >= (int)colliders.size()) continue;
+			auto found = collision_subscribers_.find(colliders[own.collider].owner);
+			if (found == collision_subscribers_.end()) continue;
+			for (auto scr : found->second) {
+				if (own.type == CollisionEnter) scr->onCollisionEnter(own);
+				else if (own.type == CollisionStay) scr->onCollisionStay(own);
+				else scr->onCollisionExit(own);
+			}
+		}
+	}
+}
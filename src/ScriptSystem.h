@@ -3,6 +3,8 @@
 #include "Components.h"
 #include <vector>
 #include "ControlSystem.h"
+#include "CollisionSystem.h"
+#include <unordered_map>
 
 
 //Forward declare ControlSystem to get input
@@ -19,6 +21,12 @@ public:
 	// pure virtual functions FORCES execution of functions in derived classes
 	virtual void update(float dt) = 0;
 
+	//collision events of subscribed entities, before update. event.collider is
+	//the collider of the subscribed entity, event.other the one it touches
+	virtual void onCollisionEnter(const CollisionEvent&) {};
+	virtual void onCollisionStay(const CollisionEvent&) {};
+	virtual void onCollisionExit(const CollisionEvent&) {};
+
 	//sets pointer to control system
 	void setInput(ControlSystem* cont_sys) { input_ = cont_sys; };
 
@@ -30,8 +38,9 @@ protected:
 class ScriptSystem {
 public:
 	
-	//initialize by setting control system pointer to send to scripts
-	void init(ControlSystem* cont_sys) { input_ = cont_sys; };
+	//initialize by setting control system pointer to send to scripts,
+	//and collision system whose events are sent to subscribed scripts
+	void init(ControlSystem* cont_sys, CollisionSystem* col_sys) { input_ = cont_sys; collisions_ = col_sys; };
 
 	//lateInit calls init of all registered scripts
 	void lateInit();
@@ -42,12 +51,20 @@ public:
 	//register new script
 	void registerScript(Script* new_script);
 
+	//script receives collision events of colliders of entity
+	void subscribeCollisions(Script* script, int entity);
+
 private:
 	std::vector<Script*> scripts_;
 
 	//pointer to the control system
 	ControlSystem* input_;
 
+	//collision events, sent to scripts subscribed to the owner of either collider
+	CollisionSystem* collisions_ = nullptr;
+	std::unordered_map<int, std::vector<Script*>> collision_subscribers_; //entity, scripts
+	void sendCollisionEvents_();
+
 
 };
 
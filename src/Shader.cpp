@@ -2,6 +2,41 @@
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#ifdef _WIN32
+#include <direct.h>
+#define MAKE_DIR(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define MAKE_DIR(path) mkdir(path, 0755)
+#endif
+
+std::string Shader::cache_folder = "data/shader_cache";
+ShaderStats Shader::stats;
+std::vector<Shader*> Shader::pending_shaders_;
+
+//driver capabilities, queried with first shader
+static bool compiler_initialized = false;
+static bool binary_supported = false;
+static bool parallel_compile = false;
+static std::string driver_string;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static float millisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
 
 
 std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems) {
@@ -21,6 +56,14 @@ std::vector<std::string> split(const std::string &s, char delim) {
 
 Shader::Shader() {}
 
+Shader::~Shader() {
+    if (!pending_) return;
+    pending_shaders_.erase(std::remove(pending_shaders_.begin(), pending_shaders_.end(), this), pending_shaders_.end());
+    //shader objects are otherwise deleted once the link is finished
+    glDeleteShader(vertex_id_);
+    glDeleteShader(fragment_id_);
+}
+
 
 //uniform setters
 //int
@@ -153,47 +196,215 @@ std::string Shader::readFile(std::string filename) {
 	return content;
 }
 
-Shader::Shader(std::string vertSource, std::string fragSource) {
+Shader::Shader(std::string vertSource, std::string fragSource) : Shader(vertSource, fragSource, 0) {}
+
+//compiles variant of shader files with a #define for each keyword in keys
+Shader::Shader(std::string vertSource, std::string fragSource, GLuint variant_keys, const std::string& extra_defines) {
     std::vector<std::string> result = split(fragSource, '/');
     name = result.back();
+    vertex_path = vertSource;
+    fragment_path = fragSource;
 	std::string vertexShaderSourceCode=readFile(vertSource);
 	std::string fragmentShaderSourceCode=readFile(fragSource);
-    makeShaderProgram(makeVertexShader(vertexShaderSourceCode.c_str()), makeFragmentShader(fragmentShaderSourceCode.c_str()));
+    keyword_mask = findKeywords(vertexShaderSourceCode) | findKeywords(fragmentShaderSourceCode);
+    keys = variant_keys & keyword_mask;
+    defines = extra_defines;
+    vertexShaderSourceCode = injectDefines(vertexShaderSourceCode, keys, defines);
+    fragmentShaderSourceCode = injectDefines(fragmentShaderSourceCode, keys, defines);
+    buildProgram_(vertexShaderSourceCode, fragmentShaderSourceCode);
 }
 
-Shader::Shader(std::string vertSource, std::string fragSource, const int num_feedback_varyings, const GLchar* feedback_varyings[]) {
-    std::string vertexShaderSourceCode = readFile(vertSource);
-    std::string fragmentShaderSourceCode = readFile(fragSource);
-    makeShaderProgram(makeVertexShader(vertexShaderSourceCode.c_str()), makeFragmentShader(fragmentShaderSourceCode.c_str()), num_feedback_varyings, feedback_varyings);
+//inserts '#define KEYWORD' lines, then extra defines, after the #version line, which must come first
+std::string Shader::injectDefines(const std::string& source, GLuint keys, const std::string& extra_defines) {
+    if (!keys && extra_defines.empty()) return source;
+    std::string defines;
+    for (int k = 0; k < KEYWORDS_COUNT; k++)
+        if (keys & (1 << k))
+            defines += std::string("#define ") + shader_keyword_names_[k] + "\n";
+    defines += extra_defines;
+    size_t insert_at = 0;
+    if (source.compare(0, 8, "#version") == 0) {
+        insert_at = source.find('\n');
+        insert_at = insert_at == std::string::npos ? source.size() : insert_at + 1;
+    }
+    std::string result = source;
+    result.insert(insert_at, defines);
+    return result;
+}
+
+//mask of keywords which appear as whole words in source
+GLuint Shader::findKeywords(const std::string& source) {
+    GLuint mask = 0;
+    for (int k = 0; k < KEYWORDS_COUNT; k++) {
+        std::string word = shader_keyword_names_[k];
+        for (size_t pos = source.find(word); pos != std::string::npos; pos = source.find(word, pos + 1)) {
+            char next = pos + word.size() < source.size() ? source[pos + word.size()] : ' ';
+            if (!isalnum((unsigned char)next) && next != '_') {
+                mask |= 1 << k;
+                break;
+            }
+        }
+    }
+    return mask;
+}
+
+Shader::Shader(std::string vertSource, std::string fragSource, const int num_feedback_varyings, const GLchar* feedback_varyings[], const std::string& extra_defines) {
+    defines = extra_defines;
+    std::string vertexShaderSourceCode = injectDefines(readFile(vertSource), 0, defines);
+    std::string fragmentShaderSourceCode = injectDefines(readFile(fragSource), 0, defines);
+    buildProgram_(vertexShaderSourceCode, fragmentShaderSourceCode, num_feedback_varyings, feedback_varyings);
 }
 
 GLuint Shader::compileFromStrings(std::string vsh, std::string fsh) {
-	makeShaderProgram(makeVertexShader(vsh.c_str()), makeFragmentShader(fsh.c_str()));
+	buildProgram_(vsh, fsh);
 	return 1;
 }
 
+void Shader::initCompiler_() {
+    compiler_initialized = true;
+    GLint num_formats = 0;
+    if (GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    binary_supported = num_formats > 0;
+    parallel_compile = GLEW_ARB_parallel_shader_compile != 0;
+    if (parallel_compile)
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF); //let driver choose
+    const char* strings[] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER),
+                              (const char*)glGetString(GL_VERSION) };
+    for (const char* str : strings)
+        if (str) driver_string += std::string(str) + "|";
+}
+
+//creates program from binary cache if possible, otherwise issues compile and link
+//without waiting for them; finishLink_ completes the program when first needed
+void Shader::buildProgram_(const std::string& vsh, const std::string& fsh,
+                           const int num_feedback_varyings, const GLchar* feedback_varyings[]) {
+    auto start = std::chrono::high_resolution_clock::now();
+    if (!compiler_initialized) initCompiler_();
+    stats.programs++;
+
+    //defines are already injected into sources, so they are part of the key
+    uint64_t key = 14695981039346656037ULL;
+    key = fnv1a(key, vsh.c_str(), vsh.size() + 1);
+    key = fnv1a(key, fsh.c_str(), fsh.size() + 1);
+    for (int i = 0; i < num_feedback_varyings; i++)
+        key = fnv1a(key, feedback_varyings[i], strlen(feedback_varyings[i]) + 1);
+    key = fnv1a(key, driver_string.c_str(), driver_string.size());
+    cache_key_ = binary_supported && !cache_folder.empty() ? key : 0;
+
+    program = glCreateProgram();
+    if (loadBinary_()) {
+        stats.cache_hits++;
+        initUniforms_();
+    }
+    else
+        makeShaderProgram(makeVertexShader(vsh.c_str()), makeFragmentShader(fsh.c_str()), num_feedback_varyings, feedback_varyings);
+    stats.build_ms += millisecondsSince(start);
+}
+
+std::string Shader::binaryPath_() {
+    char file[32];
+    snprintf(file, sizeof(file), "/%016llx.bin", (unsigned long long)cache_key_);
+    return cache_folder + file;
+}
+
+//cache file: format and length, followed by binary
+bool Shader::loadBinary_() {
+    if (!cache_key_) return false;
+    FILE* f = fopen(binaryPath_().c_str(), "rb");
+    if (!f) return false;
+    GLenum format = 0;
+    GLint length = 0;
+    std::vector<char> binary;
+    bool read_ok = fread(&format, sizeof(format), 1, f) == 1 && fread(&length, sizeof(length), 1, f) == 1 && length > 0;
+    if (read_ok) {
+        binary.resize(length);
+        read_ok = fread(&binary[0], 1, length, f) == (size_t)length;
+    }
+    fclose(f);
+    if (!read_ok) return false;
+
+    //driver may reject binaries, e.g. after an update, then we compile as usual
+    glProgramBinary(program, format, &binary[0], length);
+    GLint link_ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+    return link_ok == GL_TRUE;
+}
+
+void Shader::saveBinary_() {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+    std::string path = binaryPath_();
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        MAKE_DIR(cache_folder.c_str());
+        f = fopen(path.c_str(), "wb");
+    }
+    if (!f) {
+        std::cerr << "Could not write shader cache " << path << std::endl;
+        return;
+    }
+    fwrite(&format, sizeof(format), 1, f);
+    fwrite(&length, sizeof(length), 1, f);
+    fwrite(&binary[0], 1, length, f);
+    fclose(f);
+}
+
+//waits for link, reports errors, stores binary and finds uniforms
+void Shader::finishLink_() {
+    auto start = std::chrono::high_resolution_clock::now();
+    pending_ = false;
+    pending_shaders_.erase(std::remove(pending_shaders_.begin(), pending_shaders_.end(), this), pending_shaders_.end());
+
+    GLint link_ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+    if (!link_ok) {
+        checkShaderCompile_(vertex_id_);
+        checkShaderCompile_(fragment_id_);
+        fprintf(stderr, "glLinkProgram:");
+        saveProgramInfoLog(program);
+    }
+    else if (cache_key_)
+        saveBinary_();
+
+    //shader objects are not needed once linked
+    glDetachShader(program, vertex_id_);
+    glDetachShader(program, fragment_id_);
+    glDeleteShader(vertex_id_);
+    glDeleteShader(fragment_id_);
+    vertex_id_ = fragment_id_ = 0;
+
+    //init uniforms
+    initUniforms_();
+    stats.finish_ms += millisecondsSince(start);
+}
+
+//finishes programs the driver has completed first, then waits for the rest
+void Shader::finishAll() {
+    if (parallel_compile) {
+        std::vector<Shader*> pending = pending_shaders_;
+        for (Shader* shader : pending) {
+            GLint done = GL_FALSE;
+            glGetProgramiv(shader->program, GL_COMPLETION_STATUS_ARB, &done);
+            if (done) shader->finishLink_();
+        }
+    }
+    while (!pending_shaders_.empty())
+        pending_shaders_.front()->finishLink_();
+}
+
 GLuint Shader::makeVertexShader(const char* shaderSource)
 {
     GLuint vertexShaderID=glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vertexShaderID,1,(const GLchar**)&shaderSource, NULL);
     glCompileShader(vertexShaderID);
     
-    GLint compile=0;
-    glGetShaderiv(vertexShaderID,GL_COMPILE_STATUS,&compile);
-    
-    //we want to see the compile log if we are in debug (to check warnings)
-    if (!compile)
-    {
-        saveShaderInfoLog(vertexShaderID);
-        std::cout << "Shader code:\n " << std::endl;
-        std::string code = shaderSource;
-        std::vector<std::string> lines = split( code, '\n' );
-        for( size_t i = 0; i < lines.size(); ++i)
-            std::cout << i << "  " << lines[i] << std::endl;
-    
-    }
-    
-    
+    //status is checked when the program link finishes, see finishLink_
     return vertexShaderID;
 }
 GLuint Shader::makeFragmentShader(const char* shaderSource)
@@ -202,21 +413,7 @@ GLuint Shader::makeFragmentShader(const char* shaderSource)
     glShaderSource(fragmentShaderID,1,(const GLchar**)&shaderSource, NULL);
     glCompileShader(fragmentShaderID);
     
-    GLint compile=0;
-    glGetShaderiv(fragmentShaderID,GL_COMPILE_STATUS,&compile);
-    
-    //we want to see the compile log if we are in debug (to check warnings)
-    if (!compile)
-    {
-        saveShaderInfoLog(fragmentShaderID);
-        std::cout << "Shader code:\n " << std::endl;
-        std::string code = shaderSource;
-        std::vector<std::string> lines = split( code, '\n' );
-        for( size_t i = 0; i < lines.size(); ++i)
-            std::cout << i << "  " << lines[i] << std::endl;
-        
-    }
-    
+    //status is checked when the program link finishes, see finishLink_
     return fragmentShaderID;
 }
 
@@ -257,25 +454,42 @@ void Shader::saveProgramInfoLog(GLuint obj)
 }
 
 
+//links program, created by buildProgram_ unless called directly
 void Shader::makeShaderProgram(GLuint vertexShaderID, GLuint fragmentShaderID, const int num_feedback_varyings, const GLchar* feedback_varyings[])
 {
-    program=glCreateProgram();
+    if (!program) program=glCreateProgram();
     glAttachShader(program, vertexShaderID);
     glAttachShader(program,fragmentShaderID);
+    vertex_id_ = vertexShaderID;
+    fragment_id_ = fragmentShaderID;
     
     if (num_feedback_varyings > 0)
         glTransformFeedbackVaryings(program, num_feedback_varyings, feedback_varyings, GL_SEPARATE_ATTRIBS); //INTERLEAVED_ATTRIBS
+    if (cache_key_)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     
     glLinkProgram(program);
-    GLint link_ok = GL_FALSE;
-    glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
-    if (!link_ok) {
-        fprintf(stderr, "glLinkProgram:");
-        saveProgramInfoLog(program);
-    }
     
-    //init uniforms
-    initUniforms_();
+    //link status and uniforms are queried on first use, or in finishAll
+    pending_ = true;
+    pending_shaders_.push_back(this);
+}
+
+//prints log and numbered source of a shader which failed to compile
+void Shader::checkShaderCompile_(GLuint shader_id) {
+    GLint compile = 0;
+    glGetShaderiv(shader_id, GL_COMPILE_STATUS, &compile);
+    if (compile) return;
+    saveShaderInfoLog(shader_id);
+    GLint length = 0;
+    glGetShaderiv(shader_id, GL_SHADER_SOURCE_LENGTH, &length);
+    if (length <= 0) return;
+    std::vector<char> source(length);
+    glGetShaderSource(shader_id, length, NULL, &source[0]);
+    std::cout << "Shader code:\n " << std::endl;
+    std::vector<std::string> lines = split(std::string(&source[0]), '\n');
+    for (size_t i = 0; i < lines.size(); ++i)
+        std::cout << i << "  " << lines[i] << std::endl;
 }
 
 GLint Shader::bindAttribute(const char* attribute_name) {
@@ -313,6 +527,7 @@ void Shader::initUniforms_() {
 
 //Returns location of uniform with given enum
 GLuint Shader::getUniformLocation(UniformID uni_name) {
+    if (pending_) finishLink_();
 	return uniform_locations_[uni_name];
 }
 
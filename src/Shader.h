@@ -17,25 +17,18 @@ enum UniformID {
 	U_DIFFUSE,
 	U_SPECULAR,
 	U_SPECULAR_GLOSS,
-	U_USE_DIFFUSE_MAP,
-    U_USE_DIFFUSE_MAP_2,
-    U_USE_DIFFUSE_MAP_3,
 	U_DIFFUSE_MAP,
     U_DIFFUSE_MAP_2,
     U_DIFFUSE_MAP_3,
-    U_USE_NORMAL_MAP,
     U_NORMAL_MAP,
     U_NORMAL_FACTOR,
-    U_USE_SPECULAR_MAP,
     U_SPECULAR_MAP,
-    U_USE_NOISE_MAP,
     U_NOISE_MAP,
-    U_USE_TRANSPARENCY_MAP,
     U_TRANSPARENCY_MAP,
 	U_SKYBOX,
-	U_USE_REFLECTION_MAP,
 	U_NUM_LIGHTS,
     U_LIGHTS_UBO,
+    U_EMITTERS_UBO,
 	U_SCREEN_TEXTURE,
 	U_NEAR_PLANE,
 	U_FAR_PLANE,
@@ -44,6 +37,8 @@ enum UniformID {
     U_TEX_POSITION,
     U_TEX_NORMAL,
     U_TEX_ALBEDO,
+    U_OIT_ACCUM,
+    U_OIT_WEIGHT,
     U_SHADOW_MAP0,
     U_SHADOW_MAP1,
     U_SHADOW_MAP2,
@@ -58,8 +53,13 @@ enum UniformID {
     U_SKIN_BIND_MATRIX,
     U_BLEND_WEIGHTS, //array!
     U_TIME,
+    U_DELTA_TIME,
     U_POINT_SIZE,
     U_HEIGHT_NEAR_PLANE,
+    U_HEIGHT_MAP,
+    U_TERRAIN_RESOLUTION,
+    U_TERRAIN_STEP,
+    U_TERRAIN_SKIRT,
 	UNIFORMS_COUNT
 };
 
@@ -76,20 +76,14 @@ const std::unordered_map<std::string, UniformID> uniform_string2id_ = {
 	{ "u_diffuse", U_DIFFUSE },
 	{ "u_specular", U_SPECULAR },
 	{ "u_specular_gloss", U_SPECULAR_GLOSS },
-	{ "u_use_diffuse_map", U_USE_DIFFUSE_MAP },
-    { "u_use_diffuse_map2", U_USE_DIFFUSE_MAP_2 },
-    { "u_use_diffuse_map3", U_USE_DIFFUSE_MAP_3 },
 	{ "u_diffuse_map", U_DIFFUSE_MAP },
     { "u_diffuse_map_2", U_DIFFUSE_MAP_2 },
     { "u_diffuse_map_3", U_DIFFUSE_MAP_3 },
-    { "u_use_normal_map", U_USE_NORMAL_MAP },
     { "u_normal_map", U_NORMAL_MAP },
     { "u_normal_factor", U_NORMAL_FACTOR },
-    { "u_use_specular_map", U_USE_SPECULAR_MAP },
     { "u_specular_map", U_SPECULAR_MAP },
     { "u_noise_map", U_NOISE_MAP },
 	{ "u_skybox", U_SKYBOX },
-	{ "u_use_reflection_map", U_USE_REFLECTION_MAP },
 	{ "u_num_lights", U_NUM_LIGHTS },
 	{ "u_near_plane", U_NEAR_PLANE },
 	{ "u_far_plane", U_FAR_PLANE },
@@ -100,6 +94,8 @@ const std::unordered_map<std::string, UniformID> uniform_string2id_ = {
     { "u_tex_position", U_TEX_POSITION },
     { "u_tex_normal", U_TEX_NORMAL },
     { "u_tex_albedo", U_TEX_ALBEDO },
+    { "u_oit_accum", U_OIT_ACCUM },
+    { "u_oit_weight", U_OIT_WEIGHT },
     { "u_shadow_map[0]", U_SHADOW_MAP0 },
     { "u_shadow_map[1]", U_SHADOW_MAP1 },
     { "u_shadow_map[2]", U_SHADOW_MAP2 },
@@ -112,16 +108,56 @@ const std::unordered_map<std::string, UniformID> uniform_string2id_ = {
     { "u_uv_scale", U_UV_SCALE},
     { "u_max_height", U_MAX_HEIGHT},
     { "u_skin_bind_matrix", U_SKIN_BIND_MATRIX},
-    { "u_use_transparency_map", U_USE_TRANSPARENCY_MAP},
     { "u_transparency_map", U_TRANSPARENCY_MAP},
     { "u_blend_weights", U_BLEND_WEIGHTS},
     { "u_time", U_TIME},
+    { "u_delta_time", U_DELTA_TIME},
     { "u_point_size", U_POINT_SIZE},
-    { "u_height_near_plane", U_HEIGHT_NEAR_PLANE}
+    { "u_height_near_plane", U_HEIGHT_NEAR_PLANE},
+    { "u_height_map", U_HEIGHT_MAP},
+    { "u_terrain_resolution", U_TERRAIN_RESOLUTION},
+    { "u_terrain_step", U_TERRAIN_STEP},
+    { "u_terrain_skirt", U_TERRAIN_SKIRT}
+};
+
+//material keywords. A shader variant is compiled with a #define for each
+//keyword set in its key, instead of branching on uniforms at runtime
+enum ShaderKeyword {
+    KEYWORD_DIFFUSE_MAP,
+    KEYWORD_DIFFUSE_MAP_2,
+    KEYWORD_DIFFUSE_MAP_3,
+    KEYWORD_NORMAL_MAP,
+    KEYWORD_SPECULAR_MAP,
+    KEYWORD_REFLECTION_MAP,
+    KEYWORD_NOISE_MAP,
+    KEYWORD_TRANSPARENCY_MAP,
+    KEYWORD_WEIGHTED_OIT, //pass keyword, not set by materials
+    KEYWORDS_COUNT
+};
+
+const char* const shader_keyword_names_[KEYWORDS_COUNT] = {
+    "USE_DIFFUSE_MAP",
+    "USE_DIFFUSE_MAP_2",
+    "USE_DIFFUSE_MAP_3",
+    "USE_NORMAL_MAP",
+    "USE_SPECULAR_MAP",
+    "USE_REFLECTION_MAP",
+    "USE_NOISE_MAP",
+    "USE_TRANSPARENCY_MAP",
+    "USE_WEIGHTED_OIT"
 };
 
 const std::unordered_map<std::string, UniformID> uniformblock_string2id_ = {
     { "u_lights_ubo", U_LIGHTS_UBO },
+    { "u_emitters_ubo", U_EMITTERS_UBO },
+};
+
+//startup cost of shaders, summed over all programs
+struct ShaderStats {
+    int programs = 0;
+    int cache_hits = 0; //programs loaded from binary cache, skipping compilation
+    float build_ms = 0.0f; //time spent issuing compiles or loading binaries
+    float finish_ms = 0.0f; //time spent waiting for links to complete
 };
 
 class Shader {
@@ -129,13 +165,29 @@ private:
 	//stores, for each uniform enum, it's location
 	std::vector<GLuint> uniform_locations_;
 	void initUniforms_();
+
+    //links are checked lazily, so the driver can compile programs in parallel
+    bool pending_ = false;
+    GLuint vertex_id_ = 0, fragment_id_ = 0;
+    uint64_t cache_key_ = 0;
+    void buildProgram_(const std::string& vsh, const std::string& fsh,
+                       const int num_feedback_varyings = 0, const GLchar* feedback_varyings[] = nullptr);
+    void finishLink_();
+    void checkShaderCompile_(GLuint shader_id);
+    bool loadBinary_();
+    void saveBinary_();
+    std::string binaryPath_();
+    static std::vector<Shader*> pending_shaders_;
+    static void initCompiler_();
     
 public:
-    GLuint program;
+    GLuint program = 0;
 	std::string name;
 	Shader();
     Shader(std::string vertSource, std::string fragSource);
-    Shader(std::string vertSource, std::string fragSource, const int num_feedback_varyings, const GLchar* feedback_varyings[]);
+    Shader(std::string vertSource, std::string fragSource, GLuint keys, const std::string& defines = ""); //variant, see ShaderKeyword
+    Shader(std::string vertSource, std::string fragSource, const int num_feedback_varyings, const GLchar* feedback_varyings[], const std::string& defines = "");
+    ~Shader(); //leaves pending_shaders_, so finishAll never sees a deleted shader
     std::string readFile(std::string filename);
 	GLuint compileFromStrings(std::string vsh, std::string fsh);
     GLuint makeVertexShader(const char* shaderSource);
@@ -145,6 +197,20 @@ public:
     void saveProgramInfoLog(GLuint obj);
     void saveShaderInfoLog(GLuint obj);
     std::string log;
+
+    //program binary cache, keyed by hash of sources, defines and driver. Empty
+    //folder disables it; binaries the driver rejects fall back to compiling
+    static std::string cache_folder;
+    static ShaderStats stats;
+    static void finishAll(); //completes all pending links, e.g. at end of loading
+
+    //variants
+    std::string vertex_path, fragment_path;
+    GLuint keyword_mask = 0; //keywords used by the source - variants only differ in these
+    GLuint keys = 0; //keywords defined in this program
+    std::string defines; //extra '#define NAME value' lines, e.g. limits queried from the driver
+    static std::string injectDefines(const std::string& source, GLuint keys, const std::string& defines = "");
+    static GLuint findKeywords(const std::string& source);
     
 	//
     GLuint getUniformLocation(UniformID name);
@@ -0,0 +1,636 @@
+//
+//  Terrain.cpp
+//
+
+#include "Terrain.h"
+#include "Shader.h"
+#include "extern.h"
+#include <algorithm>
+
+//normals are computed four at a time where SSE is available
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TERRAIN_SSE
+#include <xmmintrin.h>
+#endif
+
+Terrain::~Terrain() {
+    for (auto& chunk : chunks_)
+        releaseChunkBuffers_(chunk);
+    if (ibo_) glDeleteBuffers(1, &ibo_);
+    if (height_texture_) glDeleteTextures(1, &height_texture_);
+    if (patch_vbo_) glDeleteBuffers(1, &patch_vbo_);
+    if (instance_vbo_) glDeleteBuffers(1, &instance_vbo_);
+    if (patch_vao_) glDeleteVertexArrays(1, &patch_vao_);
+}
+
+// Reads the height map into a grid of heights and sets up chunks and quadtree
+// - resolution: number of vertices per side of the terrain
+// - step: distance between vertices
+// - max_height: height of a white pixel
+// - height_map: image data, only the red channel is read
+// - chunk_size: quads per side of each chunk, must be divisible by 2^(num_lods-1)
+// - num_lods: number of geomipmap levels
+void Terrain::init(int resolution, float step, float the_max_height, ImageData& height_map,
+                   int chunk_size, int num_lods) {
+    resolution_ = resolution;
+    step_ = step;
+    max_height_ = the_max_height;
+    chunk_size_ = chunk_size;
+    num_lods_ = num_lods;
+    half_width_ = ((float)resolution_ * step_) / 2;
+    skirt_depth_ = max_height_ * 0.1f + step_;
+
+    //sample height map once, so chunks can be built at any time without the image
+    //red channel is read straight from the pixel data, rows in parallel
+    heights_.resize(resolution_ * resolution_);
+    std::vector<int> x_offsets(resolution_);
+    for (int gx = 0; gx < resolution_; gx++)
+        x_offsets[gx] = (int)(((float)gx / (float)resolution_) * height_map.width) * height_map.bytes_pp;
+    float height_scale = max_height_ / 255.0f;
+    JOBS.parallelFor(resolution_, 16, [&](int gz_begin, int gz_end) {
+        for (int gz = gz_begin; gz < gz_end; gz++) {
+            int y_pixel = (int)(((float)gz / (float)resolution_) * height_map.height);
+            const GLubyte* pixel_row = height_map.data + (size_t)y_pixel * height_map.width * height_map.bytes_pp;
+            float* height_row = &heights_[gz * resolution_];
+            for (int gx = 0; gx < resolution_; gx++)
+                height_row[gx] = (float)pixel_row[x_offsets[gx]] * height_scale;
+        }
+    });
+
+    //vertex texture mode derives normals in shader
+    if (!vertex_texture) {
+        normals_.resize(resolution_ * resolution_ * 3);
+        JOBS.parallelFor(resolution_, 16, [this](int gz_begin, int gz_end) {
+            computeNormals_(gz_begin, gz_end);
+        });
+    }
+
+    //create chunk grid, each with bounds from its heights
+    chunks_per_side_ = (resolution_ - 2) / chunk_size_ + 1;
+    chunks_.resize(chunks_per_side_ * chunks_per_side_);
+    JOBS.parallelFor((int)chunks_.size(), 8, [this](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            TerrainChunk& chunk = chunks_[i];
+            chunk.x = i % chunks_per_side_;
+            chunk.z = i / chunks_per_side_;
+            updateChunkBounds_(chunk);
+        }
+    });
+
+    //quadtree over chunk grid, root spans next power of two
+    int root_size = 1;
+    while (root_size < chunks_per_side_) root_size *= 2;
+    nodes_.clear();
+    int root = buildNode_(0, 0, root_size);
+    aabb = nodes_[root].aabb;
+
+    createIndexBuffer_();
+    chunk_vertex_bytes_ = (size_t)((chunk_size_ + 1) * (chunk_size_ + 1) + 4 * (chunk_size_ + 1)) * 8 * sizeof(GLfloat);
+    if (vertex_texture)
+        createVertexTextureBuffers_();
+}
+
+//chunk bounds from its heights, lowered to include skirts
+void Terrain::updateChunkBounds_(TerrainChunk& chunk) {
+    float min_h = 1000000.0f, max_h = -1000000.0f;
+    for (int lx = 0; lx <= chunk_size_; lx++) {
+        for (int lz = 0; lz <= chunk_size_; lz++) {
+            float h = gridHeight_(chunk.x * chunk_size_ + lx, chunk.z * chunk_size_ + lz);
+            min_h = std::min(min_h, h);
+            max_h = std::max(max_h, h);
+        }
+    }
+    min_h -= skirt_depth_;
+
+    float x0 = (float)(chunk.x * chunk_size_) * step_ - half_width_;
+    float x1 = (float)((chunk.x + 1) * chunk_size_) * step_ - half_width_;
+    float z0 = (float)-(chunk.z * chunk_size_) * step_ + half_width_;
+    float z1 = (float)-((chunk.z + 1) * chunk_size_) * step_ + half_width_;
+    chunk.aabb.center = lm::vec3((x0 + x1) / 2, (min_h + max_h) / 2, (z0 + z1) / 2);
+    chunk.aabb.half_width = lm::vec3((x1 - x0) / 2, (max_h - min_h) / 2, (z0 - z1) / 2);
+}
+
+//recursively creates quadtree nodes, returns index of node or -1 if empty
+int Terrain::buildNode_(int x0, int z0, int size) {
+    if (x0 >= chunks_per_side_ || z0 >= chunks_per_side_) return -1;
+
+    TerrainNode node;
+    if (size == 1) {
+        node.chunk = z0 * chunks_per_side_ + x0;
+        node.aabb = chunks_[node.chunk].aabb;
+        nodes_.push_back(node);
+        return (int)nodes_.size() - 1;
+    }
+
+    int half = size / 2;
+    node.children[0] = buildNode_(x0, z0, half);
+    node.children[1] = buildNode_(x0 + half, z0, half);
+    node.children[2] = buildNode_(x0, z0 + half, half);
+    node.children[3] = buildNode_(x0 + half, z0 + half, half);
+
+    nodes_.push_back(node);
+    refitNode_((int)nodes_.size() - 1);
+    return (int)nodes_.size() - 1;
+}
+
+//inner node bounds are union of children
+void Terrain::refitNode_(int node_id) {
+    TerrainNode& node = nodes_[node_id];
+    if (node.chunk != -1) {
+        node.aabb = chunks_[node.chunk].aabb;
+        return;
+    }
+    lm::vec3 min(1000000.0f, 1000000.0f, 1000000.0f);
+    lm::vec3 max(-1000000.0f, -1000000.0f, -1000000.0f);
+    for (int i = 0; i < 4; i++) {
+        if (node.children[i] == -1) continue;
+        const AABB& c = nodes_[node.children[i]].aabb;
+        for (int j = 0; j < 3; j++) {
+            min.value_[j] = std::min(min.value_[j], c.center.value_[j] - c.half_width.value_[j]);
+            max.value_[j] = std::max(max.value_[j], c.center.value_[j] + c.half_width.value_[j]);
+        }
+    }
+    node.aabb.center = (min + max) * 0.5f;
+    node.aabb.half_width = (max - min) * 0.5f;
+}
+
+//clamped access to grid heights
+float Terrain::gridHeight_(int gx, int gz) const {
+    gx = std::max(0, std::min(gx, resolution_ - 1));
+    gz = std::max(0, std::min(gz, resolution_ - 1));
+    return heights_[gz * resolution_ + gx];
+}
+
+//central difference normal. z runs opposite to gz, hence the sign of the z term
+lm::vec3 Terrain::gridNormal_(int gx, int gz) const {
+    lm::vec3 n(gridHeight_(gx - 1, gz) - gridHeight_(gx + 1, gz),
+               2.0f * step_,
+               gridHeight_(gx, gz + 1) - gridHeight_(gx, gz - 1));
+    return n.normalize();
+}
+
+//fills normals_ for rows [gz_begin, gz_end). Same result as gridNormal_, but
+//interior vertices are done four at a time, straight from the height rows
+void Terrain::computeNormals_(int gz_begin, int gz_end) {
+    const int R = resolution_;
+    for (int gz = gz_begin; gz < gz_end; gz++) {
+        const float* row = &heights_[gz * R];
+        const float* up = &heights_[std::max(gz - 1, 0) * R];
+        const float* down = &heights_[std::min(gz + 1, R - 1) * R];
+        float* out = &normals_[gz * R * 3];
+
+        int gx = 1;
+#ifdef TERRAIN_SSE
+        const __m128 ny = _mm_set1_ps(2.0f * step_);
+        const __m128 ny2 = _mm_mul_ps(ny, ny);
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; gx + 4 <= R - 1; gx += 4) {
+            __m128 nx = _mm_sub_ps(_mm_loadu_ps(row + gx - 1), _mm_loadu_ps(row + gx + 1));
+            __m128 nz = _mm_sub_ps(_mm_loadu_ps(down + gx), _mm_loadu_ps(up + gx));
+            __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), ny2), _mm_mul_ps(nz, nz));
+            __m128 inv_len = _mm_div_ps(one, _mm_sqrt_ps(len2));
+            float x[4], y[4], z[4];
+            _mm_storeu_ps(x, _mm_mul_ps(nx, inv_len));
+            _mm_storeu_ps(y, _mm_mul_ps(ny, inv_len));
+            _mm_storeu_ps(z, _mm_mul_ps(nz, inv_len));
+            for (int i = 0; i < 4; i++) {
+                out[(gx + i) * 3] = x[i];
+                out[(gx + i) * 3 + 1] = y[i];
+                out[(gx + i) * 3 + 2] = z[i];
+            }
+        }
+#endif
+        //remainder, and the clamped edge columns
+        for (; gx < R; gx++) {
+            lm::vec3 n = gridNormal_(gx, gz);
+            out[gx * 3] = n.x; out[gx * 3 + 1] = n.y; out[gx * 3 + 2] = n.z;
+        }
+        lm::vec3 n = gridNormal_(0, gz);
+        out[0] = n.x; out[1] = n.y; out[2] = n.z;
+    }
+}
+
+float Terrain::heightAt(float x, float z) const {
+    if (resolution_ < 2) return 0.0f;
+    float fx = std::max(0.0f, std::min((x + half_width_) / step_, (float)(resolution_ - 1)));
+    float fz = std::max(0.0f, std::min((half_width_ - z) / step_, (float)(resolution_ - 1)));
+    int gx = std::min((int)fx, resolution_ - 2);
+    int gz = std::min((int)fz, resolution_ - 2);
+    float tx = fx - (float)gx;
+    float tz = fz - (float)gz;
+    const float* h = &heights_[gz * resolution_ + gx];
+    float h0 = h[0] + (h[1] - h[0]) * tx;
+    float h1 = h[resolution_] + (h[resolution_ + 1] - h[resolution_]) * tx;
+    return h0 + (h1 - h0) * tz;
+}
+
+bool Terrain::containsXZ(float x, float z) const {
+    float extent = (float)(resolution_ - 1) * step_;
+    float fx = x + half_width_;
+    float fz = half_width_ - z;
+    return fx >= 0.0f && fx <= extent && fz >= 0.0f && fz <= extent;
+}
+
+// Clips ray to terrain bounds, then marches it in steps of half a grid cell
+// until it goes below the heightfield, and refines the crossing by bisection
+bool Terrain::raycast(const lm::vec3& origin, const lm::vec3& direction, float max_distance, lm::vec3& hit_point) const {
+    lm::vec3 dir = direction;
+    dir.normalize();
+
+    //slab test against bounds
+    float t_min = 0.0f, t_max = max_distance;
+    for (int i = 0; i < 3; i++) {
+        float lo = aabb.center.value_[i] - aabb.half_width.value_[i];
+        float hi = aabb.center.value_[i] + aabb.half_width.value_[i];
+        if (std::abs(dir.value_[i]) < 0.000001f) {
+            if (origin.value_[i] < lo || origin.value_[i] > hi) return false;
+            continue;
+        }
+        float t0 = (lo - origin.value_[i]) / dir.value_[i];
+        float t1 = (hi - origin.value_[i]) / dir.value_[i];
+        if (t0 > t1) std::swap(t0, t1);
+        t_min = std::max(t_min, t0);
+        t_max = std::min(t_max, t1);
+        if (t_min > t_max) return false;
+    }
+
+    auto above = [&](float t) {
+        lm::vec3 p = origin + dir * t;
+        return p.y >= heightAt(p.x, p.z);
+    };
+
+    if (!above(t_min)) {
+        hit_point = origin + dir * t_min;
+        return true;
+    }
+
+    float march = step_ * 0.5f;
+    float prev_t = t_min;
+    for (float t = t_min + march; prev_t < t_max; t += march) {
+        t = std::min(t, t_max);
+        if (!above(t)) {
+            float lo = prev_t, hi = t;
+            for (int i = 0; i < 10; i++) {
+                float mid = (lo + hi) * 0.5f;
+                if (above(mid)) lo = mid; else hi = mid;
+            }
+            hit_point = origin + dir * hi;
+            hit_point.y = heightAt(hit_point.x, hit_point.z);
+            return true;
+        }
+        prev_t = t;
+    }
+    return false;
+}
+
+void Terrain::getTriangles(std::vector<float>& positions, std::vector<unsigned int>& indices) const {
+    int R = resolution_;
+    positions.resize((size_t)R * R * 3);
+    for (int gz = 0; gz < R; gz++) {
+        for (int gx = 0; gx < R; gx++) {
+            float* p = &positions[((size_t)gz * R + gx) * 3];
+            p[0] = (float)gx * step_ - half_width_;
+            p[1] = heights_[gz * R + gx];
+            p[2] = half_width_ - (float)gz * step_;
+        }
+    }
+    //wound counter clockwise seen from above
+    indices.clear();
+    indices.reserve((size_t)(R - 1) * (R - 1) * 6);
+    for (int gz = 0; gz < R - 1; gz++) {
+        for (int gx = 0; gx < R - 1; gx++) {
+            unsigned int a = gz * R + gx, b = a + 1, c = a + R, d = c + 1;
+            indices.insert(indices.end(), { a, b, c, b, d, c });
+        }
+    }
+}
+
+// All chunks share the same topology, so a single index buffer holds the
+// triangles for every lod, one after the other. Each lod skips 2^lod vertices,
+// and finishes with skirts around the four edges to hide cracks.
+void Terrain::createIndexBuffer_() {
+    const int S = chunk_size_;
+    const GLushort row = (GLushort)(S + 1);
+    const GLushort skirt_start = (GLushort)(row * row);
+
+    std::vector<GLushort> indices;
+    lod_offsets_.clear();
+    lod_counts_.clear();
+
+    for (int lod = 0; lod < num_lods_; lod++) {
+        int s = 1 << lod;
+        lod_offsets_.push_back((GLuint)indices.size());
+
+        //grid, two tris per quad: ACB, CDB
+        // B---D
+        // | \ |
+        // A---C
+        for (int lx = 0; lx < S; lx += s) {
+            for (int lz = 0; lz < S; lz += s) {
+                GLushort A = (GLushort)(lx * row + lz);
+                GLushort B = (GLushort)(A + s);
+                GLushort C = (GLushort)((lx + s) * row + lz);
+                GLushort D = (GLushort)(C + s);
+                GLushort square[] = { A, C, B, C, D, B };
+                indices.insert(indices.end(), square, square + 6);
+            }
+        }
+
+        //skirts - edges are lz = 0, lz = S, lx = 0, lx = S
+        //both windings are added so skirts are visible regardless of culling
+        for (int edge = 0; edge < 4; edge++) {
+            for (int k = 0; k < S; k += s) {
+                GLushort t0, t1;
+                if (edge == 0) { t0 = (GLushort)(k * row); t1 = (GLushort)((k + s) * row); }
+                else if (edge == 1) { t0 = (GLushort)(k * row + S); t1 = (GLushort)((k + s) * row + S); }
+                else if (edge == 2) { t0 = (GLushort)k; t1 = (GLushort)(k + s); }
+                else { t0 = (GLushort)(S * row + k); t1 = (GLushort)(S * row + k + s); }
+                GLushort b0 = (GLushort)(skirt_start + edge * row + k);
+                GLushort b1 = (GLushort)(b0 + s);
+                GLushort quad[] = { t0, b0, t1, t1, b0, b1,
+                                    t0, t1, b0, t1, b1, b0 };
+                indices.insert(indices.end(), quad, quad + 12);
+            }
+        }
+
+        lod_counts_.push_back((GLuint)indices.size() - lod_offsets_.back());
+    }
+
+    glGenBuffers(1, &ibo_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), &(indices[0]), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    memory_bytes += indices.size() * sizeof(GLushort);
+}
+
+//builds interleaved vertex buffer for chunk (position, uv, normal) and its vao
+void Terrain::createChunkBuffers_(TerrainChunk& chunk) {
+    const int S = chunk_size_;
+    const int row = S + 1;
+    std::vector<GLfloat> verts;
+    verts.reserve((row * row + 4 * row) * 8);
+
+    auto addVertex = [&](int gx, int gz, float drop) {
+        int cgx = std::min(gx, resolution_ - 1);
+        int cgz = std::min(gz, resolution_ - 1);
+        const float* n = &normals_[(cgz * resolution_ + cgx) * 3];
+        GLfloat v[] = {
+            ((float)cgx * step_) - half_width_,
+            gridHeight_(cgx, cgz) - drop,
+            ((float)-cgz * step_) + half_width_,
+            (float)cgx / (float)(resolution_ - 1),
+            (float)cgz / (float)(resolution_ - 1),
+            n[0], n[1], n[2] };
+        verts.insert(verts.end(), v, v + 8);
+    };
+
+    int gx0 = chunk.x * S;
+    int gz0 = chunk.z * S;
+    for (int lx = 0; lx <= S; lx++)
+        for (int lz = 0; lz <= S; lz++)
+            addVertex(gx0 + lx, gz0 + lz, 0.0f);
+
+    //skirt vertices, in same edge order as index buffer
+    for (int k = 0; k <= S; k++) addVertex(gx0 + k, gz0, skirt_depth_);
+    for (int k = 0; k <= S; k++) addVertex(gx0 + k, gz0 + S, skirt_depth_);
+    for (int k = 0; k <= S; k++) addVertex(gx0, gz0 + k, skirt_depth_);
+    for (int k = 0; k <= S; k++) addVertex(gx0 + S, gz0 + k, skirt_depth_);
+
+    glGenVertexArrays(1, &chunk.vao);
+    glBindVertexArray(chunk.vao);
+    glGenBuffers(1, &chunk.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, chunk.vbo);
+    glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(GLfloat), &(verts[0]), GL_STATIC_DRAW);
+    GLsizei stride = 8 * sizeof(GLfloat);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(5 * sizeof(GLfloat)));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    chunk.resident = true;
+    num_resident++;
+    memory_bytes += chunk_vertex_bytes_;
+}
+
+void Terrain::releaseChunkBuffers_(TerrainChunk& chunk) {
+    if (!chunk.resident) return;
+    glDeleteBuffers(1, &chunk.vbo);
+    glDeleteVertexArrays(1, &chunk.vao);
+    chunk.vbo = chunk.vao = 0;
+    chunk.resident = false;
+    num_resident--;
+    memory_bytes -= chunk_vertex_bytes_;
+}
+
+//distance from point to chunk bounds, zero if inside
+float Terrain::distanceToChunk_(const TerrainChunk& chunk, const lm::vec3& p) const {
+    lm::vec3 d;
+    for (int i = 0; i < 3; i++) {
+        float delta = std::abs(p.value_[i] - chunk.aabb.center.value_[i]) - chunk.aabb.half_width.value_[i];
+        d.value_[i] = std::max(delta, 0.0f);
+    }
+    return d.length();
+}
+
+void Terrain::update(const lm::vec3& cam_pos) {
+    //candidates for upload, nearest first
+    std::vector<std::pair<float, int>> to_upload;
+
+    for (size_t i = 0; i < chunks_.size(); i++) {
+        TerrainChunk& chunk = chunks_[i];
+        float dist = distanceToChunk_(chunk, cam_pos);
+
+        //lod 0 up to lod_distance, then one level per doubling of distance
+        int lod = 0;
+        float threshold = lod_distance;
+        while (dist > threshold && lod < num_lods_ - 1) {
+            lod++;
+            threshold *= 2.0f;
+        }
+        chunk.lod = lod;
+
+        //vertex texture mode has nothing to stream, resident only means within view distance
+        if (vertex_texture) {
+            bool in_view = dist < view_distance;
+            num_resident += (int)in_view - (int)chunk.resident;
+            chunk.resident = in_view;
+            continue;
+        }
+
+        //stream in and out, with some hysteresis to avoid thrashing at boundary
+        if (!chunk.resident && dist < view_distance)
+            to_upload.push_back(std::make_pair(dist, (int)i));
+        else if (chunk.resident && dist > view_distance * 1.25f)
+            releaseChunkBuffers_(chunk);
+    }
+
+    std::sort(to_upload.begin(), to_upload.end());
+    for (size_t i = 0; i < to_upload.size() && (int)i < max_uploads_per_frame; i++)
+        createChunkBuffers_(chunks_[to_upload[i].second]);
+}
+
+void Terrain::render(const lm::mat4& mvp) {
+    if (nodes_.empty()) return;
+    if (vertex_texture) {
+        visible_origins_.assign(num_lods_, std::vector<GLfloat>());
+        renderNode_((int)nodes_.size() - 1, mvp);
+        renderInstanced_();
+        return;
+    }
+    renderNode_((int)nodes_.size() - 1, mvp); //root is created last
+    glBindVertexArray(0);
+}
+
+void Terrain::renderNode_(int node_id, const lm::mat4& mvp) {
+    const TerrainNode& node = nodes_[node_id];
+    if (!BBInFrustum(node.aabb, mvp)) return;
+
+    if (node.chunk != -1) {
+        TerrainChunk& chunk = chunks_[node.chunk];
+        if (!chunk.resident) return;
+        if (vertex_texture) {
+            visible_origins_[chunk.lod].push_back((GLfloat)(chunk.x * chunk_size_));
+            visible_origins_[chunk.lod].push_back((GLfloat)(chunk.z * chunk_size_));
+            return;
+        }
+        glBindVertexArray(chunk.vao);
+        glDrawElements(GL_TRIANGLES, lod_counts_[chunk.lod], GL_UNSIGNED_SHORT,
+                       (void*)(lod_offsets_[chunk.lod] * sizeof(GLushort)));
+        num_drawn++;
+        num_tris_drawn += lod_counts_[chunk.lod] / 3;
+        return;
+    }
+
+    for (int i = 0; i < 4; i++)
+        if (node.children[i] != -1) renderNode_(node.children[i], mvp);
+}
+
+// Vertex texture mode: heights go to a single channel float texture, and a
+// single chunk-sized patch stores only local grid coords. Patch vertices are
+// in the same order as chunk vertex buffers, so the shared index buffer
+// (with all lods and skirts) is reused as is.
+void Terrain::createVertexTextureBuffers_() {
+    glGenTextures(1, &height_texture_);
+    glBindTexture(GL_TEXTURE_2D, height_texture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, resolution_, resolution_, 0, GL_RED, GL_FLOAT, &(heights_[0]));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    memory_bytes += (size_t)resolution_ * resolution_ * sizeof(GLfloat);
+
+    //x, z: grid coords within chunk, y: 1 for skirt vertices
+    const int S = chunk_size_;
+    std::vector<GLfloat> verts;
+    for (int lx = 0; lx <= S; lx++)
+        for (int lz = 0; lz <= S; lz++)
+            verts.insert(verts.end(), { (GLfloat)lx, 0.0f, (GLfloat)lz });
+    for (int k = 0; k <= S; k++) verts.insert(verts.end(), { (GLfloat)k, 1.0f, 0.0f });
+    for (int k = 0; k <= S; k++) verts.insert(verts.end(), { (GLfloat)k, 1.0f, (GLfloat)S });
+    for (int k = 0; k <= S; k++) verts.insert(verts.end(), { 0.0f, 1.0f, (GLfloat)k });
+    for (int k = 0; k <= S; k++) verts.insert(verts.end(), { (GLfloat)S, 1.0f, (GLfloat)k });
+
+    glGenVertexArrays(1, &patch_vao_);
+    glBindVertexArray(patch_vao_);
+    glGenBuffers(1, &patch_vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, patch_vbo_);
+    glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(GLfloat), &(verts[0]), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    memory_bytes += verts.size() * sizeof(GLfloat);
+
+    //per instance chunk origin, pointer offset is set per lod when drawing
+    glGenBuffers(1, &instance_vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_);
+    glBufferData(GL_ARRAY_BUFFER, chunks_.size() * 2 * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+    memory_bytes += chunks_.size() * 2 * sizeof(GLfloat);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//uploads origins of visible chunks and draws one instanced call per lod
+void Terrain::renderInstanced_() {
+    std::vector<GLfloat> origins;
+    std::vector<int> lod_first(num_lods_);
+    for (int lod = 0; lod < num_lods_; lod++) {
+        lod_first[lod] = (int)origins.size() / 2;
+        origins.insert(origins.end(), visible_origins_[lod].begin(), visible_origins_[lod].end());
+    }
+    if (origins.empty()) return;
+
+    glBindVertexArray(patch_vao_);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_);
+    glBufferData(GL_ARRAY_BUFFER, chunks_.size() * 2 * sizeof(GLfloat), NULL, GL_STREAM_DRAW); //orphan
+    glBufferSubData(GL_ARRAY_BUFFER, 0, origins.size() * sizeof(GLfloat), &(origins[0]));
+
+    for (int lod = 0; lod < num_lods_; lod++) {
+        GLsizei count = (GLsizei)visible_origins_[lod].size() / 2;
+        if (count == 0) continue;
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, (void*)(lod_first[lod] * 2 * sizeof(GLfloat)));
+        glDrawElementsInstanced(GL_TRIANGLES, lod_counts_[lod], GL_UNSIGNED_SHORT,
+                                (void*)(lod_offsets_[lod] * sizeof(GLushort)), count);
+        num_drawn += count;
+        num_tris_drawn += count * (lod_counts_[lod] / 3);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void Terrain::setUniforms(Shader* shader) {
+    if (!vertex_texture) return;
+    shader->setTexture(U_HEIGHT_MAP, height_texture_, 16);
+    shader->setUniform(U_TERRAIN_RESOLUTION, resolution_);
+    shader->setUniform(U_TERRAIN_STEP, step_);
+    shader->setUniform(U_TERRAIN_SKIRT, skirt_depth_);
+}
+
+void Terrain::setHeights(int gx0, int gz0, int width, int height, const float* data) {
+    //clip rectangle to grid
+    int x_start = std::max(gx0, 0), z_start = std::max(gz0, 0);
+    int x_end = std::min(gx0 + width, resolution_), z_end = std::min(gz0 + height, resolution_);
+    if (x_start >= x_end || z_start >= z_end) return;
+
+    for (int gz = z_start; gz < z_end; gz++)
+        for (int gx = x_start; gx < x_end; gx++)
+            heights_[gz * resolution_ + gx] = data[(gz - gz0) * width + (gx - gx0)];
+    if (!vertex_texture)
+        computeNormals_(std::max(z_start - 1, 0), std::min(z_end + 1, resolution_));
+
+    //affected chunks; normals reach one vertex further, and chunks share edge vertices
+    int cx0 = std::max((x_start - 1) / chunk_size_ - 1, 0);
+    int cz0 = std::max((z_start - 1) / chunk_size_ - 1, 0);
+    int cx1 = std::min(x_end / chunk_size_, chunks_per_side_ - 1);
+    int cz1 = std::min(z_end / chunk_size_, chunks_per_side_ - 1);
+    for (int cz = cz0; cz <= cz1; cz++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            TerrainChunk& chunk = chunks_[cz * chunks_per_side_ + cx];
+            updateChunkBounds_(chunk);
+            if (!vertex_texture) releaseChunkBuffers_(chunk); //rebuilt by next update
+        }
+    }
+
+    //children are stored before parents, so one pass refits the whole tree
+    for (size_t i = 0; i < nodes_.size(); i++)
+        refitNode_((int)i);
+    aabb = nodes_.back().aabb;
+
+    if (vertex_texture) {
+        glBindTexture(GL_TEXTURE_2D, height_texture_);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, resolution_);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x_start, z_start, x_end - x_start, z_end - z_start,
+                        GL_RED, GL_FLOAT, &(heights_[z_start * resolution_ + x_start]));
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+}
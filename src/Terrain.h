@@ -0,0 +1,133 @@
+//
+//  Terrain.h
+//
+//  Chunked heightmap terrain. The heightfield is split into square chunks
+//  which are organised in a quadtree for hierarchical frustum culling. Each
+//  chunk shares one of a small number of index buffers (geomipmap levels),
+//  and has skirts around its edges so that neighbouring chunks at different
+//  levels never show cracks. Chunk vertex buffers are only created when the
+//  chunk is within view distance, so GPU memory scales with view distance
+//  rather than with the size of the heightmap.
+//
+//  Alternatively, in vertex texture mode, no chunk has a vertex buffer at all.
+//  The heights are stored in a single float texture, and one shared grid patch
+//  is drawn instanced for every visible chunk, displaced in the vertex shader.
+//
+#pragma once
+#include "includes.h"
+#include "GraphicsUtilities.h"
+#include <vector>
+
+struct TerrainChunk {
+    int x = 0, z = 0; //chunk coords in chunk grid
+    AABB aabb; //in terrain local space
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    int lod = 0; //currently selected geomipmap level
+    bool resident = false; //true if vertex buffer exists in VRAM
+};
+
+//quadtree node. Leaves point to a chunk, inner nodes to four children
+struct TerrainNode {
+    AABB aabb;
+    int children[4] = { -1, -1, -1, -1 };
+    int chunk = -1;
+};
+
+class Shader;
+
+class Terrain {
+public:
+    ~Terrain();
+
+    //if true (set before init), render with shared patch and height texture
+    bool vertex_texture = false;
+
+    //builds heights, chunk bounds and quadtree. No chunk is uploaded until update()
+    void init(int resolution, float step, float max_height, ImageData& height_map,
+              int chunk_size = 32, int num_lods = 4);
+
+    //select lod for each chunk, and upload/release chunks according to view distance
+    //- cam_pos: camera position in terrain local space
+    void update(const lm::vec3& cam_pos);
+
+    //draw all resident chunks which pass frustum test for given model_view_projection
+    void render(const lm::mat4& mvp);
+
+    //bilinear height of heightfield at x, z (terrain local space), clamped to edges
+    float heightAt(float x, float z) const;
+    //true if x, z (terrain local space) is over the heightfield
+    bool containsXZ(float x, float z) const;
+    //nearest intersection of ray with heightfield, in terrain local space
+    bool raycast(const lm::vec3& origin, const lm::vec3& direction, float max_distance, lm::vec3& hit_point) const;
+    //two triangles per grid cell at full resolution, in terrain local space
+    void getTriangles(std::vector<float>& positions, std::vector<unsigned int>& indices) const;
+
+    //in vertex texture mode, binds height texture and grid uniforms to shader
+    void setUniforms(Shader* shader);
+
+    //overwrite a rectangle of grid heights (world units, row major in x)
+    //updates bounds, and the height texture or affected chunk buffers
+    void setHeights(int gx0, int gz0, int width, int height, const float* data);
+
+    AABB aabb; //bounds of entire terrain
+
+    //tweakables
+    float view_distance = 150.0f; //chunks within this are streamed in, and stay drawn until 1.25x this
+    float lod_distance = 25.0f; //distance at which lod 1 kicks in, doubles for each level
+    int max_uploads_per_frame = 4; //limit chunk creation to avoid hitches
+
+    //stats
+    int num_chunks() const { return (int)chunks_.size(); }
+    int num_resident = 0;
+    int num_drawn = 0; //chunk draws this frame, over all passes
+    int num_tris_drawn = 0;
+    void resetStats() { num_drawn = 0; num_tris_drawn = 0; } //once per frame
+    size_t memory_bytes = 0; //vertex, index and texture memory in use
+
+private:
+    int resolution_ = 0; //vertices per side of full terrain
+    int chunk_size_ = 32; //quads per side of chunk
+    int chunks_per_side_ = 0;
+    int num_lods_ = 4;
+    float step_ = 1.0f;
+    float half_width_ = 0.0f;
+    float max_height_ = 0.0f;
+    float skirt_depth_ = 1.0f;
+    size_t chunk_vertex_bytes_ = 0;
+
+    //grid heights in world units, resolution_ * resolution_, row major in x
+    std::vector<float> heights_;
+    float gridHeight_(int gx, int gz) const;
+    lm::vec3 gridNormal_(int gx, int gz) const;
+
+    //normalized normals for each grid vertex, xyz. Only kept when not in vertex texture mode
+    std::vector<float> normals_;
+    void computeNormals_(int gz_begin, int gz_end);
+
+    std::vector<TerrainChunk> chunks_;
+    std::vector<TerrainNode> nodes_;
+    int buildNode_(int x0, int z0, int size);
+    void updateChunkBounds_(TerrainChunk& chunk);
+    void refitNode_(int node);
+    void renderNode_(int node, const lm::mat4& mvp);
+
+    //shared index buffer with all lods; offsets and counts are in indices
+    GLuint ibo_ = 0;
+    std::vector<GLuint> lod_offsets_;
+    std::vector<GLuint> lod_counts_;
+    void createIndexBuffer_();
+
+    void createChunkBuffers_(TerrainChunk& chunk);
+    void releaseChunkBuffers_(TerrainChunk& chunk);
+    float distanceToChunk_(const TerrainChunk& chunk, const lm::vec3& p) const;
+
+    //vertex texture mode
+    GLuint height_texture_ = 0;
+    GLuint patch_vao_ = 0;
+    GLuint patch_vbo_ = 0;
+    GLuint instance_vbo_ = 0; //grid origin of each visible chunk, grouped by lod
+    std::vector<std::vector<GLfloat>> visible_origins_; //per lod, filled by renderNode_
+    void createVertexTextureBuffers_();
+    void renderInstanced_();
+};
@@ -0,0 +1,882 @@
+//
+//  Texture.cpp
+//
+
+#include "Texture.h"
+#include "Parsers.h"
+#include "extern.h"
+#include "ResourceCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <unordered_set>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include "dirent.h"
+#else
+#include <dirent.h>
+#endif
+
+std::unordered_map<GLuint, TextureInfo> Texture::textures_;
+
+#define FOURCC(a, b, c, d) ((GLuint)(a) | ((GLuint)(b) << 8) | ((GLuint)(c) << 16) | ((GLuint)(d) << 24))
+
+//DDS file layout, after the 4 byte "DDS " magic
+struct DDSPixelFormat {
+    GLuint size, flags, four_cc, rgb_bit_count, r_mask, g_mask, b_mask, a_mask;
+};
+struct DDSHeader {
+    GLuint size, flags, height, width, pitch_or_linear_size, depth, mip_map_count;
+    GLuint reserved1[11];
+    DDSPixelFormat pixel_format;
+    GLuint caps, caps2, caps3, caps4, reserved2;
+};
+struct DDSHeaderDX10 {
+    GLuint dxgi_format, resource_dimension, misc_flag, array_size, misc_flags2;
+};
+static const GLuint DDPF_FOURCC = 0x4, DDPF_RGB = 0x40;
+
+//KTX 1 header, after the 12 byte identifier
+struct KTXHeader {
+    GLuint endianness, gl_type, gl_type_size, gl_format, gl_internal_format, gl_base_internal_format;
+    GLuint pixel_width, pixel_height, pixel_depth, number_of_array_elements, number_of_faces;
+    GLuint number_of_mipmap_levels, bytes_of_key_value_data;
+};
+
+static bool isBlockFormat(GLenum internal_format) {
+    return internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT || internal_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+           internal_format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT || internal_format == GL_COMPRESSED_RED_RGTC1 ||
+           internal_format == GL_COMPRESSED_RG_RGTC2;
+}
+
+size_t Texture::levelBytes(GLenum internal_format, int width, int height) {
+    size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+    switch (internal_format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RED_RGTC1:
+        return blocks * 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_RG_RGTC2:
+        return blocks * 16;
+    default:
+        return (size_t)width * height * 4; //drivers pad rgb8 to 4 bytes
+    }
+}
+
+const char* Texture::formatName(GLenum internal_format) {
+    switch (internal_format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: return "BC1";
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return "BC3";
+    case GL_COMPRESSED_RED_RGTC1: return "BC4";
+    case GL_COMPRESSED_RG_RGTC2: return "BC5";
+    case GL_RGB: case GL_RGB8: return "RGB8";
+    case GL_RGBA: case GL_RGBA8: return "RGBA8";
+    default: return "other";
+    }
+}
+
+void Texture::track(GLuint texture_id, const TextureInfo& info) {
+    textures_[texture_id] = info;
+}
+
+const TextureInfo* Texture::info(GLuint texture_id) {
+    auto it = textures_.find(texture_id);
+    return it == textures_.end() ? nullptr : &it->second;
+}
+
+size_t Texture::totalBytes() {
+    size_t total = 0;
+    for (auto& t : textures_) total += t.second.bytes;
+    return total;
+}
+
+//reads num_levels levels of internal_format from file, each tightly packed
+static bool readLevels(std::ifstream& file, GLenum internal_format, int width, int height, int num_levels,
+                       int bytes_pp, TextureImage& image) {
+    for (int i = 0; i < num_levels; i++) {
+        TextureLevel level;
+        level.width = std::max(width >> i, 1);
+        level.height = std::max(height >> i, 1);
+        size_t size = bytes_pp ? (size_t)level.width * level.height * bytes_pp
+                               : Texture::levelBytes(internal_format, level.width, level.height);
+        level.data.resize(size);
+        file.read((char*)level.data.data(), size);
+        if ((size_t)file.gcount() != size) return false;
+        image.levels.push_back(std::move(level));
+    }
+    return true;
+}
+
+bool Texture::loadDDS(std::string filename, TextureImage& image) {
+    std::ifstream file(filename, std::ios::binary);
+    GLuint magic = 0;
+    DDSHeader header;
+    file.read((char*)&magic, 4);
+    file.read((char*)&header, sizeof(DDSHeader));
+    if (!file || magic != FOURCC('D', 'D', 'S', ' ') || header.size != sizeof(DDSHeader)) {
+        std::cerr << "ERROR: DDS file is not in correct format or corrupted: " << filename << std::endl;
+        return false;
+    }
+
+    image = TextureImage();
+    int bytes_pp = 0;
+    const DDSPixelFormat& pf = header.pixel_format;
+    if (pf.flags & DDPF_FOURCC) {
+        switch (pf.four_cc) {
+        case FOURCC('D', 'X', 'T', '1'): image.internal_format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+        case FOURCC('D', 'X', 'T', '5'): image.internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+        case FOURCC('A', 'T', 'I', '1'):
+        case FOURCC('B', 'C', '4', 'U'): image.internal_format = GL_COMPRESSED_RED_RGTC1; break;
+        case FOURCC('A', 'T', 'I', '2'):
+        case FOURCC('B', 'C', '5', 'U'): image.internal_format = GL_COMPRESSED_RG_RGTC2; break;
+        case FOURCC('D', 'X', '1', '0'): {
+            DDSHeaderDX10 dx10;
+            file.read((char*)&dx10, sizeof(DDSHeaderDX10));
+            switch (dx10.dxgi_format) {
+            case 71: image.internal_format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break; //BC1_UNORM
+            case 77: image.internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break; //BC3_UNORM
+            case 80: image.internal_format = GL_COMPRESSED_RED_RGTC1; break; //BC4_UNORM
+            case 83: image.internal_format = GL_COMPRESSED_RG_RGTC2; break; //BC5_UNORM
+            case 28: //R8G8B8A8_UNORM
+                image.internal_format = GL_RGBA8; image.format = GL_RGBA; image.type = GL_UNSIGNED_BYTE; bytes_pp = 4;
+                break;
+            }
+            break;
+        }
+        }
+    }
+    else if ((pf.flags & DDPF_RGB) && pf.rgb_bit_count == 32 && pf.b_mask == 0xff) {
+        image.internal_format = GL_RGBA8;
+        image.format = GL_BGRA;
+        image.type = GL_UNSIGNED_BYTE;
+        bytes_pp = 4;
+    }
+    if (!image.internal_format) {
+        std::cerr << "ERROR: DDS pixel format not supported: " << filename << std::endl;
+        return false;
+    }
+
+    int num_levels = std::max((int)header.mip_map_count, 1);
+    if (!readLevels(file, image.internal_format, header.width, header.height, num_levels, bytes_pp, image)) {
+        std::cerr << "ERROR: Could not read dds data: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Texture::loadKTX(std::string filename, TextureImage& image) {
+    static const GLubyte identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+    std::ifstream file(filename, std::ios::binary);
+    GLubyte file_identifier[12];
+    KTXHeader header;
+    file.read((char*)file_identifier, 12);
+    file.read((char*)&header, sizeof(KTXHeader));
+    if (!file || memcmp(identifier, file_identifier, 12) != 0 || header.endianness != 0x04030201) {
+        std::cerr << "ERROR: KTX file is not in correct format or corrupted: " << filename << std::endl;
+        return false;
+    }
+    if (header.pixel_depth > 1 || header.number_of_array_elements > 0 || header.number_of_faces != 1) {
+        std::cerr << "ERROR: Only 2D KTX textures are supported: " << filename << std::endl;
+        return false;
+    }
+    file.seekg(header.bytes_of_key_value_data, std::ios::cur);
+
+    image = TextureImage();
+    image.internal_format = header.gl_internal_format;
+    image.format = header.gl_type ? header.gl_format : 0;
+    image.type = header.gl_type;
+    if (image.compressed() && !isBlockFormat(image.internal_format)) {
+        std::cerr << "ERROR: KTX compressed format not supported: " << filename << std::endl;
+        return false;
+    }
+
+    //each level is prefixed with its size and padded to 4 bytes
+    int num_levels = std::max((int)header.number_of_mipmap_levels, 1);
+    for (int i = 0; i < num_levels; i++) {
+        GLuint image_size = 0;
+        file.read((char*)&image_size, 4);
+        TextureLevel level;
+        level.width = std::max((int)header.pixel_width >> i, 1);
+        level.height = std::max((int)header.pixel_height >> i, 1);
+        level.data.resize(image_size);
+        file.read((char*)level.data.data(), image_size);
+        if (!file) {
+            std::cerr << "ERROR: Could not read ktx data: " << filename << std::endl;
+            return false;
+        }
+        file.seekg((4 - image_size % 4) % 4, std::ios::cur);
+        image.levels.push_back(std::move(level));
+    }
+    return true;
+}
+
+bool Texture::saveDDS(std::string filename, const TextureImage& image) {
+    if (image.levels.empty() || !image.compressed()) return false;
+
+    DDSHeader header;
+    memset(&header, 0, sizeof(DDSHeader));
+    header.size = sizeof(DDSHeader);
+    header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; //caps, height, width, pixel format, mip count, linear size
+    header.height = image.levels[0].height;
+    header.width = image.levels[0].width;
+    header.pitch_or_linear_size = (GLuint)image.levels[0].data.size();
+    header.mip_map_count = (GLuint)image.levels.size();
+    header.pixel_format.size = sizeof(DDSPixelFormat);
+    header.pixel_format.flags = DDPF_FOURCC;
+    switch (image.internal_format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: header.pixel_format.four_cc = FOURCC('D', 'X', 'T', '1'); break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: header.pixel_format.four_cc = FOURCC('D', 'X', 'T', '5'); break;
+    case GL_COMPRESSED_RED_RGTC1: header.pixel_format.four_cc = FOURCC('A', 'T', 'I', '1'); break;
+    case GL_COMPRESSED_RG_RGTC2: header.pixel_format.four_cc = FOURCC('A', 'T', 'I', '2'); break;
+    default: return false;
+    }
+    header.caps = 0x1000 | (image.levels.size() > 1 ? 0x400008 : 0); //texture, mipmap and complex
+
+    std::ofstream file(filename, std::ios::binary);
+    GLuint magic = FOURCC('D', 'D', 'S', ' ');
+    file.write((const char*)&magic, 4);
+    file.write((const char*)&header, sizeof(DDSHeader));
+    for (auto& level : image.levels)
+        file.write((const char*)level.data.data(), level.data.size());
+    return (bool)file;
+}
+
+GLuint Texture::createTexture_() {
+    GLuint texture_id;
+    glGenTextures(1, &texture_id);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4);
+    return texture_id;
+}
+
+void Texture::uploadTo_(GLuint texture_id, const TextureImage& image, std::string filename, bool from_pixel_buffer) {
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+
+    TextureInfo info;
+    info.file = filename;
+    info.internal_format = image.internal_format;
+    info.width = image.levels[0].width;
+    info.height = image.levels[0].height;
+    info.levels = (int)image.levels.size();
+    info.evictable = !filename.empty();
+    if (const TextureInfo* previous = Texture::info(texture_id))
+        info.last_used = previous->last_used;
+
+    //levels are uploaded as stored, only an uncompressed image without mips gets them generated
+    size_t offset = 0;
+    for (size_t i = 0; i < image.levels.size(); i++) {
+        const TextureLevel& level = image.levels[i];
+        const void* data = from_pixel_buffer ? (const void*)offset : level.data.data();
+        if (image.compressed())
+            glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, image.internal_format, level.width, level.height, 0,
+                                   (GLsizei)level.data.size(), data);
+        else
+            glTexImage2D(GL_TEXTURE_2D, (GLint)i, image.internal_format, level.width, level.height, 0,
+                         image.format, image.type, data);
+        offset += level.data.size();
+        info.bytes += levelBytes(image.internal_format, level.width, level.height);
+    }
+    if (image.levels.size() == 1 && !image.compressed()) {
+        info.levels = (int)std::log2(std::max(info.width, info.height)) + 1;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, info.levels - 1);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        info.bytes = info.bytes * 4 / 3;
+    }
+    else {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+    }
+
+    track(texture_id, info);
+}
+
+unsigned long long Texture::contentHash(const TextureImage& image) {
+    unsigned long long hash = ResourceCache::HASH_SEED;
+    GLenum formats[3] = { image.internal_format, image.format, image.type };
+    ResourceCache::hashBytes(formats, sizeof(formats), hash);
+    for (auto& level : image.levels) {
+        int size[2] = { level.width, level.height };
+        ResourceCache::hashBytes(size, sizeof(size), hash);
+        ResourceCache::hashBytes(level.data.data(), level.data.size(), hash);
+    }
+    return hash;
+}
+
+GLuint Texture::upload(const TextureImage& image, std::string filename) {
+    if (image.levels.empty()) return 0;
+    GLuint texture_id = createTexture_();
+    uploadTo_(texture_id, image, filename, false);
+    return texture_id;
+}
+
+//modification time of file, -1 if it doesn't exist
+static long long fileTime_(const std::string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return -1;
+    return (long long)info.st_mtime;
+}
+
+bool Texture::loadFile(std::string filename, TextureImage& image) {
+    std::string ext = filename.size() > 4 ? filename.substr(filename.size() - 4) : "";
+    if (ext == ".dds" || ext == ".DDS") return loadDDS(filename, image);
+    if (ext == ".ktx" || ext == ".KTX") return loadKTX(filename, image);
+    if (ext != ".tga" && ext != ".TGA") {
+        std::cerr << "ERROR: No extension or extension not supported" << std::endl;
+        return false;
+    }
+
+    //a converted file older than the tga is stale, the tga was edited since
+    std::string base = filename.substr(0, filename.size() - 4);
+    long long tga_time = fileTime_(filename);
+    long long dds_time = fileTime_(base + ".dds");
+    long long ktx_time = fileTime_(base + ".ktx");
+    if (dds_time >= 0 && dds_time >= tga_time && loadDDS(base + ".dds", image)) return true;
+    if (ktx_time >= 0 && ktx_time >= tga_time && loadKTX(base + ".ktx", image)) return true;
+
+    TGAInfo* tgainfo = Parsers::loadTGA(filename);
+    if (!tgainfo) return false;
+    image = TextureImage();
+    image.internal_format = tgainfo->bpp == 24 ? GL_RGB : GL_RGBA;
+    image.format = tgainfo->bpp == 24 ? GL_BGR : GL_BGRA;
+    image.type = GL_UNSIGNED_BYTE;
+    TextureLevel level;
+    level.width = tgainfo->width;
+    level.height = tgainfo->height;
+    level.data.assign(tgainfo->data, tgainfo->data + (size_t)tgainfo->width * tgainfo->height * (tgainfo->bpp / 8));
+    image.levels.push_back(std::move(level));
+    free(tgainfo->data);
+    delete tgainfo;
+    return true;
+}
+
+//staging buffers for uploads; a buffer is reused once the GPU has read it
+struct PixelBufferSlot {
+    GLuint buffer = 0;
+    size_t capacity = 0;
+    GLsync fence = 0;
+};
+static const int NUM_PIXEL_BUFFERS = 3;
+static PixelBufferSlot pixel_buffers_[NUM_PIXEL_BUFFERS];
+static int next_pixel_buffer_ = 0;
+
+//images decoded by background jobs, waiting for upload
+struct DecodedTexture {
+    GLuint texture_id;
+    std::string filename;
+    TextureImage image;
+    bool loaded;
+    unsigned long long hash; //computed on the worker
+};
+static std::mutex decoded_mutex_;
+static std::deque<DecodedTexture> decoded_;
+static std::unordered_set<GLuint> cancelled_; //released while loading, name is kept until its job is done
+static std::chrono::high_resolution_clock::time_point first_request_;
+
+bool Texture::streaming = true;
+float Texture::upload_budget_mb = 4.0f;
+TextureStreamingStats Texture::stream_stats;
+TextureResidencyStats Texture::residency_stats;
+unsigned int Texture::frame_ = 1;
+
+void Texture::release(GLuint texture_id) {
+    auto it = textures_.find(texture_id);
+    if (it != textures_.end() && !it->second.resident)
+        cancelled_.insert(texture_id);
+    else
+        glDeleteTextures(1, &texture_id);
+    if (it != textures_.end())
+        textures_.erase(it);
+}
+
+GLuint Texture::loadAsync(std::string filename) {
+    //flat normal while a normal map loads, mid grey otherwise
+    std::string name = filename.substr(0, filename.find_last_of('.'));
+    bool normal_map = name.find("_ddn") != std::string::npos || name.find("_normal") != std::string::npos ||
+                      (name.size() > 2 && name.substr(name.size() - 2) == "_n");
+    GLubyte placeholder[4] = { 128, 128, (GLubyte)(normal_map ? 255 : 128), 255 };
+
+    GLuint texture_id = createTexture_();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    TextureInfo info;
+    info.file = filename;
+    info.internal_format = GL_RGBA;
+    info.width = info.height = info.levels = 1;
+    info.bytes = 4;
+    info.resident = false;
+    track(texture_id, info);
+
+    streamInto_(texture_id, filename);
+    return texture_id;
+}
+
+//queues background load of file, which updateStreaming uploads into texture_id
+void Texture::streamInto_(GLuint texture_id, std::string filename) {
+    if (stream_stats.pending == 0)
+        first_request_ = std::chrono::high_resolution_clock::now();
+    stream_stats.requested++;
+    stream_stats.pending++;
+
+    JOBS.submit([texture_id, filename] {
+        DecodedTexture decoded;
+        decoded.texture_id = texture_id;
+        decoded.filename = filename;
+        decoded.loaded = loadFile(filename, decoded.image) && !decoded.image.levels.empty();
+        decoded.hash = decoded.loaded ? contentHash(decoded.image) : 0;
+        std::lock_guard<std::mutex> lock(decoded_mutex_);
+        decoded_.push_back(std::move(decoded));
+    });
+}
+
+void Texture::updateStreaming() {
+    stream_stats.bytes_last_frame = 0;
+    size_t budget = (size_t)(upload_budget_mb * 1024 * 1024);
+
+    while (true) {
+        DecodedTexture decoded;
+        {
+            std::lock_guard<std::mutex> lock(decoded_mutex_);
+            if (decoded_.empty()) break;
+            size_t size = 0;
+            for (auto& level : decoded_.front().image.levels) size += level.data.size();
+            if (stream_stats.bytes_last_frame > 0 && stream_stats.bytes_last_frame + size > budget) break;
+
+            //stop if the GPU has not finished reading the next staging buffer yet
+            PixelBufferSlot& slot = pixel_buffers_[next_pixel_buffer_];
+            if (slot.fence) {
+                if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED) break;
+                glDeleteSync(slot.fence);
+                slot.fence = 0;
+            }
+            decoded = std::move(decoded_.front());
+            decoded_.pop_front();
+        }
+        stream_stats.pending--;
+        if (stream_stats.pending == 0)
+            stream_stats.all_resident_ms = std::chrono::duration<float, std::milli>(
+                std::chrono::high_resolution_clock::now() - first_request_).count();
+        if (cancelled_.erase(decoded.texture_id)) {
+            glDeleteTextures(1, &decoded.texture_id);
+            continue;
+        }
+        if (!decoded.loaded) {
+            std::cerr << "ERROR: Could not stream texture, keeping what it shows: " << decoded.filename << std::endl;
+            auto it = textures_.find(decoded.texture_id);
+            if (it != textures_.end()) it->second.resident = true;
+            continue;
+        }
+
+        ResourceCache::setContentHash(ResourceTexture, decoded.texture_id, decoded.hash);
+
+        //copy levels one after another into staging buffer, then specify texture from it
+        PixelBufferSlot& slot = pixel_buffers_[next_pixel_buffer_];
+        size_t size = 0;
+        for (auto& level : decoded.image.levels) size += level.data.size();
+        if (!slot.buffer) glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        if (slot.capacity < size) {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+            slot.capacity = size;
+        }
+        //unsynchronized is safe, the fence above guarantees the GPU is done with this buffer
+        GLubyte* dst = (GLubyte*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (dst) {
+            for (auto& level : decoded.image.levels) {
+                memcpy(dst, level.data.data(), level.data.size());
+                dst += level.data.size();
+            }
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            uploadTo_(decoded.texture_id, decoded.image, decoded.filename, true);
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        else {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            uploadTo_(decoded.texture_id, decoded.image, decoded.filename, false);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        next_pixel_buffer_ = (next_pixel_buffer_ + 1) % NUM_PIXEL_BUFFERS;
+        stream_stats.bytes_last_frame += size;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+//levels kept by an eviction are copied through this buffer, orphaned on each use
+static GLuint eviction_buffer_ = 0;
+
+void Texture::releaseStreaming() {
+    for (auto& slot : pixel_buffers_) {
+        if (slot.fence) glDeleteSync(slot.fence);
+        if (slot.buffer) glDeleteBuffers(1, &slot.buffer);
+        slot = PixelBufferSlot();
+    }
+    if (eviction_buffer_) glDeleteBuffers(1, &eviction_buffer_);
+    eviction_buffer_ = 0;
+}
+
+//textures used within this many frames are not evicted, so a texture in view is not shrunk
+static const unsigned int EVICT_UNUSED_FRAMES = 60;
+//smallest level 0 an eviction may leave
+static const int EVICT_MIN_SIZE = 64;
+
+void Texture::touch(GLuint texture_id) {
+    auto it = textures_.find(texture_id);
+    if (it == textures_.end()) return;
+    TextureInfo& info = it->second;
+    info.last_used = frame_;
+
+    //reload evicted texture in full, if the levels it gains fit budget
+    if (info.evicted_levels > 0 && info.resident) {
+        size_t full_bytes = info.bytes << (2 * info.evicted_levels);
+        if (totalBytes() - info.bytes + full_bytes <= residency_stats.budget_bytes) {
+            info.resident = false;
+            residency_stats.reloads++;
+            streamInto_(texture_id, info.file);
+        }
+    }
+}
+
+// Copies levels 1 and below into a pixel buffer and respecifies the texture from
+// it, so level 1 becomes level 0. Both copies stay on the GPU, so the CPU never
+// waits for texels. Drivers free the old storage when level 0 changes size.
+bool Texture::evictTopLevel_(GLuint texture_id) {
+    TextureInfo info = textures_[texture_id];
+    if (info.levels < 2) return false;
+    bool block_format = isBlockFormat(info.internal_format);
+
+    //kept levels back to back, uncompressed ones as rgba8
+    std::vector<size_t> offsets(1, 0);
+    for (int i = 1; i < info.levels; i++)
+        offsets.push_back(offsets.back() + levelBytes(info.internal_format, std::max(info.width >> i, 1), std::max(info.height >> i, 1)));
+
+    if (!eviction_buffer_) glGenBuffers(1, &eviction_buffer_);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, eviction_buffer_);
+    glBufferData(GL_PIXEL_PACK_BUFFER, offsets.back(), NULL, GL_STREAM_COPY);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    for (int i = 1; i < info.levels; i++) {
+        if (block_format)
+            glGetCompressedTexImage(GL_TEXTURE_2D, i, (void*)offsets[i - 1]);
+        else
+            glGetTexImage(GL_TEXTURE_2D, i, GL_RGBA, GL_UNSIGNED_BYTE, (void*)offsets[i - 1]);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    TextureInfo new_info = info;
+    new_info.width = std::max(info.width >> 1, 1);
+    new_info.height = std::max(info.height >> 1, 1);
+    new_info.levels = info.levels - 1;
+    new_info.bytes = 0;
+    new_info.evicted_levels = info.evicted_levels + 1;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, eviction_buffer_);
+    for (int i = 0; i < new_info.levels; i++) {
+        int width = std::max(new_info.width >> i, 1), height = std::max(new_info.height >> i, 1);
+        if (block_format)
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, info.internal_format, width, height, 0,
+                                   (GLsizei)(offsets[i + 1] - offsets[i]), (void*)offsets[i]);
+        else
+            glTexImage2D(GL_TEXTURE_2D, i, info.internal_format, width, height, 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, (void*)offsets[i]);
+        new_info.bytes += levelBytes(info.internal_format, width, height);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, new_info.levels - 1);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    track(texture_id, new_info);
+    residency_stats.evicted_levels++;
+    return true;
+}
+
+void Texture::updateResidency(size_t budget_bytes) {
+    frame_++;
+    residency_stats.budget_bytes = budget_bytes;
+    residency_stats.over_budget = false;
+    size_t total = totalBytes();
+    if (total <= budget_bytes) return;
+
+    //least recently used first
+    std::vector<std::pair<unsigned int, GLuint>> candidates;
+    for (auto& t : textures_) {
+        const TextureInfo& info = t.second;
+        if (info.evictable && info.resident && info.levels > 1 && frame_ - info.last_used > EVICT_UNUSED_FRAMES &&
+            std::max(info.width, info.height) > EVICT_MIN_SIZE)
+            candidates.push_back({ info.last_used, t.first });
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    //one level from each, oldest first, a few per frame at most
+    const int max_evictions = 8;
+    int evictions = 0;
+    for (auto& c : candidates) {
+        if (total <= budget_bytes || evictions == max_evictions) break;
+        size_t before = textures_[c.second].bytes;
+        if (!evictTopLevel_(c.second)) continue;
+        total -= before - textures_[c.second].bytes;
+        evictions++;
+    }
+    residency_stats.over_budget = total > budget_bytes && evictions < max_evictions;
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+//colour endpoints are stored as 565
+static GLushort to565(const float c[3]) {
+    int r = (int)(std::min(std::max(c[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    int g = (int)(std::min(std::max(c[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+    int b = (int)(std::min(std::max(c[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    return (GLushort)((r << 11) | (g << 5) | b);
+}
+
+static void from565(GLushort c, int rgb[3]) {
+    int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Fits a line through the 16 colours of the block along their principal axis
+// (found by power iteration on the covariance matrix) and uses the extremes
+// of the projected colours as endpoints. Always uses the 4 colour mode.
+void Texture::encodeBC1(const GLubyte block[64], GLubyte out[8]) {
+    float mean[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 3; c++) mean[c] += block[i * 4 + c] / 16.0f;
+
+    float cov[6] = { 0, 0, 0, 0, 0, 0 }; //rr rg rb gg gb bb
+    for (int i = 0; i < 16; i++) {
+        float r = block[i * 4] - mean[0], g = block[i * 4 + 1] - mean[1], b = block[i * 4 + 2] - mean[2];
+        cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+        cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+    }
+    float axis[3] = { 1, 1, 1 };
+    for (int iter = 0; iter < 4; iter++) {
+        float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        float len = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+        if (len < 1e-6f) break; //flat block, keep current axis
+        axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+    }
+    float axis_len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+    float t_min = 1e9f, t_max = -1e9f;
+    for (int i = 0; i < 16; i++) {
+        float t = ((block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] +
+                   (block[i * 4 + 2] - mean[2]) * axis[2]) / axis_len2;
+        t_min = std::min(t_min, t);
+        t_max = std::max(t_max, t);
+    }
+    float end0[3], end1[3];
+    for (int c = 0; c < 3; c++) {
+        end0[c] = mean[c] + axis[c] * t_max;
+        end1[c] = mean[c] + axis[c] * t_min;
+    }
+    GLushort c0 = to565(end0), c1 = to565(end1);
+    if (c0 < c1) std::swap(c0, c1); //c0 > c1 selects 4 colour mode
+
+    int palette[4][3];
+    from565(c0, palette[0]);
+    from565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    GLuint indices = 0;
+    if (c0 != c1) {
+        for (int i = 0; i < 16; i++) {
+            int best = 0, best_dist = 1 << 30;
+            for (int p = 0; p < 4; p++) {
+                int dr = block[i * 4] - palette[p][0], dg = block[i * 4 + 1] - palette[p][1], db = block[i * 4 + 2] - palette[p][2];
+                int dist = dr * dr + dg * dg + db * db;
+                if (dist < best_dist) { best_dist = dist; best = p; }
+            }
+            indices |= (GLuint)best << (2 * i);
+        }
+    }
+    out[0] = c0 & 0xff; out[1] = c0 >> 8;
+    out[2] = c1 & 0xff; out[3] = c1 >> 8;
+    for (int i = 0; i < 4; i++) out[4 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+//single channel block, 8 evenly spaced values between min and max
+void Texture::encodeBC4(const GLubyte values[16], GLubyte out[8]) {
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++) {
+        lo = std::min(lo, (int)values[i]);
+        hi = std::max(hi, (int)values[i]);
+    }
+    out[0] = (GLubyte)hi; //hi > lo selects 8 value mode
+    out[1] = (GLubyte)lo;
+
+    unsigned long long indices = 0;
+    if (hi != lo) {
+        for (int i = 0; i < 16; i++) {
+            //step along lo -> hi, then remap to the order of the palette: hi, lo, then inner values from hi down
+            int step = ((values[i] - lo) * 7 + (hi - lo) / 2) / (hi - lo);
+            int index = step == 7 ? 0 : (step == 0 ? 1 : 8 - step);
+            indices |= (unsigned long long)index << (3 * i);
+        }
+    }
+    for (int i = 0; i < 6; i++) out[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+//block of 4x4 rgba pixels, repeating edge pixels of levels smaller than a block
+static void fetchBlock(const std::vector<GLubyte>& rgba, int width, int height, int bx, int by, GLubyte block[64]) {
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            int px = std::min(bx * 4 + x, width - 1), py = std::min(by * 4 + y, height - 1);
+            memcpy(&block[(y * 4 + x) * 4], &rgba[((size_t)py * width + px) * 4], 4);
+        }
+    }
+}
+
+//half size level, averaging 2x2 pixels
+static void downsample(const std::vector<GLubyte>& src, int width, int height, bool normal_map,
+                       std::vector<GLubyte>& dst, int& dst_width, int& dst_height) {
+    dst_width = std::max(width / 2, 1);
+    dst_height = std::max(height / 2, 1);
+    dst.resize((size_t)dst_width * dst_height * 4);
+    for (int y = 0; y < dst_height; y++) {
+        for (int x = 0; x < dst_width; x++) {
+            float sum[4] = { 0, 0, 0, 0 };
+            for (int s = 0; s < 4; s++) {
+                int sx = std::min(x * 2 + (s & 1), width - 1), sy = std::min(y * 2 + (s >> 1), height - 1);
+                const GLubyte* p = &src[((size_t)sy * width + sx) * 4];
+                for (int c = 0; c < 4; c++) sum[c] += p[c] * 0.25f;
+            }
+            if (normal_map) {
+                //averaged normals are shorter than 1, renormalize
+                float n[3] = { sum[0] / 127.5f - 1.0f, sum[1] / 127.5f - 1.0f, sum[2] / 127.5f - 1.0f };
+                float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                if (len > 1e-6f)
+                    for (int c = 0; c < 3; c++) sum[c] = (n[c] / len + 1.0f) * 127.5f;
+            }
+            GLubyte* d = &dst[((size_t)y * dst_width + x) * 4];
+            for (int c = 0; c < 4; c++) d[c] = (GLubyte)std::min(sum[c] + 0.5f, 255.0f);
+        }
+    }
+}
+
+void Texture::compress(const GLubyte* rgba, int width, int height, GLenum internal_format,
+                       bool normal_map, TextureImage& image) {
+    image = TextureImage();
+    image.internal_format = internal_format;
+    size_t block_bytes = levelBytes(internal_format, 4, 4);
+
+    std::vector<GLubyte> pixels(rgba, rgba + (size_t)width * height * 4), next;
+    while (true) {
+        TextureLevel level;
+        level.width = width;
+        level.height = height;
+        level.data.resize(levelBytes(internal_format, width, height));
+        int blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+
+        //block rows are independent
+        JOBS.parallelFor(blocks_y, 4, [&](int begin, int end) {
+            GLubyte block[64], channel[16];
+            for (int by = begin; by < end; by++) {
+                for (int bx = 0; bx < blocks_x; bx++) {
+                    GLubyte* out = &level.data[((size_t)by * blocks_x + bx) * block_bytes];
+                    fetchBlock(pixels, width, height, bx, by, block);
+                    switch (internal_format) {
+                    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+                        for (int i = 0; i < 16; i++) channel[i] = block[i * 4 + 3];
+                        encodeBC4(channel, out);
+                        encodeBC1(block, out + 8);
+                        break;
+                    case GL_COMPRESSED_RG_RGTC2:
+                        for (int i = 0; i < 16; i++) channel[i] = block[i * 4];
+                        encodeBC4(channel, out);
+                        for (int i = 0; i < 16; i++) channel[i] = block[i * 4 + 1];
+                        encodeBC4(channel, out + 8);
+                        break;
+                    case GL_COMPRESSED_RED_RGTC1:
+                        for (int i = 0; i < 16; i++) channel[i] = block[i * 4];
+                        encodeBC4(channel, out);
+                        break;
+                    default:
+                        encodeBC1(block, out);
+                    }
+                }
+            }
+        });
+        image.levels.push_back(std::move(level));
+
+        if (width == 1 && height == 1) break;
+        downsample(pixels, width, height, normal_map, next, width, height);
+        pixels.swap(next);
+    }
+}
+
+//collects tga files in folder and its subfolders
+static void findTGAFiles(std::string folder, std::vector<std::string>& files) {
+    DIR* dir = opendir(folder.c_str());
+    if (!dir) return;
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        std::string path = folder + "/" + name;
+        if (entry->d_type == DT_DIR)
+            findTGAFiles(path, files);
+        else if (name.size() > 4 && (name.substr(name.size() - 4) == ".tga" || name.substr(name.size() - 4) == ".TGA"))
+            files.push_back(path);
+    }
+    closedir(dir);
+}
+
+void Texture::convertFolder(std::string folder) {
+    std::vector<std::string> files;
+    findTGAFiles(folder, files);
+    std::sort(files.begin(), files.end());
+
+    printf("%-50s %11s %6s %10s %10s %10s\n", "texture", "size", "format", "tga (KB)", "dds (KB)", "time (ms)");
+    for (auto& file : files) {
+        TGAInfo* tgainfo = Parsers::loadTGA(file);
+        if (!tgainfo) continue;
+        auto start = std::chrono::high_resolution_clock::now();
+
+        //tga stores bgr(a), bottom row first; rows keep that order, which is what GL expects
+        int bytes_pp = tgainfo->bpp / 8;
+        size_t num_pixels = (size_t)tgainfo->width * tgainfo->height;
+        std::vector<GLubyte> rgba(num_pixels * 4);
+        bool has_alpha = false;
+        for (size_t i = 0; i < num_pixels; i++) {
+            const GLubyte* p = &tgainfo->data[i * bytes_pp];
+            rgba[i * 4] = p[2];
+            rgba[i * 4 + 1] = p[1];
+            rgba[i * 4 + 2] = p[0];
+            rgba[i * 4 + 3] = bytes_pp == 4 ? p[3] : 255;
+            has_alpha |= rgba[i * 4 + 3] != 255;
+        }
+
+        std::string name = file.substr(0, file.size() - 4);
+        bool normal_map = name.find("_ddn") != std::string::npos || name.find("_normal") != std::string::npos ||
+                          (name.size() > 2 && name.substr(name.size() - 2) == "_n");
+        GLenum internal_format = normal_map ? GL_COMPRESSED_RG_RGTC2
+                               : (has_alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT1_EXT);
+        TextureImage image;
+        compress(rgba.data(), tgainfo->width, tgainfo->height, internal_format, normal_map, image);
+        bool saved = saveDDS(name + ".dds", image);
+
+        auto end = std::chrono::high_resolution_clock::now();
+        size_t dds_bytes = 0;
+        for (auto& level : image.levels) dds_bytes += level.data.size();
+        char size[32];
+        snprintf(size, sizeof(size), "%dx%d", tgainfo->width, tgainfo->height);
+        printf("%-50s %11s %6s %10.1f %10.1f %10.1f%s\n", file.c_str(), size, formatName(internal_format),
+               num_pixels * bytes_pp / 1024.0f, dds_bytes / 1024.0f,
+               std::chrono::duration<float, std::milli>(end - start).count(), saved ? "" : " (not saved)");
+
+        free(tgainfo->data);
+        delete tgainfo;
+    }
+}
@@ -0,0 +1,127 @@
+//
+//  Texture.h
+//
+//  Block compressed textures: DDS and KTX loading with their mip chains,
+//  a CPU encoder for BC1 (opaque colour), BC3 (colour and alpha) and BC5
+//  (two channel normal maps), and a record of the format and GPU memory of
+//  every texture loaded through Parsers::parseTexture.
+//
+//  Textures can also be streamed: loadAsync returns at once with a 1x1
+//  placeholder, a background job reads and decodes the file, and
+//  updateStreaming uploads finished images into the same texture name
+//  through a ring of pixel buffer objects, up to a budget per frame. As the
+//  name does not change, materials show the real texture once it arrives.
+//
+//  Residency: textures loaded from files can be shrunk to keep the total
+//  under a budget. The least recently used one loses its top mip level,
+//  by copying the smaller levels through a pixel buffer and respecifying
+//  the texture with them, and when it is used again its file is streamed
+//  back in full.
+//
+#pragma once
+#include "includes.h"
+#include <vector>
+#include <unordered_map>
+
+//one mip level of a texture, as stored in its file
+struct TextureLevel {
+    int width = 0;
+    int height = 0;
+    std::vector<GLubyte> data;
+};
+
+//texture as stored in a container file, compressed or not
+struct TextureImage {
+    GLenum internal_format = 0; //e.g. GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    GLenum format = 0, type = 0; //only for uncompressed images, 0 otherwise
+    std::vector<TextureLevel> levels; //level 0 first
+    bool compressed() const { return type == 0; }
+};
+
+//what a loaded texture costs
+struct TextureInfo {
+    std::string file;
+    GLenum internal_format = 0;
+    int width = 0, height = 0, levels = 0;
+    size_t bytes = 0;
+    bool resident = true; //false while a streamed texture shows its placeholder
+    bool evictable = false; //loaded from file, so top levels can be dropped and reloaded
+    int evicted_levels = 0;
+    unsigned int last_used = 0; //residency frame of last touch
+};
+
+struct TextureResidencyStats {
+    size_t budget_bytes = 0;
+    int evicted_levels = 0; //total since start
+    int reloads = 0;
+    bool over_budget = false; //could not get under budget without evicting textures in use
+};
+
+struct TextureStreamingStats {
+    int requested = 0;
+    int pending = 0; //requested and not yet uploaded
+    size_t bytes_last_frame = 0; //uploaded by last updateStreaming
+    float all_resident_ms = 0; //from first request until pending last reached 0
+};
+
+class Texture {
+public:
+    //containers. Rows are stored bottom up, in OpenGL order, as the TGAs they
+    //are converted from; DDS files authored top down by other tools appear flipped
+    static bool loadDDS(std::string filename, TextureImage& image);
+    static bool loadKTX(std::string filename, TextureImage& image);
+    static bool saveDDS(std::string filename, const TextureImage& image);
+
+    //reads dds, ktx or tga into image. A tga with a converted .dds or .ktx
+    //beside it loads that file instead, unless the tga is newer. Safe to call from worker threads
+    static bool loadFile(std::string filename, TextureImage& image);
+    //hash of format, sizes and texels, for ResourceCache to find the same texture under another name
+    static unsigned long long contentHash(const TextureImage& image);
+
+    //creates GL texture with all levels of image, returns 0 on failure
+    static GLuint upload(const TextureImage& image, std::string filename = "");
+    //deletes texture, a streamed texture still loading is deleted when its data arrives
+    static void release(GLuint texture_id);
+
+    //streaming, see top of file. Call updateStreaming once per frame on main thread
+    static GLuint loadAsync(std::string filename);
+    static void updateStreaming();
+    static void releaseStreaming(); //deletes pixel buffers, call while context is alive
+    static bool streaming; //whether parseTexture uses loadAsync
+    static float upload_budget_mb; //per frame, at least one texture is uploaded
+    static TextureStreamingStats stream_stats;
+
+    //residency, see top of file. touch marks texture as used this frame,
+    //updateResidency evicts top levels of textures until their total fits budget
+    static void touch(GLuint texture_id);
+    static void updateResidency(size_t budget_bytes);
+    static TextureResidencyStats residency_stats;
+
+    //encodes rgba8 pixels to internal_format (BC1, BC3 or BC5), with a box
+    //filtered mip chain. Normal maps are renormalized at each level
+    static void compress(const GLubyte* rgba, int width, int height, GLenum internal_format,
+                         bool normal_map, TextureImage& image);
+    static void encodeBC1(const GLubyte block[64], GLubyte out[8]);
+    static void encodeBC4(const GLubyte values[16], GLubyte out[8]);
+
+    //converts every tga under folder to a dds beside it, choosing BC5 for
+    //normal maps (by name), BC3 for images with alpha and BC1 otherwise
+    static void convertFolder(std::string folder);
+
+    //memory of textures loaded in engine
+    static void track(GLuint texture_id, const TextureInfo& info);
+    static const TextureInfo* info(GLuint texture_id);
+    static size_t totalBytes();
+    static size_t levelBytes(GLenum internal_format, int width, int height);
+    static const char* formatName(GLenum internal_format);
+
+private:
+    static std::unordered_map<GLuint, TextureInfo> textures_;
+    static GLuint createTexture_();
+    //specifies levels of texture_id from image, or from the bound pixel buffer
+    //when image data was copied there in level order
+    static void uploadTo_(GLuint texture_id, const TextureImage& image, std::string filename, bool from_pixel_buffer);
+    static void streamInto_(GLuint texture_id, std::string filename);
+    static bool evictTopLevel_(GLuint texture_id);
+    static unsigned int frame_;
+};
@@ -3,6 +3,12 @@
 #include "ToolsSystem.h"
 #include "extern.h"
 #include "Parsers.h"
+#include "MeshOptimizer.h"
+#include "ObjParser.h"
+#include "MeshCache.h"
+#include "GeometryArena.h"
+#include "Texture.h"
+#include "ResourceCache.h"
 
 static bool no_titlebar = false;
 static bool no_scrollbar = false;
@@ -22,12 +28,13 @@ static bool show_inspector = true;
 static bool show_statistics = true;
 static bool show_quick_actions = true;
 static bool show_app_console = true;
+static bool show_memory = false;
 
 static void UpdateConsole(bool* p_open);
 
 ToolsSystem::~ToolsSystem() { }
 
-void ToolsSystem::init(GraphicsSystem* gs) {
+void ToolsSystem::init(GraphicsSystem* gs, ParticleSystem* ps, CollisionSystem* cs, FixedTimestep* ts) {
 	
 	//Styling IMGUI
 	ImGuiStyle& style = ImGui::GetStyle();
@@ -38,6 +45,9 @@ void ToolsSystem::init(GraphicsSystem* gs) {
 
 	//Variable initialization
 	graphics_system_ = gs;
+	particle_system_ = ps;
+	collision_system_ = cs;
+	timestep_ = ts;
 	ent_picked_ray_id_ = -1;
 	best = 100.0f;
 	worse = 0.0f;
@@ -49,13 +59,6 @@ void ToolsSystem::init(GraphicsSystem* gs) {
 
 void ToolsSystem::lateInit() {
 
-	//picking collider
-	ent_picking_ray_ = ECS.createEntity("picking_ray");
-	Collider& picking_ray = ECS.createComponentForEntity<Collider>(ent_picking_ray_);
-	picking_ray.collider_type = ColliderTypeRay;
-	picking_ray.direction = lm::vec3(0, 0, -1);
-	picking_ray.max_distance = 0.001f;
-
 }
 
 void ToolsSystem::update(float dt, float current_fps) {
@@ -92,6 +95,7 @@ void ToolsSystem::update(float dt, float current_fps) {
 		if (show_statistics) UpdateStatistics();
 		if (show_quick_actions) UpdateQuickActions();
 		if (show_app_console) UpdateConsole(&show_app_console);
+		if (show_memory) UpdateMemory();
 		
 		UpdateMenuBar(io);
 		//ImGui::ShowDemoWindow();
@@ -246,19 +250,19 @@ void ToolsSystem::UpdateMaterials() {
 				ImGui::Image((ImTextureID)(mat[i].diffuse_map), ImVec2(64, 64));
 				ImGui::SameLine();
 				ImGui::SetCursorPos({ ImGui::GetCursorPos().x, ImGui::GetCursorPos().y + (64 - ImGui::GetFont()->FontSize) / 2 });
-				ImGui::Text(" Diffuse Material Map");
+				imGuiTextureLabel(" Diffuse Material Map", mat[i].diffuse_map);
 			}
 			if (mat[i].normal_map != -1) {
 				ImGui::Image((ImTextureID)(mat[i].normal_map), ImVec2(64, 64));
 				ImGui::SameLine();
 				ImGui::SetCursorPos({ ImGui::GetCursorPos().x, ImGui::GetCursorPos().y + (64 - ImGui::GetFont()->FontSize) / 2 });
-				ImGui::Text(" Normal Material Map");
+				imGuiTextureLabel(" Normal Material Map", mat[i].normal_map);
 			}
 			if (mat[i].specular_map != -1) {
 				ImGui::Image((ImTextureID)(mat[i].specular_map), ImVec2(64, 64));
 				ImGui::SameLine();
 				ImGui::SetCursorPos({ ImGui::GetCursorPos().x, ImGui::GetCursorPos().y + (64 - ImGui::GetFont()->FontSize) / 2 });
-				ImGui::Text(" Specular Material Map");
+				imGuiTextureLabel(" Specular Material Map", mat[i].specular_map);
 			}
 
 			if (mat[i].diffuse_map == -1 && mat[i].normal_map == -1 && mat[i].specular_map == -1) {
@@ -282,12 +286,8 @@ void ToolsSystem::UpdateInspector() {
 	ImGui::SetNextWindowSize(ImVec2(350, 200), ImGuiCond_FirstUseEver);
 	ImGui::Begin("INSPECTOR", &show_inspector, window_flags);
 
-	Collider& pick_ray_collider = ECS.getComponentFromEntity<Collider>(ent_picking_ray_);
-
-	if (pick_ray_collider.colliding /*|| ent_picked_ray_id_ != -1*/) {
+	if (ent_picked_ray_id_ != -1) {
 
-		Collider& picked_collider = ECS.getComponentInArray<Collider>(pick_ray_collider.other);
-		ent_picked_ray_id_ = picked_collider.owner;
 		Transform& picked_transform = ECS.getComponentFromEntity<Transform>(ent_picked_ray_id_);
 
 		ImGui::Dummy(ImVec2(0.0f, 5.0f));
@@ -357,19 +357,19 @@ void ToolsSystem::UpdateInspector() {
 				ImGui::Image((ImTextureID)(mat.diffuse_map), ImVec2(64, 64));
 				ImGui::SameLine();
 				ImGui::SetCursorPos({ ImGui::GetCursorPos().x, ImGui::GetCursorPos().y + (64 - ImGui::GetFont()->FontSize) / 2 });
-				ImGui::Text(" Diffuse Material Map");
+				imGuiTextureLabel(" Diffuse Material Map", mat.diffuse_map);
 			}
 			if (mat.normal_map != -1) {
 				ImGui::Image((ImTextureID)(mat.normal_map), ImVec2(64, 64));
 				ImGui::SameLine();
 				ImGui::SetCursorPos({ ImGui::GetCursorPos().x, ImGui::GetCursorPos().y + (64 - ImGui::GetFont()->FontSize) / 2 });
-				ImGui::Text(" Normal Material Map");
+				imGuiTextureLabel(" Normal Material Map", mat.normal_map);
 			}
 			if (mat.specular_map != -1) {
 				ImGui::Image((ImTextureID)(mat.specular_map), ImVec2(64, 64));
 				ImGui::SameLine();
 				ImGui::SetCursorPos({ ImGui::GetCursorPos().x, ImGui::GetCursorPos().y + (64 - ImGui::GetFont()->FontSize) / 2 });
-				ImGui::Text(" Specular Material Map");
+				imGuiTextureLabel(" Specular Material Map", mat.specular_map);
 			}
 
 			if (mat.diffuse_map == -1 && mat.normal_map == -1 && mat.specular_map == -1) {
@@ -462,6 +462,141 @@ void ToolsSystem::UpdateStatistics() {
 	ImGui::SameLine();
 	ImGui::TextColored(ImVec4(1, 0, 0, 1), (to_string(worse) + " ms").c_str());
 
+	//fixed step simulation, independent of framerate
+	ImGui::Text("Simulation: ");
+	ImGui::SameLine();
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d steps, %.2f ms, %d dropped", timestep_->steps,
+		timestep_->simulation_ms, timestep_->dropped_steps);
+	ImGui::SliderFloat("Tick rate", &timestep_->tick_rate, 10.0f, 240.0f, "%.0f Hz");
+	ImGui::SliderInt("Max steps per frame", &timestep_->max_steps, 1, 20);
+	ImGui::Checkbox("Interpolate", &timestep_->interpolate);
+
+	ImGui::Dummy(ImVec2(0.0f, 5.0f));
+
+	//terrain chunks
+	for (auto terrain : graphics_system_->getTerrains()) {
+		ImGui::Text("Terrain chunks (all passes): ");
+		ImGui::SameLine();
+		ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d drawn / %d resident / %d total", terrain->num_drawn, terrain->num_resident, terrain->num_chunks());
+		ImGui::Text("Terrain triangles: ");
+		ImGui::SameLine();
+		ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d", terrain->num_tris_drawn);
+		ImGui::Text("Terrain memory: ");
+		ImGui::SameLine();
+		ImGui::TextColored(ImVec4(1, 1, 0, 1), "%.2f MB", (float)terrain->memory_bytes / (1024.0f * 1024.0f));
+		ImGui::Dummy(ImVec2(0.0f, 5.0f));
+	}
+
+	//shader startup cost, cache hits skip compilation
+	ImGui::Text("Shaders: ");
+	ImGui::SameLine();
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d programs, %d from cache, %.1f ms build + %.1f ms link",
+		Shader::stats.programs, Shader::stats.cache_hits, Shader::stats.build_ms, Shader::stats.finish_ms);
+
+	//geometry from files, warm loads map a cooked copy instead of parsing
+	ImGui::Text("Mesh cache: ");
+	ImGui::SameLine();
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d cold (last %.1f ms), %d warm (last %.1f ms), %d stale",
+		MeshCache::stats.cold_loads, MeshCache::stats.last_cold_ms, MeshCache::stats.warm_loads,
+		MeshCache::stats.last_warm_ms, MeshCache::stats.stale);
+
+	//gpu particles, see ADDEMITTERS console command to stress them
+	ImGui::Text("Particles: ");
+	ImGui::SameLine();
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d in %d / %d emitters, %d draws, %.2f MB",
+		ParticleSystem::stats.particles, ParticleSystem::stats.visible_emitters, ParticleSystem::stats.emitters,
+		ParticleSystem::stats.draws, (float)ParticleSystem::stats.buffer_bytes / (1024.0f * 1024.0f));
+	if (ImGui::TreeNode("Particles")) {
+		//switching restarts all particles
+		int backend = particle_system_->backend;
+		const char* backends[] = { "GPU transform feedback", "CPU simulation" };
+		if (ImGui::Combo("Backend", &backend, backends, IM_ARRAYSIZE(backends)))
+			particle_system_->backend = (ParticleBackend)backend;
+		ImGui::Checkbox("Sort back to front", &particle_system_->sort_particles);
+		ImGui::Text("Sorted: ");
+		ImGui::SameLine();
+		ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d particles in %.3f ms", ParticleSystem::stats.sorted, ParticleSystem::stats.sort_ms);
+		//prints table of CPU and GPU simulation time to console
+		if (ImGui::Button("Benchmark particles"))
+			particle_system_->benchmark();
+		ImGui::TreePop();
+	}
+
+	//transparent surfaces are sorted back to front after opaque ones
+	ImGui::Text("Transparent: ");
+	ImGui::SameLine();
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d surfaces sorted in %.3f ms",
+		graphics_system_->num_transparent_items, graphics_system_->transparent_sort_ms);
+
+	//ray tests after broadphase, against all rays times all boxes; see ADDBOXES console command
+	const CollisionStats& collision = CollisionSystem::stats;
+	ImGui::Text("Collision: ");
+	ImGui::SameLine();
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d boxes, %d rays, %d / %d tests, %d hits, %d query rays",
+		collision.boxes, collision.rays, collision.ray_box_tests, collision.rays * collision.boxes, collision.hits, collision.query_rays);
+	ImGui::Text("Broadphase: ");
+	ImGui::SameLine();
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "tree height %d, %d moved, %.3f ms tree + %.3f ms rays",
+		collision.tree_height, collision.reinserted, collision.broadphase_ms, collision.query_ms);
+	ImGui::Text("Box contacts: ");
+	ImGui::SameLine();
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d touching, %d points, %d pairs tested, %d boxes moved, %.3f ms",
+		collision.box_contacts, collision.contact_points, collision.box_pairs, collision.moved_boxes, collision.pairs_ms);
+	ImGui::Text("Collision events: ");
+	ImGui::SameLine();
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d enter, %d stay, %d exit",
+		collision.enter_events, collision.stay_events, collision.exit_events);
+
+	//geometry memory, total and per geometry
+	auto& geometries = graphics_system_->getGeometries();
+	size_t total_vertex_bytes = 0, total_index_bytes = 0, total_bvh_bytes = 0;
+	for (auto& geom : geometries) {
+		total_vertex_bytes += geom.vertex_bytes;
+		total_index_bytes += geom.index_bytes;
+		total_bvh_bytes += geom.bvh.memoryBytes();
+	}
+	ImGui::Text("Geometry memory: ");
+	ImGui::SameLine();
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "%.2f MB vertex / %.2f MB index / %.2f MB bvh",
+		(float)total_vertex_bytes / (1024.0f * 1024.0f), (float)total_index_bytes / (1024.0f * 1024.0f),
+		(float)total_bvh_bytes / (1024.0f * 1024.0f));
+	if (ImGui::TreeNode("Geometries")) {
+		for (size_t i = 0; i < geometries.size(); i++) {
+			Geometry& geom = geometries[i];
+			ImGui::Text("%d: %d verts, %.1f KB vertex, %.1f KB index (%s%s)", (int)i, geom.num_vertices,
+				(float)geom.vertex_bytes / 1024.0f, (float)geom.index_bytes / 1024.0f,
+				geom.packed_vertices ? "packed" : "float",
+				geom.index_type == GL_UNSIGNED_SHORT ? ", 16 bit" : ", 32 bit");
+			ImGui::Text("    ACMR %.3f -> %.3f, ATVR %.3f%s", geom.acmr_source, geom.acmr, geom.atvr,
+				geom.arena_allocation != -1 ? ", arena" : "");
+			if (!geom.bvh.empty())
+				ImGui::Text("    BVH %d nodes, %.1f KB, built in %.2f ms", geom.bvh.numNodes(),
+					(float)geom.bvh.memoryBytes() / 1024.0f, geom.bvh.build_ms);
+		}
+		//prints table of optimizer results for all meshes in assets to console
+		if (ImGui::Button("Benchmark mesh optimizer"))
+			MeshOptimizer::benchmark("data/assets");
+		ImGui::SameLine();
+		//bvh build and ray throughput for a large mesh and the terrains, to console
+		if (ImGui::Button("Benchmark BVH"))
+			MeshBVH::benchmark({ "data/assets/nanosuit/nanosuit.obj", "data/assets/sphere.obj" }, graphics_system_->getTerrains());
+		//mapped parser against line based one, with a generated two million triangle file
+		if (ImGui::Button("Benchmark OBJ parser"))
+			ObjParser::benchmark({ "data/assets/sphere.obj", "data/assets/nanosuit/nanosuit.obj" }, 2000000);
+		ImGui::TreePop();
+	}
+	//shared buffers of packed static geometry
+	const char* arena_names[GeometryArena::LAYOUT_COUNT] = { "half uv", "float uv" };
+	for (int l = 0; l < GeometryArena::LAYOUT_COUNT; l++) {
+		if (!GeometryArena::exists((GeometryArena::Layout)l)) continue;
+		GeometryArena& arena = GeometryArena::get((GeometryArena::Layout)l);
+		ImGui::Text("Arena (%s): ", arena_names[l]);
+		ImGui::SameLine();
+		ImGui::TextColored(ImVec4(1, 1, 0, 1), "%.2f / %.2f MB vertex, %.2f / %.2f MB index, %d compactions",
+			(float)arena.used_vertex_bytes / (1024.0f * 1024.0f), (float)arena.vertex_capacity_bytes() / (1024.0f * 1024.0f),
+			(float)arena.used_index_bytes / (1024.0f * 1024.0f), (float)arena.index_capacity_bytes() / (1024.0f * 1024.0f),
+			arena.num_compactions);
+	}
 	ImGui::Dummy(ImVec2(0.0f, 5.0f));
 
 	if (ImGui::Button("Reset values")) {
@@ -477,6 +612,67 @@ void ToolsSystem::UpdateStatistics() {
 
 }
 
+void ToolsSystem::UpdateMemory() {
+
+	ImGui::SetNextWindowSize(ImVec2(350, 250), ImGuiCond_FirstUseEver);
+	ImGui::Begin("MEMORY", &show_memory, window_flags);
+
+	//gpu memory by kind, against budget
+	const GpuMemoryStats& memory = graphics_system_->getMemoryStats();
+	const float MB = 1024.0f * 1024.0f;
+	ImGui::Text("GPU memory: ");
+	ImGui::SameLine();
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "%.1f / %.0f MB", (float)memory.total() / MB, graphics_system_->memory_budget_mb);
+	ImGui::ProgressBar(std::min((float)memory.total() / (graphics_system_->memory_budget_mb * MB), 1.0f), ImVec2(-1, 0));
+	ImGui::Text("  Textures: %.1f MB", (float)memory.textures / MB);
+	ImGui::Text("  Geometry: %.1f MB", (float)memory.geometry / MB);
+	ImGui::Text("  Terrain: %.1f MB", (float)memory.terrain / MB);
+	ImGui::Text("  Framebuffers: %.1f MB", (float)memory.framebuffers / MB);
+	ImGui::SliderFloat("Budget (MB)", &graphics_system_->memory_budget_mb, 64.0f, 4096.0f);
+
+	//textures shrunk to fit budget
+	ImGui::Text("Texture residency: ");
+	ImGui::SameLine();
+	ImGui::TextColored(Texture::residency_stats.over_budget ? ImVec4(1, 0, 0, 1) : ImVec4(1, 1, 0, 1),
+		"%.1f MB for textures, %d levels evicted, %d reloads%s", (float)Texture::residency_stats.budget_bytes / MB,
+		Texture::residency_stats.evicted_levels, Texture::residency_stats.reloads,
+		Texture::residency_stats.over_budget ? ", over budget" : "");
+	ImGui::Text("Texture streaming: ");
+	ImGui::SameLine();
+	if (Texture::stream_stats.pending > 0)
+		ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d / %d pending, %.2f MB last frame", Texture::stream_stats.pending,
+			Texture::stream_stats.requested, (float)Texture::stream_stats.bytes_last_frame / (1024.0f * 1024.0f));
+	else
+		ImGui::TextColored(ImVec4(1, 1, 0, 1), "%d resident in %.0f ms", Texture::stream_stats.requested, Texture::stream_stats.all_resident_ms);
+	ImGui::SliderFloat("Upload budget (MB/frame)", &Texture::upload_budget_mb, 0.5f, 64.0f);
+	//textures, cubemaps and geometries loaded from files, shared by path or contents
+	if (ImGui::TreeNode("Resources")) {
+		ImGui::Text("Shared: %d by path, %d by contents, %d duplicates", ResourceCache::num_path_hits,
+			ResourceCache::num_content_hits, ResourceCache::num_content_duplicates);
+		const char* type_names[RESOURCE_TYPES_COUNT] = { "texture", "cubemap", "geometry", "multi geometry", "texture + pixels" };
+		for (auto& resource : ResourceCache::resources()) {
+			if (resource.refs == 0) continue;
+			float kb = 0.0f;
+			if (ResourceCache::isTexture(resource.type)) {
+				const TextureInfo* info = Texture::info(resource.handle);
+				if (info) kb = (float)(info->bytes + resource.pixels.data.size()) / 1024.0f;
+			}
+			else {
+				Geometry& geom = graphics_system_->getGeometry(resource.handle);
+				kb = (float)(geom.vertex_bytes + geom.index_bytes) / 1024.0f;
+			}
+			ImGui::Text("%s %d: %s", type_names[resource.type], resource.handle, resource.path.c_str());
+			ImGui::Text("    %d refs, %d paths, %.1f KB", resource.refs, resource.path_count, kb);
+		}
+		ImGui::TreePop();
+	}
+	//writes a BC1/BC3/BC5 dds with mips beside every tga in assets, used from next run
+	if (ImGui::Button("Convert textures to DDS"))
+		Texture::convertFolder("data/assets");
+	ImGui::Dummy(ImVec2(0.0f, 5.0f));
+	ImGui::End();
+}
+
 void ToolsSystem::UpdateQuickActions() {
 	
 	ImGui::SetNextWindowSize(ImVec2(200, 200), ImGuiCond_FirstUseEver);
@@ -500,6 +696,12 @@ void ToolsSystem::UpdateQuickActions() {
 		graphics_system_->setBackgroundColor(background_color);
 	}
 
+	//weighted oit skips sorting, and blends intersecting surfaces smoothly
+	int transparency = graphics_system_->transparency_mode;
+	const char* transparency_modes[] = { "Sorted back to front", "Weighted blended OIT" };
+	if (ImGui::Combo("Transparency", &transparency, transparency_modes, IM_ARRAYSIZE(transparency_modes)))
+		graphics_system_->transparency_mode = (TransparencyMode)transparency;
+
 	ImGui::Dummy(ImVec2(0.0f, 5.0f));
 	ImGui::Text("View selector");
 	ImGui::Dummy(ImVec2(0.0f, 5.0f));
@@ -561,6 +763,8 @@ void ToolsSystem::UpdateMenuBar(ImGuiIO &io)
 			ImGui::Dummy(ImVec2(0.0f, 5.0f));
 			ImGui::Checkbox("Console", &show_app_console);
 			ImGui::Dummy(ImVec2(0.0f, 5.0f));
+			ImGui::Checkbox("Memory", &show_memory);
+			ImGui::Dummy(ImVec2(0.0f, 5.0f));
 			ImGui::Separator();
 			ImGui::Dummy(ImVec2(0.0f, 5.0f));
 			if(ImGui::SmallButton("Toggle All")) {
@@ -570,6 +774,7 @@ void ToolsSystem::UpdateMenuBar(ImGuiIO &io)
 				show_statistics = !show_statistics;
 				show_quick_actions = !show_quick_actions;
 				show_app_console = !show_app_console;
+				show_memory = !show_memory;
 			};
 			ImGui::Dummy(ImVec2(0.0f, 5.0f));
 
@@ -802,6 +1007,36 @@ struct PersonalisedConsole
 			sphere_collider.max_distance = 100.0f;
 
 		}
+		else if (Stricmp(command_line, "ADDEMITTERS") == 0)
+		{
+			//grid of 1000 emitters with 1000 particles each
+			for (int i = 0; i < 1000; i++) {
+				int emitter_entity = ECS.createEntity("test_emitter");
+				ECS.getComponentFromEntity<Transform>(emitter_entity).translate((float)(i % 40) * 5.0f - 100.0f, 2.0f, (float)(i / 40) * 5.0f - 60.0f);
+				ParticleEmitter& emitter = ECS.createComponentForEntity<ParticleEmitter>(emitter_entity);
+				emitter.num_particles = 1000;
+				emitter.spin = 0.0f;
+				emitter.bounds_radius = 5.0f;
+			}
+			AddLog("%d emitters\n", (int)ECS.getAllComponents<ParticleEmitter>().size());
+		}
+		else if (Stricmp(command_line, "ADDBOXES") == 0)
+		{
+			//10000 box colliders in a block above the scene
+			for (int i = 0; i < 10000; i++) {
+				int box_entity = ECS.createEntity("test_box");
+				ECS.getComponentFromEntity<Transform>(box_entity).translate((float)(i % 25) * 4.0f - 50.0f, (float)((i / 25) % 16) * 2.0f + 10.0f, (float)(i / 400) * 4.0f - 50.0f);
+				Collider& box_collider = ECS.createComponentForEntity<Collider>(box_entity);
+				box_collider.collider_type = ColliderTypeBox;
+			}
+			AddLog("%d colliders\n", (int)ECS.getAllComponents<Collider>().size());
+		}
+		else if (Stricmp(command_line, "TESTCOLLISION") == 0)
+		{
+			//checks simd and scalar ray box tests agree; timing table goes to console
+			bool passed = CollisionSystem::testNarrowphase();
+			AddLog(passed ? "narrowphase test passed\n" : "[error] narrowphase test failed, see console\n");
+		}
 		else
 		{
 			AddLog("Unknown command: '%s'\n", command_line);
@@ -1051,6 +1286,8 @@ void ToolsSystem::setPickingRay(int mouse_x, int mouse_y, int screen_width, int
 	
 	//if we are not in debug mode (alt-0) do nothing!
 	if (!can_fire_picking_ray_) return;
+	//clicks on gui windows don't pick
+	if (ImGui::GetIO().WantCaptureMouse) return;
 
 	//convert mouse_x and mouse_y to NDC
 	float ndc_x = (((float)mouse_x / (float)screen_width) * 2) - 1;
@@ -1071,24 +1308,33 @@ void ToolsSystem::setPickingRay(int mouse_x, int mouse_y, int screen_width, int
 	mouse_world.normalize();
 	lm::vec3 mouse_world_3(mouse_world.x, mouse_world.y, mouse_world.z);
 
-	//set the picking ray
-	//the actual collision detection will be done next frame in the CollisionSystem
-	Transform& pick_ray_transform = ECS.getComponentFromEntity<Transform>(ent_picking_ray_);
-	Collider& pick_ray_collider = ECS.getComponentFromEntity<Collider>(ent_picking_ray_);
-	pick_ray_transform.position(cam.position);
-	pick_ray_collider.direction = (mouse_world_3 - cam.position).normalize();
-	pick_ray_collider.max_distance = 1000000;
-
-	////Set id picked ray object
-	//if (pick_ray_collider.other != -1) {
-	//	Collider& picked_collider = ECS.getComponentInArray<Collider>(pick_ray_collider.other);
-	//	ent_picked_ray_id_ = picked_collider.owner;
-	//} else {
-	//	ent_picked_ray_id_ != -1;
-	//}
+	//pick nearest collider or mesh triangle under mouse, or nothing
+	lm::vec3 direction = mouse_world_3 - cam.position;
+	RaycastHit hit;
+	MeshHit mesh_hit;
+	ent_picked_ray_id_ = -1;
+	float distance = 1000000.0f;
+	if (collision_system_->raycast(cam.position, direction, distance, hit)) {
+		ent_picked_ray_id_ = ECS.getComponentInArray<Collider>(hit.collider).owner;
+		distance = hit.distance;
+	}
+	if (collision_system_->raycastMeshes(cam.position, direction, distance, mesh_hit))
+		ent_picked_ray_id_ = ECS.getComponentInArray<Mesh>(mesh_hit.mesh).owner;
 
-	//print(to_string(ent_picked_ray_id_).c_str());
+}
 
+//map label, followed by its format, size and memory
+void ToolsSystem::imGuiTextureLabel(const char* label, GLint texture_id) {
+	ImGui::Text("%s", label);
+	const TextureInfo* info = Texture::info(texture_id);
+	if (!info) return;
+	ImGui::SameLine();
+	if (!info->resident) {
+		ImGui::TextColored(ImVec4(0.6f, 0.6f, 0.6f, 1), "(loading)");
+		return;
+	}
+	ImGui::TextColored(ImVec4(0.6f, 0.6f, 0.6f, 1), "(%s %dx%d, %d mips, %.2f MB)", Texture::formatName(info->internal_format),
+		info->width, info->height, info->levels, (float)info->bytes / (1024.0f * 1024.0f));
 }
 
 void ToolsSystem::imGuiRenderTransformNode(TransformNode& trans) {
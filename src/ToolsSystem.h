@@ -3,6 +3,9 @@
 #include "Shader.h"
 #include <vector>
 #include "GraphicsSystem.h"
+#include "ParticleSystem.h"
+#include "CollisionSystem.h"
+#include "FixedTimestep.h"
 
 struct TransformNode {
 	std::vector<TransformNode> children;
@@ -18,7 +21,7 @@ class ToolsSystem {
 public:
 
 	~ToolsSystem();
-	void init(GraphicsSystem* gs);
+	void init(GraphicsSystem* gs, ParticleSystem* ps, CollisionSystem* cs, FixedTimestep* ts);
 	void lateInit();
 	void update(float dt, float current_fps);
 
@@ -32,8 +35,12 @@ private:
 	
 	float fpslist[MAX_VALUES];
 	GraphicsSystem* graphics_system_;
+	ParticleSystem* particle_system_;
+	CollisionSystem* collision_system_;
+	FixedTimestep* timestep_;
 
 	void imGuiRenderTransformNode(TransformNode& trans);
+	void imGuiTextureLabel(const char* label, GLint texture_id);
 	bool show_imGUI_ = true;
 	bool debugState = true;
 	bool environmentState = true;
@@ -42,11 +49,11 @@ private:
 	void UpdateMaterials();
 	void UpdateInspector();
 	void UpdateStatistics();
+	void UpdateMemory();
 	void UpdateQuickActions();
 	void UpdateMenuBar(ImGuiIO &io);
 
 	bool can_fire_picking_ray_ = true;
-	int ent_picking_ray_;
 	int ent_picked_ray_id_;
 
 	int hierarchy_mode = 0;
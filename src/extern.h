@@ -1,4 +1,6 @@
 #pragma once
 #include "EntityComponentStore.h"
+#include "JobPool.h"
 
-extern EntityComponentStore ECS;
\ No newline at end of file
+extern EntityComponentStore ECS;
+extern JobPool JOBS;
\ No newline at end of file
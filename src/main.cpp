@@ -13,6 +13,8 @@
 Game* GAME = nullptr;
 //initialise global ECS. By including extern.h in any cpp file (NOT .h file!) we can access this variable
 EntityComponentStore ECS;
+//worker threads for parallel loops, also accessed via extern.h
+JobPool JOBS;
 
 bool glCheckError() {
     GLenum errCode;
@@ -123,6 +125,9 @@ int main(void)
 	glfwGetCursorPos(window, &mouse_x, &mouse_y);
 
 
+	//start worker threads before loading anything
+	JOBS.init();
+
 	//create game singleton and initialise it
 	GAME = new Game();
 	GAME->init(WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -164,6 +169,7 @@ int main(void)
 
 	//free game memory - not necessary but good practice!
 	delete GAME;
+	JOBS.shutdown();
 
 	// Cleanup
 	ImGui_ImplOpenGL3_Shutdown();